@@ -0,0 +1,790 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "j1939decode.h"
+#include "j1939simd.h"
+#include "j1939delta.h"
+#include "j1939file.h"
+
+/* Defaults */
+#define BENCH_TRACE_FRAMES      10000U      /* frames in generated trace */
+#define BENCH_MIN_FRAMES        200000U     /* frames decoded by each benchmark */
+#define BENCH_SEED              1U
+#define BENCH_BATCH             64U         /* frames per call of the batch benchmarks */
+#define BENCH_MAX_SPNS          256U
+#define BENCH_JSON_LEN          16384U      /* output buffer for one frame */
+#define BENCH_NDJSON_LEN        (BENCH_BATCH * BENCH_JSON_LEN)
+#define BENCH_DELTA_PAIRS       4096U       /* source address and PGN pairs tracked by change detection */
+#define BENCH_CACHE_ENTRIES     4096U       /* outputs kept by the output cache */
+#define BENCH_CACHE_REPEAT      256U        /* distinct frames of the cache hit benchmark */
+
+/* Common PGN and the share of bus traffic it typically makes up, in frames per second */
+typedef struct
+{
+    uint32_t pgn;
+    uint8_t sa;
+    uint8_t priority;
+    uint32_t rate;
+} trace_pgn_t;
+
+static const trace_pgn_t trace_pgns[] =
+{
+    {61444, 0, 3, 100},     /* EEC1 */
+    {61443, 0, 3, 20},      /* EEC2 */
+    {61442, 3, 3, 100},     /* ETC1 */
+    {0, 3, 3, 100},         /* TSC1 to engine */
+    {61441, 11, 6, 10},     /* EBC1 */
+    {65215, 11, 6, 10},     /* EBC2 */
+    {65265, 0, 6, 10},      /* CCVS1 */
+    {65266, 0, 6, 10},      /* LFE1 */
+    {65132, 238, 3, 20},    /* TCO1 */
+    {65262, 0, 6, 1},       /* ET1 */
+    {65263, 0, 6, 2},       /* EFL/P1 */
+    {65269, 0, 6, 1},       /* AMB */
+    {65270, 0, 6, 2},       /* IC1 */
+    {65271, 0, 6, 1},       /* VEP1 */
+    {65253, 0, 6, 1},       /* HOURS */
+    {65226, 0, 6, 1},       /* DM1 */
+    {65280, 33, 6, 10},     /* Proprietary B */
+    {65535, 49, 6, 5},      /* Proprietary B, last */
+};
+
+#define NUM_TRACE_PGNS (sizeof(trace_pgns) / sizeof(trace_pgns[0]))
+
+/* Benchmark state shared by all benchmarks */
+typedef struct
+{
+    j1939decode_ctx_t * ctx;
+    const j1939_frame_t * frames;
+    size_t num_frames;
+
+    /* Data fields of all frames of the most frequent PGN, for columnar decoding */
+    uint32_t column_pgn;
+    uint64_t * column_data;
+    size_t num_column_data;
+
+    /* Change detection state of all source address and PGN pairs of the trace */
+    j1939decode_delta_t * delta;
+
+    /* Context with an output cache */
+    j1939decode_ctx_t * cached_ctx;
+
+    /* Scratch output */
+    char * buf;
+    j1939_decoded_t * decoded;
+    j1939_spn_value_t * spns;
+    uint64_t * value_raw;
+    double * value;
+    uint8_t * valid;
+    j1939_spn_column_t * columns;
+} bench_state_t;
+
+typedef struct
+{
+    const char * name;
+    size_t batch;                                   /* frames per call */
+    bool columns;                                   /* iterates over column_data instead of frames */
+    size_t (*run)(bench_state_t * state, size_t first, size_t count);
+} bench_t;
+
+/* Allocation counters of the decoder context */
+static size_t alloc_count;
+static size_t free_count;
+
+/* Static helper functions */
+static void * counting_malloc(void * user, size_t size);
+static void counting_free(void * user, void * ptr);
+static uint64_t now_ns(void);
+static uint64_t rand_next(uint64_t * state);
+static j1939_frame_t * trace_generate(size_t count, uint64_t seed);
+static j1939_frame_t * trace_load_candump(const char * filename, size_t * count);
+static long rss_kib(void);
+static int compare_double(const void * a, const void * b);
+static size_t bench_to_json_pretty(bench_state_t * state, size_t first, size_t count);
+static size_t bench_to_json_compact(bench_state_t * state, size_t first, size_t count);
+static size_t bench_to_json_buf(bench_state_t * state, size_t first, size_t count);
+static size_t bench_to_json_buf_profile(bench_state_t * state, size_t first, size_t count, uint32_t profile);
+static size_t bench_profile_compact(bench_state_t * state, size_t first, size_t count);
+static size_t bench_profile_raw(bench_state_t * state, size_t first, size_t count);
+static size_t bench_encode(bench_state_t * state, size_t first, size_t count, uint32_t format);
+static size_t bench_encode_cbor(bench_state_t * state, size_t first, size_t count);
+static size_t bench_encode_msgpack(bench_state_t * state, size_t first, size_t count);
+static size_t bench_encode_protobuf(bench_state_t * state, size_t first, size_t count);
+static size_t bench_delta_to_json_buf(bench_state_t * state, size_t first, size_t count);
+static size_t bench_cached_to_json_buf(bench_state_t * state, size_t first, size_t count);
+static size_t bench_cache_hit(bench_state_t * state, size_t first, size_t count);
+static size_t bench_decode(bench_state_t * state, size_t first, size_t count);
+static size_t bench_decode_payload(bench_state_t * state, size_t first, size_t count);
+static size_t bench_decode_batch(bench_state_t * state, size_t first, size_t count);
+static size_t bench_to_ndjson_batch(bench_state_t * state, size_t first, size_t count);
+static size_t bench_decode_columns(bench_state_t * state, size_t first, size_t count);
+static void bench_run(const bench_t * bench, bench_state_t * state, size_t min_frames, uint64_t clock_overhead);
+static bool setup_columns(bench_state_t * state);
+
+static const bench_t benches[] =
+{
+    {"to_json_pretty", 1, false, bench_to_json_pretty},
+    {"to_json_compact", 1, false, bench_to_json_compact},
+    {"to_json_buf", 1, false, bench_to_json_buf},
+    {"profile_compact", 1, false, bench_profile_compact},
+    {"profile_raw", 1, false, bench_profile_raw},
+    {"encode_cbor", 1, false, bench_encode_cbor},
+    {"encode_msgpack", 1, false, bench_encode_msgpack},
+    {"encode_protobuf", 1, false, bench_encode_protobuf},
+    {"delta_to_json_buf", 1, false, bench_delta_to_json_buf},
+    {"cached_to_json_buf", 1, false, bench_cached_to_json_buf},
+    {"cache_hit", 1, false, bench_cache_hit},
+    {"decode", 1, false, bench_decode},
+    {"decode_payload", 1, false, bench_decode_payload},
+    {"decode_batch", BENCH_BATCH, false, bench_decode_batch},
+    {"to_ndjson_batch", BENCH_BATCH, false, bench_to_ndjson_batch},
+    {"decode_columns", BENCH_BATCH, true, bench_decode_columns},
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/**************************************************************************//**
+
+  \brief Allocator counting calls, used to report allocations per frame
+
+******************************************************************************/
+void * counting_malloc(void * user, size_t size)
+{
+    (void) user;
+    alloc_count++;
+    return malloc(size);
+}
+
+void counting_free(void * user, void * ptr)
+{
+    (void) user;
+    free_count++;
+    free(ptr);
+}
+
+/**************************************************************************//**
+
+  \brief Read monotonic clock
+
+  \return uint64_t  time in nanoseconds
+
+******************************************************************************/
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/**************************************************************************//**
+
+  \brief Get next pseudo random number (xorshift64*)
+
+  \return uint64_t  pseudo random number
+
+******************************************************************************/
+uint64_t rand_next(uint64_t * state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12U;
+    x ^= x << 25U;
+    x ^= x >> 27U;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/**************************************************************************//**
+
+  \brief Generate a synthetic bus trace weighted by typical PGN rates
+
+  Data bytes are random, with about one in five set to 0xFF (not available)
+  as is common on a real bus.
+
+  \param count      number of frames to generate
+  \param seed       pseudo random generator seed, the same seed gives the same trace
+
+  \return j1939_frame_t *   allocated array of frames, NULL on failure
+
+******************************************************************************/
+j1939_frame_t * trace_generate(size_t count, uint64_t seed)
+{
+    j1939_frame_t * frames = calloc(count, sizeof(j1939_frame_t));
+    if (frames == NULL)
+    {
+        return NULL;
+    }
+
+    uint32_t total_rate = 0;
+    for (size_t i = 0; i < NUM_TRACE_PGNS; i++)
+    {
+        total_rate += trace_pgns[i].rate;
+    }
+
+    /* xorshift state must not be zero */
+    uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t pick = (uint32_t) (rand_next(&state) % total_rate);
+        const trace_pgn_t * p = trace_pgns;
+        while (pick >= p->rate)
+        {
+            pick -= p->rate;
+            p++;
+        }
+
+        frames[i].id = ((uint32_t) p->priority << 26U) | (p->pgn << 8U) | p->sa;
+        frames[i].dlc = 8;
+        uint64_t r = rand_next(&state);
+        for (size_t j = 0; j < sizeof(frames[i].data); j++)
+        {
+            uint8_t byte = (uint8_t) (r >> (j * 8U));
+            frames[i].data[j] = (byte % 5 == 0) ? 0xFF : byte;
+        }
+    }
+
+    return frames;
+}
+
+/**************************************************************************//**
+
+  \brief Load frames from a candump log file
+
+  \param filename           candump log file
+  \param count              set to number of frames loaded
+
+  \return j1939_frame_t *   allocated array of frames, NULL on failure
+
+******************************************************************************/
+j1939_frame_t * trace_load_candump(const char * filename, size_t * count)
+{
+    FILE * fp = fopen(filename, "r");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Could not open file %s\n", filename);
+        return NULL;
+    }
+
+    size_t cap = 1024;
+    size_t n = 0;
+    j1939_frame_t * frames = malloc(cap * sizeof(j1939_frame_t));
+    char line[256];
+    while (frames != NULL && fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (n == cap)
+        {
+            cap *= 2;
+            j1939_frame_t * grown = realloc(frames, cap * sizeof(j1939_frame_t));
+            if (grown == NULL)
+            {
+                free(frames);
+                frames = NULL;
+                break;
+            }
+            frames = grown;
+        }
+
+        uint64_t timestamp_us;
+        if (j1939decode_parse_candump(line, strlen(line), &frames[n], &timestamp_us))
+        {
+            n++;
+        }
+    }
+    fclose(fp);
+
+    if (frames != NULL && n == 0)
+    {
+        fprintf(stderr, "No CAN frames found in %s\n", filename);
+        free(frames);
+        frames = NULL;
+    }
+
+    *count = n;
+    return frames;
+}
+
+/**************************************************************************//**
+
+  \brief Get resident set size of this process
+
+  \return long  resident set size in KiB, -1 if not available
+
+******************************************************************************/
+long rss_kib(void)
+{
+    long rss = -1;
+#ifdef __linux__
+    FILE * fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL)
+    {
+        long pages;
+        if (fscanf(fp, "%*s %ld", &pages) == 1)
+        {
+            /* statm counts pages, which are 16 or 64 KiB on some arm64 systems */
+            rss = pages * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+        fclose(fp);
+    }
+#endif
+    return rss;
+}
+
+int compare_double(const void * a, const void * b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Benchmarks, each decodes count frames starting at first and returns the number of frames decoded */
+size_t bench_to_json_pretty(bench_state_t * state, size_t first, size_t count)
+{
+    const j1939_frame_t * f = &state->frames[first];
+    char * json = j1939decode_ctx_to_json(state->ctx, f->id, f->dlc, (const uint64_t *) f->data, true);
+    counting_free(NULL, json);
+    return count;
+}
+
+size_t bench_to_json_compact(bench_state_t * state, size_t first, size_t count)
+{
+    const j1939_frame_t * f = &state->frames[first];
+    char * json = j1939decode_ctx_to_json(state->ctx, f->id, f->dlc, (const uint64_t *) f->data, false);
+    counting_free(NULL, json);
+    return count;
+}
+
+size_t bench_to_json_buf(bench_state_t * state, size_t first, size_t count)
+{
+    const j1939_frame_t * f = &state->frames[first];
+    j1939decode_ctx_to_json_buf(state->ctx, f->id, f->dlc, (const uint64_t *) f->data, state->buf, BENCH_JSON_LEN, 0);
+    return count;
+}
+
+size_t bench_to_json_buf_profile(bench_state_t * state, size_t first, size_t count, uint32_t profile)
+{
+    const j1939_frame_t * f = &state->frames[first];
+    j1939decode_ctx_set_profile(state->ctx, profile);
+    j1939decode_ctx_to_json_buf(state->ctx, f->id, f->dlc, (const uint64_t *) f->data, state->buf, BENCH_JSON_LEN, 0);
+    j1939decode_ctx_set_profile(state->ctx, J1939DECODE_PROFILE_FULL);
+    return count;
+}
+
+size_t bench_profile_compact(bench_state_t * state, size_t first, size_t count)
+{
+    return bench_to_json_buf_profile(state, first, count, J1939DECODE_PROFILE_COMPACT);
+}
+
+size_t bench_profile_raw(bench_state_t * state, size_t first, size_t count)
+{
+    return bench_to_json_buf_profile(state, first, count, J1939DECODE_PROFILE_RAW);
+}
+
+size_t bench_encode(bench_state_t * state, size_t first, size_t count, uint32_t format)
+{
+    const j1939_frame_t * f = &state->frames[first];
+    j1939decode_ctx_encode(state->ctx, f->id, f->dlc, (const uint64_t *) f->data, format,
+                           (uint8_t *) state->buf, BENCH_JSON_LEN, 0);
+    return count;
+}
+
+size_t bench_encode_cbor(bench_state_t * state, size_t first, size_t count)
+{
+    return bench_encode(state, first, count, J1939DECODE_FORMAT_CBOR);
+}
+
+size_t bench_encode_msgpack(bench_state_t * state, size_t first, size_t count)
+{
+    return bench_encode(state, first, count, J1939DECODE_FORMAT_MSGPACK);
+}
+
+size_t bench_encode_protobuf(bench_state_t * state, size_t first, size_t count)
+{
+    return bench_encode(state, first, count, J1939DECODE_FORMAT_PROTOBUF);
+}
+
+size_t bench_delta_to_json_buf(bench_state_t * state, size_t first, size_t count)
+{
+    /* Frames are taken to be 1 ms apart */
+    const j1939_frame_t * f = &state->frames[first];
+    j1939decode_ctx_delta_to_json_buf(state->ctx, state->delta, f->id, f->dlc, (const uint64_t *) f->data,
+                                      (uint64_t) first * 1000U, state->buf, BENCH_JSON_LEN, 0);
+    return count;
+}
+
+size_t bench_cached_to_json_buf(bench_state_t * state, size_t first, size_t count)
+{
+    const j1939_frame_t * f = &state->frames[first];
+    j1939decode_ctx_to_json_buf(state->cached_ctx, f->id, f->dlc, (const uint64_t *) f->data, state->buf,
+                                BENCH_JSON_LEN, 0);
+    return count;
+}
+
+size_t bench_cache_hit(bench_state_t * state, size_t first, size_t count)
+{
+    /* Only the first frames of the trace repeat, so after warming up every frame whose output fits is a hit */
+    const j1939_frame_t * f = &state->frames[first % BENCH_CACHE_REPEAT];
+    j1939decode_ctx_to_json_buf(state->cached_ctx, f->id, f->dlc, (const uint64_t *) f->data, state->buf,
+                                BENCH_JSON_LEN, 0);
+    return count;
+}
+
+size_t bench_decode(bench_state_t * state, size_t first, size_t count)
+{
+    const j1939_frame_t * f = &state->frames[first];
+    j1939decode_ctx_decode(state->ctx, f->id, f->dlc, (const uint64_t *) f->data, state->decoded,
+                           state->spns, BENCH_MAX_SPNS);
+    return count;
+}
+
+size_t bench_decode_payload(bench_state_t * state, size_t first, size_t count)
+{
+    const j1939_frame_t * f = &state->frames[first];
+    j1939decode_ctx_decode_payload(state->ctx, f->id, f->data, f->dlc, state->decoded, state->spns, BENCH_MAX_SPNS);
+    return count;
+}
+
+size_t bench_decode_batch(bench_state_t * state, size_t first, size_t count)
+{
+    return j1939decode_ctx_decode_batch(state->ctx, &state->frames[first], count, state->decoded,
+                                        state->spns, BENCH_BATCH * BENCH_MAX_SPNS);
+}
+
+size_t bench_to_ndjson_batch(bench_state_t * state, size_t first, size_t count)
+{
+    size_t written;
+    return j1939decode_ctx_to_ndjson_batch(state->ctx, &state->frames[first], count, state->buf,
+                                           BENCH_NDJSON_LEN, &written);
+}
+
+size_t bench_decode_columns(bench_state_t * state, size_t first, size_t count)
+{
+    j1939decode_ctx_decode_columns(state->ctx, state->column_pgn, &state->column_data[first], count,
+                                   state->columns, BENCH_MAX_SPNS);
+    return count;
+}
+
+/**************************************************************************//**
+
+  \brief Collect the data fields of the most frequent PGN for columnar decoding
+
+  \return bool  true on success
+
+******************************************************************************/
+bool setup_columns(bench_state_t * state)
+{
+    /* Sampling the PGNs of the first frames is enough to find the dominant PGN */
+    size_t best_count = 0;
+    for (size_t i = 0; i < state->num_frames && i < 64; i++)
+    {
+        uint32_t pgn = (state->frames[i].id >> 8U) & 0x3FFFFU;
+        size_t n = 0;
+        for (size_t j = 0; j < state->num_frames; j++)
+        {
+            n += ((state->frames[j].id >> 8U) & 0x3FFFFU) == pgn;
+        }
+        if (n > best_count)
+        {
+            best_count = n;
+            state->column_pgn = pgn;
+        }
+    }
+
+    state->column_data = malloc(state->num_frames * sizeof(uint64_t));
+    if (state->column_data == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < state->num_frames; i++)
+    {
+        if (((state->frames[i].id >> 8U) & 0x3FFFFU) == state->column_pgn)
+        {
+            memcpy(&state->column_data[state->num_column_data++], state->frames[i].data, sizeof(uint64_t));
+        }
+    }
+
+    /* One chunk of columns for every SPN of the PGN */
+    state->value_raw = malloc(BENCH_MAX_SPNS * BENCH_BATCH * sizeof(uint64_t));
+    state->value = malloc(BENCH_MAX_SPNS * BENCH_BATCH * sizeof(double));
+    state->valid = malloc(BENCH_MAX_SPNS * BENCH_BATCH / 8);
+    state->columns = malloc(BENCH_MAX_SPNS * sizeof(j1939_spn_column_t));
+    if (state->value_raw == NULL || state->value == NULL || state->valid == NULL || state->columns == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < BENCH_MAX_SPNS; i++)
+    {
+        state->columns[i].value_raw = &state->value_raw[i * BENCH_BATCH];
+        state->columns[i].value = &state->value[i * BENCH_BATCH];
+        state->columns[i].valid = &state->valid[i * BENCH_BATCH / 8];
+    }
+
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Run one benchmark and print a result line
+
+  Every call is timed on its own to collect ns/frame percentiles, with the
+  measured overhead of reading the clock removed.
+
+  \param bench              benchmark to run
+  \param state              benchmark state
+  \param min_frames         minimum number of frames to decode
+  \param clock_overhead     time taken to read the clock in nanoseconds
+
+  \return void
+
+******************************************************************************/
+void bench_run(const bench_t * bench, bench_state_t * state, size_t min_frames, uint64_t clock_overhead)
+{
+    size_t source_count = bench->columns ? state->num_column_data : state->num_frames;
+    if (source_count == 0)
+    {
+        printf("%-20s %s\n", bench->name, "skipped, no frames");
+        return;
+    }
+
+    size_t max_samples = min_frames / bench->batch + 1;
+    double * samples = malloc(max_samples * sizeof(double));
+    if (samples == NULL)
+    {
+        fprintf(stderr, "Memory allocation failure\n");
+        return;
+    }
+
+    /* Warm up caches and branch predictors */
+    for (size_t first = 0; first < source_count && first < 1000; )
+    {
+        size_t count = source_count - first < bench->batch ? source_count - first : bench->batch;
+        size_t done = bench->run(state, first, count);
+        first += done > 0 ? done : count;
+    }
+
+    size_t num_samples = 0;
+    size_t frames = 0;
+    size_t first = 0;
+    size_t allocs = alloc_count;
+    uint64_t total_ns = 0;
+    while (frames < min_frames && num_samples < max_samples)
+    {
+        size_t count = source_count - first < bench->batch ? source_count - first : bench->batch;
+
+        uint64_t start = now_ns();
+        size_t done = bench->run(state, first, count);
+        uint64_t elapsed = now_ns() - start;
+
+        /* Batch calls may stop early, a call that decodes nothing only happens at error */
+        if (done == 0)
+        {
+            done = count;
+        }
+
+        elapsed = elapsed > clock_overhead ? elapsed - clock_overhead : 0;
+        total_ns += elapsed;
+        samples[num_samples++] = (double) elapsed / (double) done;
+        frames += done;
+        first += done;
+        if (first >= source_count)
+        {
+            first = 0;
+        }
+    }
+    allocs = alloc_count - allocs;
+
+    qsort(samples, num_samples, sizeof(double), compare_double);
+    double ns_per_frame = (double) total_ns / (double) frames;
+    printf("%-20s %10.1f %12.0f %9.1f %9.1f %9.1f %9.1f %8.2f\n", bench->name,
+           ns_per_frame, ns_per_frame > 0 ? 1e9 / ns_per_frame : 0.0,
+           samples[num_samples / 2], samples[num_samples * 90 / 100], samples[num_samples * 99 / 100],
+           samples[num_samples * 999 / 1000], (double) allocs / (double) frames);
+
+    free(samples);
+}
+
+/**************************************************************************//**
+
+  \brief Benchmark decoding of a synthetic or recorded CAN bus trace
+
+  Usage: j1939decode_bench [-d J1939db.json] [-l] [-c candump.log] [-t trace frames]
+                           [-n frames per benchmark] [-s seed] [-f name filter]
+
+  -l opens the database lazily, so the first pass also measures loading PGNs.
+
+  \return int   exit status
+
+******************************************************************************/
+int main(int argc, char * argv[])
+{
+    const char * db_file = J1939DECODE_DB;
+    const char * candump_file = NULL;
+    const char * filter = NULL;
+    size_t trace_frames = BENCH_TRACE_FRAMES;
+    size_t min_frames = BENCH_MIN_FRAMES;
+    uint64_t seed = BENCH_SEED;
+    uint32_t db_flags = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "-l") == 0)
+        {
+            db_flags |= J1939DECODE_DB_LAZY;
+            continue;
+        }
+        else if (value != NULL && strcmp(argv[i], "-d") == 0)
+        {
+            db_file = value;
+        }
+        else if (value != NULL && strcmp(argv[i], "-c") == 0)
+        {
+            candump_file = value;
+        }
+        else if (value != NULL && strcmp(argv[i], "-t") == 0)
+        {
+            trace_frames = strtoul(value, NULL, 0);
+        }
+        else if (value != NULL && strcmp(argv[i], "-n") == 0)
+        {
+            min_frames = strtoul(value, NULL, 0);
+        }
+        else if (value != NULL && strcmp(argv[i], "-s") == 0)
+        {
+            seed = strtoull(value, NULL, 0);
+        }
+        else if (value != NULL && strcmp(argv[i], "-f") == 0)
+        {
+            filter = value;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-d J1939db.json] [-l] [-c candump.log] [-t trace frames] "
+                    "[-n frames per benchmark] [-s seed] [-f name filter]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+
+    if (trace_frames == 0 || min_frames == 0)
+    {
+        fprintf(stderr, "Frame counts must be greater than zero\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Database load time and memory */
+    const j1939decode_allocator_t allocator = {counting_malloc, counting_free, NULL};
+    long rss_before = rss_kib();
+    uint64_t start = now_ns();
+    j1939decode_db_t * db = j1939decode_db_open(db_file, db_flags, &allocator);
+    uint64_t load_ns = now_ns() - start;
+    long rss_after = rss_kib();
+    if (db == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    size_t db_allocs = alloc_count - free_count;
+
+    bench_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.ctx = j1939decode_ctx_create_with_allocator(db, &allocator);
+    state.cached_ctx = j1939decode_ctx_create_with_allocator(db, &allocator);
+    j1939decode_db_release(db);
+    if (state.ctx == NULL || state.cached_ctx == NULL ||
+        !j1939decode_ctx_set_cache(state.cached_ctx, BENCH_CACHE_ENTRIES, 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    j1939_frame_t * frames;
+    if (candump_file != NULL)
+    {
+        frames = trace_load_candump(candump_file, &trace_frames);
+    }
+    else
+    {
+        frames = trace_generate(trace_frames, seed);
+    }
+    state.frames = frames;
+    state.num_frames = trace_frames;
+    state.buf = malloc(BENCH_NDJSON_LEN);
+    state.decoded = malloc(BENCH_BATCH * sizeof(j1939_decoded_t));
+    state.spns = malloc(BENCH_BATCH * BENCH_MAX_SPNS * sizeof(j1939_spn_value_t));
+    state.delta = j1939decode_delta_create(BENCH_DELTA_PAIRS, &allocator);
+    bool ok = frames != NULL && state.buf != NULL && state.decoded != NULL && state.spns != NULL &&
+              state.delta != NULL && setup_columns(&state);
+
+    if (ok)
+    {
+        /* Clock overhead is the minimum time measured between two reads */
+        uint64_t clock_overhead = UINT64_MAX;
+        for (int i = 0; i < 1000; i++)
+        {
+            uint64_t t = now_ns();
+            uint64_t elapsed = now_ns() - t;
+            clock_overhead = elapsed < clock_overhead ? elapsed : clock_overhead;
+        }
+
+        printf("j1939decode %s, columnar kernel %s\n", j1939decode_version(), j1939simd_kernel());
+        printf("Database %s: load %.3f ms, %zu allocation(s)", db_file, (double) load_ns / 1e6, db_allocs);
+        if (rss_before >= 0 && rss_after >= 0)
+        {
+            printf(", RSS +%ld KiB", rss_after - rss_before);
+        }
+        printf("\n");
+        if (candump_file != NULL)
+        {
+            printf("Trace %s: %zu frames\n", candump_file, state.num_frames);
+        }
+        else
+        {
+            printf("Trace generated: %zu frames, seed %llu\n", state.num_frames, (unsigned long long) seed);
+        }
+        printf("Columnar PGN %u: %zu frames\n", state.column_pgn, state.num_column_data);
+        printf("%-20s %10s %12s %9s %9s %9s %9s %8s\n", "Benchmark", "ns/frame", "frames/s",
+               "p50", "p90", "p99", "p99.9", "allocs");
+        printf("-------------------------------------------------------------------------------------------\n");
+
+        for (size_t i = 0; i < NUM_BENCHES; i++)
+        {
+            if (filter == NULL || strstr(benches[i].name, filter) != NULL)
+            {
+                bench_run(&benches[i], &state, min_frames, clock_overhead);
+            }
+        }
+
+        j1939decode_cache_stats_t cache_stats;
+        j1939decode_ctx_cache_stats(state.cached_ctx, &cache_stats);
+        if (cache_stats.hits + cache_stats.misses > 0)
+        {
+            printf("Output cache: %llu hits, %llu misses, %llu evictions\n", (unsigned long long) cache_stats.hits,
+                   (unsigned long long) cache_stats.misses, (unsigned long long) cache_stats.evictions);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Could not set up benchmarks\n");
+    }
+
+    j1939decode_delta_destroy(state.delta);
+    free(state.columns);
+    free(state.valid);
+    free(state.value);
+    free(state.value_raw);
+    free(state.column_data);
+    free(state.spns);
+    free(state.decoded);
+    free(state.buf);
+    free(frames);
+    j1939decode_ctx_destroy(state.cached_ctx);
+    j1939decode_ctx_destroy(state.ctx);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,304 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "j1939cache.h"
+#include "j1939ctx.h"
+
+/* Largest number of entries, slots are twice as many and hold 32-bit entry numbers */
+#define CACHE_MAX_ENTRIES   (1U << 24U)
+
+/* Largest output kept per entry */
+#define CACHE_MAX_LEN       (1U << 16U)
+
+/* Cached output of one frame */
+typedef struct
+{
+    uint64_t data;
+    uint32_t id;
+    uint32_t mode;              /* output format and flags */
+    uint32_t len;               /* length of output */
+    uint8_t dlc;
+    bool referenced;            /* hit since the clock hand last passed */
+} cache_entry_t;
+
+/* Cache state, slots, entries and outputs are allocated once in the same block */
+struct j1939cache
+{
+    j1939decode_allocator_t allocator;
+    size_t capacity;
+    size_t max_len;
+    size_t count;               /* entries in use, entries are used in order until the cache is full */
+    size_t hand;                /* next entry considered for eviction */
+    uint32_t num_slots;         /* power of two, at least twice the capacity */
+    uint32_t shift;             /* hash shift, 64 minus log2 of num_slots */
+    uint32_t * slots;           /* entry number plus one, 0 for an empty slot */
+    cache_entry_t * entries;
+    uint8_t * outputs;          /* max_len bytes per entry */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+/* Static helper functions */
+static void log_msg(uint32_t level, const char * fmt, ...);
+static void remove_slot(j1939cache_t * cache, uint32_t slot);
+
+static inline uint32_t key_slot(const j1939cache_t * cache, uint32_t id, uint8_t dlc, uint64_t data, uint32_t mode)
+{
+    /* Fibonacci hashing of the data mixed with the rest of the key, taking the well mixed high bits */
+    uint64_t key = data ^ (((uint64_t) id << 32U | (uint64_t) mode << 8U | dlc) * 0xFF51AFD7ED558CCDULL);
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> cache->shift);
+}
+
+static inline bool entry_matches(const cache_entry_t * entry, uint32_t id, uint8_t dlc, uint64_t data, uint32_t mode)
+{
+    return entry->data == data && entry->id == id && entry->mode == mode && entry->dlc == dlc;
+}
+
+/**************************************************************************//**
+
+  \brief Log formatted message to the process-wide handler
+
+  \return void
+
+******************************************************************************/
+void log_msg(uint32_t level, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    j1939ctx_vlog(NULL, level, fmt, args);
+    va_end(args);
+}
+
+/**************************************************************************//**
+
+  \brief Create cache of encoded output
+
+  \param capacity           maximum number of outputs
+  \param max_len            maximum length of each output in bytes
+  \param allocator          allocator for the cache, NULL to use malloc() and free()
+
+  \return j1939cache_t *    pointer to cache, NULL on failure
+
+******************************************************************************/
+j1939cache_t * j1939cache_create(size_t capacity, size_t max_len, const j1939decode_allocator_t * allocator)
+{
+    if (capacity == 0 || capacity > CACHE_MAX_ENTRIES || max_len == 0 || max_len > CACHE_MAX_LEN)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Invalid output cache size");
+        return NULL;
+    }
+
+    /* Keep the table at most half full so that probe sequences stay short */
+    uint32_t num_slots = 2;
+    uint32_t shift = 63;
+    while (num_slots < capacity * 2)
+    {
+        num_slots *= 2;
+        shift--;
+    }
+
+    /* State, slots, entries and outputs in one allocation, each 8 byte aligned */
+    size_t slots_offset = (sizeof(j1939cache_t) + 7) & ~(size_t) 7;
+    size_t entries_offset = (slots_offset + num_slots * sizeof(uint32_t) + 7) & ~(size_t) 7;
+    size_t outputs_offset = entries_offset + capacity * sizeof(cache_entry_t);
+    max_len = (max_len + 7) & ~(size_t) 7;
+    size_t size = outputs_offset + capacity * max_len;
+
+    allocator = j1939ctx_allocator(allocator);
+    j1939cache_t * cache = allocator->malloc_fn(allocator->user, size);
+    if (cache == NULL)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return NULL;
+    }
+
+    memset(cache, 0, sizeof(j1939cache_t));
+    cache->allocator = *allocator;
+    cache->capacity = capacity;
+    cache->max_len = max_len;
+    cache->num_slots = num_slots;
+    cache->shift = shift;
+    cache->slots = (uint32_t *) ((uint8_t *) cache + slots_offset);
+    cache->entries = (cache_entry_t *) ((uint8_t *) cache + entries_offset);
+    cache->outputs = (uint8_t *) cache + outputs_offset;
+    j1939cache_clear(cache);
+
+    return cache;
+}
+
+/**************************************************************************//**
+
+  \brief Free cache
+
+  \return void
+
+******************************************************************************/
+void j1939cache_free(j1939cache_t * cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    cache->allocator.free_fn(cache->allocator.user, cache);
+}
+
+/**************************************************************************//**
+
+  \brief Remove all entries
+
+  \return void
+
+******************************************************************************/
+void j1939cache_clear(j1939cache_t * cache)
+{
+    cache->count = 0;
+    cache->hand = 0;
+    memset(cache->slots, 0, cache->num_slots * sizeof(uint32_t));
+}
+
+/**************************************************************************//**
+
+  \brief Lookup output of a frame
+
+  \param cache      output cache
+  \param id         CAN identifier
+  \param dlc        data length code
+  \param data       data field
+  \param mode       output format and flags
+  \param output     set to cached output if found
+  \param len        set to length of cached output if found
+
+  \return bool      true if found
+
+******************************************************************************/
+bool j1939cache_find(j1939cache_t * cache, uint32_t id, uint8_t dlc, uint64_t data, uint32_t mode,
+                     const uint8_t ** output, size_t * len)
+{
+    uint32_t mask = cache->num_slots - 1;
+    for (uint32_t slot = key_slot(cache, id, dlc, data, mode); cache->slots[slot] != 0; slot = (slot + 1) & mask)
+    {
+        size_t i = cache->slots[slot] - 1;
+        cache_entry_t * entry = &cache->entries[i];
+        if (entry_matches(entry, id, dlc, data, mode))
+        {
+            entry->referenced = true;
+            cache->hits++;
+            *output = cache->outputs + i * cache->max_len;
+            *len = entry->len;
+            return true;
+        }
+    }
+
+    cache->misses++;
+    return false;
+}
+
+/**************************************************************************//**
+
+  \brief Remove an entry number from its slot, moving later entries of the probe sequence back
+
+  \return void
+
+******************************************************************************/
+void remove_slot(j1939cache_t * cache, uint32_t slot)
+{
+    uint32_t mask = cache->num_slots - 1;
+    for (uint32_t next = (slot + 1) & mask; cache->slots[next] != 0; next = (next + 1) & mask)
+    {
+        /* An entry may fill the hole if its home slot is not cyclically between the hole and its slot */
+        const cache_entry_t * entry = &cache->entries[cache->slots[next] - 1];
+        uint32_t home = key_slot(cache, entry->id, entry->dlc, entry->data, entry->mode);
+        if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+            cache->slots[slot] = cache->slots[next];
+            slot = next;
+        }
+    }
+    cache->slots[slot] = 0;
+}
+
+/**************************************************************************//**
+
+  \brief Add output of a frame, evicting an entry if the cache is full
+
+  \param cache      output cache
+  \param id         CAN identifier
+  \param dlc        data length code
+  \param data       data field
+  \param mode       output format and flags
+  \param output     output of the frame
+  \param len        length of output
+
+  \return void
+
+******************************************************************************/
+void j1939cache_insert(j1939cache_t * cache, uint32_t id, uint8_t dlc, uint64_t data, uint32_t mode,
+                       const uint8_t * output, size_t len)
+{
+    if (len > cache->max_len)
+    {
+        return;
+    }
+
+    uint32_t mask = cache->num_slots - 1;
+    size_t i;
+    if (cache->count < cache->capacity)
+    {
+        i = cache->count++;
+    }
+    else
+    {
+        /* Advance the clock hand past referenced entries, clearing their reference bits */
+        while (cache->entries[cache->hand].referenced)
+        {
+            cache->entries[cache->hand].referenced = false;
+            cache->hand = cache->hand + 1 < cache->capacity ? cache->hand + 1 : 0;
+        }
+        i = cache->hand;
+        cache->hand = cache->hand + 1 < cache->capacity ? cache->hand + 1 : 0;
+
+        const cache_entry_t * victim = &cache->entries[i];
+        uint32_t slot = key_slot(cache, victim->id, victim->dlc, victim->data, victim->mode);
+        while (cache->slots[slot] != i + 1)
+        {
+            slot = (slot + 1) & mask;
+        }
+        remove_slot(cache, slot);
+        cache->evictions++;
+    }
+
+    cache_entry_t * entry = &cache->entries[i];
+    entry->data = data;
+    entry->id = id;
+    entry->mode = mode;
+    entry->len = (uint32_t) len;
+    entry->dlc = dlc;
+    entry->referenced = false;
+    memcpy(cache->outputs + i * cache->max_len, output, len);
+
+    uint32_t slot = key_slot(cache, id, dlc, data, mode);
+    while (cache->slots[slot] != 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+    cache->slots[slot] = (uint32_t) i + 1;
+}
+
+/**************************************************************************//**
+
+  \brief Get counters of a cache
+
+  \return void
+
+******************************************************************************/
+void j1939cache_stats(const j1939cache_t * cache, j1939decode_cache_stats_t * stats)
+{
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->count = cache->count;
+}
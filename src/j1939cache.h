@@ -0,0 +1,49 @@
+#ifndef J1939CACHE_H
+#define J1939CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939decode.h"
+
+/* Cache of encoded output of repeated frames
+ * Entries are keyed on the identifier, DLC and data of a frame together with the output format and flags, and hold a
+ * copy of the complete output. Entries live in one fixed size allocation and are evicted with the CLOCK algorithm,
+ * which gives each entry that was hit since the hand last passed it a second chance
+ * A cache must only be used by one thread at a time */
+typedef struct j1939cache j1939cache_t;
+
+/* Create cache of up to capacity outputs of at most max_len bytes each
+ * Returns NULL on failure */
+j1939cache_t * j1939cache_create(size_t capacity, size_t max_len, const j1939decode_allocator_t * allocator);
+
+/* Free cache */
+void j1939cache_free(j1939cache_t * cache);
+
+/* Remove all entries, the counters are kept */
+void j1939cache_clear(j1939cache_t * cache);
+
+/* Lookup output of a frame, counting a hit or a miss
+ * output and len are set to the cached output if found, which stays valid until the next insert or clear
+ * Returns true if found */
+bool j1939cache_find(j1939cache_t * cache, uint32_t id, uint8_t dlc, uint64_t data, uint32_t mode,
+                     const uint8_t ** output, size_t * len);
+
+/* Add output of a frame after j1939cache_find() missed, evicting an entry if the cache is full
+ * Outputs longer than the maximum length are not added */
+void j1939cache_insert(j1939cache_t * cache, uint32_t id, uint8_t dlc, uint64_t data, uint32_t mode,
+                       const uint8_t * output, size_t len);
+
+/* Get counters */
+void j1939cache_stats(const j1939cache_t * cache, j1939decode_cache_stats_t * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939CACHE_H
@@ -0,0 +1,198 @@
+#ifndef J1939CTX_H
+#define J1939CTX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include "j1939decode.h"
+#include "j1939db.h"
+#include "j1939index.h"
+#include "j1939delta.h"
+#include "j1939cache.h"
+#include "j1939stats.h"
+
+/* Database problems that are logged once for each number, repeats are only counted */
+enum
+{
+    J1939CTX_LOG_NO_START_BIT,          /* SPN numbers */
+    J1939CTX_LOG_NEGATIVE_START_BIT,
+    J1939CTX_LOG_NO_SPN_DATA,
+    J1939CTX_LOG_NO_PGN_NAME,           /* PGN numbers */
+    J1939CTX_LOG_NO_SPNS,
+    J1939CTX_LOG_EMPTY_SPNS,
+    J1939CTX_LOG_PGN_NOT_FOUND,
+    J1939CTX_LOG_NO_SA_NAME,            /* source addresses */
+    J1939CTX_LOG_NUM_SITES
+};
+
+/* Log handler and the minimum level of messages passed to it */
+typedef struct
+{
+    log_fn_ptr fn;                      /* handler without user pointer or level, used if handler is NULL */
+    log_handler_ptr handler;
+    void * user;
+    uint32_t level;
+} j1939ctx_logger_t;
+
+/* Shareable database handle
+ * The compiled tables are immutable once loaded, so any number of contexts may decode with them concurrently
+ * The handle and the tables are one allocation, unless the tables are a memory-mapped binary image
+ * Lazily loaded databases keep an index instead, and build or validate the tables of each PGN on first use */
+struct j1939decode_db
+{
+    /* Number of owners, including every context created with this database */
+    uint32_t refcount;
+
+    /* Compiled lookup tables */
+    j1939db_t * tables;
+
+    /* Allocator the handle was allocated with */
+    j1939decode_allocator_t allocator;
+
+    /* Storage for the table structure, pointing into the binary image that follows the handle */
+    j1939db_t storage;
+
+    /* Index of a lazily loaded database, NULL if all tables were loaded up front */
+    j1939index_t * index;
+
+    /* File contents kept for the index, NULL if the index does not need them */
+    const char * text;
+    size_t text_size;
+    bool text_mapped;
+
+    /* Name of every source address, resolved when the database is opened */
+    const char * sa_names[256];
+
+    /* Bitmaps of the numbers each database problem has been logged for, allocated on first use */
+    uint32_t * logged[J1939CTX_LOG_NUM_SITES];
+
+    /* Number of repeated database problem messages not logged */
+    uint32_t log_repeats[J1939CTX_LOG_NUM_SITES];
+
+    /* Contexts created with this database and the counters of those destroyed, guarded by stats_lock */
+    j1939decode_ctx_t * contexts;
+    j1939decode_stats_t retired;
+    bool stats_lock;
+
+    /* Database replacing this one, referenced by it and published once, NULL while this is the newest */
+    j1939decode_db_t * successor;
+
+    /* Set once the database has been published as the successor of another */
+    bool replacement;
+};
+
+/* Counters of a context, only written by the thread using the context */
+typedef struct
+{
+    j1939decode_stats_t counters;
+
+    /* Counters already added to the databases the context moved from, written under their stats_lock */
+    j1939decode_stats_t moved;
+
+    /* Receive time of the frame decoded next, 0 if not set */
+    uint64_t time_us;
+
+    /* Per-PGN statistics, NULL if not counted */
+    j1939stats_pgns_t * pgns;
+} j1939ctx_stats_t;
+
+/* Decoder context
+ * A context must only be used by one thread at a time */
+struct j1939decode_ctx
+{
+    /* Database handle, retained for the lifetime of the context */
+    j1939decode_db_t * db;
+
+    /* Lookup tables used for the current decode call */
+    const j1939db_t * tables;
+
+    /* Log handler, the process-wide handler is used if neither handler function is set */
+    j1939ctx_logger_t logger;
+
+    /* Allocator for the context, temporary buffers and returned strings */
+    j1939decode_allocator_t allocator;
+
+    /* J1939DECODE_PROFILE_ of JSON output */
+    uint32_t profile;
+
+    /* PGN and SPN filter bitmaps, a set bit passes the number, NULL to pass all numbers */
+    uint8_t * pgn_filter;
+    uint8_t * spn_filter;
+
+    /* Encoded output of repeated frames, NULL without a cache */
+    j1939cache_t * cache;
+
+    /* Counters, allocated with the context so that they can be written while decoding */
+    j1939ctx_stats_t * stats;
+
+    /* Other contexts created with the same database */
+    j1939decode_ctx_t * prev;
+    j1939decode_ctx_t * next;
+};
+
+/* Change detection entry of one source address and PGN */
+typedef struct
+{
+    uint32_t key;               /* source address and PGN plus one, 0 for an empty slot */
+    uint8_t dlc;
+    uint64_t payload;           /* last payload received */
+    uint64_t reported;          /* payload holding the SPN values last reported */
+    uint64_t mask;              /* payload bits covered by decoded SPNs */
+    uint64_t heartbeat_us;      /* time all SPNs were last reported */
+} j1939delta_entry_t;
+
+/* Change detection state, entries are allocated once in the same block */
+struct j1939decode_delta
+{
+    j1939decode_allocator_t allocator;
+    double deadband;
+    uint64_t heartbeat_us;
+    size_t capacity;            /* maximum number of entries in use */
+    size_t count;
+    uint32_t num_slots;         /* power of two, at least twice the capacity */
+    uint32_t shift;             /* hash shift, 32 minus log2 of num_slots */
+    bool full;                  /* capacity was reached, only logged once */
+    j1939delta_entry_t * entries;
+};
+
+/* Find change detection entry of a source address and PGN, inserting an empty entry if not found
+ * inserted is set if the entry was inserted, returns NULL if not found and the table is full */
+j1939delta_entry_t * j1939delta_find(j1939decode_delta_t * delta, uint8_t sa, uint32_t pgn, bool * inserted);
+
+/* Returns true if a message of a J1939DECODE_LOG_ level is passed to the handler of ctx, or the process-wide handler
+ * if ctx is NULL */
+bool j1939ctx_log_enabled(const j1939decode_ctx_t * ctx, uint32_t level);
+
+/* Log formatted message to the context's handler, or the process-wide handler if ctx is NULL
+ * The message is only formatted if its level is enabled */
+void j1939ctx_vlog(const j1939decode_ctx_t * ctx, uint32_t level, const char * fmt, va_list args);
+
+/* Check that a context has a database, moving it to the database replacing its own if there is one
+ * Call at the start of every call decoding with the context, returns false if no database is loaded */
+bool j1939ctx_check_ready(j1939decode_ctx_t * ctx);
+
+/* Lookup SPN record in the database of a context, on its own rather than through a PGN
+ * tables is set to the tables the record belongs to, returns NULL if the SPN is not in the database */
+const j1939db_spn_t * j1939ctx_find_spn(const j1939decode_ctx_t * ctx, uint32_t spn, const j1939db_t ** tables);
+
+/* Get file contents, memory-mapped read-only where possible and otherwise read with allocator
+ * mapped is set to true if the contents are memory-mapped, returns NULL on failure */
+const char * j1939ctx_file_open(const char * filename, const j1939decode_allocator_t * allocator, size_t * size,
+                                bool * mapped);
+
+/* Release file contents of j1939ctx_file_open() */
+void j1939ctx_file_close(const char * text, size_t size, bool mapped, const j1939decode_allocator_t * allocator);
+
+/* Allocator to use when a caller supplies allocator, malloc() and free() if allocator is NULL */
+const j1939decode_allocator_t * j1939ctx_allocator(const j1939decode_allocator_t * allocator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939CTX_H
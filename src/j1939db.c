@@ -0,0 +1,1545 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "j1939db.h"
+
+/* Growable string pool with de-duplication of identical strings
+ * Each string is preceded by its quoted and escaped JSON fragment and the fragment length:
+ *   [JSON fragment][uint32_t fragment length][string][\0]
+ * String offsets point at the string itself */
+typedef struct
+{
+    char * data;
+    uint32_t size;
+    uint32_t capacity;
+
+    /* Open addressing hash table of string offsets */
+    uint32_t * slots;
+    uint32_t num_slots;
+    uint32_t used_slots;
+
+    /* Set on any memory allocation failure */
+    bool failed;
+} string_pool_t;
+
+/* Binary image section types */
+enum
+{
+    SECTION_STRINGS = 1,
+    SECTION_PGNS = 2,
+    SECTION_SPNS = 3,
+    SECTION_STEPS = 4,
+    SECTION_SA_NAMES = 5,
+    SECTION_STATES = 6,
+    SECTION_VARIANTS = 7,
+};
+
+/* Number of sections written to binary images */
+#define IMAGE_NUM_SECTIONS 7
+
+/* Binary image section table entry, all offsets are relative to the start of the image */
+typedef struct
+{
+    uint32_t type;
+    uint32_t entry_size;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t offset;
+} image_section_t;
+
+/* Binary image header, followed by the section table */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t image_size;
+    uint32_t num_sections;
+    uint32_t reserved;
+} image_header_t;
+
+/* Growable table of state name string offsets */
+typedef struct
+{
+    uint32_t * data;
+    uint32_t size;
+    uint32_t capacity;
+} state_table_t;
+
+/* Written in native byte order to detect images from other architectures */
+#define IMAGE_BYTE_ORDER 0x01020304U
+
+/* Static helper functions */
+#ifndef J1939DECODE_NO_CJSON
+static uint32_t hash_string(const char * s);
+static bool pool_init(string_pool_t * pool);
+static bool pool_rehash(string_pool_t * pool);
+static uint32_t pool_intern(string_pool_t * pool, const char * s);
+static uint32_t pool_intern_item(string_pool_t * pool, const cJSON * object, const char * key);
+static bool parse_number_key(const char * key, uint32_t * number);
+static double get_number_item(const cJSON * object, const char * key, double fallback);
+static bool is_proprietary_spn(uint32_t spn);
+static bool compile_states(string_pool_t * pool, state_table_t * states, j1939db_spn_t * spn, const cJSON * decodings);
+static void compile_step(const j1939db_t * db, j1939db_step_t * step, uint32_t spn, int32_t start_bit);
+static void compile_pgn(string_pool_t * pool, j1939db_t * db, j1939db_step_t * steps, j1939db_pgn_t * pgn,
+                        const cJSON * item, uint32_t number);
+static uint32_t count_steps(const cJSON * item);
+static void link_variants(j1939db_pgn_t * pgns, uint32_t num_pgns, j1939db_pgn_t * variants, uint32_t num_variants);
+static void merge_members(cJSON * into, cJSON * from, bool nested);
+static int compare_pgns(const void * a, const void * b);
+static int compare_variants(const void * a, const void * b);
+static int compare_spns(const void * a, const void * b);
+#endif
+static const void * image_section(const void * image, size_t size, uint32_t type, uint32_t entry_size, uint32_t * count);
+static bool valid_string(const j1939db_t * db, uint32_t offset);
+static bool write_padding(FILE * fp, uint64_t * position);
+static void image_layout(const j1939db_t * db, image_header_t * header, image_section_t * sections, const void ** data);
+
+#ifndef J1939DECODE_NO_CJSON
+/**************************************************************************//**
+
+  \brief 32-bit FNV-1a hash of a null terminated string
+
+  \return uint32_t  hash value
+
+******************************************************************************/
+uint32_t hash_string(const char * s)
+{
+    uint32_t hash = 2166136261U;
+    while (*s)
+    {
+        hash ^= (uint8_t) *s++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+#endif
+
+/**************************************************************************//**
+
+  \brief Get length of string as a quoted and escaped JSON string
+
+  Uses the same escaping rules as cJSON so that output is unchanged.
+
+  \return size_t    length in bytes including quotes
+
+******************************************************************************/
+size_t j1939db_json_escaped_length(const char * s)
+{
+    size_t len = 2;
+    for (const unsigned char * p = (const unsigned char *) s; *p; p++)
+    {
+        switch (*p)
+        {
+            case '\"':
+            case '\\':
+            case '\b':
+            case '\f':
+            case '\n':
+            case '\r':
+            case '\t':
+                /* One character escape sequence */
+                len += 2;
+                break;
+            default:
+                /* UTF-16 escape sequence uXXXX for other control characters */
+                len += *p < 32 ? 6 : 1;
+                break;
+        }
+    }
+    return len;
+}
+
+/**************************************************************************//**
+
+  \brief Write string as a quoted and escaped JSON string
+
+  \param s      null terminated string
+  \param out    output buffer of at least j1939db_json_escaped_length() bytes
+
+  \return void
+
+******************************************************************************/
+void j1939db_json_escape(const char * s, char * out)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    *out++ = '"';
+    for (const unsigned char * p = (const unsigned char *) s; *p; p++)
+    {
+        if (*p > 31 && *p != '"' && *p != '\\')
+        {
+            *out++ = (char) *p;
+            continue;
+        }
+
+        *out++ = '\\';
+        switch (*p)
+        {
+            case '\\':
+                *out++ = '\\';
+                break;
+            case '"':
+                *out++ = '"';
+                break;
+            case '\b':
+                *out++ = 'b';
+                break;
+            case '\f':
+                *out++ = 'f';
+                break;
+            case '\n':
+                *out++ = 'n';
+                break;
+            case '\r':
+                *out++ = 'r';
+                break;
+            case '\t':
+                *out++ = 't';
+                break;
+            default:
+                *out++ = 'u';
+                *out++ = '0';
+                *out++ = '0';
+                *out++ = hex[*p >> 4U];
+                *out++ = hex[*p & 0xFU];
+                break;
+        }
+    }
+    *out = '"';
+}
+
+#ifndef J1939DECODE_NO_CJSON
+/**************************************************************************//**
+
+  \brief Initialize string pool containing the empty string
+
+  \return bool  false on memory allocation failure
+
+******************************************************************************/
+bool pool_init(string_pool_t * pool)
+{
+    pool->capacity = 4096;
+    pool->data = malloc(pool->capacity);
+    pool->num_slots = 1024;
+    pool->slots = malloc(pool->num_slots * sizeof(uint32_t));
+    if (pool->data == NULL || pool->slots == NULL)
+    {
+        free(pool->data);
+        free(pool->slots);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < pool->num_slots; i++)
+    {
+        pool->slots[i] = J1939DB_NONE;
+    }
+    pool->used_slots = 0;
+    pool->failed = false;
+    pool->size = 0;
+
+    return pool_intern(pool, "") != J1939DB_NONE;
+}
+
+/**************************************************************************//**
+
+  \brief Double the number of hash slots in the string pool
+
+  \return bool  false on memory allocation failure
+
+******************************************************************************/
+bool pool_rehash(string_pool_t * pool)
+{
+    uint32_t num_slots = pool->num_slots * 2;
+    uint32_t * slots = malloc(num_slots * sizeof(uint32_t));
+    if (slots == NULL)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < num_slots; i++)
+    {
+        slots[i] = J1939DB_NONE;
+    }
+
+    for (uint32_t i = 0; i < pool->num_slots; i++)
+    {
+        uint32_t offset = pool->slots[i];
+        if (offset != J1939DB_NONE)
+        {
+            uint32_t slot = hash_string(pool->data + offset) & (num_slots - 1);
+            while (slots[slot] != J1939DB_NONE)
+            {
+                slot = (slot + 1) & (num_slots - 1);
+            }
+            slots[slot] = offset;
+        }
+    }
+
+    free(pool->slots);
+    pool->slots = slots;
+    pool->num_slots = num_slots;
+
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Add string to the pool, reusing an existing copy if one exists
+
+  \return uint32_t  offset of string in the pool, J1939DB_NONE on failure
+
+******************************************************************************/
+uint32_t pool_intern(string_pool_t * pool, const char * s)
+{
+    /* Keep load factor below one half */
+    if ((pool->used_slots + 1) * 2 > pool->num_slots && !pool_rehash(pool))
+    {
+        pool->failed = true;
+        return J1939DB_NONE;
+    }
+
+    uint32_t slot = hash_string(s) & (pool->num_slots - 1);
+    while (pool->slots[slot] != J1939DB_NONE)
+    {
+        if (strcmp(pool->data + pool->slots[slot], s) == 0)
+        {
+            return pool->slots[slot];
+        }
+        slot = (slot + 1) & (pool->num_slots - 1);
+    }
+
+    size_t json_len = j1939db_json_escaped_length(s);
+    size_t len = json_len + sizeof(uint32_t) + strlen(s) + 1;
+    if (len > UINT32_MAX - pool->size)
+    {
+        pool->failed = true;
+        return J1939DB_NONE;
+    }
+
+    if (pool->size + len > pool->capacity)
+    {
+        uint32_t capacity = pool->capacity;
+        while (pool->size + len > capacity)
+        {
+            capacity *= 2;
+        }
+
+        char * data = realloc(pool->data, capacity);
+        if (data == NULL)
+        {
+            pool->failed = true;
+            return J1939DB_NONE;
+        }
+        pool->data = data;
+        pool->capacity = capacity;
+    }
+
+    /* JSON fragment and its length go in front of the string */
+    char * entry = pool->data + pool->size;
+    uint32_t fragment_len = (uint32_t) json_len;
+    j1939db_json_escape(s, entry);
+    memcpy(entry + json_len, &fragment_len, sizeof(fragment_len));
+
+    uint32_t offset = pool->size + (uint32_t) (json_len + sizeof(fragment_len));
+    memcpy(pool->data + offset, s, strlen(s) + 1);
+    pool->size += (uint32_t) len;
+
+    pool->slots[slot] = offset;
+    pool->used_slots++;
+
+    return offset;
+}
+
+/**************************************************************************//**
+
+  \brief Add string member of JSON object to the pool
+
+  \return uint32_t  offset of string in the pool, J1939DB_NONE if not a string
+
+******************************************************************************/
+uint32_t pool_intern_item(string_pool_t * pool, const cJSON * object, const char * key)
+{
+    const char * s = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(object, key));
+    if (s == NULL)
+    {
+        return J1939DB_NONE;
+    }
+
+    return pool_intern(pool, s);
+}
+
+/**************************************************************************//**
+
+  \brief Parse decimal number used as a JSON object key
+
+  \return bool  true if entire key is a valid number
+
+******************************************************************************/
+bool parse_number_key(const char * key, uint32_t * number)
+{
+    if (key == NULL || *key < '0' || *key > '9')
+    {
+        return false;
+    }
+
+    char * end;
+    unsigned long value = strtoul(key, &end, 10);
+    if (*end != '\0' || value > UINT32_MAX)
+    {
+        return false;
+    }
+
+    *number = (uint32_t) value;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Get numeric member of JSON object
+
+  \return double  member value, or fallback value if member is not a number
+
+******************************************************************************/
+double get_number_item(const cJSON * object, const char * key, double fallback)
+{
+    const cJSON * item = cJSON_GetObjectItemCaseSensitive(object, key);
+    return cJSON_IsNumber(item) ? item->valuedouble : fallback;
+}
+
+/**************************************************************************//**
+
+  \brief Check for proprietary SPNs, which are not decoded
+
+  \return bool  true if SPN is proprietary
+
+******************************************************************************/
+bool is_proprietary_spn(uint32_t spn)
+{
+    /* Array of all possible proprietary SPNs */
+    static const uint32_t proprietary_spns[] = {2550, 2551, 3328};
+
+    for (size_t i = 0; i < sizeof(proprietary_spns) / sizeof(proprietary_spns[0]); i++)
+    {
+        if (proprietary_spns[i] == spn)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**************************************************************************//**
+
+  \brief Compile the bit decodings of a discrete SPN into its state table
+
+  The table is indexed by raw value, from 0 up to the largest raw value with
+  a name, so that decoding a state is a single bounds checked lookup.
+
+  \param pool       string pool for the state names
+  \param states     state table to append to
+  \param spn        SPN record, its state table range is filled in
+  \param decodings  object of state names by decimal raw value, NULL if the SPN has none
+
+  \return bool      false on memory allocation failure
+
+******************************************************************************/
+bool compile_states(string_pool_t * pool, state_table_t * states, j1939db_spn_t * spn, const cJSON * decodings)
+{
+    const cJSON * item;
+    uint32_t value;
+    uint32_t count = 0;
+
+    /* Raw values that do not fit in the SPN can never be decoded */
+    cJSON_ArrayForEach(item, decodings)
+    {
+        if (cJSON_IsString(item) && parse_number_key(item->string, &value) && value <= J1939DB_MAX_STATE &&
+            spn->length > 0 && (spn->length >= 32 || value < (1U << spn->length)) && value >= count)
+        {
+            count = value + 1;
+        }
+    }
+    if (count == 0)
+    {
+        return true;
+    }
+
+    if (count > UINT32_MAX - states->size)
+    {
+        return false;
+    }
+    if (states->size + count > states->capacity)
+    {
+        uint32_t capacity = states->capacity > 0 ? states->capacity : 256;
+        while (states->size + count > capacity)
+        {
+            capacity *= 2;
+        }
+
+        uint32_t * data = realloc(states->data, capacity * sizeof(uint32_t));
+        if (data == NULL)
+        {
+            return false;
+        }
+        states->data = data;
+        states->capacity = capacity;
+    }
+
+    spn->first_state = states->size;
+    spn->num_states = count;
+    uint32_t * names = &states->data[states->size];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        names[i] = J1939DB_NONE;
+    }
+    cJSON_ArrayForEach(item, decodings)
+    {
+        if (cJSON_IsString(item) && parse_number_key(item->string, &value) && value < count)
+        {
+            names[value] = pool_intern(pool, item->valuestring);
+        }
+    }
+    states->size += count;
+
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Compile decode plan step for an SPN placed within a PGN
+
+  \param db         database with the SPN table already sorted
+  \param step       decode plan step to be filled in
+  \param spn        suspect parameter number
+  \param start_bit  starting bit number, J1939DB_START_BIT_MISSING if not in the database
+
+  \return void
+
+******************************************************************************/
+void compile_step(const j1939db_t * db, j1939db_step_t * step, uint32_t spn, int32_t start_bit)
+{
+    memset(step, 0, sizeof(*step));
+    step->spn = spn;
+    step->spn_index = J1939DB_NONE;
+    step->start_bit = start_bit;
+
+    const j1939db_spn_t * spn_data = j1939db_find_spn(db, spn);
+    if (spn_data == NULL)
+    {
+        return;
+    }
+    step->spn_index = (uint32_t) (spn_data - db->spns);
+
+    /* Bits at or above bit 64 are outside of the data field and decode as zero */
+    if (start_bit >= 0 && start_bit < 64)
+    {
+        step->shift = (uint32_t) start_bit;
+        step->mask = spn_data->length < 64 ? (1ULL << spn_data->length) - 1 : UINT64_MAX;
+    }
+
+    step->scale = spn_data->resolution;
+    step->offset = spn_data->offset;
+    step->low = spn_data->operational_low;
+    step->high = spn_data->operational_high;
+}
+
+/**************************************************************************//**
+
+  \brief Compile one PGN object into a PGN record and its decode plan
+
+  \param pool       string pool for the name
+  \param db         database with the SPN table, its step count is advanced
+  \param steps      step table to append the decode plan to
+  \param pgn        PGN record to be filled in
+  \param item       PGN object
+  \param number     parameter group number
+
+  \return void
+
+******************************************************************************/
+void compile_pgn(string_pool_t * pool, j1939db_t * db, j1939db_step_t * steps, j1939db_pgn_t * pgn,
+                 const cJSON * item, uint32_t number)
+{
+    pgn->pgn = number;
+    pgn->name = pool_intern_item(pool, item, "Name");
+    pgn->first_step = db->num_steps;
+    pgn->num_steps = 0;
+    pgn->num_spns = J1939DB_NONE;
+    pgn->sa = J1939DB_NONE;
+    pgn->first_variant = 0;
+    pgn->num_variants = 0;
+
+    const cJSON * spn_list = cJSON_GetObjectItemCaseSensitive(item, "SPNs");
+    if (!cJSON_IsArray(spn_list))
+    {
+        return;
+    }
+    pgn->num_spns = 0;
+
+    /* Walk both lists together rather than indexing, since cJSON arrays are linked lists */
+    const cJSON * start_bits = cJSON_GetObjectItemCaseSensitive(item, "SPNStartBits");
+    const cJSON * start_bit = cJSON_IsArray(start_bits) ? start_bits->child : NULL;
+
+    const cJSON * spn_number;
+    cJSON_ArrayForEach(spn_number, spn_list)
+    {
+        /* Newer databases store start bits as a list per SPN, only the first is used */
+        const cJSON * start_bit_value = cJSON_IsArray(start_bit) ? start_bit->child : start_bit;
+
+        if (cJSON_IsNumber(spn_number) && spn_number->valueint >= 0)
+        {
+            pgn->num_spns++;
+
+            /* Proprietary SPNs are never decoded, so leave them out of the plan */
+            if (!is_proprietary_spn((uint32_t) spn_number->valueint))
+            {
+                compile_step(db, &steps[db->num_steps], (uint32_t) spn_number->valueint,
+                             cJSON_IsNumber(start_bit_value) ? start_bit_value->valueint : J1939DB_START_BIT_MISSING);
+                db->num_steps++;
+                pgn->num_steps++;
+            }
+        }
+
+        start_bit = start_bit ? start_bit->next : NULL;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Count the SPNs listed by a PGN object, an upper bound on its decode plan steps
+
+  \return uint32_t  number of SPN list entries
+
+******************************************************************************/
+uint32_t count_steps(const cJSON * item)
+{
+    const cJSON * spn_list = cJSON_GetObjectItemCaseSensitive(item, "SPNs");
+    return cJSON_IsArray(spn_list) ? (uint32_t) cJSON_GetArraySize(spn_list) : 0;
+}
+
+/**************************************************************************//**
+
+  \brief Point each PGN record at its source address specific variants
+
+  Both tables are sorted by PGN, so one pass over each finds every range.
+  Variants without a name take the name of their PGN, and variants of PGNs
+  missing from the PGN table are never found.
+
+  \return void
+
+******************************************************************************/
+void link_variants(j1939db_pgn_t * pgns, uint32_t num_pgns, j1939db_pgn_t * variants, uint32_t num_variants)
+{
+    uint32_t v = 0;
+    for (uint32_t i = 0; i < num_pgns; i++)
+    {
+        while (v < num_variants && variants[v].pgn < pgns[i].pgn)
+        {
+            v++;
+        }
+
+        pgns[i].first_variant = v;
+        while (v < num_variants && variants[v].pgn == pgns[i].pgn)
+        {
+            if (variants[v].name == J1939DB_NONE)
+            {
+                variants[v].name = pgns[i].name;
+            }
+            pgns[i].num_variants++;
+            v++;
+        }
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Move the members of an overlay table into a database table
+
+  \param into       table of the database
+  \param from       table of the overlay, emptied
+  \param nested     merge member objects one level down instead of replacing them
+
+  \return void
+
+******************************************************************************/
+void merge_members(cJSON * into, cJSON * from, bool nested)
+{
+    while (from->child != NULL)
+    {
+        cJSON * item = cJSON_DetachItemViaPointer(from, from->child);
+        cJSON * existing = item->string != NULL ? cJSON_GetObjectItemCaseSensitive(into, item->string) : NULL;
+        if (nested && cJSON_IsObject(existing) && cJSON_IsObject(item))
+        {
+            merge_members(existing, item, false);
+            cJSON_Delete(item);
+        }
+        else if (existing != NULL)
+        {
+            cJSON_ReplaceItemViaPointer(into, existing, item);
+        }
+        else if (item->string != NULL)
+        {
+            cJSON_AddItemToObject(into, item->string, item);
+        }
+        else
+        {
+            cJSON_Delete(item);
+        }
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Merge parsed overlay JSON into parsed J1939db JSON
+
+  Overlays hold the same tables as a database. Source address specific PGNs
+  are merged per source address, everything else per key, so an overlay only
+  needs to hold what it changes or adds.
+
+  \param json       root J1939db JSON object
+  \param overlay    root overlay JSON object, its entries are moved into json
+
+  \return bool      false if a table is not an object
+
+******************************************************************************/
+bool j1939db_merge(cJSON * json, cJSON * overlay)
+{
+    static const char * const tables[] = {"J1939PGNdb", "J1939SPNdb", "J1939BitDecodings", "J1939SATabledb",
+                                          "J1939PGNSAdb"};
+
+    if (!cJSON_IsObject(json) || !cJSON_IsObject(overlay))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++)
+    {
+        cJSON * from = cJSON_GetObjectItemCaseSensitive(overlay, tables[i]);
+        cJSON * into = cJSON_GetObjectItemCaseSensitive(json, tables[i]);
+        if (from == NULL)
+        {
+            continue;
+        }
+        if (!cJSON_IsObject(from) || (into != NULL && !cJSON_IsObject(into)))
+        {
+            return false;
+        }
+
+        if (into == NULL)
+        {
+            cJSON_AddItemToObject(json, tables[i], cJSON_DetachItemViaPointer(overlay, from));
+        }
+        else
+        {
+            merge_members(into, from, strcmp(tables[i], "J1939PGNSAdb") == 0);
+        }
+    }
+
+    return true;
+}
+
+/* qsort() comparators */
+int compare_pgns(const void * a, const void * b)
+{
+    const j1939db_pgn_t * x = a;
+    const j1939db_pgn_t * y = b;
+    return (x->pgn > y->pgn) - (x->pgn < y->pgn);
+}
+
+int compare_variants(const void * a, const void * b)
+{
+    const j1939db_pgn_t * x = a;
+    const j1939db_pgn_t * y = b;
+    if (x->pgn != y->pgn)
+    {
+        return (x->pgn > y->pgn) - (x->pgn < y->pgn);
+    }
+    return (x->sa > y->sa) - (x->sa < y->sa);
+}
+
+int compare_spns(const void * a, const void * b)
+{
+    const j1939db_spn_t * x = a;
+    const j1939db_spn_t * y = b;
+    return (x->spn > y->spn) - (x->spn < y->spn);
+}
+
+/**************************************************************************//**
+
+  \brief Compile parsed J1939db JSON into flat lookup tables
+
+  \param json           root J1939db JSON object
+
+  \return j1939db_t *   pointer to allocated database, NULL on failure
+
+******************************************************************************/
+j1939db_t * j1939db_compile(const cJSON * json)
+{
+    const cJSON * pgns_json = cJSON_GetObjectItemCaseSensitive(json, "J1939PGNdb");
+    const cJSON * spns_json = cJSON_GetObjectItemCaseSensitive(json, "J1939SPNdb");
+    const cJSON * sa_json = cJSON_GetObjectItemCaseSensitive(json, "J1939SATabledb");
+    const cJSON * decodings_json = cJSON_GetObjectItemCaseSensitive(json, "J1939BitDecodings");
+    const cJSON * sa_pgns_json = cJSON_GetObjectItemCaseSensitive(json, "J1939PGNSAdb");
+    const cJSON * item;
+    const cJSON * variant;
+    state_table_t states = {NULL, 0, 0};
+
+    string_pool_t pool;
+    if (!pool_init(&pool))
+    {
+        return NULL;
+    }
+
+    j1939db_t * db = calloc(1, sizeof(j1939db_t));
+    if (db == NULL)
+    {
+        goto cleanup;
+    }
+
+    /* Size the tables before filling them in */
+    uint32_t max_pgns = 0;
+    uint32_t max_steps = 0;
+    cJSON_ArrayForEach(item, pgns_json)
+    {
+        max_pgns++;
+        max_steps += count_steps(item);
+    }
+
+    uint32_t max_variants = 0;
+    cJSON_ArrayForEach(item, sa_pgns_json)
+    {
+        cJSON_ArrayForEach(variant, item)
+        {
+            max_variants++;
+            max_steps += count_steps(variant);
+        }
+    }
+
+    uint32_t max_spns = 0;
+    cJSON_ArrayForEach(item, spns_json)
+    {
+        max_spns++;
+    }
+
+    /* Allocate at least one element so that a NULL pointer always means failure */
+    j1939db_pgn_t * pgns = malloc((max_pgns + 1) * sizeof(j1939db_pgn_t));
+    j1939db_pgn_t * variants = malloc((max_variants + 1) * sizeof(j1939db_pgn_t));
+    j1939db_spn_t * spns = malloc((max_spns + 1) * sizeof(j1939db_spn_t));
+    j1939db_step_t * steps = malloc((max_steps + 1) * sizeof(j1939db_step_t));
+    db->pgns = pgns;
+    db->variants = variants;
+    db->spns = spns;
+    db->steps = steps;
+    if (pgns == NULL || variants == NULL || spns == NULL || steps == NULL)
+    {
+        goto cleanup;
+    }
+
+    /* SPN table */
+    cJSON_ArrayForEach(item, spns_json)
+    {
+        uint32_t number;
+        if (!cJSON_IsObject(item) || !parse_number_key(item->string, &number))
+        {
+            continue;
+        }
+
+        j1939db_spn_t * spn = &spns[db->num_spns];
+        memset(spn, 0, sizeof(*spn));
+        spn->spn = number;
+        spn->key = pool_intern(&pool, item->string);
+        spn->name = pool_intern_item(&pool, item, "Name");
+        spn->units = pool_intern_item(&pool, item, "Units");
+        spn->data_range = pool_intern_item(&pool, item, "DataRange");
+        spn->operational_range = pool_intern_item(&pool, item, "OperationalRange");
+
+        const cJSON * length = cJSON_GetObjectItemCaseSensitive(item, "SPNLength");
+        if (cJSON_IsNumber(length) && length->valueint > 0)
+        {
+            spn->length = (uint32_t) length->valueint;
+        }
+        else if (cJSON_IsString(length))
+        {
+            spn->flags |= J1939DB_SPN_VARIABLE_LENGTH;
+        }
+
+        if (cJSON_IsString(cJSON_GetObjectItemCaseSensitive(item, "Resolution")))
+        {
+            spn->flags |= J1939DB_SPN_RESOLUTION_ASCII;
+        }
+        const char * units = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(item, "Units"));
+        if ((spn->flags & J1939DB_SPN_RESOLUTION_ASCII) || (units != NULL && strcmp(units, "ASCII") == 0))
+        {
+            spn->flags |= J1939DB_SPN_TEXT;
+        }
+
+        spn->resolution = get_number_item(item, "Resolution", 0);
+        spn->offset = get_number_item(item, "Offset", 0);
+        spn->operational_low = get_number_item(item, "OperationalLow", 0);
+        spn->operational_high = get_number_item(item, "OperationalHigh", 0);
+
+        if (!compile_states(&pool, &states, spn, cJSON_GetObjectItemCaseSensitive(decodings_json, item->string)))
+        {
+            goto cleanup;
+        }
+
+        db->num_spns++;
+    }
+
+    qsort(spns, db->num_spns, sizeof(j1939db_spn_t), compare_spns);
+
+    /* PGN table and SPN references */
+    cJSON_ArrayForEach(item, pgns_json)
+    {
+        uint32_t number;
+        if (!cJSON_IsObject(item) || !parse_number_key(item->string, &number))
+        {
+            continue;
+        }
+
+        compile_pgn(&pool, db, steps, &pgns[db->num_pgns], item, number);
+        db->num_pgns++;
+    }
+
+    qsort(pgns, db->num_pgns, sizeof(j1939db_pgn_t), compare_pgns);
+
+    /* Source address specific PGNs, keyed by PGN and then by source address */
+    cJSON_ArrayForEach(item, sa_pgns_json)
+    {
+        uint32_t number;
+        if (!cJSON_IsObject(item) || !parse_number_key(item->string, &number))
+        {
+            continue;
+        }
+
+        cJSON_ArrayForEach(variant, item)
+        {
+            uint32_t sa;
+            if (!cJSON_IsObject(variant) || !parse_number_key(variant->string, &sa) || sa >= 256)
+            {
+                continue;
+            }
+
+            compile_pgn(&pool, db, steps, &variants[db->num_variants], variant, number);
+            variants[db->num_variants].sa = sa;
+            db->num_variants++;
+        }
+    }
+
+    qsort(variants, db->num_variants, sizeof(j1939db_pgn_t), compare_variants);
+    link_variants(pgns, db->num_pgns, variants, db->num_variants);
+
+    /* Source address table */
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        db->sa_names[i] = J1939DB_NONE;
+    }
+    cJSON_ArrayForEach(item, sa_json)
+    {
+        uint32_t number;
+        if (cJSON_IsString(item) && parse_number_key(item->string, &number) && number < 256)
+        {
+            db->sa_names[number] = pool_intern(&pool, item->valuestring);
+        }
+    }
+
+    if (pool.failed)
+    {
+        goto cleanup;
+    }
+
+    /* Allocate at least one element so that a NULL pointer always means failure */
+    if (states.data == NULL && (states.data = malloc(sizeof(uint32_t))) == NULL)
+    {
+        goto cleanup;
+    }
+
+    free(pool.slots);
+    db->strings = pool.data;
+    db->strings_size = pool.size;
+    db->states = states.data;
+    db->num_states = states.size;
+
+    return db;
+
+    cleanup:
+    free(pool.slots);
+    free(pool.data);
+    free(states.data);
+    j1939db_free(db);
+    return NULL;
+}
+
+#endif
+
+/**************************************************************************//**
+
+  \brief Release the tables of a database without freeing the database structure
+
+  \return void
+
+******************************************************************************/
+void j1939db_close(j1939db_t * db)
+{
+    if (db->image != NULL)
+    {
+        /* Tables point into the image */
+        if (db->image_release != NULL)
+        {
+            db->image_release(db->image, db->image_size);
+        }
+    }
+    else
+    {
+        /* Casting away const since the tables are only constant for readers */
+        free((void *) db->pgns);
+        free((void *) db->variants);
+        free((void *) db->spns);
+        free((void *) db->steps);
+        free((void *) db->strings);
+        free((void *) db->states);
+    }
+    memset(db, 0, sizeof(*db));
+}
+
+/**************************************************************************//**
+
+  \brief Free compiled database
+
+  \return void
+
+******************************************************************************/
+void j1939db_free(j1939db_t * db)
+{
+    if (db == NULL)
+    {
+        return;
+    }
+
+    j1939db_close(db);
+    free(db);
+}
+
+/**************************************************************************//**
+
+  \brief Lookup PGN record using binary search
+
+  \param db     compiled database
+  \param pgn    parameter group number
+
+  \return const j1939db_pgn_t *  pointer to PGN record, NULL if not found
+
+******************************************************************************/
+const j1939db_pgn_t * j1939db_find_pgn(const j1939db_t * db, uint32_t pgn)
+{
+    uint32_t low = 0;
+    uint32_t high = db->num_pgns;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (db->pgns[mid].pgn < pgn)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return (low < db->num_pgns && db->pgns[low].pgn == pgn) ? &db->pgns[low] : NULL;
+}
+
+/**************************************************************************//**
+
+  \brief Lookup SPN record using binary search
+
+  \param db     compiled database
+  \param spn    suspect parameter number
+
+  \return const j1939db_spn_t *  pointer to SPN record, NULL if not found
+
+******************************************************************************/
+const j1939db_spn_t * j1939db_find_spn(const j1939db_t * db, uint32_t spn)
+{
+    uint32_t low = 0;
+    uint32_t high = db->num_spns;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (db->spns[mid].spn < spn)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return (low < db->num_spns && db->spns[low].spn == spn) ? &db->spns[low] : NULL;
+}
+
+/**************************************************************************//**
+
+  \brief Check if buffer starts with a binary database image header
+
+  \return bool  true if magic number matches
+
+******************************************************************************/
+bool j1939db_is_image(const void * buf, size_t size)
+{
+    return size >= sizeof(J1939DB_IMAGE_MAGIC) && memcmp(buf, J1939DB_IMAGE_MAGIC, sizeof(J1939DB_IMAGE_MAGIC)) == 0;
+}
+
+/**************************************************************************//**
+
+  \brief Find section in binary image and check that it fits within the image
+
+  \param image          binary image
+  \param size           size of binary image in bytes
+  \param type           section type
+  \param entry_size     expected size of each entry in bytes
+  \param count          number of entries in section
+
+  \return const void *  pointer to section data, NULL if missing or invalid
+
+******************************************************************************/
+const void * image_section(const void * image, size_t size, uint32_t type, uint32_t entry_size, uint32_t * count)
+{
+    const image_header_t * header = image;
+    const image_section_t * sections = (const image_section_t *) (header + 1);
+
+    for (uint32_t i = 0; i < header->num_sections; i++)
+    {
+        if (sections[i].type != type)
+        {
+            continue;
+        }
+
+        if (sections[i].entry_size != entry_size || sections[i].offset % 8 != 0 || sections[i].offset > size ||
+            (uint64_t) sections[i].count * entry_size > size - sections[i].offset)
+        {
+            return NULL;
+        }
+
+        *count = sections[i].count;
+        return (const uint8_t *) image + sections[i].offset;
+    }
+
+    return NULL;
+}
+
+/**************************************************************************//**
+
+  \brief Check that a string offset points at a string pool entry
+
+  \return bool  true if offset is valid or J1939DB_NONE
+
+******************************************************************************/
+bool valid_string(const j1939db_t * db, uint32_t offset)
+{
+    if (offset == J1939DB_NONE)
+    {
+        return true;
+    }
+    if (offset < sizeof(uint32_t) || offset >= db->strings_size)
+    {
+        return false;
+    }
+
+    /* JSON fragment must fit in front of the string */
+    uint32_t fragment_len;
+    memcpy(&fragment_len, db->strings + offset - sizeof(fragment_len), sizeof(fragment_len));
+    return fragment_len >= 2 && fragment_len <= offset - sizeof(fragment_len);
+}
+
+/**************************************************************************//**
+
+  \brief Initialize database structure from a binary image, checking only the header and SA names
+
+  Nothing is read beyond the header, section table and SA name table, so
+  the pages of a memory-mapped image are only touched as PGNs are used.
+  Each PGN must be checked with j1939db_validate_pgn() before it is used.
+
+  \param db             database structure to be filled in
+  \param image          binary image, must be 8 byte aligned
+  \param size           size of binary image in bytes
+  \param error          set to a description of the problem on failure
+
+  \return bool          true on success
+
+******************************************************************************/
+bool j1939db_init_image_lazy(j1939db_t * db, const void * image, size_t size, const char ** error)
+{
+    const image_header_t * header = image;
+
+    memset(db, 0, sizeof(*db));
+    *error = "Invalid J1939db image";
+
+    if (!j1939db_is_image(image, size) || size < sizeof(image_header_t) || ((uintptr_t) image) % 8 != 0)
+    {
+        return false;
+    }
+
+    if (header->byte_order != IMAGE_BYTE_ORDER)
+    {
+        *error = "J1939db image byte order does not match";
+        return false;
+    }
+
+    if (header->version != J1939DB_IMAGE_VERSION)
+    {
+        *error = "Unsupported J1939db image version";
+        return false;
+    }
+
+    if (header->image_size != size ||
+        header->num_sections > (size - sizeof(image_header_t)) / sizeof(image_section_t))
+    {
+        return false;
+    }
+
+    uint32_t num_sa_names = 0;
+    const uint32_t * sa_names = image_section(image, size, SECTION_SA_NAMES, sizeof(uint32_t), &num_sa_names);
+
+    db->strings = image_section(image, size, SECTION_STRINGS, 1, &db->strings_size);
+    db->pgns = image_section(image, size, SECTION_PGNS, sizeof(j1939db_pgn_t), &db->num_pgns);
+    db->variants = image_section(image, size, SECTION_VARIANTS, sizeof(j1939db_pgn_t), &db->num_variants);
+    db->spns = image_section(image, size, SECTION_SPNS, sizeof(j1939db_spn_t), &db->num_spns);
+    db->steps = image_section(image, size, SECTION_STEPS, sizeof(j1939db_step_t), &db->num_steps);
+    db->states = image_section(image, size, SECTION_STATES, sizeof(uint32_t), &db->num_states);
+
+    if (db->strings == NULL || db->pgns == NULL || db->variants == NULL || db->spns == NULL || db->steps == NULL || db->states == NULL ||
+        sa_names == NULL || num_sa_names != 256 || db->strings_size == 0 || db->strings[db->strings_size - 1] != '\0')
+    {
+        goto cleanup;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        if (!valid_string(db, sa_names[i]))
+        {
+            goto cleanup;
+        }
+        db->sa_names[i] = sa_names[i];
+    }
+
+    db->image = image;
+    db->image_size = size;
+
+    *error = NULL;
+    return true;
+
+    cleanup:
+    memset(db, 0, sizeof(*db));
+    return false;
+}
+
+/**************************************************************************//**
+
+  \brief Initialize caller owned database structure from a binary image in place
+
+  \param db             database structure to be filled in
+  \param image          binary image, must be 8 byte aligned
+  \param size           size of binary image in bytes
+  \param error          set to a description of the problem on failure
+
+  \return bool          true on success
+
+******************************************************************************/
+bool j1939db_init_image(j1939db_t * db, const void * image, size_t size, const char ** error)
+{
+    if (!j1939db_init_image_lazy(db, image, size, error))
+    {
+        return false;
+    }
+
+    /* Validate every index up front so that lookups never need bounds checks */
+    for (uint32_t i = 0; i < db->num_pgns; i++)
+    {
+        if ((i > 0 && db->pgns[i].pgn <= db->pgns[i - 1].pgn) || !j1939db_validate_pgn(db, &db->pgns[i]))
+        {
+            goto cleanup;
+        }
+    }
+
+    for (uint32_t i = 0; i < db->num_spns; i++)
+    {
+        if ((i > 0 && db->spns[i].spn <= db->spns[i - 1].spn) || !j1939db_validate_spn(db, &db->spns[i]))
+        {
+            goto cleanup;
+        }
+    }
+
+    return true;
+
+    cleanup:
+    *error = "Invalid J1939db image";
+    memset(db, 0, sizeof(*db));
+    return false;
+}
+
+/**************************************************************************//**
+
+  \brief Check that a PGN record, its decode plan and the SPN records it uses are within the image
+
+  The source address specific variants of the PGN are checked the same way.
+
+  \param db             database opened with j1939db_init_image_lazy()
+  \param pgn            PGN record of the database
+
+  \return bool          true if the PGN can be decoded without further bounds checks
+
+******************************************************************************/
+bool j1939db_validate_pgn(const j1939db_t * db, const j1939db_pgn_t * pgn)
+{
+    if (!valid_string(db, pgn->name) || pgn->first_step > db->num_steps ||
+        pgn->num_steps > db->num_steps - pgn->first_step || pgn->first_variant > db->num_variants ||
+        pgn->num_variants > db->num_variants - pgn->first_variant)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < pgn->num_variants; i++)
+    {
+        /* Variants have no variants of their own, which also bounds the recursion */
+        const j1939db_pgn_t * variant = &db->variants[pgn->first_variant + i];
+        if (variant->num_variants != 0 || !j1939db_validate_pgn(db, variant))
+        {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < pgn->num_steps; i++)
+    {
+        const j1939db_step_t * step = &db->steps[pgn->first_step + i];
+        if (step->shift > 63)
+        {
+            return false;
+        }
+        if (step->spn_index != J1939DB_NONE &&
+            (step->spn_index >= db->num_spns || !j1939db_validate_spn(db, &db->spns[step->spn_index])))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Check that the strings of an SPN record and its state names are string pool entries, the key is required
+
+  \return bool  true if all strings are valid
+
+******************************************************************************/
+bool j1939db_validate_spn(const j1939db_t * db, const j1939db_spn_t * spn)
+{
+    if (spn->key == J1939DB_NONE || !valid_string(db, spn->key) || !valid_string(db, spn->name) || !valid_string(db, spn->units) ||
+        !valid_string(db, spn->data_range) || !valid_string(db, spn->operational_range) ||
+        spn->first_state > db->num_states || spn->num_states > db->num_states - spn->first_state)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < spn->num_states; i++)
+    {
+        if (!valid_string(db, db->states[spn->first_state + i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Pad file with zeroes up to the next 8 byte boundary
+
+  \return bool  false on write failure
+
+******************************************************************************/
+bool write_padding(FILE * fp, uint64_t * position)
+{
+    static const uint8_t zeroes[8] = {0};
+    size_t padding = (size_t) ((8 - *position % 8) % 8);
+
+    *position += padding;
+    return fwrite(zeroes, 1, padding, fp) == padding;
+}
+
+/**************************************************************************//**
+
+  \brief Lay out binary image sections on 8 byte boundaries after the section table
+
+  \param db         compiled database
+  \param header     image header to be filled in
+  \param sections   section table to be filled in
+  \param data       set to pointer to the table of each section
+
+  \return void
+
+******************************************************************************/
+void image_layout(const j1939db_t * db, image_header_t * header, image_section_t * sections, const void ** data)
+{
+    struct
+    {
+        uint32_t type;
+        uint32_t entry_size;
+        uint32_t count;
+        const void * data;
+    } tables[IMAGE_NUM_SECTIONS] = {
+        {SECTION_STRINGS, 1, db->strings_size, db->strings},
+        {SECTION_PGNS, sizeof(j1939db_pgn_t), db->num_pgns, db->pgns},
+        {SECTION_SPNS, sizeof(j1939db_spn_t), db->num_spns, db->spns},
+        {SECTION_STEPS, sizeof(j1939db_step_t), db->num_steps, db->steps},
+        {SECTION_SA_NAMES, sizeof(uint32_t), 256, db->sa_names},
+        {SECTION_STATES, sizeof(uint32_t), db->num_states, db->states},
+        {SECTION_VARIANTS, sizeof(j1939db_pgn_t), db->num_variants, db->variants},
+    };
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, J1939DB_IMAGE_MAGIC, sizeof(J1939DB_IMAGE_MAGIC));
+    header->version = J1939DB_IMAGE_VERSION;
+    header->byte_order = IMAGE_BYTE_ORDER;
+    header->num_sections = IMAGE_NUM_SECTIONS;
+
+    uint64_t position = sizeof(*header) + IMAGE_NUM_SECTIONS * sizeof(image_section_t);
+    for (uint32_t i = 0; i < IMAGE_NUM_SECTIONS; i++)
+    {
+        position = (position + 7) & ~(uint64_t) 7;
+
+        memset(&sections[i], 0, sizeof(sections[i]));
+        sections[i].type = tables[i].type;
+        sections[i].entry_size = tables[i].entry_size;
+        sections[i].count = tables[i].count;
+        sections[i].offset = position;
+        data[i] = tables[i].data;
+
+        position += (uint64_t) tables[i].entry_size * tables[i].count;
+    }
+    header->image_size = position;
+}
+
+/**************************************************************************//**
+
+  \brief Get size of compiled database as a binary image
+
+  \return size_t    image size in bytes
+
+******************************************************************************/
+size_t j1939db_image_size(const j1939db_t * db)
+{
+    image_header_t header;
+    image_section_t sections[IMAGE_NUM_SECTIONS];
+    const void * data[IMAGE_NUM_SECTIONS];
+
+    image_layout(db, &header, sections, data);
+    return (size_t) header.image_size;
+}
+
+/**************************************************************************//**
+
+  \brief Build binary image of compiled database in memory
+
+  \param db     compiled database
+  \param image  buffer of j1939db_image_size() bytes
+
+  \return void
+
+******************************************************************************/
+void j1939db_build_image(const j1939db_t * db, void * image)
+{
+    image_header_t header;
+    image_section_t sections[IMAGE_NUM_SECTIONS];
+    const void * data[IMAGE_NUM_SECTIONS];
+
+    image_layout(db, &header, sections, data);
+
+    /* Zero fill padding between sections */
+    memset(image, 0, (size_t) header.image_size);
+    memcpy(image, &header, sizeof(header));
+    memcpy((uint8_t *) image + sizeof(header), sections, sizeof(sections));
+    for (uint32_t i = 0; i < IMAGE_NUM_SECTIONS; i++)
+    {
+        memcpy((uint8_t *) image + sections[i].offset, data[i], (size_t) sections[i].entry_size * sections[i].count);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Copy compiled database into one allocation
+
+  The structure is followed by a binary image of the tables, so the copy is
+  freed with a single call to allocator->free_fn().
+
+  \param db             compiled database
+  \param allocator      allocator for the copy
+
+  \return j1939db_t *   pointer to copy, NULL on failure
+
+******************************************************************************/
+j1939db_t * j1939db_copy(const j1939db_t * db, const j1939decode_allocator_t * allocator)
+{
+    /* Images must be 8 byte aligned */
+    size_t offset = (sizeof(j1939db_t) + 7) & ~(size_t) 7;
+    size_t size = j1939db_image_size(db);
+
+    j1939db_t * copy = allocator->malloc_fn(allocator->user, offset + size);
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+
+    const char * error;
+    void * image = (uint8_t *) copy + offset;
+    j1939db_build_image(db, image);
+    if (!j1939db_init_image(copy, image, size, &error))
+    {
+        allocator->free_fn(allocator->user, copy);
+        return NULL;
+    }
+
+    return copy;
+}
+
+/**************************************************************************//**
+
+  \brief Write compiled database as a binary image
+
+  \param db     compiled database
+  \param fp     file opened for binary writing
+
+  \return bool  false on write failure
+
+******************************************************************************/
+bool j1939db_write_image(const j1939db_t * db, FILE * fp)
+{
+    image_header_t header;
+    image_section_t sections[IMAGE_NUM_SECTIONS];
+    const void * data[IMAGE_NUM_SECTIONS];
+
+    image_layout(db, &header, sections, data);
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 || fwrite(sections, sizeof(sections), 1, fp) != 1)
+    {
+        return false;
+    }
+
+    uint64_t position = sizeof(header) + sizeof(sections);
+    for (uint32_t i = 0; i < IMAGE_NUM_SECTIONS; i++)
+    {
+        size_t table_size = (size_t) sections[i].entry_size * sections[i].count;
+        if (!write_padding(fp, &position) || fwrite(data[i], 1, table_size, fp) != table_size)
+        {
+            return false;
+        }
+        position += table_size;
+    }
+
+    return true;
+}
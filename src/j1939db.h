@@ -0,0 +1,228 @@
+#ifndef J1939DB_H
+#define J1939DB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "j1939decode.h"
+#ifndef J1939DECODE_NO_CJSON
+#include "cJSON.h"
+#endif
+
+/* Binary database image format */
+#define J1939DB_IMAGE_MAGIC "J1939DB"
+#define J1939DB_IMAGE_VERSION 5
+
+/* Marker for a missing string or table index */
+#define J1939DB_NONE UINT32_MAX
+
+/* Start bit marker for SPNs without a start bit in the database */
+#define J1939DB_START_BIT_MISSING INT32_MIN
+
+/* SPN record flags */
+#define J1939DB_SPN_VARIABLE_LENGTH (1U << 0U)  /* "SPNLength" is "Variable" */
+#define J1939DB_SPN_RESOLUTION_ASCII (1U << 1U) /* "Resolution" is "ASCII" */
+#define J1939DB_SPN_TEXT (1U << 2U)             /* "Resolution" or "Units" is "ASCII", decoded as text */
+
+/* Largest raw value with a state name, larger values of "J1939BitDecodings" are left out */
+#define J1939DB_MAX_STATE 0xFFFFU
+
+/* Compiled suspect parameter number record
+ * Strings are stored as offsets into the database string pool */
+typedef struct j1939db_spn
+{
+    uint32_t spn;
+    uint32_t name;
+    uint32_t units;
+    uint32_t data_range;
+    uint32_t operational_range;
+    uint32_t length;
+    uint32_t flags;
+    uint32_t key;       /* SPN number as a decimal string */
+    uint32_t first_state; /* index of the state name of raw value 0 in the state table */
+    uint32_t num_states;  /* number of raw values with an entry in the state table, 0 if not a discrete SPN */
+    double resolution;
+    double offset;
+    double operational_low;
+    double operational_high;
+} j1939db_spn_t;
+
+/* Decode plan step for one SPN within a PGN
+ * Everything needed to decode the SPN is precomputed so that decoding is a single pass over the plan */
+typedef struct
+{
+    uint32_t spn;
+    uint32_t spn_index;  /* index into SPN table, J1939DB_NONE if SPN is not in the database */
+    int32_t start_bit;   /* J1939DB_START_BIT_MISSING if not found in the database */
+    uint32_t shift;      /* right shift of the 64 bit data field */
+    uint64_t mask;       /* mask of the shifted data, 0 if start bit is outside of the data field */
+    double scale;        /* resolution */
+    double offset;
+    double low;          /* operational range */
+    double high;
+} j1939db_step_t;
+
+/* Compiled parameter group number record
+ * Source address specific definitions are records of their own in the variant table */
+typedef struct
+{
+    uint32_t pgn;
+    uint32_t name;
+    uint32_t first_step; /* index of first decode plan step */
+    uint32_t num_steps;  /* number of decode plan steps, proprietary SPNs are left out */
+    uint32_t num_spns;   /* number of SPNs listed in the database, J1939DB_NONE if PGN has no SPN list */
+    uint32_t sa;         /* source address of a variant, J1939DB_NONE for the PGN table */
+    uint32_t first_variant; /* index of first source address specific variant in the variant table */
+    uint32_t num_variants;  /* number of variants, 0 for variants themselves */
+} j1939db_pgn_t;
+
+/* Compiled J1939 database
+ * PGN and SPN tables are sorted by number for binary search lookups */
+typedef struct
+{
+    const j1939db_pgn_t * pgns;
+    uint32_t num_pgns;
+
+    /* Source address specific PGN records, sorted by PGN and then source address */
+    const j1939db_pgn_t * variants;
+    uint32_t num_variants;
+
+    const j1939db_spn_t * spns;
+    uint32_t num_spns;
+
+    const j1939db_step_t * steps;
+    uint32_t num_steps;
+
+    /* State name string offsets of discrete SPNs indexed by raw value, J1939DB_NONE for raw values without a name */
+    const uint32_t * states;
+    uint32_t num_states;
+
+    /* Source address name string offsets, J1939DB_NONE if not in the database */
+    uint32_t sa_names[256];
+
+    const char * strings;
+    uint32_t strings_size;
+
+    /* Binary image the tables point into, NULL if the tables were allocated */
+    const void * image;
+    size_t image_size;
+    /* Called by j1939db_close() to release the image, NULL if the image is owned elsewhere */
+    void (*image_release)(const void * image, size_t image_size);
+} j1939db_t;
+
+#ifndef J1939DECODE_NO_CJSON
+/* Compile parsed J1939db JSON into flat lookup tables and per-PGN decode plans */
+j1939db_t * j1939db_compile(const cJSON * json);
+
+/* Merge parsed overlay JSON into parsed J1939db JSON, moving the overlay's entries into json
+ * Each PGN, SPN, bit decoding, source address and source address specific PGN of the overlay replaces the entry
+ * with the same key, or is added. Returns false if a table of either is not an object */
+bool j1939db_merge(cJSON * json, cJSON * overlay);
+#endif
+
+#ifdef J1939DECODE_STATIC_DB
+/* Binary image compiled into the library as 64-bit words, generated by j1939db-convert */
+extern const uint64_t j1939db_static_image[];
+extern const size_t j1939db_static_image_size;
+#endif
+
+/* Check if buffer starts with a binary database image header */
+bool j1939db_is_image(const void * buf, size_t size);
+
+/* Initialize caller owned database structure from a binary image in place */
+bool j1939db_init_image(j1939db_t * db, const void * image, size_t size, const char ** error);
+
+/* Initialize database structure from a binary image, validating only the header and SA names
+ * Each PGN must be checked with j1939db_validate_pgn() before use */
+bool j1939db_init_image_lazy(j1939db_t * db, const void * image, size_t size, const char ** error);
+
+/* Check that a PGN record, its decode plan and its SPN records are within the image */
+bool j1939db_validate_pgn(const j1939db_t * db, const j1939db_pgn_t * pgn);
+
+/* Check that the strings and state names of an SPN record are within the image */
+bool j1939db_validate_spn(const j1939db_t * db, const j1939db_spn_t * spn);
+
+/* Copy compiled database into one allocation holding the structure followed by its binary image
+ * Free with allocator->free_fn(), returns NULL on failure */
+j1939db_t * j1939db_copy(const j1939db_t * db, const j1939decode_allocator_t * allocator);
+
+/* Get size of compiled database as a binary image */
+size_t j1939db_image_size(const j1939db_t * db);
+
+/* Build binary image of compiled database into a buffer of j1939db_image_size() bytes */
+void j1939db_build_image(const j1939db_t * db, void * image);
+
+/* Write compiled database as a binary image */
+bool j1939db_write_image(const j1939db_t * db, FILE * fp);
+
+/* Release the tables of a database, including image_release() for images, without freeing the structure */
+void j1939db_close(j1939db_t * db);
+
+/* Free compiled database */
+void j1939db_free(j1939db_t * db);
+
+/* Lookup PGN record, NULL if not found */
+const j1939db_pgn_t * j1939db_find_pgn(const j1939db_t * db, uint32_t pgn);
+
+/* Lookup SPN record, NULL if not found */
+const j1939db_spn_t * j1939db_find_spn(const j1939db_t * db, uint32_t spn);
+
+/* Get length of string as a quoted and escaped JSON string, using the same escaping rules as cJSON */
+size_t j1939db_json_escaped_length(const char * s);
+
+/* Write string as a quoted and escaped JSON string, not null terminated */
+void j1939db_json_escape(const char * s, char * out);
+
+/* Get the variant of a PGN record for a source address, the record itself if it has none for that address
+ * Variants of one PGN are next to each other, so this is a short scan rather than a second search */
+static inline const j1939db_pgn_t * j1939db_pgn_variant(const j1939db_t * db, const j1939db_pgn_t * pgn, uint8_t sa)
+{
+    for (uint32_t i = 0; i < pgn->num_variants; i++)
+    {
+        if (db->variants[pgn->first_variant + i].sa == sa)
+        {
+            return &db->variants[pgn->first_variant + i];
+        }
+    }
+    return pgn;
+}
+
+/* Get string from string pool offset, NULL if offset is J1939DB_NONE */
+static inline const char * j1939db_string(const j1939db_t * db, uint32_t offset)
+{
+    return offset == J1939DB_NONE ? NULL : db->strings + offset;
+}
+
+/* Get state name string offset of a raw value of an SPN, J1939DB_NONE if it has no name */
+static inline uint32_t j1939db_spn_state(const j1939db_t * db, const j1939db_spn_t * spn, uint64_t value_raw)
+{
+    return value_raw < spn->num_states ? db->states[spn->first_state + value_raw] : J1939DB_NONE;
+}
+
+/* Get quoted and escaped JSON fragment of a string pool entry, NULL if offset is J1939DB_NONE
+ * The fragment is not null terminated, len is set to its length */
+static inline const char * j1939db_json_string(const j1939db_t * db, uint32_t offset, size_t * len)
+{
+    if (offset == J1939DB_NONE)
+    {
+        return NULL;
+    }
+
+    uint32_t fragment_len;
+    memcpy(&fragment_len, db->strings + offset - sizeof(fragment_len), sizeof(fragment_len));
+    *len = fragment_len;
+    return db->strings + offset - sizeof(fragment_len) - fragment_len;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939DB_H
@@ -1,34 +1,181 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define J1939DECODE_HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "j1939decode.h"
+#include "j1939db.h"
+#include "j1939ctx.h"
+#include "j1939json.h"
+#include "j1939encode.h"
+#include "j1939delta.h"
+#include "j1939dm.h"
+#include "j1939simd.h"
+#ifndef J1939DECODE_NO_CJSON
 #include "cJSON.h"
+#endif
+
+/* Process-wide log handler, used when loading databases and by contexts without their own handler */
+static j1939ctx_logger_t logger = {NULL, NULL, NULL, J1939DECODE_LOG_INFO};
 
-/* Log function pointer */
-static log_fn_ptr log_fn = NULL;
+/* Default context used by the functions without a context parameter */
+static j1939decode_ctx_t * default_ctx = NULL;
 
-/* J1939 lookup table pointer */
-static cJSON * j1939db_json = NULL;
+/* Newest database of the default context, referenced until it is replaced or deinitialized */
+static j1939decode_db_t * default_db = NULL;
 
-/* JSON object for all PGNs */
-static cJSON * j1939db_pgns = NULL;
-/* JSON object for all SPNs */
-static cJSON * j1939db_spns = NULL;
-/* JSON object for all source addresses */
-static cJSON * j1939db_source_addresses = NULL;
+/* Change detection state of the frame being decoded */
+typedef struct
+{
+    j1939delta_entry_t * entry;     /* NULL to decode all SPNs */
+    double deadband;
+    bool report_all;                /* first frame of the pair, heartbeat due, or length changed */
+} delta_frame_t;
 
 /* Static helper functions */
-static void log_msg(const char * fmt, ...);
-static char * file_read(const char * filename, const char * mode);
-static bool in_array(uint32_t val, const uint32_t * array, size_t len);
-static cJSON * create_byte_array(const uint64_t * data);
-static const cJSON * get_pgn_data(uint32_t pgn);
-static const cJSON * get_spn_data(uint32_t spn);
-static cJSON * extract_spn_data(uint32_t spn, const uint64_t * data, uint32_t start_bit);
-static char * get_sa_name(uint8_t sa);
-static char * get_pgn_name(uint32_t pgn);
+static const j1939ctx_logger_t * get_logger(const j1939decode_ctx_t * ctx);
+static void log_msg(const j1939decode_ctx_t * ctx, uint32_t level, const char * fmt, ...);
+static void log_db_problem(const j1939decode_ctx_t * ctx, uint32_t site, uint32_t number);
+static uint32_t * get_logged(j1939decode_db_t * db, uint32_t site);
+static void * default_malloc(void * user, size_t size);
+static void default_free(void * user, void * ptr);
+#if !defined(J1939DECODE_HAVE_MMAP) || !defined(J1939DECODE_NO_CJSON)
+static char * file_read(const char * filename, const char * mode, const j1939decode_allocator_t * allocator,
+                        size_t offset, size_t * size);
+#endif
+static bool file_is_image(const char * filename);
+#ifdef J1939DECODE_HAVE_MMAP
+static const void * file_map(const char * filename, size_t * size);
+static void file_unmap(const void * image, size_t size);
+#endif
+static j1939decode_db_t * alloc_db(const j1939decode_allocator_t * allocator, size_t image_size);
+#ifndef J1939DECODE_NO_CJSON
+static cJSON * parse_file(const char * filename, const j1939decode_allocator_t * allocator);
+#endif
+static j1939decode_db_t * load_db(const char * filename, const char * const * overlays, size_t num_overlays,
+                                  const j1939decode_allocator_t * allocator);
+static j1939decode_db_t * load_db_lazy(const char * filename, const j1939decode_allocator_t * allocator);
+static void release_text(j1939decode_db_t * db);
+static j1939decode_db_t * open_default_db(const char * filename);
+static void create_default_ctx(j1939decode_db_t * db);
+static void resolve_sa_names(j1939decode_db_t * db);
+static const j1939db_pgn_t * find_pgn(const j1939decode_ctx_t * ctx, uint32_t pgn, const j1939db_t ** tables);
+static const j1939db_pgn_t * find_frame_pgn(const j1939decode_ctx_t * ctx, uint32_t id, const j1939db_t ** tables);
+static const j1939db_spn_t * check_step(const j1939decode_ctx_t * ctx, const j1939db_t * tables,
+                                        const j1939db_step_t * step);
+static void set_spn_value(const j1939db_t * tables, const j1939db_step_t * step, const j1939db_spn_t * spn_data,
+                          uint64_t value_raw, const uint8_t * payload, size_t len, j1939_spn_value_t * value);
+static void set_spn_text(const j1939db_spn_t * spn_data, const uint8_t * payload, size_t len,
+                         j1939_spn_value_t * value);
+static bool extract_spn_data(const j1939decode_ctx_t * ctx, const j1939db_t * tables, const j1939db_step_t * step,
+                             const uint64_t * data, j1939_spn_value_t * value);
+static bool extract_spn_payload(const j1939decode_ctx_t * ctx, const j1939db_t * tables, const j1939db_step_t * step,
+                                const uint8_t * payload, size_t len, uint64_t head, j1939_spn_value_t * value);
+static const char * get_sa_name(const j1939decode_ctx_t * ctx, uint8_t sa);
+static const char * get_pgn_name(const j1939decode_ctx_t * ctx, const j1939db_t * tables, const j1939db_pgn_t * pgn_data);
+static void follow_successor(j1939decode_ctx_t * ctx);
+static void * ctx_malloc(const j1939decode_ctx_t * ctx, size_t size);
+static void lock_stats(j1939decode_db_t * db);
+static void link_ctx(j1939decode_db_t * db, j1939decode_ctx_t * ctx);
+static void unlink_ctx(j1939decode_db_t * db, j1939decode_ctx_t * ctx);
+static void unlock_stats(j1939decode_db_t * db);
+static bool set_filter(j1939decode_ctx_t * ctx, uint8_t ** bitmap, uint32_t bits, const uint32_t * numbers,
+                       size_t count, bool allow, const char * name);
+static void skip_message(uint32_t id, size_t len, j1939_decoded_t * out, j1939_spn_value_t * spns);
+static bool pgn_number_at(const j1939decode_ctx_t * ctx, size_t i, uint32_t * pgn);
+static bool write_schema_pgn(const j1939decode_ctx_t * ctx, j1939json_t * writer, uint32_t pgn);
+static size_t write_schema(const j1939decode_ctx_t * ctx, char * buf, size_t len, bool pretty);
+static const j1939db_step_t * begin_message(const j1939decode_ctx_t * ctx, uint32_t id, size_t len,
+                                            const j1939db_t * tables, const j1939db_pgn_t * pgn_data,
+                                            j1939_decoded_t * out, j1939_spn_value_t * spns);
+static size_t decode_message(const j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                             const j1939db_t * tables, const j1939db_pgn_t * pgn_data,
+                             j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap);
+static size_t decode_payload(const j1939decode_ctx_t * ctx, uint32_t id, const uint8_t * payload, size_t len,
+                             const j1939db_t * tables, const j1939db_pgn_t * pgn_data,
+                             j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap);
+static uint64_t payload_mask(const j1939db_t * tables, const j1939db_pgn_t * pgn_data, const uint8_t * spn_filter);
+static bool check_delta(j1939decode_ctx_t * ctx, j1939decode_delta_t * delta, uint32_t id, uint8_t dlc,
+                        const uint64_t * data, uint64_t timestamp_us, delta_frame_t * change,
+                        const j1939db_t ** tables, const j1939db_pgn_t ** pgn_data);
+static size_t decode_changes(const j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                             const j1939db_t * tables, const j1939db_pgn_t * pgn_data, const delta_frame_t * change,
+                             j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap);
+static size_t write_output(const j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                           const j1939db_t * tables, const j1939db_pgn_t * pgn_data, const delta_frame_t * change,
+                           uint32_t format, void * buf, size_t len, uint32_t flags, char ** allocated);
+static size_t encode_frame(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data, uint32_t format,
+                           void * buf, size_t len, uint32_t flags, char ** allocated);
+static const j1939db_pgn_t * find_pgn_cached(const j1939decode_ctx_t * ctx, uint32_t id, uint32_t * last_pgn,
+                                             const j1939db_pgn_t ** last_pgn_data, const j1939db_t ** last_tables);
+
+/* Allocator using malloc() and free() */
+static const j1939decode_allocator_t default_allocator = {default_malloc, default_free, NULL};
+
+/* Allocator for the database and default context */
+static j1939decode_allocator_t allocator_fns = {default_malloc, default_free, NULL};
+
+/* Name of source addresses missing from the database */
+static const char sa_unknown[] = "Unknown";
+
+/* Flags for opening the database of the default context */
+static uint32_t db_flags = 0;
+
+/* Overlay files merged into the database of the default context */
+static const char * const * overlay_files = NULL;
+static size_t num_overlay_files = 0;
+
+/* Database problem log sites, indexed by J1939CTX_LOG_ */
+static const struct
+{
+    uint32_t level;
+    uint32_t num_bits;                  /* size of the logged bitmap, one bit per number */
+    const char * fmt;                   /* message format taking the number */
+    const char * repeats;               /* description of repeated messages */
+    size_t counter;                     /* offset of the j1939decode_stats_t counter of the problem */
+} log_sites[J1939CTX_LOG_NUM_SITES] = {
+    {J1939DECODE_LOG_WARNING, 1U << 19U, "No start bit found in database for SPN %u, skipping decode",
+     "SPNs without a start bit", offsetof(j1939decode_stats_t, unknown_spns)},
+    {J1939DECODE_LOG_WARNING, 1U << 19U, "Start bit cannot be negative for SPN %u, skipping decode",
+     "SPNs with a negative start bit", offsetof(j1939decode_stats_t, unknown_spns)},
+    {J1939DECODE_LOG_WARNING, 1U << 19U, "No SPN data found in database for SPN %u", "SPNs without data",
+     offsetof(j1939decode_stats_t, unknown_spns)},
+    {J1939DECODE_LOG_WARNING, 1U << 18U, "No PGN name found in database for PGN %u", "PGNs without a name",
+     offsetof(j1939decode_stats_t, incomplete_pgns)},
+    {J1939DECODE_LOG_WARNING, 1U << 18U, "No SPNs found in database for PGN %u", "PGNs without SPNs",
+     offsetof(j1939decode_stats_t, incomplete_pgns)},
+    {J1939DECODE_LOG_WARNING, 1U << 18U, "Empty SPN list found in database for PGN %u", "PGNs with an empty SPN list",
+     offsetof(j1939decode_stats_t, incomplete_pgns)},
+    {J1939DECODE_LOG_DEBUG, 1U << 18U, "PGN %u not found in database", "PGNs not found",
+     offsetof(j1939decode_stats_t, unknown_pgns)},
+    {J1939DECODE_LOG_WARNING, 1U << 8U, "No source address name found in database for source address %u",
+     "source addresses without a name", offsetof(j1939decode_stats_t, unknown_sas)},
+};
+
+/* Repeated database problem messages are counted, and the count is logged each time it is a multiple of this */
+#define LOG_REPEAT_INTERVAL (1U << 16U)
+
+/* Offset of binary image stored in the same allocation as the database handle, keeping 8 byte alignment */
+#define DB_IMAGE_OFFSET ((sizeof(j1939decode_db_t) + 7) & ~(size_t) 7)
+
+/* Number of bits in the filter bitmaps, PGNs are 18 bits and SPNs are 19 bits */
+#define PGN_FILTER_BITS (1U << 18U)
+#define SPN_FILTER_BITS (1U << 19U)
+
+/* Stringify version number macros */
+#define J1939DECODE_STRINGIFY(x) #x
+#define J1939DECODE_VERSION_STRING(major, minor, patch) \
+    J1939DECODE_STRINGIFY(major) "." J1939DECODE_STRINGIFY(minor) "." J1939DECODE_STRINGIFY(patch)
 
 /* Extract J1939 sub fields from CAN ID */
 static inline uint8_t get_pri(uint32_t id)
@@ -47,24 +194,117 @@ static inline uint8_t get_sa(uint32_t id)
     return (uint8_t) ((id >> 0U) & ((1U << 8U) - 1));
 }
 
+/* Check number against a filter bitmap, a NULL bitmap passes all numbers */
+static inline bool filter_passes(const uint8_t * bitmap, uint32_t bits, uint32_t number)
+{
+    return bitmap == NULL || (number < bits && ((bitmap[number / 8U] >> (number % 8U)) & 1U) != 0);
+}
+
+/* Check that output of written bytes fits whole in a buffer of len bytes */
+static inline bool output_complete(uint32_t format, size_t written, size_t len)
+{
+    /* JSON output needs room for the null terminator */
+    return written > 0 && (format == J1939DECODE_FORMAT_JSON ? written < len : written <= len);
+}
+
+static inline void count_frame(const j1939decode_ctx_t * ctx, uint8_t sa, uint32_t pgn)
+{
+    j1939ctx_stats_t * stats = ctx->stats;
+    j1939stats_count(&stats->counters.frames, 1);
+    if (stats->pgns != NULL)
+    {
+        j1939stats_pgns_count(stats->pgns, sa, pgn, stats->time_us);
+    }
+}
+
+static inline void count_spn(const j1939decode_ctx_t * ctx, const j1939_spn_value_t * value)
+{
+    j1939stats_count(&ctx->stats->counters.spns, 1);
+    if (!value->valid)
+    {
+        j1939stats_count(&ctx->stats->counters.spns_out_of_range, 1);
+    }
+}
+
+/* Load 8 payload bytes starting at offset as a little endian word, bytes past the end of the payload read as zero */
+static inline uint64_t load_word(const uint8_t * payload, size_t len, size_t offset)
+{
+    uint64_t word = 0;
+    if (offset + sizeof(word) <= len)
+    {
+        memcpy(&word, &payload[offset], sizeof(word));
+    }
+    else if (offset < len)
+    {
+        memcpy(&word, &payload[offset], len - offset);
+    }
+    return word;
+}
+
+/**************************************************************************//**
+
+  \brief Get the log handler of a decoder context
+
+  \param ctx    decoder context, NULL for the process-wide handler
+
+  \return j1939ctx_logger_t *   the context's own handler if it has one, otherwise the process-wide handler
+
+******************************************************************************/
+const j1939ctx_logger_t * get_logger(const j1939decode_ctx_t * ctx)
+{
+    if (ctx != NULL && (ctx->logger.handler != NULL || ctx->logger.fn != NULL))
+    {
+        return &ctx->logger;
+    }
+    return &logger;
+}
+
+/**************************************************************************//**
+
+  \brief Check whether messages of a log level are passed to the handler
+
+  \param ctx    decoder context, NULL to use the process-wide handler
+  \param level  J1939DECODE_LOG_ level of the message
+
+  \return bool  true if the message would be logged
+
+******************************************************************************/
+bool j1939ctx_log_enabled(const j1939decode_ctx_t * ctx, uint32_t level)
+{
+    return level >= get_logger(ctx)->level;
+}
+
 /**************************************************************************//**
 
   \brief Log formatted message to user defined handler, or stderr as default
 
+  \param ctx    decoder context, NULL to use the process-wide handler
+  \param level  J1939DECODE_LOG_ level of the message
+  \param fmt    printf style format string
+  \param args   format arguments
+
   \return void
 
 ******************************************************************************/
-void log_msg(const char * fmt, ...)
+void j1939ctx_vlog(const j1939decode_ctx_t * ctx, uint32_t level, const char * fmt, va_list args)
 {
+    const j1939ctx_logger_t * log = get_logger(ctx);
+    if (level < log->level)
+    {
+        /* Filtered out before any formatting */
+        return;
+    }
+
     char buf[4096];
-    va_list args;
-    va_start(args, fmt);
     vsnprintf(buf, sizeof(buf), fmt, args);
-    va_end(args);
 
-    if (log_fn)
+    if (log->handler)
+    {
+        (*log->handler)(log->user, level, buf);
+    }
+    else if (log->fn)
     {
-        (*log_fn)(buf);
+        (*log->fn)(buf);
     }
     else
     {
@@ -73,19 +313,150 @@ void log_msg(const char * fmt, ...)
     }
 }
 
+/**************************************************************************//**
+
+  \brief Log formatted message for a decoder context
+
+  \return void
+
+******************************************************************************/
+void log_msg(const j1939decode_ctx_t * ctx, uint32_t level, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    j1939ctx_vlog(ctx, level, fmt, args);
+    va_end(args);
+}
+
+/**************************************************************************//**
+
+  \brief Get the bitmap of numbers a database problem has been logged for, allocating it on first use
+
+  \param db     database handle
+  \param site   J1939CTX_LOG_ site of the problem
+
+  \return uint32_t *    pointer to bitmap, NULL on allocation failure
+
+******************************************************************************/
+uint32_t * get_logged(j1939decode_db_t * db, uint32_t site)
+{
+    uint32_t * logged = __atomic_load_n(&db->logged[site], __ATOMIC_ACQUIRE);
+    if (logged != NULL)
+    {
+        return logged;
+    }
+
+    size_t size = log_sites[site].num_bits / 8;
+    logged = db->allocator.malloc_fn(db->allocator.user, size);
+    if (logged == NULL)
+    {
+        return NULL;
+    }
+    memset(logged, 0, size);
+
+    /* Another thread may have published its bitmap first */
+    uint32_t * expected = NULL;
+    if (!__atomic_compare_exchange_n(&db->logged[site], &expected, logged, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE))
+    {
+        db->allocator.free_fn(db->allocator.user, logged);
+        logged = expected;
+    }
+    return logged;
+}
+
+/**************************************************************************//**
+
+  \brief Log a database problem the first time it is found for a number
+
+  Repeats are counted instead, and the count is logged periodically
+  Only the counter of the context is updated if the level of the problem is filtered out
+
+  \param ctx    decoder context
+  \param site   J1939CTX_LOG_ site of the problem
+  \param number SPN, PGN or source address the problem was found for
+
+  \return void
+
+******************************************************************************/
+void log_db_problem(const j1939decode_ctx_t * ctx, uint32_t site, uint32_t number)
+{
+    j1939stats_count((uint64_t *) ((uint8_t *) &ctx->stats->counters + log_sites[site].counter), 1);
+
+    uint32_t level = log_sites[site].level;
+    if (!j1939ctx_log_enabled(ctx, level))
+    {
+        return;
+    }
+
+    /* Without a bitmap the number is treated as logged, so that allocation failures cannot flood the log */
+    uint32_t * logged = get_logged(ctx->db, site);
+    number &= log_sites[site].num_bits - 1;
+    uint32_t bit = 1U << (number % 32U);
+    if (logged != NULL && (__atomic_fetch_or(&logged[number / 32U], bit, __ATOMIC_RELAXED) & bit) == 0)
+    {
+        log_msg(ctx, level, log_sites[site].fmt, number);
+        return;
+    }
+
+    uint32_t repeats = __atomic_add_fetch(&ctx->db->log_repeats[site], 1, __ATOMIC_RELAXED);
+    if (repeats % LOG_REPEAT_INTERVAL == 0)
+    {
+        log_msg(ctx, level, "%u repeated messages not logged for %s", repeats, log_sites[site].repeats);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Default allocator using malloc() and free()
+
+******************************************************************************/
+void * default_malloc(void * user, size_t size)
+{
+    (void) user;
+    return malloc(size);
+}
+
+void default_free(void * user, void * ptr)
+{
+    (void) user;
+    free(ptr);
+}
+
+/**************************************************************************//**
+
+  \brief Get allocator to use for a caller supplied allocator
+
+  \return const j1939decode_allocator_t *   allocator, malloc() and free() if allocator is NULL
+
+******************************************************************************/
+const j1939decode_allocator_t * j1939ctx_allocator(const j1939decode_allocator_t * allocator)
+{
+    return allocator != NULL ? allocator : &default_allocator;
+}
+
+/* Only needed to read JSON text, and images where files cannot be mapped */
+#if !defined(J1939DECODE_HAVE_MMAP) || !defined(J1939DECODE_NO_CJSON)
 /**************************************************************************//**
 
   \brief  Read file contents into allocated memory
 
-  \return pointer to string containing file contents
+  \param filename   file to read
+  \param mode       fopen() mode
+  \param allocator  allocator for the returned buffer
+  \param offset     number of bytes to reserve in front of the file contents
+  \param size       set to file size in bytes
+
+  \return pointer to allocated buffer with null terminated file contents at offset
 
 ******************************************************************************/
-char * file_read(const char * filename, const char * mode)
+char * file_read(const char * filename, const char * mode, const j1939decode_allocator_t * allocator,
+                 size_t offset, size_t * size)
 {
     FILE * fp = fopen(filename, mode);
     if (fp == NULL)
     {
-        log_msg("Could not open file %s", filename);
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Could not open file %s", filename);
         /* No need to close the file before returning since it was never opened */
         return NULL;
     }
@@ -94,21 +465,28 @@ char * file_read(const char * filename, const char * mode)
     fseek(fp, 0, SEEK_END);
     long file_size = ftell(fp);
     rewind(fp);
+    if (file_size < 0)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Could not get size of file %s", filename);
+        fclose(fp);
+        return NULL;
+    }
 
     /* Allocate enough memory for entire file */
-    char * buf = malloc(file_size + 1);
+    char * buf = allocator->malloc_fn(allocator->user, offset + (size_t) file_size + 1);
     if (buf == NULL)
     {
-        log_msg("Memory allocation failure");
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Memory allocation failure");
         fclose(fp);
         return NULL;
     }
 
     /* Read the entire file into a buffer */
-    long read_size = fread(buf, 1, file_size, fp);
+    long read_size = (long) fread(buf + offset, 1, (size_t) file_size, fp);
     if (read_size != file_size)
     {
-        log_msg("Read %ld of %ld total bytes in file %s", read_size, file_size, filename);
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Read %ld of %ld total bytes in file %s", read_size, file_size, filename);
+        allocator->free_fn(allocator->user, buf);
         fclose(fp);
         return NULL;
     }
@@ -116,10 +494,12 @@ char * file_read(const char * filename, const char * mode)
     fclose(fp);
 
     // Null terminator
-    buf[file_size] = '\0';
+    buf[offset + (size_t) file_size] = '\0';
 
+    *size = (size_t) file_size;
     return buf;
 }
+#endif
 
 /**************************************************************************//**
 
@@ -132,528 +512,3178 @@ void j1939decode_set_log_fn(log_fn_ptr fn)
 {
     if (fn)
     {
-        log_fn = fn;
+        logger.fn = fn;
+        logger.handler = NULL;
+        logger.user = NULL;
     }
 }
 
 /**************************************************************************//**
 
-  \brief Print version string
+  \brief Set log handler with a user pointer
 
-  \return version string
+  \return void
 
 ******************************************************************************/
-const char * j1939decode_version(void)
+void j1939decode_set_log_handler(log_handler_ptr fn, void * user)
 {
-    static char version[15];
-    sprintf(version, "%i.%i.%i", J1939DECODE_VERSION_MAJOR, J1939DECODE_VERSION_MINOR, J1939DECODE_VERSION_PATCH);
-
-    return version;
+    logger.fn = NULL;
+    logger.handler = fn;
+    logger.user = user;
 }
 
 /**************************************************************************//**
 
-  \brief Initialize and allocate memory for J1939 lookup table
+  \brief Set minimum level of logged messages
 
   \return void
 
 ******************************************************************************/
-void j1939decode_init(void)
+void j1939decode_set_log_level(uint32_t level)
 {
-    char * s;
-    /* Memory-map all file contents */
-    s = file_read(J1939DECODE_DB, "r");
-    if (s != NULL)
-    {
-        j1939db_json = cJSON_Parse(s);
-        free(s);
-        if (j1939db_json == NULL)
-        {
-            log_msg("Unable to parse J1939db");
-        }
-    }
+    logger.level = level;
+}
+
+/**************************************************************************//**
+
+  \brief Set allocator for the database and default context of j1939decode_init()
 
-    /* Pre-allocate large JSON objects */
-    j1939db_pgns = cJSON_GetObjectItemCaseSensitive(j1939db_json, "J1939PGNdb");
-    j1939db_spns = cJSON_GetObjectItemCaseSensitive(j1939db_json, "J1939SPNdb");
-    j1939db_source_addresses = cJSON_GetObjectItemCaseSensitive(j1939db_json, "J1939SATabledb");
+  \return void
+
+******************************************************************************/
+void j1939decode_set_allocator(const j1939decode_allocator_t * allocator)
+{
+    allocator_fns = allocator != NULL ? *allocator : default_allocator;
 }
 
 /**************************************************************************//**
 
-  \brief Deinitialize and free memory for J1939 lookup table
+  \brief Set flags for opening the database of j1939decode_init()
 
   \return void
 
 ******************************************************************************/
-void j1939decode_deinit(void)
+void j1939decode_set_db_flags(uint32_t flags)
 {
-    /* cJSON_Delete() checks if pointer is NULL before freeing */
-    cJSON_Delete(j1939db_json);
+    db_flags = flags;
+}
 
-    /* Explicitly set pointer to NULL */
-    j1939db_json = NULL;
+/**************************************************************************//**
+
+  \brief Set overlay files merged into the database of j1939decode_init()
+
+  \param overlays       overlay filenames, which must stay valid, NULL for none
+  \param num_overlays   number of overlay filenames
+
+  \return void
+
+******************************************************************************/
+void j1939decode_set_overlays(const char * const * overlays, size_t num_overlays)
+{
+    overlay_files = overlays;
+    num_overlay_files = overlays != NULL ? num_overlays : 0;
 }
 
 /**************************************************************************//**
 
-  \brief
+  \brief Print version string
+
+  \return version string
+
+******************************************************************************/
+const char * j1939decode_version(void)
+{
+    /* Built at compile time so there is no shared buffer to write to */
+    return J1939DECODE_VERSION_STRING(J1939DECODE_VERSION_MAJOR, J1939DECODE_VERSION_MINOR, J1939DECODE_VERSION_PATCH);
+}
 
-  \param val    value to search
-  \param array  array of values to search in
-  \param len    number of elements in array
+/**************************************************************************//**
+
+  \brief Check if file is a binary J1939 database image
 
-  \return bool  boolean indicating if value was found in array
+  \return bool  true if file starts with the binary image magic number
 
 ******************************************************************************/
-bool in_array(uint32_t val, const uint32_t * array, size_t len)
+bool file_is_image(const char * filename)
 {
-    for (size_t i = 0; i < len; i++)
+    char magic[sizeof(J1939DB_IMAGE_MAGIC)];
+
+    FILE * fp = fopen(filename, "rb");
+    if (fp == NULL)
     {
-        if (val == array[i])
-        {
-            return true;
-        }
+        return false;
     }
-    return false;
+
+    size_t read_size = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+
+    return j1939db_is_image(magic, read_size);
 }
 
+#ifdef J1939DECODE_HAVE_MMAP
 /**************************************************************************//**
 
-  \brief Split 64 bit number into JSON array object of bytes
+  \brief Map file contents read-only into memory
 
-  \param data     pointer to data (8 bytes total)
+  \param filename       file to map
+  \param size           set to file size in bytes
 
-  \return cJSON * pointer to the JSON array object
+  \return const void *  pointer to file contents, NULL on failure
 
 ******************************************************************************/
-cJSON * create_byte_array(const uint64_t * data)
+const void * file_map(const char * filename, size_t * size)
 {
-    cJSON * array = cJSON_CreateArray();
-    if (array == NULL)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
     {
-        goto cleanup;
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Could not open file %s", filename);
+        return NULL;
     }
 
-    for (uint32_t i = 0; i < sizeof(data); i++)
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
     {
-        /* Cast to uint8 pointer and then index */
-        cJSON * num = cJSON_CreateNumber(((uint8_t *) data)[i]);
-        if (num == NULL)
-        {
-            goto cleanup;
-        }
-        cJSON_AddItemToArray(array, num);
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Could not get size of file %s", filename);
+        close(fd);
+        return NULL;
     }
 
-    return array;
+    /* Pages are shared between all processes mapping the same file */
+    void * image = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Could not map file %s", filename);
+        return NULL;
+    }
 
-    cleanup:
-    cJSON_Delete(array);
-    return NULL;
+    *size = (size_t) st.st_size;
+    return image;
 }
 
 /**************************************************************************//**
 
-  \brief Get parameter group number data
-
-  \param pgn      parameter group number
+  \brief Release file contents mapped by file_map()
 
-  \return cJSON * pointer to the PGN data JSON object
+  \return void
 
 ******************************************************************************/
-const cJSON * get_pgn_data(uint32_t pgn)
+void file_unmap(const void * image, size_t size)
 {
-    /* String large enough to fit a six-digit number (18 bits) */
-    char pgn_string[7];
-    snprintf(pgn_string, sizeof(pgn_string), "%d", pgn);
-
-    const cJSON * pgn_data = cJSON_GetObjectItemCaseSensitive(j1939db_pgns, pgn_string);
-
-    return pgn_data;
+    munmap((void *) image, size);
 }
+#endif
 
 /**************************************************************************//**
 
-  \brief Get suspect parameter number data
+  \brief Allocate database handle with room for a binary image after it
 
-  \param spn      suspect parameter number
+  \param allocator          allocator for the handle
+  \param image_size         size of binary image stored after the handle, 0 if none
 
-  \return cJSON * pointer to the SPN data JSON object
+  \return j1939decode_db_t * pointer to database handle, NULL on failure
 
 ******************************************************************************/
-const cJSON * get_spn_data(uint32_t spn)
+j1939decode_db_t * alloc_db(const j1939decode_allocator_t * allocator, size_t image_size)
 {
-    /* String large enough to fit a six-digit number */
-    char spn_string[7];
-    snprintf(spn_string, sizeof(spn_string), "%d", spn);
-
-    const cJSON * spn_data = cJSON_GetObjectItemCaseSensitive(j1939db_spns, spn_string);
+    j1939decode_db_t * db = allocator->malloc_fn(allocator->user, DB_IMAGE_OFFSET + image_size);
+    if (db == NULL)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return NULL;
+    }
 
-    return spn_data;
+    memset(db, 0, sizeof(j1939decode_db_t));
+    db->allocator = *allocator;
+    db->tables = &db->storage;
+    return db;
 }
 
+#ifndef J1939DECODE_NO_CJSON
 /**************************************************************************//**
 
-  \brief Extract suspect parameter number data items and decode SPN value
-
-  \param spn        suspect parameter number
-  \param data       pointer to data (8 bytes total)
-  \param start_bit  starting bit of SPN in PGN (zero-order)
+  \brief Read and parse a JSON database or overlay file
 
-  \return cJSON *   pointer to the SPN data JSON object
+  \return cJSON *   parsed JSON, NULL on failure
 
 ******************************************************************************/
-cJSON * extract_spn_data(uint32_t spn, const uint64_t * data, uint32_t start_bit)
+cJSON * parse_file(const char * filename, const j1939decode_allocator_t * allocator)
 {
-    /* JSON object for specific SPN data */
-    const cJSON * spn_data = get_spn_data(spn);
+    size_t size;
+    char * s = file_read(filename, "r", allocator, 0, &size);
+    if (s == NULL)
+    {
+        return NULL;
+    }
+
+    cJSON * json = cJSON_Parse(s);
+    allocator->free_fn(allocator->user, s);
+    if (json == NULL)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Unable to parse J1939db: %s", filename);
+    }
+    return json;
+}
+
+#endif
 
-    /* Mutable copy of SPN data object
-     * We are keeping all existing fields and then adding more of our own */
-    /* TODO: Create our own SPN data JSON object rather than copying the existing one
-     * By creating our own JSON object and adding all fields explicitly we have control over what the key names are */
-    cJSON * spn_data_copy = cJSON_Duplicate(spn_data, 1);
+/**************************************************************************//**
 
-    /* TODO: Use PascalCase or snake_case for JSON key names?
-     * Existing J1939 lookup table uses PascalCase but snake_case may be more appropriate */
+  \brief Load J1939 lookup table from JSON or binary image file
 
-    if (cJSON_IsObject(spn_data))
-    {
-        int length_in_bits = cJSON_GetObjectItemCaseSensitive(spn_data, "SPNLength")->valueint;
-        int offset = cJSON_GetObjectItemCaseSensitive(spn_data, "Offset")->valueint;
-        double resolution = cJSON_GetObjectItemCaseSensitive(spn_data, "Resolution")->valuedouble;
-        double operational_high = cJSON_GetObjectItemCaseSensitive(spn_data, "OperationalHigh")->valuedouble;
-        double operational_low = cJSON_GetObjectItemCaseSensitive(spn_data, "OperationalLow")->valuedouble;
-        /* Not currently using name or units
-        char * name = cJSON_GetObjectItemCaseSensitive(spn_data, "Name")->valuestring;
-        char * units = cJSON_GetObjectItemCaseSensitive(spn_data, "Units")->valuestring;
-        */
+  JSON databases are compiled and then copied as a binary image into the same
+  allocation as the handle, so the whole database is allocated once and freed once.
+  Overlays are merged into the parsed JSON before compiling, so their entries
+  end up in the same tables as everything else.
 
-        /* TODO: Support bit decodings for when the units are "Bits" */
-        /* TODO: Support decoding of ASCII values when resolution is "ASCII" */
+  \param filename       database filename
+  \param overlays       overlay filenames, merged in order
+  \param num_overlays   number of overlay filenames, 0 for none
+  \param allocator      allocator for the database
 
-        /* Decode the data for this SPN */
-        uint64_t mask = (1U << (unsigned int) length_in_bits) - 1;
-        uint64_t value_raw = ((*data) >> start_bit) & mask;
-        double value = value_raw * resolution + offset;
+  \return j1939decode_db_t *    pointer to database handle, NULL on failure
+
+******************************************************************************/
+j1939decode_db_t * load_db(const char * filename, const char * const * overlays, size_t num_overlays,
+                           const j1939decode_allocator_t * allocator)
+{
+    j1939decode_db_t * db;
+    const void * image;
+    size_t size;
+    const char * error;
 
-        if (cJSON_AddNumberToObject(spn_data_copy, "StartBit", start_bit) == NULL)
+    if (file_is_image(filename))
+    {
+        if (num_overlays > 0)
         {
-            goto cleanup;
+            /* Images hold no JSON to merge into, merge overlays with j1939db-convert instead */
+            log_msg(NULL, J1939DECODE_LOG_ERROR, "Overlays need a JSON database: %s", filename);
+            return NULL;
         }
 
-        if (cJSON_AddNumberToObject(spn_data_copy, "ValueRaw", value_raw) == NULL)
+#ifdef J1939DECODE_HAVE_MMAP
+        image = file_map(filename, &size);
+        if (image == NULL)
         {
-            goto cleanup;
+            return NULL;
         }
 
-        /* Decoded value is valid boolean defaulting to false */
-        cJSON_bool valid = false;
+        db = alloc_db(allocator, 0);
+        if (db == NULL)
+        {
+            file_unmap(image, size);
+            return NULL;
+        }
 
-        /* Check that decoded value is within operational range */
-        if (value >= operational_low && value <= operational_high)
+        if (!j1939db_init_image(db->tables, image, size, &error))
         {
-            if (cJSON_AddNumberToObject(spn_data_copy, "ValueDecoded", value) == NULL)
-            {
-                goto cleanup;
-            }
+            log_msg(NULL, J1939DECODE_LOG_ERROR, "%s: %s", error, filename);
+            file_unmap(image, size);
+            allocator->free_fn(allocator->user, db);
+            return NULL;
+        }
 
-            valid = true;
+        db->tables->image_release = file_unmap;
+#else
+        /* Read the image straight into the handle allocation */
+        db = (j1939decode_db_t *) file_read(filename, "rb", allocator, DB_IMAGE_OFFSET, &size);
+        if (db == NULL)
+        {
+            return NULL;
         }
-        else
+
+        memset(db, 0, sizeof(j1939decode_db_t));
+        db->allocator = *allocator;
+        db->tables = &db->storage;
+
+        image = (const uint8_t *) db + DB_IMAGE_OFFSET;
+        if (!j1939db_init_image(db->tables, image, size, &error))
         {
-            /* Decoded value is invalid or not available if outside of operation range
-             * Use the "Valid" boolean key when checking if decoded data is valid or not */
-            if (cJSON_AddStringToObject(spn_data_copy, "ValueDecoded", "Not available") == NULL)
-            {
-                goto cleanup;
-            }
+            log_msg(NULL, J1939DECODE_LOG_ERROR, "%s: %s", error, filename);
+            allocator->free_fn(allocator->user, db);
+            return NULL;
         }
+#endif
+        return db;
+    }
+
+#ifdef J1939DECODE_NO_CJSON
+    (void) overlays;
+    log_msg(NULL, J1939DECODE_LOG_ERROR, "JSON databases are not supported by this build: %s", filename);
+    return NULL;
+#else
+    cJSON * j1939db_json = parse_file(filename, allocator);
+    if (j1939db_json == NULL)
+    {
+        return NULL;
+    }
 
-        if (cJSON_AddBoolToObject(spn_data_copy, "Valid", valid) == NULL)
+    for (size_t i = 0; i < num_overlays; i++)
+    {
+        cJSON * overlay = parse_file(overlays[i], allocator);
+        bool merged = overlay != NULL && j1939db_merge(j1939db_json, overlay);
+        cJSON_Delete(overlay);
+        if (!merged)
         {
-            goto cleanup;
+            if (overlay != NULL)
+            {
+                log_msg(NULL, J1939DECODE_LOG_ERROR, "Invalid J1939db overlay: %s", overlays[i]);
+            }
+            cJSON_Delete(j1939db_json);
+            return NULL;
         }
     }
-    else
+
+    /* Compile into flat lookup tables, the parsed JSON is no longer needed after this */
+    j1939db_t * compiled = j1939db_compile(j1939db_json);
+    cJSON_Delete(j1939db_json);
+    if (compiled == NULL)
     {
-        log_msg("No SPN data found in database for SPN %d", spn);
-        goto cleanup;
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return NULL;
     }
 
-    return spn_data_copy;
+    /* Copy compiled tables into the handle allocation */
+    size = j1939db_image_size(compiled);
+    db = alloc_db(allocator, size);
+    if (db != NULL)
+    {
+        void * db_image = (uint8_t *) db + DB_IMAGE_OFFSET;
+        j1939db_build_image(compiled, db_image);
+        if (!j1939db_init_image(db->tables, db_image, size, &error))
+        {
+            log_msg(NULL, J1939DECODE_LOG_ERROR, "%s: %s", error, filename);
+            allocator->free_fn(allocator->user, db);
+            db = NULL;
+        }
+    }
+    j1939db_free(compiled);
 
-    cleanup:
-    cJSON_Delete(spn_data_copy);
-    /* Do not return the freed cJSON pointer to avoid use-after-free flaw
-     * cJSON_Delete() does not set the freed pointer to NULL */
-    return NULL;
+    return db;
+#endif
 }
 
 /**************************************************************************//**
 
-  \brief Get source address name
+  \brief Open J1939 lookup table from JSON or binary image file without loading its PGNs
 
-  \param sa      source address number
+  Binary images are only checked as far as needed to find PGNs, each PGN is
+  validated when first looked up. JSON text is memory-mapped where possible
+  and indexed, each PGN and its SPNs are compiled when first looked up.
 
-  \return char * pointer to the source address name string
+  \return j1939decode_db_t *    pointer to database handle, NULL on failure
 
 ******************************************************************************/
-char * get_sa_name(uint8_t sa)
+j1939decode_db_t * load_db_lazy(const char * filename, const j1939decode_allocator_t * allocator)
 {
-    char * sa_name;
+    const char * error;
+    bool image = file_is_image(filename);
 
-    /* Preferred Addresses are in the range of 0 to 127 and 248 to 255 */
-    if (sa <= 127 || sa >= 248)
+    j1939decode_db_t * db = alloc_db(allocator, 0);
+    if (db == NULL)
     {
-        /* Source addresses 92 through to 127 have not yet been assigned */
-        if (sa >= 92 && sa <= 127)
+        return NULL;
+    }
+
+    /* Released on failure like any other handle, which frees whatever was set up so far */
+    db->refcount = 1;
+
+    db->text = j1939ctx_file_open(filename, allocator, &db->text_size, &db->text_mapped);
+    if (db->text == NULL)
+    {
+        j1939decode_db_release(db);
+        return NULL;
+    }
+
+    if (image)
+    {
+        if (!j1939db_init_image_lazy(db->tables, db->text, db->text_size, &error))
         {
-            sa_name = "Reserved";
+            log_msg(NULL, J1939DECODE_LOG_ERROR, "%s: %s", error, filename);
+            j1939decode_db_release(db);
+            return NULL;
         }
-        else
+
+        db->index = j1939index_open_image(db->tables, allocator);
+    }
+    else
+    {
+        db->index = j1939index_open_json(db->text, db->text_size, allocator, &error);
+        if (db->index == NULL)
         {
-            /* String large enough to fit a three-digit number (8 bits) */
-            char sa_string[4];
-            snprintf(sa_string, sizeof(sa_string), "%d", sa);
+            log_msg(NULL, J1939DECODE_LOG_ERROR, "%s: %s", error, filename);
+        }
+        else
+        {
+            /* Casting away const since the tables are only constant for readers */
+            db->tables = (j1939db_t *) j1939index_tables(db->index);
+        }
 
-            sa_name = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(j1939db_source_addresses, sa_string));
-            if (sa_name == NULL)
+#if defined(J1939DECODE_HAVE_MMAP) && defined(MADV_DONTNEED)
+        /* Drop the pages read by the index scan, they are read again as PGNs are first used */
+        madvise((void *) db->text, db->text_size, MADV_DONTNEED);
+#endif
+    }
+
+    if (db->index == NULL)
+    {
+        j1939decode_db_release(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+/**************************************************************************//**
+
+  \brief Release file contents kept for the index of a lazily loaded database
+
+  \return void
+
+******************************************************************************/
+void release_text(j1939decode_db_t * db)
+{
+    if (db->text != NULL)
+    {
+        j1939ctx_file_close(db->text, db->text_size, db->text_mapped, &db->allocator);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Get file contents, memory-mapped read-only where possible
+
+  \param filename       file to open
+  \param allocator      allocator for the contents if they cannot be mapped
+  \param size           set to file size in bytes
+  \param mapped         set to true if the contents are memory-mapped
+
+  \return const char *  pointer to file contents, NULL on failure
+
+******************************************************************************/
+const char * j1939ctx_file_open(const char * filename, const j1939decode_allocator_t * allocator, size_t * size,
+                                bool * mapped)
+{
+#ifdef J1939DECODE_HAVE_MMAP
+    (void) allocator;
+    *mapped = true;
+    return file_map(filename, size);
+#else
+    /* Binary mode, so that the size matches the file on every platform */
+    *mapped = false;
+    return file_read(filename, "rb", allocator, 0, size);
+#endif
+}
+
+/**************************************************************************//**
+
+  \brief Release file contents of j1939ctx_file_open()
+
+  \return void
+
+******************************************************************************/
+void j1939ctx_file_close(const char * text, size_t size, bool mapped, const j1939decode_allocator_t * allocator)
+{
+#ifdef J1939DECODE_HAVE_MMAP
+    if (mapped)
+    {
+        file_unmap(text, size);
+        return;
+    }
+#endif
+    (void) size;
+    (void) mapped;
+
+    /* Casting away const since the text is only constant for readers */
+    allocator->free_fn(allocator->user, (void *) text);
+}
+
+/**************************************************************************//**
+
+  \brief Load J1939 database from a JSON or binary database file
+
+  \param filename           database filename
+
+  \return j1939decode_db_t * pointer to database handle, NULL on failure
+
+******************************************************************************/
+j1939decode_db_t * j1939decode_db_load(const char * filename)
+{
+    return j1939decode_db_load_with_allocator(filename, NULL);
+}
+
+/**************************************************************************//**
+
+  \brief Load J1939 database from a JSON or binary database file using an allocator
+
+  \param filename           database filename
+  \param allocator          allocator for the database, NULL to use malloc() and free()
+
+  \return j1939decode_db_t * pointer to database handle, NULL on failure
+
+******************************************************************************/
+j1939decode_db_t * j1939decode_db_load_with_allocator(const char * filename, const j1939decode_allocator_t * allocator)
+{
+    return j1939decode_db_open(filename, 0, allocator);
+}
+
+/**************************************************************************//**
+
+  \brief Open J1939 database from a JSON or binary database file
+
+  \param filename           database filename
+  \param flags              J1939DECODE_DB_ flags
+  \param allocator          allocator for the database, NULL to use malloc() and free()
+
+  \return j1939decode_db_t * pointer to database handle, NULL on failure
+
+******************************************************************************/
+j1939decode_db_t * j1939decode_db_open(const char * filename, uint32_t flags, const j1939decode_allocator_t * allocator)
+{
+    allocator = j1939ctx_allocator(allocator);
+    j1939decode_db_t * db = (flags & J1939DECODE_DB_LAZY) ? load_db_lazy(filename, allocator) :
+                            load_db(filename, NULL, 0, allocator);
+    if (db != NULL)
+    {
+        db->refcount = 1;
+        resolve_sa_names(db);
+    }
+    return db;
+}
+
+/**************************************************************************//**
+
+  \brief Open J1939 database from a JSON database file with overlay files merged into it
+
+  \param filename           JSON database filename
+  \param overlays           JSON overlay filenames, merged in order
+  \param num_overlays       number of overlay filenames
+  \param allocator          allocator for the database, NULL to use malloc() and free()
+
+  \return j1939decode_db_t * pointer to database handle, NULL on failure
+
+******************************************************************************/
+j1939decode_db_t * j1939decode_db_open_overlays(const char * filename, const char * const * overlays,
+                                                size_t num_overlays, const j1939decode_allocator_t * allocator)
+{
+    allocator = j1939ctx_allocator(allocator);
+    j1939decode_db_t * db = load_db(filename, overlays, num_overlays, allocator);
+    if (db != NULL)
+    {
+        db->refcount = 1;
+        resolve_sa_names(db);
+    }
+    return db;
+}
+
+/**************************************************************************//**
+
+  \brief Open J1939 database from a binary image in memory
+
+  \param image              binary image, 8 byte aligned, valid until the database is freed
+  \param size               size of binary image in bytes
+  \param flags              J1939DECODE_DB_ flags
+  \param allocator          allocator for the database handle, NULL to use malloc() and free()
+
+  \return j1939decode_db_t * pointer to database handle, NULL on failure
+
+******************************************************************************/
+j1939decode_db_t * j1939decode_db_open_image(const void * image, size_t size, uint32_t flags,
+                                             const j1939decode_allocator_t * allocator)
+{
+    const char * error;
+
+    allocator = j1939ctx_allocator(allocator);
+    j1939decode_db_t * db = alloc_db(allocator, 0);
+    if (db == NULL)
+    {
+        return NULL;
+    }
+
+    /* Released on failure like any other handle, the image is owned by the caller */
+    db->refcount = 1;
+
+    bool lazy = (flags & J1939DECODE_DB_LAZY) != 0;
+    if (!(lazy ? j1939db_init_image_lazy(db->tables, image, size, &error) :
+          j1939db_init_image(db->tables, image, size, &error)))
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "%s in memory", error);
+        j1939decode_db_release(db);
+        return NULL;
+    }
+
+    if (lazy)
+    {
+        db->index = j1939index_open_image(db->tables, allocator);
+        if (db->index == NULL)
+        {
+            j1939decode_db_release(db);
+            return NULL;
+        }
+    }
+
+    resolve_sa_names(db);
+    return db;
+}
+
+/**************************************************************************//**
+
+  \brief Add a reference to a database handle
+
+  \return j1939decode_db_t * the same database handle
+
+******************************************************************************/
+j1939decode_db_t * j1939decode_db_retain(j1939decode_db_t * db)
+{
+    if (db != NULL)
+    {
+        __atomic_add_fetch(&db->refcount, 1, __ATOMIC_RELAXED);
+    }
+    return db;
+}
+
+/**************************************************************************//**
+
+  \brief Drop a reference to a database handle, freeing it with the last reference
+
+  \return void
+
+******************************************************************************/
+void j1939decode_db_release(j1939decode_db_t * db)
+{
+    /* Each database holds a reference to its replacement, a chain of replacements is dropped in a loop */
+    while (db != NULL && __atomic_sub_fetch(&db->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        /* Unmaps memory-mapped images, tables copied into the handle allocation are freed with it */
+        j1939index_free(db->index);
+        j1939db_close(&db->storage);
+        release_text(db);
+        for (uint32_t site = 0; site < J1939CTX_LOG_NUM_SITES; site++)
+        {
+            if (db->logged[site] != NULL)
             {
-                sa_name = "Unknown";
-                log_msg("No source address name found in database for source address %d", sa);
+                db->allocator.free_fn(db->allocator.user, db->logged[site]);
             }
         }
+        j1939decode_db_t * successor = db->successor;
+        db->allocator.free_fn(db->allocator.user, db);
+
+        /* Dropped last, the replacement outlives every database it replaced */
+        db = successor;
     }
-        /* Industry Group specific addresses are in the range of 128 to 247 */
-    else if (sa >= 128 && sa <= 247)
+}
+
+/**************************************************************************//**
+
+  \brief Replace a database with another without stopping decoding
+
+  The replacement is published with one atomic pointer swap. Each context of
+  the old database moves to the newest replacement at the start of its next
+  call, and the old database is freed once its last context has moved.
+
+  \param db         database being replaced
+  \param new_db     replacement, which must not have replaced or been replaced by a database before
+
+  \return bool      true if published
+
+******************************************************************************/
+bool j1939decode_db_replace(j1939decode_db_t * db, j1939decode_db_t * new_db)
+{
+    if (db == NULL || new_db == NULL)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "J1939 database not loaded");
+        return false;
+    }
+
+    /* A database that has been replaced, or has replaced another, could close a loop of replacements */
+    if (db == new_db || __atomic_load_n(&new_db->successor, __ATOMIC_ACQUIRE) != NULL ||
+        __atomic_test_and_set(&new_db->replacement, __ATOMIC_ACQ_REL))
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "J1939 database already used in a replacement");
+        return false;
+    }
+
+    /* Published after the newest replacement so far, which is where every context ends up */
+    j1939decode_db_retain(new_db);
+    j1939decode_db_t * expected = NULL;
+    while (!__atomic_compare_exchange_n(&db->successor, &expected, new_db, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+    {
+        db = expected;
+        expected = NULL;
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Save J1939 database as a binary database image
+
+  \param db         database handle
+  \param filename   output filename
+
+  \return bool      true on success
+
+******************************************************************************/
+bool j1939decode_db_save(const j1939decode_db_t * db, const char * filename)
+{
+    if (db == NULL)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "J1939 database not loaded");
+        return false;
+    }
+
+    if (db->index != NULL)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Lazily loaded databases cannot be saved");
+        return false;
+    }
+
+    FILE * fp = fopen(filename, "wb");
+    if (fp == NULL)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Could not open file %s", filename);
+        return false;
+    }
+
+    bool written = j1939db_write_image(db->tables, fp);
+    if (fclose(fp) != 0 || !written)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Could not write file %s", filename);
+        return false;
+    }
+
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Create decoder context using a database
+
+  \param db                     database handle, a reference is kept by the context
+
+  \return j1939decode_ctx_t *   pointer to decoder context, NULL on failure
+
+******************************************************************************/
+j1939decode_ctx_t * j1939decode_ctx_create(j1939decode_db_t * db)
+{
+    return j1939decode_ctx_create_with_allocator(db, NULL);
+}
+
+/**************************************************************************//**
+
+  \brief Create decoder context using a database and an allocator
+
+  \param db                     database handle, a reference is kept by the context
+  \param allocator              allocator for the context, NULL to use malloc() and free()
+
+  \return j1939decode_ctx_t *   pointer to decoder context, NULL on failure
+
+******************************************************************************/
+j1939decode_ctx_t * j1939decode_ctx_create_with_allocator(j1939decode_db_t * db, const j1939decode_allocator_t * allocator)
+{
+    if (db == NULL)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "J1939 database not loaded");
+        return NULL;
+    }
+
+    /* Context and counters in one allocation, counters are 8 byte aligned */
+    size_t stats_offset = (sizeof(j1939decode_ctx_t) + 7) & ~(size_t) 7;
+    size_t size = stats_offset + sizeof(j1939ctx_stats_t);
+
+    allocator = j1939ctx_allocator(allocator);
+    j1939decode_ctx_t * ctx = allocator->malloc_fn(allocator->user, size);
+    if (ctx == NULL)
+    {
+        log_msg(NULL, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return NULL;
+    }
+
+    memset(ctx, 0, size);
+    ctx->allocator = *allocator;
+    ctx->db = j1939decode_db_retain(db);
+    ctx->tables = db->tables;
+    ctx->logger.level = J1939DECODE_LOG_INFO;
+    ctx->stats = (j1939ctx_stats_t *) ((uint8_t *) ctx + stats_offset);
+
+    /* Counters of the database's contexts are only summed when they are read */
+    lock_stats(db);
+    link_ctx(db, ctx);
+    unlock_stats(db);
+
+    return ctx;
+}
+
+/**************************************************************************//**
+
+  \brief Destroy decoder context and release its database reference
+
+  \return void
+
+******************************************************************************/
+void j1939decode_ctx_destroy(j1939decode_ctx_t * ctx)
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+
+    j1939decode_db_t * db = ctx->db;
+    lock_stats(db);
+    unlink_ctx(db, ctx);
+    j1939stats_add_since(&db->retired, &ctx->stats->counters, &ctx->stats->moved);
+    unlock_stats(db);
+
+    j1939decode_db_release(db);
+    set_filter(ctx, &ctx->pgn_filter, PGN_FILTER_BITS, NULL, 0, true, "PGN");
+    set_filter(ctx, &ctx->spn_filter, SPN_FILTER_BITS, NULL, 0, true, "SPN");
+    j1939cache_free(ctx->cache);
+    j1939stats_pgns_free(ctx->stats->pgns);
+    ctx->allocator.free_fn(ctx->allocator.user, ctx);
+}
+
+/**************************************************************************//**
+
+  \brief Set log function handler for a decoder context
+
+  \return void
+
+******************************************************************************/
+void j1939decode_ctx_set_log_fn(j1939decode_ctx_t * ctx, log_fn_ptr fn)
+{
+    ctx->logger.fn = fn;
+    ctx->logger.handler = NULL;
+    ctx->logger.user = NULL;
+}
+
+/**************************************************************************//**
+
+  \brief Set log handler with a user pointer for a decoder context
+
+  \return void
+
+******************************************************************************/
+void j1939decode_ctx_set_log_handler(j1939decode_ctx_t * ctx, log_handler_ptr fn, void * user)
+{
+    ctx->logger.fn = NULL;
+    ctx->logger.handler = fn;
+    ctx->logger.user = user;
+}
+
+/**************************************************************************//**
+
+  \brief Set minimum level of messages logged to the handler of a decoder context
+
+  \return void
+
+******************************************************************************/
+void j1939decode_ctx_set_log_level(j1939decode_ctx_t * ctx, uint32_t level)
+{
+    ctx->logger.level = level;
+}
+
+/**************************************************************************//**
+
+  \brief Compile a list of numbers into a filter bitmap
+
+  \param ctx        decoder context
+  \param bitmap     filter bitmap to replace
+  \param bits       number of bits in the bitmap
+  \param numbers    array of numbers, NULL to remove the filter
+  \param count      number of elements in the array
+  \param allow      true to pass only the listed numbers, false to pass all others
+  \param name       description of the numbers for log messages
+
+  \return bool      true on success, the previous bitmap is kept on failure
+
+******************************************************************************/
+bool set_filter(j1939decode_ctx_t * ctx, uint8_t ** bitmap, uint32_t bits, const uint32_t * numbers,
+                size_t count, bool allow, const char * name)
+{
+    uint8_t * filter = NULL;
+    if (numbers != NULL)
+    {
+        filter = ctx_malloc(ctx, bits / 8U);
+        if (filter == NULL)
+        {
+            log_msg(ctx, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+            return false;
+        }
+
+        memset(filter, allow ? 0x00 : 0xFF, bits / 8U);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t number = numbers[i];
+            if (number >= bits)
+            {
+                log_msg(ctx, J1939DECODE_LOG_ERROR, "%s %u is out of range for filter", name, number);
+                ctx->allocator.free_fn(ctx->allocator.user, filter);
+                return false;
+            }
+
+            uint8_t bit = (uint8_t) (1U << (number % 8U));
+            filter[number / 8U] = allow ? (uint8_t) (filter[number / 8U] | bit) : (uint8_t) (filter[number / 8U] & ~bit);
+        }
+    }
+
+    if (*bitmap != NULL)
+    {
+        ctx->allocator.free_fn(ctx->allocator.user, *bitmap);
+    }
+    *bitmap = filter;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Set PGN filter of a decoder context
+
+  \param ctx        decoder context
+  \param pgns       array of PGNs, NULL to remove the filter
+  \param count      number of elements in the array
+  \param allow      true to decode only the listed PGNs, false to decode all others
+
+  \return bool      true on success
+
+******************************************************************************/
+bool j1939decode_ctx_set_pgn_filter(j1939decode_ctx_t * ctx, const uint32_t * pgns, size_t count, bool allow)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return false;
+    }
+    return set_filter(ctx, &ctx->pgn_filter, PGN_FILTER_BITS, pgns, count, allow, "PGN");
+}
+
+/**************************************************************************//**
+
+  \brief Set SPN allowlist of a decoder context
+
+  \param ctx        decoder context
+  \param spns       array of SPNs to decode, NULL to decode all SPNs
+  \param count      number of elements in the array
+
+  \return bool      true on success
+
+******************************************************************************/
+bool j1939decode_ctx_set_spn_filter(j1939decode_ctx_t * ctx, const uint32_t * spns, size_t count)
+{
+    if (!j1939ctx_check_ready(ctx) || !set_filter(ctx, &ctx->spn_filter, SPN_FILTER_BITS, spns, count, true, "SPN"))
+    {
+        return false;
+    }
+
+    /* Cached outputs hold the SPNs of the previous filter */
+    if (ctx->cache != NULL)
+    {
+        j1939cache_clear(ctx->cache);
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Set JSON output profile of a decoder context
+
+  \param ctx        decoder context
+  \param profile    J1939DECODE_PROFILE_ value
+
+  \return bool      true on success
+
+******************************************************************************/
+bool j1939decode_ctx_set_profile(j1939decode_ctx_t * ctx, uint32_t profile)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return false;
+    }
+
+    if (profile != J1939DECODE_PROFILE_FULL && profile != J1939DECODE_PROFILE_COMPACT &&
+        profile != J1939DECODE_PROFILE_RAW)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "Unknown output profile %u", profile);
+        return false;
+    }
+
+    ctx->profile = profile;
+    if (ctx->cache != NULL)
+    {
+        j1939cache_clear(ctx->cache);
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Set output cache of a decoder context
+
+  \param ctx        decoder context
+  \param entries    maximum number of outputs cached, 0 to remove the cache
+  \param max_len    longest output cached in bytes, 0 for J1939DECODE_CACHE_LEN
+
+  \return bool      true on success
+
+******************************************************************************/
+bool j1939decode_ctx_set_cache(j1939decode_ctx_t * ctx, size_t entries, size_t max_len)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return false;
+    }
+
+    j1939cache_t * cache = NULL;
+    if (entries > 0)
+    {
+        cache = j1939cache_create(entries, max_len > 0 ? max_len : J1939DECODE_CACHE_LEN, &ctx->allocator);
+        if (cache == NULL)
+        {
+            return false;
+        }
+    }
+
+    if (cache != NULL)
+    {
+        j1939stats_count(&ctx->stats->counters.allocations, 1);
+    }
+    j1939cache_free(ctx->cache);
+    ctx->cache = cache;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Get counters of a decoder context
+
+  \return void
+
+******************************************************************************/
+void j1939decode_ctx_stats(const j1939decode_ctx_t * ctx, j1939decode_stats_t * stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (ctx != NULL)
+    {
+        j1939stats_add(stats, &ctx->stats->counters);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Get the sum of the counters of all contexts created with a database
+
+  \return void
+
+******************************************************************************/
+void j1939decode_db_stats(j1939decode_db_t * db, j1939decode_stats_t * stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (db == NULL)
+    {
+        return;
+    }
+
+    lock_stats(db);
+    j1939stats_add(stats, &db->retired);
+    for (const j1939decode_ctx_t * ctx = db->contexts; ctx != NULL; ctx = ctx->next)
+    {
+        j1939stats_add_since(stats, &ctx->stats->counters, &ctx->stats->moved);
+    }
+    unlock_stats(db);
+}
+
+/**************************************************************************//**
+
+  \brief Count frames and cycle times of each PGN and source address pair in a decoder context
+
+  \param ctx        decoder context
+  \param capacity   maximum number of pairs counted, 0 to stop counting
+
+  \return bool      true on success
+
+******************************************************************************/
+bool j1939decode_ctx_set_pgn_stats(j1939decode_ctx_t * ctx, size_t capacity)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return false;
+    }
+
+    j1939stats_pgns_t * pgns = NULL;
+    if (capacity > 0)
+    {
+        pgns = j1939stats_pgns_create(capacity, &ctx->allocator);
+        if (pgns == NULL)
+        {
+            return false;
+        }
+        j1939stats_count(&ctx->stats->counters.allocations, 1);
+    }
+
+    j1939stats_pgns_free(ctx->stats->pgns);
+    ctx->stats->pgns = pgns;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Set receive time of the frame decoded next
+
+  \return void
+
+******************************************************************************/
+void j1939decode_ctx_set_time(j1939decode_ctx_t * ctx, uint64_t timestamp_us)
+{
+    ctx->stats->time_us = timestamp_us;
+}
+
+/**************************************************************************//**
+
+  \brief Get per-PGN statistics of a decoder context
+
+  \param ctx        decoder context
+  \param stats      array for the statistics of each pair
+  \param cap        number of elements in the array
+
+  \return size_t    number of pairs counted, which may be more than were written
+
+******************************************************************************/
+size_t j1939decode_ctx_pgn_stats(const j1939decode_ctx_t * ctx, j1939decode_pgn_stats_t * stats, size_t cap)
+{
+    if (ctx == NULL || ctx->stats->pgns == NULL)
+    {
+        return 0;
+    }
+    return j1939stats_pgns_read(ctx->stats->pgns, stats, cap);
+}
+
+/**************************************************************************//**
+
+  \brief Get counters of the output cache of a decoder context
+
+  \return void
+
+******************************************************************************/
+void j1939decode_ctx_cache_stats(const j1939decode_ctx_t * ctx, j1939decode_cache_stats_t * stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (ctx != NULL && ctx->cache != NULL)
+    {
+        j1939cache_stats(ctx->cache, stats);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Get database handle used by a decoder context
+
+  \return j1939decode_db_t * database handle, not retained
+
+******************************************************************************/
+j1939decode_db_t * j1939decode_ctx_db(const j1939decode_ctx_t * ctx)
+{
+    return ctx->db;
+}
+
+/**************************************************************************//**
+
+  \brief Initialize and allocate memory for J1939 lookup table
+
+  \return void
+
+******************************************************************************/
+void j1939decode_init(void)
+{
+#ifdef J1939DECODE_STATIC_DB
+    j1939decode_deinit();
+
+    /* Tables are read in place from the image compiled into the library */
+    create_default_ctx(j1939decode_db_open_image(j1939db_static_image, j1939db_static_image_size, db_flags,
+                                             &allocator_fns));
+#else
+    j1939decode_init_file(J1939DECODE_DB);
+#endif
+}
+
+/**************************************************************************//**
+
+  \brief Initialize J1939 lookup table from a JSON or binary database file
+
+  \param filename   database filename
+
+  \return void
+
+******************************************************************************/
+void j1939decode_init_file(const char * filename)
+{
+    /* Replace any previously loaded lookup table */
+    j1939decode_deinit();
+
+    create_default_ctx(open_default_db(filename));
+}
+
+/**************************************************************************//**
+
+  \brief Open a database file for the default context, with any overlays merged into it
+
+  \return j1939decode_db_t *    database handle with one reference, NULL on failure
+
+******************************************************************************/
+j1939decode_db_t * open_default_db(const char * filename)
+{
+    if (num_overlay_files > 0)
+    {
+        /* Overlays are merged as the tables are compiled, so they are always loaded up front */
+        return j1939decode_db_open_overlays(filename, overlay_files, num_overlay_files, &allocator_fns);
+    }
+    return j1939decode_db_open(filename, db_flags, &allocator_fns);
+}
+
+/**************************************************************************//**
+
+  \brief Create the default context of a newly opened database
+
+  \param db         database handle with one reference, NULL if it could not be opened
+
+  \return void
+
+******************************************************************************/
+void create_default_ctx(j1939decode_db_t * db)
+{
+    if (db != NULL)
+    {
+        /* The opening reference is kept so that the database can be replaced later */
+        default_ctx = j1939decode_ctx_create_with_allocator(db, &allocator_fns);
+        if (default_ctx == NULL)
+        {
+            j1939decode_db_release(db);
+            return;
+        }
+        default_db = db;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Replace the loaded J1939 lookup table with a database file without stopping decoding
+
+  \param filename   database filename
+
+  \return bool      true if the database was opened and published
+
+******************************************************************************/
+bool j1939decode_reload(const char * filename)
+{
+    if (default_ctx == NULL)
+    {
+        j1939decode_init_file(filename);
+        return default_ctx != NULL;
+    }
+
+    /* Opened by this thread while the default context keeps decoding with the old database */
+    j1939decode_db_t * db = open_default_db(filename);
+    if (db == NULL || !j1939decode_db_replace(default_db, db))
+    {
+        j1939decode_db_release(db);
+        return false;
+    }
+
+    /* The old database is freed once the default context has moved on */
+    j1939decode_db_release(default_db);
+    default_db = db;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Save loaded J1939 lookup table as a binary database image
+
+  \param filename   output filename
+
+  \return bool      true on success
+
+******************************************************************************/
+bool j1939decode_save_db(const char * filename)
+{
+    return j1939decode_db_save(default_db, filename);
+}
+
+/**************************************************************************//**
+
+  \brief Deinitialize and free memory for J1939 lookup table
+
+  \return void
+
+******************************************************************************/
+void j1939decode_deinit(void)
+{
+    /* j1939decode_ctx_destroy() checks if pointer is NULL before freeing */
+    j1939decode_ctx_destroy(default_ctx);
+    j1939decode_db_release(default_db);
+
+    /* Explicitly set pointers to NULL */
+    default_ctx = NULL;
+    default_db = NULL;
+}
+
+/**************************************************************************//**
+
+  \brief Check that a decode plan step can be decoded
+
+  \param ctx        decoder context
+  \param tables     tables the decode plan belongs to
+  \param step       decode plan step of the SPN
+
+  \return const j1939db_spn_t *  SPN record, NULL if the SPN cannot be decoded
+
+******************************************************************************/
+const j1939db_spn_t * check_step(const j1939decode_ctx_t * ctx, const j1939db_t * tables, const j1939db_step_t * step)
+{
+    /* SPN starting bit position is found in the PGN data, not the SPN data */
+    if (step->start_bit < 0 || step->spn_index == J1939DB_NONE)
+    {
+        if (step->start_bit == J1939DB_START_BIT_MISSING)
+        {
+            log_db_problem(ctx, J1939CTX_LOG_NO_START_BIT, step->spn);
+        }
+        else if (step->start_bit < 0)
+        {
+            log_db_problem(ctx, J1939CTX_LOG_NEGATIVE_START_BIT, step->spn);
+        }
+        else
+        {
+            log_db_problem(ctx, J1939CTX_LOG_NO_SPN_DATA, step->spn);
+        }
+        return NULL;
+    }
+
+    return &tables->spns[step->spn_index];
+}
+
+/**************************************************************************//**
+
+  \brief Fill in decoded SPN from its raw value
+
+  The state name of discrete SPNs is a lookup in the state table compiled
+  from the database bit decodings. ASCII SPNs point into the payload.
+
+  \param tables     tables the decode plan belongs to
+  \param step       decode plan step of the SPN
+  \param spn_data   SPN record
+  \param value_raw  raw value extracted from the payload
+  \param payload    payload bytes, NULL to leave out the text of ASCII SPNs
+  \param len        payload length in bytes
+  \param value      decoded SPN to be filled in
+
+  \return void
+
+******************************************************************************/
+void set_spn_value(const j1939db_t * tables, const j1939db_step_t * step, const j1939db_spn_t * spn_data,
+                   uint64_t value_raw, const uint8_t * payload, size_t len, j1939_spn_value_t * value)
+{
+    double decoded = value_raw * step->scale + step->offset;
+
+    const char * name = j1939db_string(tables, spn_data->name);
+    const char * units = j1939db_string(tables, spn_data->units);
+
+    value->spn = step->spn;
+    value->name = name != NULL ? name : "";
+    value->units = units != NULL ? units : "";
+    value->start_bit = (uint32_t) step->start_bit;
+    value->length = spn_data->length;
+    value->value_raw = value_raw;
+    value->value = decoded;
+    /* Check that decoded value is within operational range */
+    value->valid = decoded >= step->low && decoded <= step->high;
+    value->state = j1939db_string(tables, j1939db_spn_state(tables, spn_data, value_raw));
+    value->text = NULL;
+    value->text_len = 0;
+    value->record = spn_data;
+
+    if ((spn_data->flags & J1939DB_SPN_TEXT) && payload != NULL)
+    {
+        set_spn_text(spn_data, payload, len, value);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Point the text of an ASCII SPN into the payload
+
+  ASCII SPNs start on a byte boundary. Fixed length ones hold length / 8
+  characters, variable length ones run up to a "*" delimiter or the end of
+  the payload. Only printable characters are taken, so padding with 0xFF or
+  NUL bytes is left out and the text is always valid UTF-8.
+
+  \return void
+
+******************************************************************************/
+void set_spn_text(const j1939db_spn_t * spn_data, const uint8_t * payload, size_t len, j1939_spn_value_t * value)
+{
+    size_t start = value->start_bit / 8U;
+    if (start >= len)
+    {
+        value->text = "";
+        return;
+    }
+
+    bool variable = (spn_data->flags & J1939DB_SPN_VARIABLE_LENGTH) != 0;
+    size_t end = len;
+    if (!variable && spn_data->length / 8U < len - start)
+    {
+        end = start + spn_data->length / 8U;
+    }
+
+    size_t i = start;
+    while (i < end && payload[i] >= 0x20 && payload[i] < 0x7F && !(variable && payload[i] == '*'))
+    {
+        i++;
+    }
+    value->text = (const char *) &payload[start];
+    value->text_len = i - start;
+}
+
+/**************************************************************************//**
+
+  \brief Extract SPN data from the 64 bit data field of a CAN frame
+
+  \param ctx        decoder context
+  \param tables     tables the decode plan belongs to
+  \param step       decode plan step of the SPN
+  \param data       pointer to data (8 bytes total)
+  \param value      decoded SPN to be filled in
+
+  \return bool      true if SPN was decoded
+
+******************************************************************************/
+bool extract_spn_data(const j1939decode_ctx_t * ctx, const j1939db_t * tables, const j1939db_step_t * step,
+                      const uint64_t * data, j1939_spn_value_t * value)
+{
+    const j1939db_spn_t * spn_data = check_step(ctx, tables, step);
+    if (spn_data == NULL)
+    {
+        return false;
+    }
+
+    /* Decode the data for this SPN */
+    set_spn_value(tables, step, spn_data, ((*data) >> step->shift) & step->mask, (const uint8_t *) data,
+                  sizeof(*data), value);
+    count_spn(ctx, value);
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Extract SPN data from a payload of any length
+
+  SPNs within the first 8 bytes are taken from the preloaded first word the
+  same way as for a CAN frame. Others are read with unaligned word loads, so
+  SPNs at any start bit and of up to 64 bits are extracted with one or two
+  loads. Longer SPNs, such as ASCII text, have the low 64 bits as their raw
+  value. SPNs that do not fit in the payload are not decoded.
+
+  \param ctx        decoder context
+  \param tables     tables the decode plan belongs to
+  \param step       decode plan step of the SPN
+  \param payload    payload bytes
+  \param len        payload length in bytes
+  \param head       first 8 payload bytes as loaded by load_word()
+  \param value      decoded SPN to be filled in
+
+  \return bool      true if SPN was decoded
+
+******************************************************************************/
+bool extract_spn_payload(const j1939decode_ctx_t * ctx, const j1939db_t * tables, const j1939db_step_t * step,
+                         const uint8_t * payload, size_t len, uint64_t head, j1939_spn_value_t * value)
+{
+    const j1939db_spn_t * spn_data = check_step(ctx, tables, step);
+    if (spn_data == NULL)
+    {
+        return false;
+    }
+
+    size_t start_bit = (size_t) step->start_bit;
+    uint32_t length = spn_data->length;
+    if (start_bit + length > len * 8U || start_bit >= len * 8U)
+    {
+        return false;
+    }
+
+    uint64_t value_raw;
+    if (start_bit + length <= 64U)
+    {
+        value_raw = (head >> step->shift) & step->mask;
+    }
+    else
+    {
+        size_t offset = start_bit / 8U;
+        uint32_t bit = (uint32_t) (start_bit % 8U);
+        value_raw = load_word(payload, len, offset) >> bit;
+        if (bit != 0 && bit + length > 64U)
+        {
+            /* Remaining high bits are in the next word */
+            value_raw |= load_word(payload, len, offset + sizeof(uint64_t)) << (64U - bit);
+        }
+        if (length < 64U)
+        {
+            value_raw &= (1ULL << length) - 1;
+        }
+    }
+
+    set_spn_value(tables, step, spn_data, value_raw, payload, len, value);
+    count_spn(ctx, value);
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Resolve the name of every source address
+
+  \return void
+
+******************************************************************************/
+void resolve_sa_names(j1939decode_db_t * db)
+{
+    for (uint32_t sa = 0; sa < sizeof(db->sa_names) / sizeof(db->sa_names[0]); sa++)
+    {
+        const char * sa_name;
+
+        /* Source addresses 92 through to 127 have not yet been assigned */
+        if (sa >= 92 && sa <= 127)
+        {
+            sa_name = "Reserved";
+        }
+        /* Industry Group specific addresses are in the range of 128 to 247 */
+        else if (sa >= 128 && sa <= 247)
+        {
+            sa_name = "Industry Group specific";
+        }
+        else
+        {
+            /* Preferred Addresses are in the range of 0 to 91 and 248 to 255 */
+            sa_name = j1939db_string(db->tables, db->tables->sa_names[sa]);
+            if (sa_name == NULL)
+            {
+                sa_name = sa_unknown;
+            }
+        }
+
+        db->sa_names[sa] = sa_name;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Get source address name
+
+  \param ctx     decoder context
+  \param sa      source address number
+
+  \return char * pointer to the source address name string
+
+******************************************************************************/
+const char * get_sa_name(const j1939decode_ctx_t * ctx, uint8_t sa)
+{
+    const char * sa_name = ctx->db->sa_names[sa];
+    if (sa_name == sa_unknown)
+    {
+        log_db_problem(ctx, J1939CTX_LOG_NO_SA_NAME, sa);
+    }
+    return sa_name;
+}
+
+/**************************************************************************//**
+
+  \brief Get parameter group number name
+
+  \param ctx        decoder context
+  \param tables     tables the PGN record belongs to
+  \param pgn_data   compiled PGN database record
+
+  \return char *    pointer to the PGN name string
+
+******************************************************************************/
+const char * get_pgn_name(const j1939decode_ctx_t * ctx, const j1939db_t * tables, const j1939db_pgn_t * pgn_data)
+{
+    const char * pgn_name = j1939db_string(tables, pgn_data->name);
+    if (pgn_name == NULL)
+    {
+        pgn_name = "Unknown";
+        log_db_problem(ctx, J1939CTX_LOG_NO_PGN_NAME, pgn_data->pgn);
+    }
+
+    return pgn_name;
+}
+
+/**************************************************************************//**
+
+  \brief Fill in identifier fields of a message rejected by the PGN filter
+
+  \param id         CAN identifier
+  \param len        payload length in bytes
+  \param out        decoded message to be filled in
+  \param spns       array for decoded SPNs
+
+  \return void
+
+******************************************************************************/
+void skip_message(uint32_t id, size_t len, j1939_decoded_t * out, j1939_spn_value_t * spns)
+{
+    out->id = id;
+    out->priority = get_pri(id);
+    out->pgn = get_pgn(id);
+    out->sa = get_sa(id);
+    out->dlc = (uint8_t) (len < 8 ? len : 8);
+    out->len = len;
+    out->pgn_name = NULL;
+    out->sa_name = NULL;
+    out->decoded = false;
+    out->filtered = true;
+    out->num_spns = 0;
+    out->spns = spns;
+}
+
+/**************************************************************************//**
+
+  \brief Fill in message fields and find the decode plan of the PGN
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param len        payload length in bytes
+  \param tables     tables the PGN record belongs to
+  \param pgn_data   compiled PGN record, NULL if PGN is not in database
+  \param out        decoded message to be filled in
+  \param spns       array for decoded SPNs
+
+  \return const j1939db_step_t *  decode plan, NULL if there are no SPNs to decode
+
+******************************************************************************/
+const j1939db_step_t * begin_message(const j1939decode_ctx_t * ctx, uint32_t id, size_t len,
+                                     const j1939db_t * tables, const j1939db_pgn_t * pgn_data,
+                                     j1939_decoded_t * out, j1939_spn_value_t * spns)
+{
+    out->id = id;
+    out->priority = get_pri(id);
+    out->pgn = get_pgn(id);
+    out->sa = get_sa(id);
+    out->dlc = (uint8_t) (len < 8 ? len : 8);
+    out->len = len;
+    out->pgn_name = NULL;
+    out->sa_name = get_sa_name(ctx, out->sa);
+    out->decoded = false;
+    out->filtered = false;
+    out->num_spns = 0;
+    out->spns = spns;
+    count_frame(ctx, out->sa, out->pgn);
+
+    if (pgn_data == NULL)
+    {
+        /* Logged at debug level, this may happen on every frame when decoding non-J1939 data */
+        log_db_problem(ctx, J1939CTX_LOG_PGN_NOT_FOUND, out->pgn);
+        return NULL;
+    }
+
+    /* PGN number found in lookup table */
+    out->pgn_name = get_pgn_name(ctx, tables, pgn_data);
+
+    if (pgn_data->num_spns == J1939DB_NONE)
+    {
+        log_db_problem(ctx, J1939CTX_LOG_NO_SPNS, out->pgn);
+        return NULL;
+    }
+
+    if (pgn_data->num_spns == 0)
+    {
+        log_db_problem(ctx, J1939CTX_LOG_EMPTY_SPNS, out->pgn);
+        return NULL;
+    }
+
+    /* One or more SPNs exist for PGN */
+    return &tables->steps[pgn_data->first_step];
+}
+
+/**************************************************************************//**
+
+  \brief Decode j1939 data into caller supplied structures
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param dlc        data length code
+  \param data       pointer to data (8 bytes total)
+  \param tables     tables the PGN record belongs to
+  \param pgn_data   compiled PGN record, NULL if PGN is not in database
+  \param out        decoded message to be filled in
+  \param spns       array for decoded SPNs
+  \param cap        number of elements in SPN array
+
+  \return size_t    number of SPNs written
+
+******************************************************************************/
+size_t decode_message(const j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                      const j1939db_t * tables, const j1939db_pgn_t * pgn_data,
+                      j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap)
+{
+    const j1939db_step_t * plan = begin_message(ctx, id, dlc, tables, pgn_data, out, spns);
+    if (plan == NULL)
+    {
+        return 0;
+    }
+
+    j1939_spn_value_t discard;
+    for (uint32_t i = 0; i < pgn_data->num_steps; i++)
+    {
+        if (!filter_passes(ctx->spn_filter, SPN_FILTER_BITS, plan[i].spn))
+        {
+            continue;
+        }
+
+        /* Keep counting SPNs even after the caller's array is full */
+        j1939_spn_value_t * value = out->num_spns < cap ? &spns[out->num_spns] : &discard;
+        if (extract_spn_data(ctx, tables, &plan[i], data, value))
+        {
+            out->num_spns++;
+        }
+    }
+
+    /* TODO: What criteria should be used to determine if the message should be flagged as "decoded" or not?
+     * 1. If PGN data found in database?
+     * 2. If at least one SPN found in database for PGN?
+     * 3. If at least one SPN, with start bits, found in database for PGN?
+     * 4. If at least one SPN actually decoded? (i.e. extract_spn_data() returned true)
+     * Using #4 criteria for now */
+    out->decoded = out->num_spns > 0;
+
+    return out->num_spns < cap ? out->num_spns : cap;
+}
+
+/**************************************************************************//**
+
+  \brief Decode a payload of any length into caller supplied structures
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param payload    payload bytes
+  \param len        payload length in bytes
+  \param tables     tables the PGN record belongs to
+  \param pgn_data   compiled PGN record, NULL if PGN is not in database
+  \param out        decoded message to be filled in
+  \param spns       array for decoded SPNs
+  \param cap        number of elements in SPN array
+
+  \return size_t    number of SPNs written
+
+******************************************************************************/
+size_t decode_payload(const j1939decode_ctx_t * ctx, uint32_t id, const uint8_t * payload, size_t len,
+                      const j1939db_t * tables, const j1939db_pgn_t * pgn_data,
+                      j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap)
+{
+    const j1939db_step_t * plan = begin_message(ctx, id, len, tables, pgn_data, out, spns);
+    if (plan == NULL)
+    {
+        return 0;
+    }
+
+    uint64_t head = load_word(payload, len, 0);
+    j1939_spn_value_t discard;
+    for (uint32_t i = 0; i < pgn_data->num_steps; i++)
+    {
+        if (!filter_passes(ctx->spn_filter, SPN_FILTER_BITS, plan[i].spn))
+        {
+            continue;
+        }
+
+        j1939_spn_value_t * value = out->num_spns < cap ? &spns[out->num_spns] : &discard;
+        if (extract_spn_payload(ctx, tables, &plan[i], payload, len, head, value))
+        {
+            out->num_spns++;
+        }
+    }
+
+    out->decoded = out->num_spns > 0;
+
+    return out->num_spns < cap ? out->num_spns : cap;
+}
+
+/**************************************************************************//**
+
+  \brief Get payload bits covered by the SPNs of a PGN that are decoded
+
+  \param tables     tables the PGN record belongs to
+  \param pgn_data   compiled PGN record, NULL if PGN is not in database
+  \param spn_filter SPN filter bitmap, NULL to decode all SPNs
+
+  \return uint64_t  payload mask, all bits if no SPN can be decoded
+
+******************************************************************************/
+uint64_t payload_mask(const j1939db_t * tables, const j1939db_pgn_t * pgn_data, const uint8_t * spn_filter)
+{
+    uint64_t mask = 0;
+
+    if (pgn_data != NULL && pgn_data->num_spns != J1939DB_NONE)
+    {
+        const j1939db_step_t * plan = &tables->steps[pgn_data->first_step];
+        for (uint32_t i = 0; i < pgn_data->num_steps; i++)
+        {
+            /* Same conditions as check_step(), without logging */
+            if (plan[i].start_bit >= 0 && plan[i].spn_index != J1939DB_NONE &&
+                filter_passes(spn_filter, SPN_FILTER_BITS, plan[i].spn))
+            {
+                mask |= plan[i].mask << plan[i].shift;
+            }
+        }
+    }
+
+    /* Report any payload change of frames that have nothing to decode */
+    return mask != 0 ? mask : ~(uint64_t) 0;
+}
+
+/**************************************************************************//**
+
+  \brief Check whether a frame changed since its source address and PGN were last seen
+
+  Unchanged frames are detected by comparing the payload bits covered by the
+  decoded SPNs with the last payload, before the PGN is looked up. For frames
+  that changed the entry is updated and the PGN record is looked up.
+
+  \param ctx            decoder context
+  \param delta          change detection state
+  \param id             CAN identifier
+  \param dlc            data length code
+  \param data           pointer to data (8 bytes total)
+  \param timestamp_us   time the frame was received
+  \param change         change detection state of the frame to be filled in
+  \param tables         set to the tables the PGN record belongs to
+  \param pgn_data       set to the compiled PGN record, NULL if PGN is not in database
+
+  \return bool          true if the frame needs decoding
+
+******************************************************************************/
+bool check_delta(j1939decode_ctx_t * ctx, j1939decode_delta_t * delta, uint32_t id, uint8_t dlc,
+                 const uint64_t * data, uint64_t timestamp_us, delta_frame_t * change,
+                 const j1939db_t ** tables, const j1939db_pgn_t ** pgn_data)
+{
+    bool inserted;
+    j1939delta_entry_t * entry = j1939delta_find(delta, get_sa(id), get_pgn(id), &inserted);
+
+    change->entry = entry;
+    change->deadband = delta->deadband;
+    change->report_all = true;
+
+    bool heartbeat = entry != NULL && delta->heartbeat_us > 0 &&
+                     timestamp_us - entry->heartbeat_us >= delta->heartbeat_us;
+    if (entry != NULL && !inserted && !heartbeat && entry->dlc == dlc &&
+        ((*data ^ entry->payload) & entry->mask) == 0)
+    {
+        return false;
+    }
+
+    *pgn_data = find_frame_pgn(ctx, id, tables);
+    if (entry == NULL)
+    {
+        /* Table is full, decode all SPNs */
+        return true;
+    }
+
+    if (inserted)
+    {
+        entry->mask = payload_mask(*tables, *pgn_data, ctx->spn_filter);
+    }
+
+    if (inserted || heartbeat || entry->dlc != dlc)
+    {
+        entry->reported = *data;
+        entry->heartbeat_us = timestamp_us;
+    }
+    else
+    {
+        change->report_all = false;
+    }
+
+    entry->payload = *data;
+    entry->dlc = dlc;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Decode the SPNs of j1939 data that changed since they were last reported
+
+  An SPN is reported when its raw value differs from the one last reported, and
+  with a deadband set, when its decoded value moved by more than the deadband
+  or its validity changed. The SPN values of the entry are only updated for
+  reported SPNs, so slow drifts are reported once they exceed the deadband.
+  Frames with no SPN to report are returned as filtered.
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param dlc        data length code
+  \param data       pointer to data (8 bytes total)
+  \param tables     tables the PGN record belongs to
+  \param pgn_data   compiled PGN record, NULL if PGN is not in database
+  \param change     change detection state, NULL to decode all SPNs
+  \param out        decoded message to be filled in
+  \param spns       array for decoded SPNs
+  \param cap        number of elements in SPN array
+
+  \return size_t    number of SPNs written
+
+******************************************************************************/
+size_t decode_changes(const j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                      const j1939db_t * tables, const j1939db_pgn_t * pgn_data, const delta_frame_t * change,
+                      j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap)
+{
+    if (change == NULL || change->entry == NULL || change->report_all)
+    {
+        return decode_message(ctx, id, dlc, data, tables, pgn_data, out, spns, cap);
+    }
+
+    const j1939db_step_t * plan = begin_message(ctx, id, dlc, tables, pgn_data, out, spns);
+    if (plan == NULL)
+    {
+        /* Payload changed but there is nothing to decode */
+        return 0;
+    }
+
+    j1939delta_entry_t * entry = change->entry;
+    j1939_spn_value_t discard;
+    for (uint32_t i = 0; i < pgn_data->num_steps; i++)
+    {
+        const j1939db_step_t * step = &plan[i];
+        if (!filter_passes(ctx->spn_filter, SPN_FILTER_BITS, step->spn))
+        {
+            continue;
+        }
+
+        j1939_spn_value_t * value = out->num_spns < cap ? &spns[out->num_spns] : &discard;
+        if (!extract_spn_data(ctx, tables, step, data, value))
+        {
+            continue;
+        }
+
+        uint64_t reported_raw = (entry->reported >> step->shift) & step->mask;
+        if (value->value_raw == reported_raw)
+        {
+            continue;
+        }
+
+        if (change->deadband > 0)
+        {
+            double reported = reported_raw * step->scale + step->offset;
+            bool reported_valid = reported >= step->low && reported <= step->high;
+            double diff = value->value > reported ? value->value - reported : reported - value->value;
+            if (diff <= change->deadband && value->valid == reported_valid)
+            {
+                continue;
+            }
+        }
+
+        entry->reported = (entry->reported & ~(step->mask << step->shift)) | (value->value_raw << step->shift);
+        out->num_spns++;
+    }
+
+    if (out->num_spns == 0)
+    {
+        skip_message(id, dlc, out, spns);
+        return 0;
+    }
+
+    out->decoded = true;
+
+    return out->num_spns < cap ? out->num_spns : cap;
+}
+
+/**************************************************************************//**
+
+  \brief Decode j1939 data and write it in an output format, decoding into a temporary SPN array
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param dlc        data length code
+  \param data       pointer to data (8 bytes total)
+  \param tables     tables the PGN record belongs to
+  \param pgn_data   compiled PGN record, NULL if PGN is not in database
+  \param change     change detection state, NULL to write all SPNs
+  \param format     J1939DECODE_FORMAT_ output format
+  \param buf        output buffer, may be NULL if len is 0
+  \param len        size of output buffer in bytes
+  \param flags      J1939DECODE_JSON_ and J1939DECODE_ENCODE_ flags
+  \param allocated  set to JSON output in an allocation of its exact length if it does not fit in buf,
+                    NULL to only write into buf
+
+  \return size_t    length of output, 0 on failure
+
+******************************************************************************/
+size_t write_output(const j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                    const j1939db_t * tables, const j1939db_pgn_t * pgn_data, const delta_frame_t * change,
+                    uint32_t format, void * buf, size_t len, uint32_t flags, char ** allocated)
+{
+    /* Decode into a stack array first, most PGNs have far fewer SPNs than this */
+    j1939_spn_value_t stack_spns[64];
+    j1939_spn_value_t * spns = stack_spns;
+    j1939_decoded_t decoded;
+
+    if (pgn_data != NULL && pgn_data->num_steps > sizeof(stack_spns) / sizeof(stack_spns[0]))
+    {
+        spns = ctx_malloc(ctx, pgn_data->num_steps * sizeof(j1939_spn_value_t));
+        if (spns == NULL)
+        {
+            log_msg(ctx, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+            return 0;
+        }
+    }
+
+    decode_changes(ctx, id, dlc, data, tables, pgn_data, change, &decoded, spns,
+                   spns == stack_spns ? sizeof(stack_spns) / sizeof(stack_spns[0]) : pgn_data->num_steps);
+
+    /* Buffer is left empty if nothing changed enough to be reported */
+    size_t written;
+    if (format == J1939DECODE_FORMAT_JSON)
+    {
+        bool pretty = (flags & J1939DECODE_JSON_PRETTY) != 0;
+        j1939json_t writer;
+        j1939json_init(&writer, buf, len, pretty);
+        if (!decoded.filtered)
+        {
+            j1939json_write_message(&writer, tables, &decoded, data, ctx->profile);
+        }
+        written = j1939json_finish(&writer);
+
+        /* Written again from the same decoded message, so the frame is only decoded and counted once */
+        if (allocated != NULL && written > 0 && written >= len)
+        {
+            *allocated = ctx_malloc(ctx, written + 1);
+            if (*allocated == NULL)
+            {
+                log_msg(ctx, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+                written = 0;
+            }
+            else
+            {
+                len = written + 1;
+                j1939json_init(&writer, *allocated, len, pretty);
+                j1939json_write_message(&writer, tables, &decoded, data, ctx->profile);
+                written = j1939json_finish(&writer);
+            }
+        }
+    }
+    else
+    {
+        j1939encode_t writer;
+        j1939encode_init(&writer, buf, len, format, flags);
+        if (!decoded.filtered)
+        {
+            j1939encode_write_message(&writer, tables, &decoded, data, ctx->profile);
+        }
+        written = j1939encode_finish(&writer);
+    }
+
+    if (spns != stack_spns)
+    {
+        ctx->allocator.free_fn(ctx->allocator.user, spns);
+    }
+
+    if (output_complete(format, written, len))
+    {
+        j1939stats_count(&ctx->stats->counters.output_bytes, written);
+    }
+    return written;
+}
+
+/**************************************************************************//**
+
+  \brief Lock the list of contexts of a database and the counters of destroyed contexts
+
+  Held only to link or unlink a context and to sum counters, so a spin lock is enough
+
+  \return void
+
+******************************************************************************/
+void lock_stats(j1939decode_db_t * db)
+{
+    while (__atomic_test_and_set(&db->stats_lock, __ATOMIC_ACQUIRE))
+    {
+    }
+}
+
+void unlock_stats(j1939decode_db_t * db)
+{
+    __atomic_clear(&db->stats_lock, __ATOMIC_RELEASE);
+}
+
+/**************************************************************************//**
+
+  \brief Add a context to the list of contexts of a database, with the list locked
+
+  \return void
+
+******************************************************************************/
+void link_ctx(j1939decode_db_t * db, j1939decode_ctx_t * ctx)
+{
+    ctx->prev = NULL;
+    ctx->next = db->contexts;
+    if (db->contexts != NULL)
+    {
+        db->contexts->prev = ctx;
+    }
+    db->contexts = ctx;
+}
+
+/**************************************************************************//**
+
+  \brief Remove a context from the list of contexts of a database, with the list locked
+
+  \return void
+
+******************************************************************************/
+void unlink_ctx(j1939decode_db_t * db, j1939decode_ctx_t * ctx)
+{
+    if (ctx->prev != NULL)
+    {
+        ctx->prev->next = ctx->next;
+    }
+    else
+    {
+        db->contexts = ctx->next;
+    }
+    if (ctx->next != NULL)
+    {
+        ctx->next->prev = ctx->prev;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Allocate memory with the allocator of a decoder context, counting the allocation
+
+  \return void *    pointer to memory, NULL on failure
+
+******************************************************************************/
+void * ctx_malloc(const j1939decode_ctx_t * ctx, size_t size)
+{
+    void * ptr = ctx->allocator.malloc_fn(ctx->allocator.user, size);
+    if (ptr != NULL)
+    {
+        j1939stats_count(&ctx->stats->counters.allocations, 1);
+    }
+    return ptr;
+}
+
+/**************************************************************************//**
+
+  \brief Check that a decoder context is ready for decoding
+
+  \return bool  true if context exists with a loaded database
+
+******************************************************************************/
+bool j1939ctx_check_ready(j1939decode_ctx_t * ctx)
+{
+    /* Fail if database is not loaded
+     * Remember to call j1939decode_init() first! */
+    if (ctx == NULL || ctx->tables == NULL)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "J1939 database not loaded");
+        return false;
+    }
+
+    /* A single load while the database has not been replaced */
+    if (__atomic_load_n(&ctx->db->successor, __ATOMIC_ACQUIRE) != NULL)
+    {
+        follow_successor(ctx);
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Move a context to the newest database replacing its own
+
+  Done by the thread using the context at the start of a call, so decoding
+  never waits for a replacement. Calls already running on other contexts keep
+  using their own database, which is freed once its last context has moved.
+
+  \return void
+
+******************************************************************************/
+void follow_successor(j1939decode_ctx_t * ctx)
+{
+    j1939decode_db_t * old_db = ctx->db;
+    j1939decode_db_t * db = old_db;
+    j1939decode_db_t * successor;
+    while ((successor = __atomic_load_n(&db->successor, __ATOMIC_ACQUIRE)) != NULL)
+    {
+        db = successor;
+    }
+
+    /* Frames decoded with the old database stay in its counters, only later ones count for the new one */
+    lock_stats(old_db);
+    unlink_ctx(old_db, ctx);
+    j1939stats_add_since(&old_db->retired, &ctx->stats->counters, &ctx->stats->moved);
+    ctx->stats->moved = ctx->stats->counters;
+    unlock_stats(old_db);
+
+    ctx->db = j1939decode_db_retain(db);
+    ctx->tables = db->tables;
+    lock_stats(db);
+    link_ctx(db, ctx);
+    unlock_stats(db);
+
+    /* Cached output was written with the old tables */
+    if (ctx->cache != NULL)
+    {
+        j1939cache_clear(ctx->cache);
+    }
+
+    j1939decode_db_release(old_db);
+}
+
+/**************************************************************************//**
+
+  \brief Decode j1939 data into caller supplied structures
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param dlc        data length code
+  \param data       pointer to data (8 bytes total)
+  \param out        decoded message to be filled in
+  \param spns       array for decoded SPNs
+  \param cap        number of elements in SPN array
+
+  \return int       number of SPNs written, -1 on error
+
+******************************************************************************/
+int j1939decode_ctx_decode(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                           j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return -1;
+    }
+
+    if (dlc > 8)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "DLC cannot be greater than 8 bytes");
+        return -1;
+    }
+
+    if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, get_pgn(id)))
+    {
+        skip_message(id, dlc, out, spns);
+        return 0;
+    }
+
+    const j1939db_t * tables;
+    const j1939db_pgn_t * pgn_data = find_frame_pgn(ctx, id, &tables);
+    return (int) decode_message(ctx, id, dlc, data, tables, pgn_data, out, spns, cap);
+}
+
+/**************************************************************************//**
+
+  \brief Decode a payload of any length into caller supplied structures
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param payload    payload bytes
+  \param len        payload length in bytes, at most J1939DECODE_MAX_PAYLOAD
+  \param out        decoded message to be filled in
+  \param spns       array for decoded SPNs
+  \param cap        number of elements in SPN array
+
+  \return int       number of SPNs written, -1 on error
+
+******************************************************************************/
+int j1939decode_ctx_decode_payload(j1939decode_ctx_t * ctx, uint32_t id, const uint8_t * payload, size_t len,
+                                   j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return -1;
+    }
+
+    if (len > J1939DECODE_MAX_PAYLOAD)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "Payload cannot be longer than %u bytes", J1939DECODE_MAX_PAYLOAD);
+        return -1;
+    }
+
+    if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, get_pgn(id)))
+    {
+        skip_message(id, len, out, spns);
+        return 0;
+    }
+
+    const j1939db_t * tables;
+    const j1939db_pgn_t * pgn_data = find_frame_pgn(ctx, id, &tables);
+    return (int) decode_payload(ctx, id, payload, len, tables, pgn_data, out, spns, cap);
+}
+
+/**************************************************************************//**
+
+  \brief Build JSON string for j1939 decoded data
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param dlc        data length code
+  \param data       pointer to data (8 bytes total)
+  \param pretty     pretty print returned JSON string
+
+  \return char *    pointer to the JSON string
+
+******************************************************************************/
+char * j1939decode_ctx_to_json(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data, bool pretty)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return NULL;
+    }
+
+    if (dlc > 8)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "DLC cannot be greater than 8 bytes");
+        return NULL;
+    }
+
+    if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, get_pgn(id)))
+    {
+        return NULL;
+    }
+
+    /* Write into a stack buffer first, most messages fit and then the exact length is known
+     * Longer messages are written again straight into an allocation of their exact length */
+    char stack_buf[4096];
+    char * json_string = NULL;
+    uint32_t flags = pretty ? J1939DECODE_JSON_PRETTY : 0;
+    size_t len = encode_frame(ctx, id, dlc, data, J1939DECODE_FORMAT_JSON, stack_buf, sizeof(stack_buf), flags,
+                              &json_string);
+    if (len == 0)
+    {
+        return NULL;
+    }
+
+    /* Memory will be allocated so remember to free it when you are done with it! */
+    if (json_string == NULL)
+    {
+        json_string = ctx_malloc(ctx, len + 1);
+        if (json_string == NULL)
+        {
+            log_msg(ctx, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+            return NULL;
+        }
+        memcpy(json_string, stack_buf, len + 1);
+    }
+
+    return json_string;
+}
+
+/**************************************************************************//**
+
+  \brief Write JSON string for j1939 decoded data into a caller supplied buffer
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param dlc        data length code
+  \param data       pointer to data (8 bytes total)
+  \param buf        output buffer, may be NULL if len is 0
+  \param len        size of output buffer in bytes
+  \param flags      J1939DECODE_JSON_ flags
+
+  \return size_t    length of JSON string, not counting the null terminator, 0 on error
+                    output is truncated if this is not less than len
+
+******************************************************************************/
+size_t j1939decode_ctx_to_json_buf(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                                   char * buf, size_t len, uint32_t flags)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return 0;
+    }
+
+    if (dlc > 8)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "DLC cannot be greater than 8 bytes");
+        return 0;
+    }
+
+    if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, get_pgn(id)))
+    {
+        if (len > 0)
+        {
+            buf[0] = '\0';
+        }
+        return 0;
+    }
+
+    return encode_frame(ctx, id, dlc, data, J1939DECODE_FORMAT_JSON, buf, len, flags, NULL);
+}
+
+/**************************************************************************//**
+
+  \brief Encode j1939 decoded data into a caller supplied buffer
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param dlc        data length code
+  \param data       pointer to data (8 bytes total)
+  \param format     J1939DECODE_FORMAT_ output format
+  \param buf        output buffer, may be NULL if len is 0
+  \param len        size of output buffer in bytes
+  \param flags      J1939DECODE_JSON_ and J1939DECODE_ENCODE_ flags
+
+  \return size_t    length of output, 0 on error
+                    output is truncated if this is more than len, for JSON if this is not less than len
+
+******************************************************************************/
+size_t j1939decode_ctx_encode(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data, uint32_t format,
+                              uint8_t * buf, size_t len, uint32_t flags)
+{
+    if (format > J1939DECODE_FORMAT_PROTOBUF)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "Unknown output format %u", format);
+        return 0;
+    }
+
+    if (format == J1939DECODE_FORMAT_JSON)
+    {
+        return j1939decode_ctx_to_json_buf(ctx, id, dlc, data, (char *) buf, len, flags);
+    }
+
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return 0;
+    }
+
+    if (dlc > 8)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "DLC cannot be greater than 8 bytes");
+        return 0;
+    }
+
+    if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, get_pgn(id)))
+    {
+        return 0;
+    }
+
+    return encode_frame(ctx, id, dlc, data, format, buf, len, flags, NULL);
+}
+
+/**************************************************************************//**
+
+  \brief Decode only the SPNs of j1939 data that changed since they were last reported
+
+  \param ctx            decoder context
+  \param delta          change detection state
+  \param id             CAN identifier
+  \param dlc            data length code
+  \param data           pointer to data (8 bytes total)
+  \param timestamp_us   time the frame was received
+  \param out            decoded message to be filled in
+  \param spns           array for decoded SPNs
+  \param cap            number of elements in SPN array
+
+  \return int           number of SPNs written, -1 on error
+
+******************************************************************************/
+int j1939decode_ctx_decode_delta(j1939decode_ctx_t * ctx, j1939decode_delta_t * delta, uint32_t id, uint8_t dlc,
+                                 const uint64_t * data, uint64_t timestamp_us,
+                                 j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return -1;
+    }
+
+    if (dlc > 8)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "DLC cannot be greater than 8 bytes");
+        return -1;
+    }
+
+    delta_frame_t change;
+    const j1939db_t * tables;
+    const j1939db_pgn_t * pgn_data;
+    if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, get_pgn(id)) ||
+        !check_delta(ctx, delta, id, dlc, data, timestamp_us, &change, &tables, &pgn_data))
+    {
+        skip_message(id, dlc, out, spns);
+        return 0;
+    }
+
+    return (int) decode_changes(ctx, id, dlc, data, tables, pgn_data, &change, out, spns, cap);
+}
+
+/**************************************************************************//**
+
+  \brief Write JSON of only the SPNs that changed since they were last reported
+
+  \param ctx            decoder context
+  \param delta          change detection state
+  \param id             CAN identifier
+  \param dlc            data length code
+  \param data           pointer to data (8 bytes total)
+  \param timestamp_us   time the frame was received
+  \param buf            output buffer, may be NULL if len is 0
+  \param len            size of output buffer in bytes
+  \param flags          J1939DECODE_JSON_ flags
+
+  \return size_t        length of JSON string, 0 if unchanged or on error
+
+******************************************************************************/
+size_t j1939decode_ctx_delta_to_json_buf(j1939decode_ctx_t * ctx, j1939decode_delta_t * delta, uint32_t id,
+                                         uint8_t dlc, const uint64_t * data, uint64_t timestamp_us,
+                                         char * buf, size_t len, uint32_t flags)
+{
+    if (len > 0)
+    {
+        buf[0] = '\0';
+    }
+
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return 0;
+    }
+
+    if (dlc > 8)
     {
-        sa_name = "Industry Group specific";
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "DLC cannot be greater than 8 bytes");
+        return 0;
     }
-    else
+
+    delta_frame_t change;
+    const j1939db_t * tables;
+    const j1939db_pgn_t * pgn_data;
+    if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, get_pgn(id)) ||
+        !check_delta(ctx, delta, id, dlc, data, timestamp_us, &change, &tables, &pgn_data))
     {
-        sa_name = "Unknown";
-        log_msg("Unknown source address %d outside of expected range", sa);
+        return 0;
     }
 
-    return sa_name;
+    return write_output(ctx, id, dlc, data, tables, pgn_data, &change, J1939DECODE_FORMAT_JSON, buf, len, flags,
+                        NULL);
 }
 
 /**************************************************************************//**
 
-  \brief Get parameter group number name
+  \brief Find PGN record, loading it first if the database is lazily loaded
 
-  \param pgn     parameter group number
+  \param ctx        decoder context
+  \param pgn        parameter group number
+  \param tables     set to the tables the PGN record belongs to
 
-  \return char * pointer to the PGN name string
+  \return const j1939db_pgn_t *  pointer to PGN record, NULL if not found
 
 ******************************************************************************/
-char * get_pgn_name(uint32_t pgn)
+const j1939db_pgn_t * find_pgn(const j1939decode_ctx_t * ctx, uint32_t pgn, const j1939db_t ** tables)
 {
-    char * pgn_name = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(get_pgn_data(pgn), "Name"));
-    if (pgn_name == NULL)
+    *tables = ctx->tables;
+    if (ctx->db->index != NULL)
     {
-        pgn_name = "Unknown";
-        log_msg("No PGN name found in database for PGN %d", pgn);
+        return j1939index_find_pgn(ctx->db->index, pgn, tables);
     }
+    return j1939db_find_pgn(ctx->tables, pgn);
+}
 
-    return pgn_name;
+/**************************************************************************//**
+
+  \brief Find PGN record of a frame, the variant for its source address if there is one
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param tables     set to the tables the PGN record belongs to
+
+  \return const j1939db_pgn_t *  pointer to PGN record, NULL if not found
+
+******************************************************************************/
+const j1939db_pgn_t * find_frame_pgn(const j1939decode_ctx_t * ctx, uint32_t id, const j1939db_t ** tables)
+{
+    const j1939db_pgn_t * pgn_data = find_pgn(ctx, get_pgn(id), tables);
+    return pgn_data != NULL ? j1939db_pgn_variant(*tables, pgn_data, get_sa(id)) : NULL;
 }
 
 /**************************************************************************//**
 
-  \brief Build JSON string for j1939 decoded data
+  \brief Lookup SPN record on its own, in the tables of the whole database or through the index
+
+  \param ctx        decoder context
+  \param spn        suspect parameter number
+  \param tables     set to the tables the SPN record belongs to
+
+  \return const j1939db_spn_t *  pointer to SPN record, NULL if not found
+
+******************************************************************************/
+const j1939db_spn_t * j1939ctx_find_spn(const j1939decode_ctx_t * ctx, uint32_t spn, const j1939db_t ** tables)
+{
+    *tables = ctx->tables;
+    if (ctx->db->index != NULL)
+    {
+        return j1939index_find_spn(ctx->db->index, spn, tables);
+    }
+    return j1939db_find_spn(ctx->tables, spn);
+}
 
+/**************************************************************************//**
+
+  \brief Write output of a frame passing the PGN filter, copying it from the output cache if it has been cached
+
+  \param ctx        decoder context
   \param id         CAN identifier
   \param dlc        data length code
   \param data       pointer to data (8 bytes total)
-  \param pretty     pretty print returned JSON string
+  \param format     J1939DECODE_FORMAT_ output format
+  \param buf        output buffer, may be NULL if len is 0
+  \param len        size of output buffer in bytes
+  \param flags      J1939DECODE_JSON_ and J1939DECODE_ENCODE_ flags
+  \param allocated  set like write_output(), NULL to only write into buf
 
-  \return char *    pointer to the JSON string
+  \return size_t    length of output like write_output(), 0 on error
 
 ******************************************************************************/
-char * j1939decode_to_json(uint32_t id, uint8_t dlc, const uint64_t * data, bool pretty)
+size_t encode_frame(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data, uint32_t format,
+                    void * buf, size_t len, uint32_t flags, char ** allocated)
 {
-    /* Fail and return NULL if database is not loaded
-     * Remember to call j1939decode_init() first! */
-    if (j1939db_json == NULL)
+    uint32_t mode = format | (flags << 8U);
+    const uint8_t * output;
+    size_t output_len;
+    if (ctx->cache != NULL && j1939cache_find(ctx->cache, id, dlc, *data, mode, &output, &output_len))
     {
-        log_msg("J1939 database not loaded");
-        return NULL;
+        if (allocated != NULL && format == J1939DECODE_FORMAT_JSON && output_len >= len)
+        {
+            len = output_len + 1;
+            buf = *allocated = ctx_malloc(ctx, len);
+            if (buf == NULL)
+            {
+                log_msg(ctx, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+                return 0;
+            }
+        }
+
+        /* Truncated like write_output(), JSON is null terminated */
+        if (format == J1939DECODE_FORMAT_JSON && len > 0)
+        {
+            size_t n = output_len < len - 1 ? output_len : len - 1;
+            memcpy(buf, output, n);
+            ((char *) buf)[n] = '\0';
+        }
+        else if (format != J1939DECODE_FORMAT_JSON)
+        {
+            memcpy(buf, output, output_len < len ? output_len : len);
+        }
+
+        count_frame(ctx, get_sa(id), get_pgn(id));
+        if (output_complete(format, output_len, len))
+        {
+            j1939stats_count(&ctx->stats->counters.output_bytes, output_len);
+        }
+        return output_len;
     }
 
-    if (dlc > 8)
+    const j1939db_t * tables;
+    const j1939db_pgn_t * pgn_data = find_frame_pgn(ctx, id, &tables);
+    size_t written = write_output(ctx, id, dlc, data, tables, pgn_data, NULL, format, buf, len, flags, allocated);
+    if (allocated != NULL && *allocated != NULL)
     {
-        log_msg("DLC cannot be greater than 8 bytes");
-        return NULL;
+        buf = *allocated;
+        len = written + 1;
     }
 
-    /* JSON string to be returned */
-    char * json_string = NULL;
+    /* Only complete outputs are cached */
+    if (ctx->cache != NULL && output_complete(format, written, len))
+    {
+        j1939cache_insert(ctx->cache, id, dlc, *data, mode, buf, written);
+    }
+    return written;
+}
+
+/**************************************************************************//**
+
+  \brief Find PGN record of a frame, reusing the previous lookup for repeated PGNs
+
+  Only the search is reused, the source address variant is picked for every frame.
+
+  \return const j1939db_pgn_t *  pointer to PGN record, NULL if not found
+
+******************************************************************************/
+const j1939db_pgn_t * find_pgn_cached(const j1939decode_ctx_t * ctx, uint32_t id, uint32_t * last_pgn,
+                                      const j1939db_pgn_t ** last_pgn_data, const j1939db_t ** last_tables)
+{
+    uint32_t pgn = get_pgn(id);
+    if (pgn != *last_pgn)
+    {
+        *last_pgn = pgn;
+        *last_pgn_data = find_pgn(ctx, pgn, last_tables);
+    }
+    return *last_pgn_data != NULL ? j1939db_pgn_variant(*last_tables, *last_pgn_data, get_sa(id)) : NULL;
+}
+
+/**************************************************************************//**
+
+  \brief Decode an array of CAN frames into caller supplied structures
+
+  Decoding stops early at the first frame whose SPNs may not fit in the remaining
+  SPN array space, so every decoded message has all of its SPNs written. The
+  exception is a frame with more SPNs than the whole array when no SPNs have
+  been written yet, which is decoded with only the first cap SPNs written.
+
+  \param ctx        decoder context
+  \param frames     array of CAN frames
+  \param count      number of CAN frames
+  \param out        array of decoded messages, one per frame
+  \param spns       array for decoded SPNs of all frames
+  \param cap        number of elements in SPN array
+
+  \return size_t    number of frames decoded
+
+******************************************************************************/
+size_t j1939decode_ctx_decode_batch(j1939decode_ctx_t * ctx, const j1939_frame_t * frames, size_t count,
+                                    j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return 0;
+    }
+
+    uint32_t last_pgn = J1939DB_NONE;
+    const j1939db_pgn_t * last_pgn_data = NULL;
+    const j1939db_t * last_tables = ctx->tables;
+    size_t used = 0;
+
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        uint32_t id = frames[i].id & J1939DECODE_ID_MASK;
+        if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, get_pgn(id)))
+        {
+            skip_message(id, frames[i].dlc, &out[i], &spns[used]);
+            continue;
+        }
+
+        if (frames[i].dlc > 8)
+        {
+            /* Report the frame with only its identifier fields rather than stopping the batch */
+            log_msg(ctx, J1939DECODE_LOG_ERROR, "DLC cannot be greater than 8 bytes");
+            skip_message(id, frames[i].dlc, &out[i], &spns[used]);
+            out[i].filtered = false;
+            continue;
+        }
+
+        const j1939db_pgn_t * pgn_data = find_pgn_cached(ctx, id, &last_pgn, &last_pgn_data, &last_tables);
+
+        /* Number of decode plan steps is the upper bound of SPNs decoded
+         * A first frame with more SPNs than the whole array is decoded truncated, so each call makes progress */
+        size_t needed = pgn_data != NULL ? pgn_data->num_steps : 0;
+        if (needed > cap - used && used > 0)
+        {
+            break;
+        }
+
+        uint64_t data;
+        memcpy(&data, frames[i].data, sizeof(data));
+        used += decode_message(ctx, id, frames[i].dlc, &data, last_tables, pgn_data, &out[i], &spns[used], cap - used);
+    }
+
+    return i;
+}
+
+/**************************************************************************//**
+
+  \brief Decode an array of CAN frames into newline delimited JSON
 
-    /* JSON object containing decoded J1939 data */
-    cJSON * json_object = cJSON_CreateObject();
-    if (json_object == NULL)
+  Each frame is written as one line of compact JSON. Output stops at the first
+  frame whose JSON does not fit in the remaining buffer space.
+
+  \param ctx        decoder context
+  \param frames     array of CAN frames
+  \param count      number of CAN frames
+  \param buf        output buffer
+  \param len        size of output buffer in bytes
+  \param written    set to number of bytes written to buffer, excluding null terminator
+
+  \return size_t    number of frames written or skipped by the PGN filter or for a DLC greater than 8
+
+******************************************************************************/
+size_t j1939decode_ctx_to_ndjson_batch(j1939decode_ctx_t * ctx, const j1939_frame_t * frames, size_t count,
+                                       char * buf, size_t len, size_t * written)
+{
+    *written = 0;
+
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return 0;
+    }
+
+    uint32_t last_pgn = J1939DB_NONE;
+    const j1939db_pgn_t * last_pgn_data = NULL;
+    const j1939db_t * last_tables = ctx->tables;
+
+    size_t i;
+    for (i = 0; i < count; i++)
     {
-        goto end;
+        uint32_t id = frames[i].id & J1939DECODE_ID_MASK;
+        if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, get_pgn(id)))
+        {
+            continue;
+        }
+
+        if (frames[i].dlc > 8)
+        {
+            /* Skipped without a line, stopping here could not be told apart from a full buffer */
+            log_msg(ctx, J1939DECODE_LOG_ERROR, "DLC cannot be greater than 8 bytes");
+            continue;
+        }
+
+        uint64_t data;
+        memcpy(&data, frames[i].data, sizeof(data));
+
+        /* Room is needed for the newline and the null terminator */
+        size_t remaining = len - *written;
+        if (remaining < 2)
+        {
+            break;
+        }
+
+        size_t json_len;
+        if (ctx->cache != NULL)
+        {
+            json_len = encode_frame(ctx, id, frames[i].dlc, &data, J1939DECODE_FORMAT_JSON, buf + *written,
+                                    remaining - 1, 0, NULL);
+        }
+        else
+        {
+            const j1939db_pgn_t * pgn_data = find_pgn_cached(ctx, id, &last_pgn, &last_pgn_data,
+                                                             &last_tables);
+            json_len = write_output(ctx, id, frames[i].dlc, &data, last_tables, pgn_data, NULL,
+                                    J1939DECODE_FORMAT_JSON, buf + *written, remaining - 1, 0, NULL);
+        }
+        if (json_len == 0 || json_len >= remaining - 1)
+        {
+            /* Drop the partially written line */
+            buf[*written] = '\0';
+            break;
+        }
+
+        *written += json_len;
+        buf[(*written)++] = '\n';
+        buf[*written] = '\0';
     }
 
-    if (cJSON_AddNumberToObject(json_object, "ID", id) == NULL)
+    return i;
+}
+
+/**************************************************************************//**
+
+  \brief Decode the data fields of many frames of the same PGN into SPN columns
+
+  \param ctx            decoder context
+  \param pgn            parameter group number of all frames
+  \param data           array of data fields (8 bytes each), one per frame
+  \param count          number of frames
+  \param columns        array of SPN columns with caller supplied arrays
+  \param num_columns    number of elements in column array
+
+  \return int           number of SPN columns of the PGN, -1 on error
+
+******************************************************************************/
+int j1939decode_ctx_decode_columns(j1939decode_ctx_t * ctx, uint32_t pgn, const uint64_t * data, size_t count,
+                                   j1939_spn_column_t * columns, size_t num_columns)
+{
+    if (!j1939ctx_check_ready(ctx))
     {
-        goto end;
+        return -1;
     }
 
-    if (cJSON_AddNumberToObject(json_object, "Priority", get_pri(id)) == NULL)
+    if (!filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, pgn))
     {
-        goto end;
+        return 0;
     }
 
-    if (cJSON_AddNumberToObject(json_object, "PGN", get_pgn(id)) == NULL)
+    const j1939db_t * tables;
+    const j1939db_pgn_t * pgn_data = find_pgn(ctx, pgn, &tables);
+    if (pgn_data == NULL)
     {
-        goto end;
+        return 0;
     }
 
-    if (cJSON_AddNumberToObject(json_object, "SA", get_sa(id)) == NULL)
+    const j1939db_step_t * plan = &tables->steps[pgn_data->first_step];
+    size_t num_spns = 0;
+    for (uint32_t i = 0; i < pgn_data->num_steps; i++)
     {
-        goto end;
+        /* Same SPNs as extract_spn_data() decodes */
+        if (plan[i].start_bit < 0 || plan[i].spn_index == J1939DB_NONE ||
+            !filter_passes(ctx->spn_filter, SPN_FILTER_BITS, plan[i].spn))
+        {
+            continue;
+        }
+
+        if (num_spns < num_columns)
+        {
+            j1939_spn_column_t * column = &columns[num_spns];
+            column->spn = plan[i].spn;
+            j1939simd_extract(&plan[i], data, count, column->value_raw, column->value, column->valid);
+        }
+        num_spns++;
     }
 
-    if (cJSON_AddStringToObject(json_object, "SAName", get_sa_name(get_sa(id))) == NULL)
+    return (int) num_spns;
+}
+
+/**************************************************************************//**
+
+  \brief Get number of the PGN at a position of the PGN table
+
+  \return bool  true if position is within the table
+
+******************************************************************************/
+bool pgn_number_at(const j1939decode_ctx_t * ctx, size_t i, uint32_t * pgn)
+{
+    if (ctx->db->index != NULL)
     {
-        goto end;
+        return j1939index_pgn_number(ctx->db->index, i, pgn);
     }
 
-    if (cJSON_AddNumberToObject(json_object, "DLC", dlc) == NULL)
+    if (i >= ctx->tables->num_pgns)
     {
-        goto end;
+        return false;
     }
+    *pgn = ctx->tables->pgns[i].pgn;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Write the schema of one PGN, with the same SPNs as decoding it gives
 
-    /* Add raw data bytes to JSON object */
-    cJSON_AddItemToObject(json_object, "DataRaw", create_byte_array(data));
+  Unlike decoding, missing database entries are not logged since every PGN is
+  visited.
 
-    /* JSON object for specific PGN data */
-    const cJSON * pgn_data = get_pgn_data(get_pgn(id));
+  \param ctx        decoder context
+  \param writer     JSON writer
+  \param pgn        parameter group number
 
-    /* Decoded flag default to false until set otherwise */
-    cJSON_bool decoded_flag = false;
+  \return bool      true on success
 
-    if (cJSON_IsObject(pgn_data))
+******************************************************************************/
+bool write_schema_pgn(const j1939decode_ctx_t * ctx, j1939json_t * writer, uint32_t pgn)
+{
+    const j1939db_t * tables;
+    const j1939db_pgn_t * pgn_data = find_pgn(ctx, pgn, &tables);
+    if (pgn_data == NULL)
     {
-        /* PGN number found in lookup table */
+        return true;
+    }
 
-        if (cJSON_AddStringToObject(json_object, "PGNName", get_pgn_name(get_pgn(id))) == NULL)
+    j1939_spn_value_t stack_spns[64];
+    j1939_spn_value_t * spns = stack_spns;
+    if (pgn_data->num_steps > sizeof(stack_spns) / sizeof(stack_spns[0]))
+    {
+        spns = ctx_malloc(ctx, pgn_data->num_steps * sizeof(j1939_spn_value_t));
+        if (spns == NULL)
         {
-            goto end;
+            log_msg(ctx, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+            return false;
         }
+    }
+
+    const char * pgn_name = j1939db_string(tables, pgn_data->name);
+    j1939_decoded_t decoded;
+    memset(&decoded, 0, sizeof(decoded));
+    decoded.pgn = pgn;
+    decoded.pgn_name = pgn_name != NULL ? pgn_name : "Unknown";
+    decoded.spns = spns;
 
-        /* JSON object containing list of decoded SPN data */
-        cJSON * spn_object = cJSON_CreateObject();
-        if (spn_object == NULL)
+    const j1939db_step_t * plan = &tables->steps[pgn_data->first_step];
+    for (uint32_t i = 0; pgn_data->num_spns != J1939DB_NONE && i < pgn_data->num_steps; i++)
+    {
+        /* Same SPNs as extract_spn_data() decodes */
+        if (plan[i].start_bit < 0 || plan[i].spn_index == J1939DB_NONE ||
+            !filter_passes(ctx->spn_filter, SPN_FILTER_BITS, plan[i].spn))
         {
-            goto end;
+            continue;
         }
 
-        /* JSON object for SPN list in PGN */
-        const cJSON * spn_list_array = cJSON_GetObjectItemCaseSensitive(pgn_data, "SPNs");
-        if (cJSON_IsArray(spn_list_array))
+        set_spn_value(tables, &plan[i], &tables->spns[plan[i].spn_index], 0, NULL, 0, &spns[decoded.num_spns++]);
+    }
+
+    j1939json_write_schema_pgn(writer, tables, &decoded);
+
+    if (spns != stack_spns)
+    {
+        ctx->allocator.free_fn(ctx->allocator.user, spns);
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Write the database schema as JSON
+
+  \param ctx        decoder context
+  \param buf        output buffer, may be NULL if len is 0
+  \param len        size of output buffer in bytes
+  \param pretty     pretty print output
+
+  \return size_t    length of JSON string, 0 on failure
+
+******************************************************************************/
+size_t write_schema(const j1939decode_ctx_t * ctx, char * buf, size_t len, bool pretty)
+{
+    j1939json_t writer;
+    j1939json_init(&writer, buf, len, pretty);
+    j1939json_begin_schema(&writer, ctx->tables);
+
+    uint32_t last_pgn = J1939DB_NONE;
+    uint32_t pgn;
+    for (size_t i = 0; pgn_number_at(ctx, i, &pgn); i++)
+    {
+        if (pgn == last_pgn || !filter_passes(ctx->pgn_filter, PGN_FILTER_BITS, pgn))
         {
-            uint32_t num_spns = cJSON_GetArraySize(spn_list_array);
-            if (num_spns > 0)
-            {
-                /* One or more SPNs exist for PGN */
-
-                for (uint32_t i = 0; i < num_spns; i++)
-                {
-                    /* Getting SPN number from SPN list in PGN since the SPN number is used as a key only and not included in the SPN data object itself */
-                    uint32_t spn_number = (uint32_t) cJSON_GetArrayItem(spn_list_array, i)->valueint;
-
-                    /* Array of all possible proprietary SPNs */
-                    const uint32_t proprietary_spns[] = {2550, 2551, 3328};
-
-                    /* Check for proprietary SPNs */
-                    if (in_array(spn_number, proprietary_spns, sizeof(proprietary_spns) / sizeof(proprietary_spns[0])))
-                    {
-                        /* TODO: Disabling print to silently ignore proprietary SPNs */
-                        /* log_msg("Skipping decode for proprietary SPN %d", spn_number); */
-                    }
-                    else
-                    {
-                        /* Need to pass SPN starting bit position since it is found in the PGN data object */
-                        uint32_t start_bit;
-                        const cJSON * start_bit_json = cJSON_GetArrayItem(cJSON_GetObjectItemCaseSensitive(pgn_data, "SPNStartBits"), i);
-                        if (cJSON_IsNumber(start_bit_json))
-                        {
-                            if (start_bit_json->valueint < 0)
-                            {
-                                log_msg("Start bit cannot be negative for SPN %d, skipping decode", spn_number);
-                                continue;
-                            }
-
-                            /* Now cast to unsigned */
-                            start_bit = (uint32_t) start_bit_json->valueint;
-                        }
-                        else
-                        {
-                            log_msg("No start bit found in database for SPN %d, skipping decode", spn_number);
-                            continue;
-                        }
-
-                        /* Add SPN data object to SPN list object using SPN number as a key */
-                        char spn_string[7];
-                        snprintf(spn_string, sizeof(spn_string), "%d", spn_number);
-
-                        cJSON * spn_data = extract_spn_data(spn_number, data, start_bit);
-                        if (spn_data != NULL)
-                        {
-                            /* At least one SPN found in database and actually decoded */
-
-                            /* TODO: What criteria should be used to determine if the message should be flagged as "decoded" or not?
-                             * 1. If PGN data found in database?
-                             * 2. If at least one SPN found in database for PGN?
-                             * 3. If at least one SPN, with start bits, found in database for PGN?
-                             * 4. If at least one SPN actually decoded? (i.e. extract_spn_data() did not return NULL)
-                             * Using #4 criteria for now */
-
-                            decoded_flag = true;
-                        }
-                        cJSON_AddItemToObject(spn_object, spn_string, spn_data);
-                    }
-                }
-            }
-            else
-            {
-                log_msg("Empty SPN list found in database for PGN %d", get_pgn(id));
-            }
+            continue;
         }
-        else
+        last_pgn = pgn;
+
+        if (!write_schema_pgn(ctx, &writer, pgn))
         {
-            log_msg("No SPNs found in database for PGN %d", get_pgn(id));
+            return 0;
         }
-
-        /* Add SPN list object to the main JSON object */
-        cJSON_AddItemToObject(json_object, "SPNs", spn_object);
     }
-    else
+
+    j1939json_end_schema(&writer);
+    return j1939json_finish(&writer);
+}
+
+/**************************************************************************//**
+
+  \brief Build JSON string of the database schema
+
+  \param ctx        decoder context
+  \param pretty     pretty print returned JSON string
+
+  \return char *    pointer to the JSON string, NULL on failure
+
+******************************************************************************/
+char * j1939decode_ctx_schema_to_json(j1939decode_ctx_t * ctx, bool pretty)
+{
+    if (!j1939ctx_check_ready(ctx))
     {
-        /* TODO: This print may happen too often when trying to decode non-J1939 data */
-        /* log_msg("PGN %d not found in database", get_pgn(id)); */
+        return NULL;
     }
 
-    if (cJSON_AddBoolToObject(json_object, "Decoded", decoded_flag) == NULL)
+    /* Measure first, the schema is written once so the second pass is not worth avoiding */
+    size_t len = write_schema(ctx, NULL, 0, pretty);
+    if (len == 0)
     {
-        goto end;
+        return NULL;
     }
 
-    /* Print the JSON string
-     * Memory will be allocated so remember to free it when you are done with it! */
-    json_string = pretty ? cJSON_Print(json_object) : cJSON_PrintUnformatted(json_object);
+    char * json_string = ctx_malloc(ctx, len + 1);
     if (json_string == NULL)
     {
-        log_msg("Failed to print JSON string");
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return NULL;
+    }
+
+    if (write_schema(ctx, json_string, len + 1, pretty) != len)
+    {
+        ctx->allocator.free_fn(ctx->allocator.user, json_string);
+        return NULL;
     }
 
-    end:
-    cJSON_Delete(json_object);
     return json_string;
 }
+
+/* Default context variants */
+
+int j1939decode_decode(uint32_t id, uint8_t dlc, const uint64_t * data, j1939_decoded_t * out,
+                       j1939_spn_value_t * spns, size_t cap)
+{
+    return j1939decode_ctx_decode(default_ctx, id, dlc, data, out, spns, cap);
+}
+
+int j1939decode_decode_payload(uint32_t id, const uint8_t * payload, size_t len, j1939_decoded_t * out,
+                               j1939_spn_value_t * spns, size_t cap)
+{
+    return j1939decode_ctx_decode_payload(default_ctx, id, payload, len, out, spns, cap);
+}
+
+char * j1939decode_to_json(uint32_t id, uint8_t dlc, const uint64_t * data, bool pretty)
+{
+    return j1939decode_ctx_to_json(default_ctx, id, dlc, data, pretty);
+}
+
+size_t j1939decode_to_json_buf(uint32_t id, uint8_t dlc, const uint64_t * data, char * buf, size_t len, uint32_t flags)
+{
+    return j1939decode_ctx_to_json_buf(default_ctx, id, dlc, data, buf, len, flags);
+}
+
+size_t j1939decode_encode(uint32_t id, uint8_t dlc, const uint64_t * data, uint32_t format,
+                          uint8_t * buf, size_t len, uint32_t flags)
+{
+    return j1939decode_ctx_encode(default_ctx, id, dlc, data, format, buf, len, flags);
+}
+
+size_t j1939decode_decode_batch(const j1939_frame_t * frames, size_t count, j1939_decoded_t * out,
+                                j1939_spn_value_t * spns, size_t cap)
+{
+    return j1939decode_ctx_decode_batch(default_ctx, frames, count, out, spns, cap);
+}
+
+size_t j1939decode_to_ndjson_batch(const j1939_frame_t * frames, size_t count, char * buf, size_t len, size_t * written)
+{
+    return j1939decode_ctx_to_ndjson_batch(default_ctx, frames, count, buf, len, written);
+}
+
+int j1939decode_decode_columns(uint32_t pgn, const uint64_t * data, size_t count,
+                               j1939_spn_column_t * columns, size_t num_columns)
+{
+    return j1939decode_ctx_decode_columns(default_ctx, pgn, data, count, columns, num_columns);
+}
+
+bool j1939decode_set_profile(uint32_t profile)
+{
+    return j1939decode_ctx_set_profile(default_ctx, profile);
+}
+
+char * j1939decode_schema_to_json(bool pretty)
+{
+    return j1939decode_ctx_schema_to_json(default_ctx, pretty);
+}
+
+bool j1939decode_set_cache(size_t entries, size_t max_len)
+{
+    return j1939decode_ctx_set_cache(default_ctx, entries, max_len);
+}
+
+void j1939decode_stats(j1939decode_stats_t * stats)
+{
+    j1939decode_ctx_stats(default_ctx, stats);
+}
+
+void j1939decode_cache_stats(j1939decode_cache_stats_t * stats)
+{
+    j1939decode_ctx_cache_stats(default_ctx, stats);
+}
+
+bool j1939decode_set_pgn_filter(const uint32_t * pgns, size_t count, bool allow)
+{
+    return j1939decode_ctx_set_pgn_filter(default_ctx, pgns, count, allow);
+}
+
+bool j1939decode_set_spn_filter(const uint32_t * spns, size_t count)
+{
+    return j1939decode_ctx_set_spn_filter(default_ctx, spns, count);
+}
+
+int j1939decode_decode_delta(j1939decode_delta_t * delta, uint32_t id, uint8_t dlc, const uint64_t * data,
+                             uint64_t timestamp_us, j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap)
+{
+    return j1939decode_ctx_decode_delta(default_ctx, delta, id, dlc, data, timestamp_us, out, spns, cap);
+}
+
+size_t j1939decode_delta_to_json_buf(j1939decode_delta_t * delta, uint32_t id, uint8_t dlc, const uint64_t * data,
+                                     uint64_t timestamp_us, char * buf, size_t len, uint32_t flags)
+{
+    return j1939decode_ctx_delta_to_json_buf(default_ctx, delta, id, dlc, data, timestamp_us, buf, len, flags);
+}
+
+int j1939decode_decode_dm(uint32_t id, const uint8_t * payload, size_t len, j1939_dm_t * out, j1939_dtc_t * dtcs,
+                          size_t cap)
+{
+    return j1939decode_ctx_decode_dm(default_ctx, id, payload, len, out, dtcs, cap);
+}
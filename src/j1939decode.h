@@ -7,6 +7,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /* Project version */
 #define J1939DECODE_VERSION_MAJOR 3
@@ -16,21 +17,225 @@ extern "C" {
 /* J1939 digital annex JSON filename */
 #define J1939DECODE_DB "J1939db.json"
 
+/* 29-bit extended CAN identifier mask, SocketCAN flag bits are above this */
+#define J1939DECODE_ID_MASK 0x1FFFFFFFU
+
+/* Longest payload that can be decoded, a J1939-21 transport protocol message of 255 packets of 7 bytes */
+#define J1939DECODE_MAX_PAYLOAD 1785U
+
+/* Default longest output kept by the output cache */
+#define J1939DECODE_CACHE_LEN 4096U
+
+/* Cycle time histogram buckets of per-PGN statistics, bucket i counts cycle times of up to 2^i ms that are longer
+ * than those of bucket i - 1, and the last bucket all longer cycle times */
+#define J1939DECODE_CYCLE_BUCKETS 16U
+
+/* Database open flags */
+#define J1939DECODE_DB_LAZY (1U << 0U)          /* load the tables of each PGN the first time it is decoded */
+
+/* JSON output flags */
+#define J1939DECODE_JSON_PRETTY (1U << 0U)      /* pretty print JSON output */
+
+/* Output formats of j1939decode_encode() */
+#define J1939DECODE_FORMAT_JSON 0U              /* the same as j1939decode_to_json_buf() */
+#define J1939DECODE_FORMAT_CBOR 1U              /* RFC 8949 CBOR map with the fields of JSON output */
+#define J1939DECODE_FORMAT_MSGPACK 2U           /* MessagePack map with the fields of JSON output */
+#define J1939DECODE_FORMAT_PROTOBUF 3U          /* protobuf Message of j1939decode.proto */
+
+/* Binary output flags */
+#define J1939DECODE_ENCODE_INT_KEYS (1U << 1U)  /* CBOR and MessagePack map keys are j1939decode.proto field numbers
+                                                 * and SPN numbers instead of strings */
+
+/* JSON output profiles, selecting the fields written for each message */
+#define J1939DECODE_PROFILE_FULL 0U             /* all message fields and SPN database metadata */
+#define J1939DECODE_PROFILE_COMPACT 1U          /* ID, PGN, SA and Decoded, SPN ValueDecoded, Units and Valid */
+#define J1939DECODE_PROFILE_RAW 2U              /* ID, PGN, SA and Decoded, SPN raw values instead of objects */
+
+/* Log levels, in increasing order of severity */
+#define J1939DECODE_LOG_DEBUG 0U                /* frames with a PGN that is not in the database */
+#define J1939DECODE_LOG_INFO 1U
+#define J1939DECODE_LOG_WARNING 2U              /* database records with missing fields */
+#define J1939DECODE_LOG_ERROR 3U                /* failed calls */
+#define J1939DECODE_LOG_NONE 4U                 /* minimum level that disables logging */
+
+/* CAN frame, memory layout compatible with Linux SocketCAN struct can_frame */
+typedef struct
+{
+    uint32_t id;                        /* CAN identifier, bits above J1939DECODE_ID_MASK are ignored */
+    uint8_t dlc;                        /* data length code */
+    uint8_t reserved[3];
+    uint8_t data[8];                    /* CAN data bytes */
+} j1939_frame_t;
+
+/* Opaque database record of a decoded SPN */
+struct j1939db_spn;
+
+/* Decoded suspect parameter number */
+typedef struct
+{
+    uint32_t spn;                       /* suspect parameter number */
+    const char * name;                  /* descriptive name, "" if not in database */
+    const char * units;                 /* units of the decoded value, "" if not in database */
+    uint32_t start_bit;                 /* starting bit number of data within 64 bit data field */
+    uint32_t length;                    /* length of data in bits, 0 if variable */
+    uint64_t value_raw;                 /* raw data value without resolution and offset applied */
+    double value;                       /* decoded data value */
+    bool valid;                         /* decoded value is within operational range */
+    const char * state;                 /* state name of the raw value from the database bit decodings, NULL if none */
+    const char * text;                  /* characters of ASCII SPNs up to the first unprintable character, pointing
+                                         * into the decoded data and not null terminated, NULL if not ASCII */
+    size_t text_len;                    /* number of characters in text */
+    const struct j1939db_spn * record;  /* database record, for library internal use */
+} j1939_spn_value_t;
+
+/* Decoded J1939 message */
+typedef struct
+{
+    uint32_t id;                        /* CAN identifier */
+    uint8_t priority;                   /* message priority */
+    uint32_t pgn;                       /* parameter group number */
+    uint8_t sa;                         /* source address */
+    uint8_t dlc;                        /* data length code, at most 8 for longer payloads */
+    const char * pgn_name;              /* descriptive PGN name, NULL if PGN is not in database */
+    const char * sa_name;               /* descriptive source address name */
+    bool decoded;                       /* one or more SPNs decoded */
+    bool filtered;                      /* rejected by the PGN filter or unchanged in change detection,
+                                         * only the identifier fields are set */
+    size_t len;                         /* payload length in bytes, the same as dlc for CAN frames */
+    size_t num_spns;                    /* number of SPNs decoded, may be more than were written */
+    j1939_spn_value_t * spns;           /* caller supplied SPN array */
+} j1939_decoded_t;
+
+/* Column of one SPN decoded from many frames of the same PGN */
+typedef struct
+{
+    uint32_t spn;                       /* suspect parameter number, set by the decoder */
+    uint64_t * value_raw;               /* caller supplied array of raw data values, one per frame */
+    double * value;                     /* caller supplied array of decoded data values, one per frame */
+    uint8_t * valid;                    /* caller supplied validity bitmap, bit (i % 8) of byte (i / 8) is set if
+                                         * the value of frame i is within operational range */
+} j1939_spn_column_t;
+
+/* Counters of the output cache of a context */
+typedef struct
+{
+    uint64_t hits;                      /* outputs copied from the cache */
+    uint64_t misses;                    /* outputs encoded, including those too long to be cached */
+    uint64_t evictions;                 /* outputs evicted to make room */
+    size_t count;                       /* outputs cached */
+} j1939decode_cache_stats_t;
+
+/* Counters of a context, or of all contexts of a database */
+typedef struct
+{
+    uint64_t frames;                    /* frames decoded or written, not counting frames rejected by the PGN filter */
+    uint64_t unknown_pgns;              /* frames with a PGN that is not in the database */
+    uint64_t incomplete_pgns;           /* frames of PGNs without a name or without SPNs in the database */
+    uint64_t unknown_spns;              /* SPNs without a start bit or SPN record in the database */
+    uint64_t unknown_sas;               /* frames from a source address without a name in the database */
+    uint64_t spns;                      /* SPNs decoded */
+    uint64_t spns_out_of_range;         /* SPNs decoded outside their operational range */
+    uint64_t allocations;               /* memory allocations by the context */
+    uint64_t output_bytes;              /* bytes of JSON and binary output written */
+} j1939decode_stats_t;
+
+/* Frame count and cycle times of one PGN from one source address */
+typedef struct
+{
+    uint32_t pgn;
+    uint8_t sa;
+    uint64_t frames;
+    uint64_t cycles[J1939DECODE_CYCLE_BUCKETS];     /* cycle times counted in each bucket */
+    uint64_t cycle_sum_us;                          /* sum of cycle times counted */
+} j1939decode_pgn_stats_t;
+
 /* Log function pointer type */
 typedef void (*log_fn_ptr)(const char *);
 
-/* Set log function handler */
+/* Log handler type, with the user pointer it was set with and the J1939DECODE_LOG_ level of the message */
+typedef void (*log_handler_ptr)(void * user, uint32_t level, const char * msg);
+
+/* Memory allocator used instead of malloc() and free()
+ * malloc_fn must return memory suitably aligned for any type, like malloc(), or NULL on failure
+ * free_fn may be a no-op, for example for a bump arena that is reset after each frame or batch */
+typedef struct
+{
+    void * (*malloc_fn)(void * user, size_t size);
+    void (*free_fn)(void * user, void * ptr);
+    void * user;                        /* passed to malloc_fn and free_fn */
+} j1939decode_allocator_t;
+
+/* Opaque shareable J1939 database handle */
+typedef struct j1939decode_db j1939decode_db_t;
+
+/* Opaque decoder context */
+typedef struct j1939decode_ctx j1939decode_ctx_t;
+
+/* Set process-wide log function handler, used by contexts without their own handler */
 void j1939decode_set_log_fn(log_fn_ptr fn);
 
+/* Set process-wide log handler and its user pointer, NULL to print to stderr */
+void j1939decode_set_log_handler(log_handler_ptr fn, void * user);
+
+/* Set minimum J1939DECODE_LOG_ level of messages passed to the process-wide handler, J1939DECODE_LOG_INFO by default
+ * Messages below the level are not formatted */
+void j1939decode_set_log_level(uint32_t level);
+
+/* Set allocator used by j1939decode_init() for the database and the default context, NULL to use malloc() and free()
+ * Call before j1939decode_init(), strings returned by j1939decode_to_json() are then allocated with it */
+void j1939decode_set_allocator(const j1939decode_allocator_t * allocator);
+
+/* Set J1939DECODE_DB_ flags used by j1939decode_init() to open the database, call before j1939decode_init() */
+void j1939decode_set_db_flags(uint32_t flags);
+
+/* Set overlay files merged into the database by j1939decode_init(), j1939decode_init_file() and j1939decode_reload()
+ * The array and the strings must stay valid while they are set, NULL for none. The database is then always loaded up
+ * front, see j1939decode_db_open_overlays(). Not used by builds with a static database */
+void j1939decode_set_overlays(const char * const * overlays, size_t num_overlays);
+
 /* Print version string */
 const char * j1939decode_version(void);
 
-/* Initialize and allocate memory for J1939 lookup table */
+/* Initialize and allocate memory for J1939 lookup table
+ * Builds with a static database open the image compiled into the library, no file is read */
 void j1939decode_init(void);
 
+/* Initialize J1939 lookup table from a JSON or binary database file
+ * Binary database images are memory-mapped read-only instead of being parsed */
+void j1939decode_init_file(const char * filename);
+
+/* Replace the loaded J1939 lookup table with a JSON or binary database file without stopping decoding
+ * The file is opened by the calling thread while decoding goes on, and the default context moves to the new
+ * database at the start of its next call. Initializes like j1939decode_init_file() if nothing is loaded
+ * Returns false and keeps the loaded table if the file cannot be opened */
+bool j1939decode_reload(const char * filename);
+
+/* Save loaded J1939 lookup table as a binary database image
+ * Returns true on success */
+bool j1939decode_save_db(const char * filename);
+
 /* Deinitialize and free memory for J1939 lookup table */
 void j1939decode_deinit(void);
 
+/* Set JSON output profile of the default context, see j1939decode_ctx_set_profile() */
+bool j1939decode_set_profile(uint32_t profile);
+
+/* Build JSON string of the database metadata left out by the compact and raw profiles
+ * Memory will be allocated so remember to free the string when you are done with it! */
+char * j1939decode_schema_to_json(bool pretty);
+
+/* Get counters of the default context, see j1939decode_ctx_stats() */
+void j1939decode_stats(j1939decode_stats_t * stats);
+
+/* Set output cache of the default context and get its counters, see j1939decode_ctx_set_cache() */
+bool j1939decode_set_cache(size_t entries, size_t max_len);
+void j1939decode_cache_stats(j1939decode_cache_stats_t * stats);
+
+/* Set PGN filter and SPN allowlist of the default context, see j1939decode_ctx_set_pgn_filter()
+ * Call after j1939decode_init(), filters are removed when the database is loaded again */
+bool j1939decode_set_pgn_filter(const uint32_t * pgns, size_t count, bool allow);
+bool j1939decode_set_spn_filter(const uint32_t * spns, size_t count);
+
 /* Build JSON string for j1939 decoded data
  * Memory will be allocated so remember to free the string when you are done with it! */
 /* Example JSON output format:
@@ -66,6 +271,219 @@ void j1939decode_deinit(void);
  */
 char * j1939decode_to_json(uint32_t id, uint8_t dlc, const uint64_t * data, bool pretty);
 
+/* Write JSON string for j1939 decoded data into a caller supplied buffer without allocating memory
+ * Output is the same as j1939decode_to_json(), flags is a combination of J1939DECODE_JSON_ flags
+ * Returns length of the JSON string not counting the null terminator, like snprintf()
+ * If this is not less than len the output was truncated, and a buffer of at least the returned length + 1 is needed
+ * Returns 0 on error */
+size_t j1939decode_to_json_buf(uint32_t id, uint8_t dlc, const uint64_t * data, char * buf, size_t len, uint32_t flags);
+
+/* Encode j1939 decoded data into a caller supplied buffer without allocating memory, in one of the J1939DECODE_FORMAT_
+ * formats, flags is a combination of J1939DECODE_JSON_ and J1939DECODE_ENCODE_ flags
+ * Binary formats hold the same fields as JSON output and the output profile applies, doubles are written natively
+ * in single precision when that is exact, and the output is not null terminated
+ * Returns length of the output, if this is more than len the output was truncated (JSON: not less than len)
+ * Returns 0 on error */
+size_t j1939decode_encode(uint32_t id, uint8_t dlc, const uint64_t * data, uint32_t format,
+                          uint8_t * buf, size_t len, uint32_t flags);
+
+/* Decode j1939 data into caller supplied structures without allocating memory
+ * Up to cap SPNs are written to spns, check out->num_spns to detect if more were available
+ * Returned name strings point into the lookup table and stay valid until j1939decode_deinit()
+ * Returns number of SPNs written, or -1 on error */
+int j1939decode_decode(uint32_t id, uint8_t dlc, const uint64_t * data, j1939_decoded_t * out,
+                       j1939_spn_value_t * spns, size_t cap);
+
+/* Decode a payload of any length, such as a reassembled transport protocol message or a CAN FD frame
+ * SPNs at any start bit are decoded, SPNs extending past the end of the payload are skipped
+ * Returns number of SPNs written, or -1 on error */
+int j1939decode_decode_payload(uint32_t id, const uint8_t * payload, size_t len, j1939_decoded_t * out,
+                               j1939_spn_value_t * spns, size_t cap);
+
+/* Decode an array of CAN frames into caller supplied structures without allocating memory
+ * out must have room for count messages, and all decoded SPNs are written to the spns array
+ * Decoding stops early if the SPNs of the next frame may not fit, call again with the remaining frames
+ * At least one frame is decoded when count is not 0, with num_spns above cap if its SPNs do not fit in the array
+ * Frames with a DLC greater than 8 are logged and reported with only their identifier fields set
+ * Returns number of frames decoded */
+size_t j1939decode_decode_batch(const j1939_frame_t * frames, size_t count, j1939_decoded_t * out,
+                                j1939_spn_value_t * spns, size_t cap);
+
+/* Decode an array of CAN frames into newline delimited JSON (one compact JSON object per line)
+ * Output stops early if the next frame does not fit in the buffer, call again with the remaining frames
+ * written is set to the number of bytes written, not counting the null terminator
+ * Frames with a DLC greater than 8 are logged and skipped without a line
+ * Returns number of frames written or skipped */
+size_t j1939decode_to_ndjson_batch(const j1939_frame_t * frames, size_t count, char * buf, size_t len, size_t * written);
+
+/* Decode the data fields of many frames of the same PGN into one column per SPN, using SIMD kernels where available
+ * Each column needs arrays of count values and a validity bitmap of (count + 7) / 8 bytes
+ * Up to num_columns columns are written, for the same SPNs in the same order as j1939decode_decode()
+ * Returns number of SPN columns of the PGN, which may be more than were written, or -1 on error */
+int j1939decode_decode_columns(uint32_t pgn, const uint64_t * data, size_t count,
+                               j1939_spn_column_t * columns, size_t num_columns);
+
+/* Reentrant API
+ * A database handle is immutable once loaded and may be shared by any number of contexts and threads.
+ * Each context must only be used by one thread at a time, create one context per thread.
+ * The functions above use a default context set up by j1939decode_init() */
+
+/* Load J1939 database from a JSON or binary database file
+ * Returns database handle with one reference, or NULL on failure */
+j1939decode_db_t * j1939decode_db_load(const char * filename);
+
+/* Load J1939 database using an allocator, NULL to use malloc() and free()
+ * The database is a single allocation, made once and freed once with the last reference */
+j1939decode_db_t * j1939decode_db_load_with_allocator(const char * filename, const j1939decode_allocator_t * allocator);
+
+/* Open J1939 database with J1939DECODE_DB_ flags using an allocator, NULL to use malloc() and free()
+ * With J1939DECODE_DB_LAZY only an index is built when opening. JSON databases then parse and compile each
+ * PGN and its SPNs on first use, binary images validate each PGN on first use. Lazily loaded databases may
+ * still be shared by any number of threads, but cannot be saved as binary images */
+j1939decode_db_t * j1939decode_db_open(const char * filename, uint32_t flags, const j1939decode_allocator_t * allocator);
+
+/* Open J1939 database from a JSON database file with JSON overlay files merged into it, such as OEM definitions
+ * Overlays have the tables of a database, and each of their PGNs, SPNs, bit decodings and source addresses replaces
+ * the entry with the same number or is added, later overlays winning. PGNs defined only for some source addresses
+ * go in "J1939PGNSAdb", keyed by PGN and then by source address, and are decoded instead of the "J1939PGNdb" entry
+ * of the same PGN, which must exist, for frames from those addresses. The database is always loaded up front
+ * Returns database handle with one reference, or NULL on failure */
+j1939decode_db_t * j1939decode_db_open_overlays(const char * filename, const char * const * overlays,
+                                                size_t num_overlays, const j1939decode_allocator_t * allocator);
+
+/* Open J1939 database from a binary image in memory, such as one compiled into flash, with J1939DECODE_DB_ flags
+ * The image must be 8 byte aligned and stay valid and unchanged until the database is freed, its tables are read
+ * in place and only the handle is allocated. Returns database handle with one reference, or NULL on failure */
+j1939decode_db_t * j1939decode_db_open_image(const void * image, size_t size, uint32_t flags,
+                                             const j1939decode_allocator_t * allocator);
+
+/* Add a reference to a database handle */
+j1939decode_db_t * j1939decode_db_retain(j1939decode_db_t * db);
+
+/* Drop a reference to a database handle, the database is freed with the last reference */
+void j1939decode_db_release(j1939decode_db_t * db);
+
+/* Replace a database with new_db without stopping decoding, new_db gets a reference from db
+ * Every context of db moves to the newest replacement at the start of its next call, never waiting for another
+ * thread, and db is freed once its last context has moved and its last reference is released. new_db must not
+ * have replaced or been replaced by a database before. Output caches are cleared when a context moves, reset
+ * change detection state if the SPNs of tracked PGNs changed. Returns true if the replacement was published */
+bool j1939decode_db_replace(j1939decode_db_t * db, j1939decode_db_t * new_db);
+
+/* Save J1939 database as a binary database image
+ * Returns true on success */
+bool j1939decode_db_save(const j1939decode_db_t * db, const char * filename);
+
+/* Create decoder context, the context keeps its own reference to the database
+ * Returns NULL on failure */
+j1939decode_ctx_t * j1939decode_ctx_create(j1939decode_db_t * db);
+
+/* Create decoder context using an allocator, NULL to use malloc() and free()
+ * The allocator is used for the context itself, temporary buffers and strings returned by j1939decode_ctx_to_json() */
+j1939decode_ctx_t * j1939decode_ctx_create_with_allocator(j1939decode_db_t * db, const j1939decode_allocator_t * allocator);
+
+/* Destroy decoder context */
+void j1939decode_ctx_destroy(j1939decode_ctx_t * ctx);
+
+/* Set log function handler for a context, NULL to use the process-wide handler */
+void j1939decode_ctx_set_log_fn(j1939decode_ctx_t * ctx, log_fn_ptr fn);
+
+/* Set log handler and its user pointer for a context, NULL to use the process-wide handler */
+void j1939decode_ctx_set_log_handler(j1939decode_ctx_t * ctx, log_handler_ptr fn, void * user);
+
+/* Set minimum J1939DECODE_LOG_ level of messages passed to the context's own handler
+ * J1939DECODE_LOG_INFO by default, contexts without their own handler use the process-wide level */
+void j1939decode_ctx_set_log_level(j1939decode_ctx_t * ctx, uint32_t level);
+
+/* Set PGN filter of a context from an array of PGNs, NULL to remove the filter
+ * With allow true only the listed PGNs are decoded, otherwise all PGNs except the listed ones are decoded
+ * Frames rejected by the filter are skipped before any database lookup, decode functions return them with
+ * only the identifier fields set and filtered true, j1939decode_ctx_to_json() returns NULL without logging,
+ * j1939decode_ctx_to_json_buf() returns 0 and j1939decode_ctx_to_ndjson_batch() writes no line for them
+ * Returns false if a PGN is out of range or memory could not be allocated, the previous filter is then kept */
+bool j1939decode_ctx_set_pgn_filter(j1939decode_ctx_t * ctx, const uint32_t * pgns, size_t count, bool allow);
+
+/* Set SPN allowlist of a context from an array of SPNs, NULL to decode all SPNs
+ * SPNs not in the list are never extracted, and are left out of decoded messages, JSON output and columns
+ * Returns false if an SPN is out of range or memory could not be allocated, the previous filter is then kept */
+bool j1939decode_ctx_set_spn_filter(j1939decode_ctx_t * ctx, const uint32_t * spns, size_t count);
+
+/* Set JSON output profile of a context, one of the J1939DECODE_PROFILE_ values
+ * Fields left out by the profile are never looked up or formatted
+ * Returns false for an unknown profile */
+bool j1939decode_ctx_set_profile(j1939decode_ctx_t * ctx, uint32_t profile);
+
+/* Cache encoded output of up to entries frames in a context, so that repeats of a frame are copied instead of decoded
+ * Entries are keyed on the identifier, DLC and all 8 data bytes together with the output format and flags, and hold
+ * outputs of up to max_len bytes, 0 for J1939DECODE_CACHE_LEN. All entries are allocated up front and the least
+ * recently hit are evicted first (CLOCK), entries 0 removes the cache. The cache is cleared when the profile or the
+ * SPN filter changes. Change detection and the structure decode functions do not use the cache
+ * Returns false if the size is out of range or memory could not be allocated, the previous cache is then kept */
+bool j1939decode_ctx_set_cache(j1939decode_ctx_t * ctx, size_t entries, size_t max_len);
+
+/* Get counters of the output cache of a context, all 0 without a cache */
+void j1939decode_ctx_cache_stats(const j1939decode_ctx_t * ctx, j1939decode_cache_stats_t * stats);
+
+/* Get counters of a context, which may be called from any thread while the context is in use
+ * Counters are only written by the thread using the context, so counting takes no locks or atomic read-modify-writes
+ * Frames copied from the output cache are counted as frames and output, but not as database misses or SPNs */
+void j1939decode_ctx_stats(const j1939decode_ctx_t * ctx, j1939decode_stats_t * stats);
+
+/* Get the sum of the counters of all contexts created with a database, including contexts already destroyed
+ * A context moved to a replacement database counts the frames decoded before the move for the old database */
+void j1939decode_db_stats(j1939decode_db_t * db, j1939decode_stats_t * stats);
+
+/* Count frames and cycle times of up to capacity PGN and source address pairs in a context, 0 to stop counting
+ * Frames of pairs beyond capacity are not counted. Counting again starts over
+ * Returns false if the capacity is out of range or memory could not be allocated */
+bool j1939decode_ctx_set_pgn_stats(j1939decode_ctx_t * ctx, size_t capacity);
+
+/* Set receive time of the frame decoded next, for the cycle times of per-PGN statistics
+ * Timestamps are in microseconds and only need to be monotonic, cycle times are not counted before this is called */
+void j1939decode_ctx_set_time(j1939decode_ctx_t * ctx, uint64_t timestamp_us);
+
+/* Get per-PGN statistics of a context, which may be called from any thread while the context is in use, but not
+ * while j1939decode_ctx_set_pgn_stats() is called. Up to cap pairs are written to stats in no particular order
+ * Returns number of pairs counted, which may be more than were written */
+size_t j1939decode_ctx_pgn_stats(const j1939decode_ctx_t * ctx, j1939decode_pgn_stats_t * stats, size_t cap);
+
+/* Write counters and optional per-PGN statistics in the Prometheus text exposition format, pgns may be NULL
+ * Returns length of the text not counting the null terminator, like snprintf()
+ * If this is not less than len the output was truncated */
+size_t j1939decode_stats_to_prometheus(const j1939decode_stats_t * stats, const j1939decode_pgn_stats_t * pgns,
+                                       size_t num_pgns, char * buf, size_t len);
+
+/* Build JSON string of the database metadata, so consumers of compact or raw output can fetch it once
+ * Holds the source address names, and for each PGN its name and the metadata of each SPN as in the full profile
+ * {
+ *     "SANames":  { "0": "Engine #1", ... },
+ *     "PGNs":     { "65265": { "PGNName": "Cruise Control/Vehicle Speed 1", "SPNs": { "84": { "Name": ..., ... } } } }
+ * }
+ * The context's PGN and SPN filters apply, and lazily loaded databases load all PGNs
+ * Memory will be allocated so remember to free the string when you are done with it! */
+char * j1939decode_ctx_schema_to_json(j1939decode_ctx_t * ctx, bool pretty);
+
+/* Get database handle used by a context, no reference is added */
+j1939decode_db_t * j1939decode_ctx_db(const j1939decode_ctx_t * ctx);
+
+/* Context variants of the decode functions above
+ * Returned name strings stay valid while the context's database is referenced */
+char * j1939decode_ctx_to_json(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data, bool pretty);
+size_t j1939decode_ctx_to_json_buf(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                                   char * buf, size_t len, uint32_t flags);
+size_t j1939decode_ctx_encode(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data, uint32_t format,
+                              uint8_t * buf, size_t len, uint32_t flags);
+int j1939decode_ctx_decode(j1939decode_ctx_t * ctx, uint32_t id, uint8_t dlc, const uint64_t * data,
+                           j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap);
+int j1939decode_ctx_decode_payload(j1939decode_ctx_t * ctx, uint32_t id, const uint8_t * payload, size_t len,
+                                   j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap);
+size_t j1939decode_ctx_decode_batch(j1939decode_ctx_t * ctx, const j1939_frame_t * frames, size_t count,
+                                    j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap);
+size_t j1939decode_ctx_to_ndjson_batch(j1939decode_ctx_t * ctx, const j1939_frame_t * frames, size_t count,
+                                       char * buf, size_t len, size_t * written);
+int j1939decode_ctx_decode_columns(j1939decode_ctx_t * ctx, uint32_t pgn, const uint64_t * data, size_t count,
+                                   j1939_spn_column_t * columns, size_t num_columns);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "j1939delta.h"
+#include "j1939ctx.h"
+
+/* Largest number of slots, keys are hashed to 32 bits */
+#define DELTA_MAX_SLOTS     (1U << 30U)
+
+/* Static helper functions */
+static void log_msg(uint32_t level, const char * fmt, ...);
+
+static inline uint32_t entry_key(uint8_t sa, uint32_t pgn)
+{
+    /* 18-bit PGN and 8-bit source address, never 0 */
+    return (((uint32_t) sa << 18U) | pgn) + 1U;
+}
+
+static inline uint32_t entry_slot(const j1939decode_delta_t * delta, uint32_t key)
+{
+    /* Fibonacci hashing, taking the well mixed high bits of the product */
+    return (uint32_t) (key * 2654435769U) >> delta->shift;
+}
+
+/**************************************************************************//**
+
+  \brief Log formatted message to the process-wide handler
+
+  \return void
+
+******************************************************************************/
+void log_msg(uint32_t level, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    j1939ctx_vlog(NULL, level, fmt, args);
+    va_end(args);
+}
+
+/**************************************************************************//**
+
+  \brief Create change detection state
+
+  \param capacity                   maximum number of source address and PGN pairs
+  \param allocator                  allocator for the state, NULL to use malloc() and free()
+
+  \return j1939decode_delta_t *     pointer to change detection state, NULL on failure
+
+******************************************************************************/
+j1939decode_delta_t * j1939decode_delta_create(size_t capacity, const j1939decode_allocator_t * allocator)
+{
+    if (capacity == 0 || capacity > DELTA_MAX_SLOTS / 2)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Invalid change detection capacity");
+        return NULL;
+    }
+
+    /* Keep the table at most half full so that probe sequences stay short */
+    uint32_t num_slots = 2;
+    uint32_t shift = 31;
+    while (num_slots < capacity * 2)
+    {
+        num_slots *= 2;
+        shift--;
+    }
+
+    /* State and entries in one allocation, entries are 8 byte aligned */
+    size_t entries_offset = (sizeof(j1939decode_delta_t) + 7) & ~(size_t) 7;
+    size_t size = entries_offset + num_slots * sizeof(j1939delta_entry_t);
+
+    allocator = j1939ctx_allocator(allocator);
+    j1939decode_delta_t * delta = allocator->malloc_fn(allocator->user, size);
+    if (delta == NULL)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return NULL;
+    }
+
+    delta->allocator = *allocator;
+    delta->deadband = 0;
+    delta->heartbeat_us = 0;
+    delta->capacity = capacity;
+    delta->num_slots = num_slots;
+    delta->shift = shift;
+    delta->entries = (j1939delta_entry_t *) ((uint8_t *) delta + entries_offset);
+    j1939decode_delta_reset(delta);
+
+    return delta;
+}
+
+/**************************************************************************//**
+
+  \brief Free change detection state
+
+  \return void
+
+******************************************************************************/
+void j1939decode_delta_destroy(j1939decode_delta_t * delta)
+{
+    if (delta == NULL)
+    {
+        return;
+    }
+
+    delta->allocator.free_fn(delta->allocator.user, delta);
+}
+
+/**************************************************************************//**
+
+  \brief Forget all payloads
+
+  \return void
+
+******************************************************************************/
+void j1939decode_delta_reset(j1939decode_delta_t * delta)
+{
+    delta->count = 0;
+    delta->full = false;
+    memset(delta->entries, 0, delta->num_slots * sizeof(j1939delta_entry_t));
+}
+
+/**************************************************************************//**
+
+  \brief Set deadband on decoded values
+
+  \return void
+
+******************************************************************************/
+void j1939decode_delta_set_deadband(j1939decode_delta_t * delta, double deadband)
+{
+    delta->deadband = deadband > 0 ? deadband : 0;
+}
+
+/**************************************************************************//**
+
+  \brief Set heartbeat interval
+
+  \return void
+
+******************************************************************************/
+void j1939decode_delta_set_heartbeat(j1939decode_delta_t * delta, uint64_t interval_us)
+{
+    delta->heartbeat_us = interval_us;
+}
+
+/**************************************************************************//**
+
+  \brief Get number of source address and PGN pairs tracked
+
+  \return size_t    number of entries in use
+
+******************************************************************************/
+size_t j1939decode_delta_count(const j1939decode_delta_t * delta)
+{
+    return delta->count;
+}
+
+/**************************************************************************//**
+
+  \brief Find change detection entry, inserting an empty entry if not found
+
+  \param delta      change detection state
+  \param sa         source address
+  \param pgn        parameter group number
+  \param inserted   set to true if the entry was inserted
+
+  \return j1939delta_entry_t *  pointer to entry, NULL if not found and the table is full
+
+******************************************************************************/
+j1939delta_entry_t * j1939delta_find(j1939decode_delta_t * delta, uint8_t sa, uint32_t pgn, bool * inserted)
+{
+    uint32_t key = entry_key(sa, pgn);
+    uint32_t slot = entry_slot(delta, key);
+
+    *inserted = false;
+
+    /* Linear probing, the table always has empty slots so the search ends */
+    while (delta->entries[slot].key != 0)
+    {
+        if (delta->entries[slot].key == key)
+        {
+            return &delta->entries[slot];
+        }
+        slot = (slot + 1) & (delta->num_slots - 1);
+    }
+
+    if (delta->count >= delta->capacity)
+    {
+        if (!delta->full)
+        {
+            log_msg(J1939DECODE_LOG_WARNING,
+                    "Change detection table is full, decoding new source address and PGN pairs in full");
+            delta->full = true;
+        }
+        return NULL;
+    }
+
+    j1939delta_entry_t * entry = &delta->entries[slot];
+    memset(entry, 0, sizeof(*entry));
+    entry->key = key;
+    delta->count++;
+    *inserted = true;
+    return entry;
+}
@@ -0,0 +1,70 @@
+#ifndef J1939DELTA_H
+#define J1939DELTA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939decode.h"
+
+/* Opaque change detection state, one entry per source address and PGN */
+typedef struct j1939decode_delta j1939decode_delta_t;
+
+/* Change detection
+ * The last payload of each source address and PGN is kept in a fixed size open addressed table, with no
+ * allocation after j1939decode_delta_create(). Frames whose payload bits covered by SPNs are unchanged are
+ * skipped before any database lookup, otherwise only the SPNs whose raw value changed are decoded.
+ * Timestamps are supplied by the caller in microseconds and only need to be monotonic
+ * Reset the state after changing the SPN filter, the payload bits compared are fixed when a pair is first seen */
+
+/* Create change detection state for up to capacity source address and PGN pairs, allocator may be NULL to use
+ * malloc() and free(). Frames of pairs beyond capacity are always decoded in full
+ * Returns NULL on failure */
+j1939decode_delta_t * j1939decode_delta_create(size_t capacity, const j1939decode_allocator_t * allocator);
+
+/* Free change detection state */
+void j1939decode_delta_destroy(j1939decode_delta_t * delta);
+
+/* Forget all payloads, so the next frame of every pair is decoded in full */
+void j1939decode_delta_reset(j1939decode_delta_t * delta);
+
+/* Only report SPNs whose decoded value moved more than deadband from the value last reported, 0 by default
+ * Changes in validity are always reported */
+void j1939decode_delta_set_deadband(j1939decode_delta_t * delta, double deadband);
+
+/* Report all SPNs of a pair at least every interval_us even if unchanged, 0 to disable, the default */
+void j1939decode_delta_set_heartbeat(j1939decode_delta_t * delta, uint64_t interval_us);
+
+/* Number of source address and PGN pairs tracked */
+size_t j1939decode_delta_count(const j1939decode_delta_t * delta);
+
+/* Decode only the SPNs that changed since they were last reported, using the default context
+ * Unchanged frames are returned with only the identifier fields set and filtered true, like frames rejected by
+ * the PGN filter. The first frame of each pair, and frames when the heartbeat is due, report all SPNs
+ * Returns number of SPNs written, or -1 on error */
+int j1939decode_decode_delta(j1939decode_delta_t * delta, uint32_t id, uint8_t dlc, const uint64_t * data,
+                             uint64_t timestamp_us, j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap);
+
+/* Write JSON of only the SPNs that changed since they were last reported into a caller supplied buffer
+ * Returns length of the JSON string like j1939decode_to_json_buf(), or 0 if the frame is unchanged or on error */
+size_t j1939decode_delta_to_json_buf(j1939decode_delta_t * delta, uint32_t id, uint8_t dlc, const uint64_t * data,
+                                     uint64_t timestamp_us, char * buf, size_t len, uint32_t flags);
+
+/* Context variants, the same change detection state must not be used by two threads at once */
+int j1939decode_ctx_decode_delta(j1939decode_ctx_t * ctx, j1939decode_delta_t * delta, uint32_t id, uint8_t dlc,
+                                 const uint64_t * data, uint64_t timestamp_us,
+                                 j1939_decoded_t * out, j1939_spn_value_t * spns, size_t cap);
+
+size_t j1939decode_ctx_delta_to_json_buf(j1939decode_ctx_t * ctx, j1939decode_delta_t * delta, uint32_t id,
+                                         uint8_t dlc, const uint64_t * data, uint64_t timestamp_us,
+                                         char * buf, size_t len, uint32_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939DELTA_H
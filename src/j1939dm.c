@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "j1939dm.h"
+#include "j1939ctx.h"
+
+/* Lamp status bytes in front of the DTCs */
+#define DM_LAMPS_LEN        2U
+
+/* Bytes of each DTC */
+#define DM_DTC_LEN          4U
+
+/* Static helper functions */
+static void log_msg(const j1939decode_ctx_t * ctx, uint32_t level, const char * fmt, ...);
+static void unpack_lamps(const uint8_t * payload, j1939_dm_lamps_t * lamps);
+static bool unpack_dtc(const j1939decode_ctx_t * ctx, const uint8_t * p, j1939_dtc_t * dtc);
+
+/**************************************************************************//**
+
+  \brief Log formatted message to the context's handler
+
+  \return void
+
+******************************************************************************/
+void log_msg(const j1939decode_ctx_t * ctx, uint32_t level, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    j1939ctx_vlog(ctx, level, fmt, args);
+    va_end(args);
+}
+
+/**************************************************************************//**
+
+  \brief Unpack lamp status and flash bytes, each lamp is two bits from the most significant bits down
+
+  \return void
+
+******************************************************************************/
+void unpack_lamps(const uint8_t * payload, j1939_dm_lamps_t * lamps)
+{
+    lamps->mil = (uint8_t) ((payload[0] >> 6U) & 3U);
+    lamps->red_stop = (uint8_t) ((payload[0] >> 4U) & 3U);
+    lamps->amber_warning = (uint8_t) ((payload[0] >> 2U) & 3U);
+    lamps->protect = (uint8_t) (payload[0] & 3U);
+    lamps->mil_flash = (uint8_t) ((payload[1] >> 6U) & 3U);
+    lamps->red_stop_flash = (uint8_t) ((payload[1] >> 4U) & 3U);
+    lamps->amber_warning_flash = (uint8_t) ((payload[1] >> 2U) & 3U);
+    lamps->protect_flash = (uint8_t) (payload[1] & 3U);
+}
+
+/**************************************************************************//**
+
+  \brief Unpack one DTC and resolve the name of its SPN
+
+  The 19 bit SPN is split over the first two bytes and the top three bits of
+  the third, below which is the FMI. The fourth byte holds the conversion
+  method bit above the occurrence count.
+
+  \param ctx        decoder context
+  \param p          4 bytes of the DTC
+  \param dtc        DTC to be filled in
+
+  \return bool      false for the "no DTC" entry and for padding
+
+******************************************************************************/
+bool unpack_dtc(const j1939decode_ctx_t * ctx, const uint8_t * p, j1939_dtc_t * dtc)
+{
+    uint32_t raw = (uint32_t) p[0] | ((uint32_t) p[1] << 8U) | ((uint32_t) p[2] << 16U) | ((uint32_t) p[3] << 24U);
+    if (raw == 0 || raw == UINT32_MAX)
+    {
+        return false;
+    }
+
+    if (dtc != NULL)
+    {
+        dtc->spn = (uint32_t) p[0] | ((uint32_t) p[1] << 8U) | ((uint32_t) (p[2] >> 5U) << 16U);
+        dtc->fmi = (uint8_t) (p[2] & 0x1FU);
+        dtc->oc = (uint8_t) (p[3] & 0x7FU);
+        dtc->cm = (p[3] & 0x80U) != 0;
+
+        const j1939db_t * tables;
+        const j1939db_spn_t * spn_data = j1939ctx_find_spn(ctx, dtc->spn, &tables);
+        dtc->spn_name = spn_data != NULL ? j1939db_string(tables, spn_data->name) : NULL;
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Decode a DM1 or DM2 payload into caller supplied structures
+
+  \param ctx        decoder context
+  \param id         CAN identifier
+  \param payload    payload bytes, a single frame or a reassembled transport protocol message
+  \param len        payload length in bytes
+  \param out        decoded message to be filled in
+  \param dtcs       array for the DTCs
+  \param cap        number of elements in the DTC array
+
+  \return int       number of DTCs written, -1 on error
+
+******************************************************************************/
+int j1939decode_ctx_decode_dm(j1939decode_ctx_t * ctx, uint32_t id, const uint8_t * payload, size_t len,
+                              j1939_dm_t * out, j1939_dtc_t * dtcs, size_t cap)
+{
+    if (!j1939ctx_check_ready(ctx))
+    {
+        return -1;
+    }
+
+    uint32_t pgn = (id >> 8U) & ((1U << 18U) - 1);
+    if (pgn != J1939DECODE_DM1_PGN && pgn != J1939DECODE_DM2_PGN)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "PGN %u is not a DM1 or DM2", pgn);
+        return -1;
+    }
+    if (len < DM_LAMPS_LEN || len > J1939DECODE_MAX_PAYLOAD)
+    {
+        log_msg(ctx, J1939DECODE_LOG_ERROR, "Invalid DM1 or DM2 length of %zu bytes", len);
+        return -1;
+    }
+
+    j1939stats_count(&ctx->stats->counters.frames, 1);
+
+    out->id = id;
+    out->pgn = pgn;
+    out->sa = (uint8_t) id;
+    out->sa_name = ctx->db->sa_names[out->sa];
+    out->num_dtcs = 0;
+    out->dtcs = dtcs;
+    unpack_lamps(payload, &out->lamps);
+
+    /* A trailing partial DTC is padding */
+    for (size_t offset = DM_LAMPS_LEN; offset + DM_DTC_LEN <= len; offset += DM_DTC_LEN)
+    {
+        if (unpack_dtc(ctx, &payload[offset], out->num_dtcs < cap ? &dtcs[out->num_dtcs] : NULL))
+        {
+            out->num_dtcs++;
+        }
+    }
+
+    return (int) (out->num_dtcs < cap ? out->num_dtcs : cap);
+}
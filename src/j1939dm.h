@@ -0,0 +1,87 @@
+#ifndef J1939DM_H
+#define J1939DM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939decode.h"
+
+/* Active and previously active diagnostic trouble code PGNs */
+#define J1939DECODE_DM1_PGN 65226U
+#define J1939DECODE_DM2_PGN 65227U
+
+/* Lamp status values */
+#define J1939DECODE_LAMP_OFF            0U
+#define J1939DECODE_LAMP_ON             1U
+#define J1939DECODE_LAMP_ERROR          2U
+#define J1939DECODE_LAMP_NOT_AVAILABLE  3U
+
+/* Lamp flash values */
+#define J1939DECODE_FLASH_SLOW          0U
+#define J1939DECODE_FLASH_FAST          1U
+#define J1939DECODE_FLASH_RESERVED      2U
+#define J1939DECODE_FLASH_OFF           3U
+
+/* Occurrence count of DTCs that do not count occurrences */
+#define J1939DECODE_OC_NOT_AVAILABLE    127U
+
+/* Lamp status and flash of a diagnostic message, each a J1939DECODE_LAMP_ or J1939DECODE_FLASH_ value */
+typedef struct
+{
+    uint8_t mil;                        /* malfunction indicator lamp */
+    uint8_t red_stop;                   /* red stop lamp */
+    uint8_t amber_warning;              /* amber warning lamp */
+    uint8_t protect;                    /* protect lamp */
+    uint8_t mil_flash;
+    uint8_t red_stop_flash;
+    uint8_t amber_warning_flash;
+    uint8_t protect_flash;
+} j1939_dm_lamps_t;
+
+/* Diagnostic trouble code */
+typedef struct
+{
+    uint32_t spn;                       /* suspect parameter number of the fault, 19 bits */
+    uint8_t fmi;                        /* failure mode identifier, 5 bits */
+    uint8_t oc;                         /* occurrence count, 7 bits */
+    bool cm;                            /* SPN conversion method bit, the SPN is always unpacked as version 4 */
+    const char * spn_name;              /* descriptive SPN name, NULL if the SPN is not in the database */
+} j1939_dtc_t;
+
+/* Decoded DM1 or DM2 message */
+typedef struct
+{
+    uint32_t id;                        /* CAN identifier */
+    uint32_t pgn;                       /* J1939DECODE_DM1_PGN or J1939DECODE_DM2_PGN */
+    uint8_t sa;                         /* source address */
+    const char * sa_name;               /* descriptive source address name */
+    j1939_dm_lamps_t lamps;
+    size_t num_dtcs;                    /* number of DTCs in the message, may be more than were written */
+    j1939_dtc_t * dtcs;                 /* caller supplied DTC array */
+} j1939_dm_t;
+
+/* Diagnostic messages
+ * DM1 and DM2 hold the lamp status in their first two bytes, followed by one 4 byte DTC after another. Single
+ * frames and payloads reassembled with j1939tp.h are unpacked straight into caller supplied structures, with no
+ * allocation and no JSON. The "no DTC" entry of all zeroes and the 0xFF padding of single frames are skipped */
+
+/* Decode a DM1 or DM2 payload with the default context, and resolve the name of each DTC's SPN
+ * Up to cap DTCs are written to dtcs, num_dtcs of out may be more
+ * Returns number of DTCs written, or -1 if the identifier is not a DM1 or DM2 or the payload is too short or long */
+int j1939decode_decode_dm(uint32_t id, const uint8_t * payload, size_t len, j1939_dm_t * out, j1939_dtc_t * dtcs,
+                          size_t cap);
+
+/* Context variant, names are looked up in the context's database */
+int j1939decode_ctx_decode_dm(j1939decode_ctx_t * ctx, uint32_t id, const uint8_t * payload, size_t len,
+                              j1939_dm_t * out, j1939_dtc_t * dtcs, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939DM_H
@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "j1939dtoa.h"
+
+/* Largest number of digits written by the Grisu2 path, the same as the first precision cJSON tries */
+#define SHORT_DIGITS 15
+
+/* Floating point number with a 64 bit significand and a binary exponent, value = f * 2^e */
+typedef struct
+{
+    uint64_t f;
+    int e;
+} diy_fp_t;
+
+/* Normalized cached powers 10^k for k = -348, -340, ..., 340, significands rounded to nearest
+ * Generated with Python: for each k, 10**k as an exact Fraction scaled by 2^-e into [2^63, 2^64) */
+static const diy_fp_t cached_powers[] =
+{
+    {0xFA8FD5A0081C0288ULL, -1220}, /* 1e-348 */
+    {0xBAAEE17FA23EBF76ULL, -1193}, /* 1e-340 */
+    {0x8B16FB203055AC76ULL, -1166}, /* 1e-332 */
+    {0xCF42894A5DCE35EAULL, -1140}, /* 1e-324 */
+    {0x9A6BB0AA55653B2DULL, -1113}, /* 1e-316 */
+    {0xE61ACF033D1A45DFULL, -1087}, /* 1e-308 */
+    {0xAB70FE17C79AC6CAULL, -1060}, /* 1e-300 */
+    {0xFF77B1FCBEBCDC4FULL, -1034}, /* 1e-292 */
+    {0xBE5691EF416BD60CULL, -1007}, /* 1e-284 */
+    {0x8DD01FAD907FFC3CULL,  -980}, /* 1e-276 */
+    {0xD3515C2831559A83ULL,  -954}, /* 1e-268 */
+    {0x9D71AC8FADA6C9B5ULL,  -927}, /* 1e-260 */
+    {0xEA9C227723EE8BCBULL,  -901}, /* 1e-252 */
+    {0xAECC49914078536DULL,  -874}, /* 1e-244 */
+    {0x823C12795DB6CE57ULL,  -847}, /* 1e-236 */
+    {0xC21094364DFB5637ULL,  -821}, /* 1e-228 */
+    {0x9096EA6F3848984FULL,  -794}, /* 1e-220 */
+    {0xD77485CB25823AC7ULL,  -768}, /* 1e-212 */
+    {0xA086CFCD97BF97F4ULL,  -741}, /* 1e-204 */
+    {0xEF340A98172AACE5ULL,  -715}, /* 1e-196 */
+    {0xB23867FB2A35B28EULL,  -688}, /* 1e-188 */
+    {0x84C8D4DFD2C63F3BULL,  -661}, /* 1e-180 */
+    {0xC5DD44271AD3CDBAULL,  -635}, /* 1e-172 */
+    {0x936B9FCEBB25C996ULL,  -608}, /* 1e-164 */
+    {0xDBAC6C247D62A584ULL,  -582}, /* 1e-156 */
+    {0xA3AB66580D5FDAF6ULL,  -555}, /* 1e-148 */
+    {0xF3E2F893DEC3F126ULL,  -529}, /* 1e-140 */
+    {0xB5B5ADA8AAFF80B8ULL,  -502}, /* 1e-132 */
+    {0x87625F056C7C4A8BULL,  -475}, /* 1e-124 */
+    {0xC9BCFF6034C13053ULL,  -449}, /* 1e-116 */
+    {0x964E858C91BA2655ULL,  -422}, /* 1e-108 */
+    {0xDFF9772470297EBDULL,  -396}, /* 1e-100 */
+    {0xA6DFBD9FB8E5B88FULL,  -369}, /* 1e-92 */
+    {0xF8A95FCF88747D94ULL,  -343}, /* 1e-84 */
+    {0xB94470938FA89BCFULL,  -316}, /* 1e-76 */
+    {0x8A08F0F8BF0F156BULL,  -289}, /* 1e-68 */
+    {0xCDB02555653131B6ULL,  -263}, /* 1e-60 */
+    {0x993FE2C6D07B7FACULL,  -236}, /* 1e-52 */
+    {0xE45C10C42A2B3B06ULL,  -210}, /* 1e-44 */
+    {0xAA242499697392D3ULL,  -183}, /* 1e-36 */
+    {0xFD87B5F28300CA0EULL,  -157}, /* 1e-28 */
+    {0xBCE5086492111AEBULL,  -130}, /* 1e-20 */
+    {0x8CBCCC096F5088CCULL,  -103}, /* 1e-12 */
+    {0xD1B71758E219652CULL,   -77}, /* 1e-4 */
+    {0x9C40000000000000ULL,   -50}, /* 1e4 */
+    {0xE8D4A51000000000ULL,   -24}, /* 1e12 */
+    {0xAD78EBC5AC620000ULL,     3}, /* 1e20 */
+    {0x813F3978F8940984ULL,    30}, /* 1e28 */
+    {0xC097CE7BC90715B3ULL,    56}, /* 1e36 */
+    {0x8F7E32CE7BEA5C70ULL,    83}, /* 1e44 */
+    {0xD5D238A4ABE98068ULL,   109}, /* 1e52 */
+    {0x9F4F2726179A2245ULL,   136}, /* 1e60 */
+    {0xED63A231D4C4FB27ULL,   162}, /* 1e68 */
+    {0xB0DE65388CC8ADA8ULL,   189}, /* 1e76 */
+    {0x83C7088E1AAB65DBULL,   216}, /* 1e84 */
+    {0xC45D1DF942711D9AULL,   242}, /* 1e92 */
+    {0x924D692CA61BE758ULL,   269}, /* 1e100 */
+    {0xDA01EE641A708DEAULL,   295}, /* 1e108 */
+    {0xA26DA3999AEF774AULL,   322}, /* 1e116 */
+    {0xF209787BB47D6B85ULL,   348}, /* 1e124 */
+    {0xB454E4A179DD1877ULL,   375}, /* 1e132 */
+    {0x865B86925B9BC5C2ULL,   402}, /* 1e140 */
+    {0xC83553C5C8965D3DULL,   428}, /* 1e148 */
+    {0x952AB45CFA97A0B3ULL,   455}, /* 1e156 */
+    {0xDE469FBD99A05FE3ULL,   481}, /* 1e164 */
+    {0xA59BC234DB398C25ULL,   508}, /* 1e172 */
+    {0xF6C69A72A3989F5CULL,   534}, /* 1e180 */
+    {0xB7DCBF5354E9BECEULL,   561}, /* 1e188 */
+    {0x88FCF317F22241E2ULL,   588}, /* 1e196 */
+    {0xCC20CE9BD35C78A5ULL,   614}, /* 1e204 */
+    {0x98165AF37B2153DFULL,   641}, /* 1e212 */
+    {0xE2A0B5DC971F303AULL,   667}, /* 1e220 */
+    {0xA8D9D1535CE3B396ULL,   694}, /* 1e228 */
+    {0xFB9B7CD9A4A7443CULL,   720}, /* 1e236 */
+    {0xBB764C4CA7A44410ULL,   747}, /* 1e244 */
+    {0x8BAB8EEFB6409C1AULL,   774}, /* 1e252 */
+    {0xD01FEF10A657842CULL,   800}, /* 1e260 */
+    {0x9B10A4E5E9913129ULL,   827}, /* 1e268 */
+    {0xE7109BFBA19C0C9DULL,   853}, /* 1e276 */
+    {0xAC2820D9623BF429ULL,   880}, /* 1e284 */
+    {0x80444B5E7AA7CF85ULL,   907}, /* 1e292 */
+    {0xBF21E44003ACDD2DULL,   933}, /* 1e300 */
+    {0x8E679C2F5E44FF8FULL,   960}, /* 1e308 */
+    {0xD433179D9C8CB841ULL,   986}, /* 1e316 */
+    {0x9E19DB92B4E31BA9ULL,  1013}, /* 1e324 */
+    {0xEB96BF6EBADF77D9ULL,  1039}, /* 1e332 */
+    {0xAF87023B9BF0EE6BULL,  1066}, /* 1e340 */
+};
+
+static const uint32_t pow10_32[] =
+{
+    1U, 10U, 100U, 1000U, 10000U, 100000U, 1000000U, 10000000U, 100000000U, 1000000000U
+};
+
+/* Static helper functions */
+static diy_fp_t cached_power(int e, int * k);
+static void grisu_round(char * digits, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w);
+static int digit_gen(diy_fp_t w, diy_fp_t mp, uint64_t delta, char * digits, int * k);
+static int grisu2(double value, char * digits, int * k);
+static size_t format_digits(const char * digits, int len, int k, char * out);
+static size_t format_fallback(double value, char * out);
+
+static inline diy_fp_t diy_fp_from_double(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint64_t significand = bits & ((1ULL << 52U) - 1);
+    int biased_exponent = (int) ((bits >> 52U) & 0x7FF);
+
+    diy_fp_t fp;
+    if (biased_exponent != 0)
+    {
+        fp.f = significand | (1ULL << 52U);
+        fp.e = biased_exponent - 1075;
+    }
+    else
+    {
+        /* Subnormal */
+        fp.f = significand;
+        fp.e = -1074;
+    }
+    return fp;
+}
+
+static inline diy_fp_t diy_fp_normalize(diy_fp_t fp)
+{
+    while ((fp.f & (1ULL << 63U)) == 0)
+    {
+        fp.f <<= 1U;
+        fp.e--;
+    }
+    return fp;
+}
+
+/* Product rounded to the upper 64 bits */
+static inline diy_fp_t diy_fp_multiply(diy_fp_t x, diy_fp_t y)
+{
+    const uint64_t m32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32U;
+    uint64_t b = x.f & m32;
+    uint64_t c = y.f >> 32U;
+    uint64_t d = y.f & m32;
+    uint64_t ac = a * c;
+    uint64_t bc = b * c;
+    uint64_t ad = a * d;
+    uint64_t bd = b * d;
+    uint64_t tmp = (bd >> 32U) + (ad & m32) + (bc & m32) + (1ULL << 31U);
+
+    diy_fp_t r;
+    r.f = ac + (ad >> 32U) + (bc >> 32U) + (tmp >> 32U);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static inline int count_digits(uint32_t n)
+{
+    int digits = 1;
+    while (digits < 10 && n >= pow10_32[digits])
+    {
+        digits++;
+    }
+    return digits;
+}
+
+/**************************************************************************//**
+
+  \brief Get cached power of ten that brings a binary exponent into the Grisu range
+
+  \param e      binary exponent of the upper boundary
+  \param k      set to the decimal exponent to apply to the digits
+
+  \return diy_fp_t  cached power 10^-k
+
+******************************************************************************/
+diy_fp_t cached_power(int e, int * k)
+{
+    /* 0.30102999566398114 is log10(2) */
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int) dk;
+    if (dk - ik > 0.0)
+    {
+        ik++;
+    }
+
+    unsigned index = (unsigned) ((ik >> 3) + 1);
+    *k = -(-348 + (int) (index << 3U));
+    return cached_powers[index];
+}
+
+/**************************************************************************//**
+
+  \brief Move the last digit towards the value while staying inside the rounding interval
+
+  \return void
+
+******************************************************************************/
+void grisu_round(char * digits, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Generate the shortest digits inside the scaled rounding interval
+
+  \param w          scaled value
+  \param mp         scaled upper boundary
+  \param delta      width of the scaled rounding interval
+  \param digits     digit buffer, at least 18 chars
+  \param k          decimal exponent, adjusted for the digits generated
+
+  \return int       number of digits
+
+******************************************************************************/
+int digit_gen(diy_fp_t w, diy_fp_t mp, uint64_t delta, char * digits, int * k)
+{
+    const int shift = -mp.e;
+    const uint64_t one = 1ULL << (unsigned) shift;
+    const uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t) (mp.f >> (unsigned) shift);
+    uint64_t p2 = mp.f & (one - 1);
+    int kappa = count_digits(p1);
+    int len = 0;
+
+    /* Integral part */
+    while (kappa > 0)
+    {
+        uint32_t d = p1 / pow10_32[kappa - 1];
+        p1 %= pow10_32[kappa - 1];
+        if (d != 0 || len != 0)
+        {
+            digits[len++] = (char) ('0' + d);
+        }
+        kappa--;
+
+        uint64_t rest = ((uint64_t) p1 << (unsigned) shift) + p2;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            grisu_round(digits, len, delta, rest, (uint64_t) pow10_32[kappa] << (unsigned) shift, wp_w);
+            return len;
+        }
+    }
+
+    /* Fractional part */
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char) (p2 >> (unsigned) shift);
+        if (d != 0 || len != 0)
+        {
+            digits[len++] = (char) ('0' + d);
+        }
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            *k += kappa;
+            int index = -kappa;
+            grisu_round(digits, len, delta, p2, one, index < 10 ? wp_w * pow10_32[index] : 0);
+            return len;
+        }
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Get shortest digits of a positive double with Grisu2
+
+  The digits always read back as the same value, and are the shortest such
+  digits for almost all values.
+
+  \param value      positive finite double
+  \param digits     digit buffer, at least 18 chars
+  \param k          set to the decimal exponent, value = digits * 10^k
+
+  \return int       number of digits
+
+******************************************************************************/
+int grisu2(double value, char * digits, int * k)
+{
+    diy_fp_t v = diy_fp_from_double(value);
+
+    /* Boundaries halfway to the neighboring doubles, the lower one is closer at powers of two */
+    diy_fp_t plus = {(v.f << 1U) + 1, v.e - 1};
+    while ((plus.f & (1ULL << 53U)) == 0)
+    {
+        plus.f <<= 1U;
+        plus.e--;
+    }
+    plus.f <<= 10U;
+    plus.e -= 10;
+
+    diy_fp_t minus;
+    if (v.f == (1ULL << 52U))
+    {
+        minus.f = (v.f << 2U) - 1;
+        minus.e = v.e - 2;
+    }
+    else
+    {
+        minus.f = (v.f << 1U) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= (unsigned) (minus.e - plus.e);
+    minus.e = plus.e;
+
+    diy_fp_t c_mk = cached_power(plus.e, k);
+    diy_fp_t w = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+    diy_fp_t wp = diy_fp_multiply(plus, c_mk);
+    diy_fp_t wm = diy_fp_multiply(minus, c_mk);
+
+    /* Narrow the interval by the multiplication error, so all digits found are inside the exact interval */
+    wm.f++;
+    wp.f--;
+    return digit_gen(w, wp, wp.f - wm.f, digits, k);
+}
+
+/**************************************************************************//**
+
+  \brief Format digits the way printf("%1.15g") does
+
+  \param digits     significant digits, without leading or trailing zeros
+  \param len        number of digits, at most 15
+  \param k          decimal exponent, value = digits * 10^k
+  \param out        output buffer
+
+  \return size_t    length of output
+
+******************************************************************************/
+size_t format_digits(const char * digits, int len, int k, char * out)
+{
+    /* Decimal exponent of the first digit */
+    int exponent = len + k - 1;
+    size_t pos = 0;
+
+    if (exponent < -4 || exponent >= SHORT_DIGITS)
+    {
+        /* Scientific notation, with at least two exponent digits */
+        out[pos++] = digits[0];
+        if (len > 1)
+        {
+            out[pos++] = '.';
+            memcpy(&out[pos], &digits[1], (size_t) (len - 1));
+            pos += (size_t) (len - 1);
+        }
+        out[pos++] = 'e';
+        out[pos++] = exponent < 0 ? '-' : '+';
+        unsigned magnitude = (unsigned) (exponent < 0 ? -exponent : exponent);
+        if (magnitude >= 100)
+        {
+            out[pos++] = (char) ('0' + magnitude / 100);
+        }
+        out[pos++] = (char) ('0' + magnitude / 10 % 10);
+        out[pos++] = (char) ('0' + magnitude % 10);
+    }
+    else if (exponent < 0)
+    {
+        /* 0.000ddd */
+        out[pos++] = '0';
+        out[pos++] = '.';
+        for (int i = -1; i > exponent; i--)
+        {
+            out[pos++] = '0';
+        }
+        memcpy(&out[pos], digits, (size_t) len);
+        pos += (size_t) len;
+    }
+    else if (len <= exponent + 1)
+    {
+        /* Integer, digits followed by zeros */
+        memcpy(&out[pos], digits, (size_t) len);
+        pos += (size_t) len;
+        for (int i = len; i <= exponent; i++)
+        {
+            out[pos++] = '0';
+        }
+    }
+    else
+    {
+        /* ddd.ddd */
+        memcpy(&out[pos], digits, (size_t) exponent + 1);
+        pos += (size_t) exponent + 1;
+        out[pos++] = '.';
+        memcpy(&out[pos], &digits[exponent + 1], (size_t) (len - exponent - 1));
+        pos += (size_t) (len - exponent - 1);
+    }
+
+    return pos;
+}
+
+/**************************************************************************//**
+
+  \brief Format double with snprintf() the way cJSON does
+
+  \return size_t    length of output
+
+******************************************************************************/
+size_t format_fallback(double value, char * out)
+{
+    char number[J1939DTOA_MAX_LEN + 1];
+
+    /* Try 15 decimal places of precision to avoid nonsignificant nonzero digits */
+    int len = snprintf(number, sizeof(number), "%1.15g", value);
+    if (strtod(number, NULL) != value)
+    {
+        /* Print with 17 decimal places of precision if the double cannot be recovered */
+        len = snprintf(number, sizeof(number), "%1.17g", value);
+    }
+
+    if (len <= 0 || (size_t) len > J1939DTOA_MAX_LEN)
+    {
+        return 0;
+    }
+
+    /* Replace locale dependent decimal point with '.' */
+    for (int i = 0; i < len; i++)
+    {
+        out[i] = number[i] == ',' ? '.' : number[i];
+    }
+    return (size_t) len;
+}
+
+/**************************************************************************//**
+
+  \brief Write finite double the way cJSON prints it
+
+  Any digits of at most 15 significant digits that read back as the value are
+  the digits printf("%1.15g") writes, since a double's rounding interval is
+  narrower than the spacing of 15 digit decimals. So the Grisu2 digits are
+  used when there are at most 15 of them, and the rare values needing more,
+  and subnormals, are left to snprintf().
+
+  \param value      finite double
+  \param out        output buffer of J1939DTOA_MAX_LEN chars
+
+  \return size_t    length of output
+
+******************************************************************************/
+size_t j1939dtoa_format(double value, char * out)
+{
+    size_t pos = 0;
+    double magnitude = value;
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits >> 63U)
+    {
+        out[pos++] = '-';
+        magnitude = -value;
+    }
+
+    /* Integer fast path, also covers zero */
+    if (magnitude < 1e15 && magnitude == (double) (uint64_t) magnitude)
+    {
+        uint64_t n = (uint64_t) magnitude;
+        char digits[16];
+        size_t i = sizeof(digits);
+        do
+        {
+            digits[--i] = (char) ('0' + n % 10);
+            n /= 10;
+        } while (n != 0);
+        memcpy(&out[pos], &digits[i], sizeof(digits) - i);
+        return pos + sizeof(digits) - i;
+    }
+
+    /* Subnormals have fewer significant bits, so more than one 15 digit decimal reads back as the value */
+    if (magnitude < DBL_MIN)
+    {
+        return format_fallback(value, out);
+    }
+
+    char digits[18];
+    int k;
+    int len = grisu2(magnitude, digits, &k);
+    while (len > 1 && digits[len - 1] == '0')
+    {
+        len--;
+        k++;
+    }
+
+    if (len > SHORT_DIGITS)
+    {
+        return format_fallback(value, out);
+    }
+
+    return pos + format_digits(digits, len, k, &out[pos]);
+}
@@ -0,0 +1,25 @@
+#ifndef J1939DTOA_H
+#define J1939DTOA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* Buffer size needed by j1939dtoa_format() */
+#define J1939DTOA_MAX_LEN 32
+
+/* Write finite double the way cJSON prints it, byte for byte
+ * That is printf("%1.15g") if it reads back as the same value, otherwise printf("%1.17g"), with '.' as decimal point
+ * Integral values take an integer fast path, others use Grisu2 shortest digits, only values needing more than 15
+ * digits are formatted with snprintf()
+ * out must hold J1939DTOA_MAX_LEN chars, output is not null terminated
+ * Returns length of output */
+size_t j1939dtoa_format(double value, char * out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939DTOA_H
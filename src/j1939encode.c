@@ -0,0 +1,725 @@
+#include <float.h>
+#include <string.h>
+
+#include "j1939encode.h"
+
+/* Field numbers of j1939decode.proto, also used as integer map keys */
+#define FIELD_ID                    1U
+#define FIELD_PRIORITY              2U
+#define FIELD_PGN                   3U
+#define FIELD_SA                    4U
+#define FIELD_SA_NAME               5U
+#define FIELD_DLC                   6U
+#define FIELD_DATA_RAW              7U
+#define FIELD_PGN_NAME              8U
+#define FIELD_SPNS                  9U
+#define FIELD_DECODED               10U
+
+#define FIELD_SPN                   1U
+#define FIELD_NAME                  2U
+#define FIELD_DATA_RANGE            3U
+#define FIELD_OPERATIONAL_RANGE     4U
+#define FIELD_OPERATIONAL_HIGH      5U
+#define FIELD_OPERATIONAL_LOW       6U
+#define FIELD_START_BIT             7U
+#define FIELD_SPN_LENGTH            8U
+#define FIELD_RESOLUTION            9U
+#define FIELD_OFFSET                10U
+#define FIELD_VALUE_RAW             11U
+#define FIELD_VALUE_DECODED         12U
+#define FIELD_UNITS                 13U
+#define FIELD_VALID                 14U
+#define FIELD_VARIABLE_LENGTH       15U
+#define FIELD_RESOLUTION_ASCII      16U
+#define FIELD_STATE                 17U
+#define FIELD_VALUE_TEXT            18U
+
+/* Protobuf wire types */
+#define WIRE_VARINT                 0U
+#define WIRE_FIXED64                1U
+#define WIRE_LEN                    2U
+
+/* String literal and its length */
+#define LITERAL(s) s, sizeof(s) - 1
+
+/* Static helper functions */
+static void put_head(j1939encode_t * w, uint8_t cbor_major, uint64_t len, uint8_t fix, uint8_t fix_limit,
+                     uint8_t msgpack_first);
+static void put_uint(j1939encode_t * w, uint64_t value);
+static void put_double(j1939encode_t * w, double value);
+static void put_text(j1939encode_t * w, const char * s, size_t len);
+static void put_key(j1939encode_t * w, uint32_t field, const char * key, size_t len);
+static void write_spn(j1939encode_t * w, const j1939db_t * db, const j1939_spn_value_t * value, uint32_t profile);
+static void write_map_message(j1939encode_t * w, const j1939db_t * db, const j1939_decoded_t * decoded,
+                              const uint64_t * data, uint32_t profile);
+static void pb_varint(j1939encode_t * w, uint64_t value);
+static void pb_string(j1939encode_t * w, uint32_t field, const char * s);
+static void pb_text(j1939encode_t * w, uint32_t field, const char * s, size_t len);
+static void pb_double(j1939encode_t * w, uint32_t field, double value);
+static void pb_write_spn(j1939encode_t * w, const j1939db_t * db, const j1939_spn_value_t * value, uint32_t profile);
+static void pb_write_message(j1939encode_t * w, const j1939db_t * db, const j1939_decoded_t * decoded,
+                             const uint64_t * data, uint32_t profile);
+
+/* Append bytes to output, once something does not fit only the length is counted */
+static inline void put(j1939encode_t * w, const void * s, size_t len)
+{
+    if (w->written == w->pos && len <= w->cap - w->pos)
+    {
+        memcpy(w->buf + w->pos, s, len);
+        w->written += len;
+    }
+    w->pos += len;
+}
+
+static inline void put_byte(j1939encode_t * w, uint8_t b)
+{
+    put(w, &b, 1);
+}
+
+/* Append the low n bytes of a value, most significant byte first as CBOR and MessagePack require */
+static inline void put_be(j1939encode_t * w, uint64_t value, size_t n)
+{
+    uint8_t bytes[8];
+    for (size_t i = 0; i < n; i++)
+    {
+        bytes[i] = (uint8_t) (value >> (8U * (n - 1 - i)));
+    }
+    put(w, bytes, n);
+}
+
+static inline void put_map(j1939encode_t * w, size_t n)
+{
+    put_head(w, 5, n, 0x80, 16, 0xDE);
+}
+
+static inline void put_array(j1939encode_t * w, size_t n)
+{
+    put_head(w, 4, n, 0x90, 16, 0xDC);
+}
+
+static inline void put_bool(j1939encode_t * w, bool value)
+{
+    if (w->format == J1939DECODE_FORMAT_CBOR)
+    {
+        put_byte(w, value ? 0xF5 : 0xF4);
+    }
+    else
+    {
+        put_byte(w, value ? 0xC3 : 0xC2);
+    }
+}
+
+static inline void put_string(j1939encode_t * w, const char * s)
+{
+    s = s != NULL ? s : "";
+    put_text(w, s, strlen(s));
+}
+
+static inline void pb_tag(j1939encode_t * w, uint32_t field, uint32_t wire)
+{
+    pb_varint(w, ((uint64_t) field << 3U) | wire);
+}
+
+/* Scalar fields equal to their default value are left out, as protobuf encoders do */
+static inline void pb_uint(j1939encode_t * w, uint32_t field, uint64_t value)
+{
+    if (value != 0)
+    {
+        pb_tag(w, field, WIRE_VARINT);
+        pb_varint(w, value);
+    }
+}
+
+static inline void pb_bool(j1939encode_t * w, uint32_t field, bool value)
+{
+    pb_uint(w, field, value ? 1 : 0);
+}
+
+/**************************************************************************//**
+
+  \brief Start writing into buffer
+
+  \param w          binary writer
+  \param buf        output buffer, may be NULL if len is 0
+  \param len        size of output buffer in bytes
+  \param format     J1939DECODE_FORMAT_CBOR, J1939DECODE_FORMAT_MSGPACK or J1939DECODE_FORMAT_PROTOBUF
+  \param flags      J1939DECODE_ENCODE_ flags
+
+  \return void
+
+******************************************************************************/
+void j1939encode_init(j1939encode_t * w, uint8_t * buf, size_t len, uint32_t format, uint32_t flags)
+{
+    w->buf = len > 0 ? buf : NULL;
+    w->cap = len;
+    w->pos = 0;
+    w->written = 0;
+    w->format = format;
+    w->int_keys = (flags & J1939DECODE_ENCODE_INT_KEYS) != 0;
+}
+
+/**************************************************************************//**
+
+  \brief Finish writing
+
+  \return size_t    length of complete output, truncated if more than the buffer length
+
+******************************************************************************/
+size_t j1939encode_finish(const j1939encode_t * w)
+{
+    return w->pos;
+}
+
+/**************************************************************************//**
+
+  \brief Write type and length of a map, array or string
+
+  \param w              binary writer
+  \param cbor_major     CBOR major type
+  \param len            number of elements or bytes
+  \param fix            MessagePack fix type, holding lengths below fix_limit
+  \param fix_limit      limit of the MessagePack fix type
+  \param msgpack_first  MessagePack type with a 16 bit length, followed by the 32 bit length type
+
+  \return void
+
+******************************************************************************/
+void put_head(j1939encode_t * w, uint8_t cbor_major, uint64_t len, uint8_t fix, uint8_t fix_limit,
+              uint8_t msgpack_first)
+{
+    if (w->format == J1939DECODE_FORMAT_CBOR)
+    {
+        uint8_t major = (uint8_t) (cbor_major << 5U);
+        if (len < 24)
+        {
+            put_byte(w, major | (uint8_t) len);
+        }
+        else if (len <= 0xFF)
+        {
+            put_byte(w, major | 24);
+            put_be(w, len, 1);
+        }
+        else if (len <= 0xFFFF)
+        {
+            put_byte(w, major | 25);
+            put_be(w, len, 2);
+        }
+        else if (len <= 0xFFFFFFFF)
+        {
+            put_byte(w, major | 26);
+            put_be(w, len, 4);
+        }
+        else
+        {
+            put_byte(w, major | 27);
+            put_be(w, len, 8);
+        }
+    }
+    else if (len < fix_limit)
+    {
+        put_byte(w, fix | (uint8_t) len);
+    }
+    else if (len <= 0xFFFF)
+    {
+        put_byte(w, msgpack_first);
+        put_be(w, len, 2);
+    }
+    else
+    {
+        put_byte(w, (uint8_t) (msgpack_first + 1));
+        put_be(w, len, 4);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write unsigned integer in the smallest encoding
+
+  \return void
+
+******************************************************************************/
+void put_uint(j1939encode_t * w, uint64_t value)
+{
+    if (w->format == J1939DECODE_FORMAT_CBOR)
+    {
+        put_head(w, 0, value, 0, 0, 0);
+    }
+    else if (value < 0x80)
+    {
+        put_byte(w, (uint8_t) value);
+    }
+    else if (value <= 0xFF)
+    {
+        put_byte(w, 0xCC);
+        put_be(w, value, 1);
+    }
+    else if (value <= 0xFFFF)
+    {
+        put_byte(w, 0xCD);
+        put_be(w, value, 2);
+    }
+    else if (value <= 0xFFFFFFFF)
+    {
+        put_byte(w, 0xCE);
+        put_be(w, value, 4);
+    }
+    else
+    {
+        put_byte(w, 0xCF);
+        put_be(w, value, 8);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write floating point number, as single precision when that is exact
+
+  \return void
+
+******************************************************************************/
+void put_double(j1939encode_t * w, double value)
+{
+    bool cbor = w->format == J1939DECODE_FORMAT_CBOR;
+
+    /* NaN and infinity are written as null, the same as in JSON output */
+    if ((value * 0) != 0)
+    {
+        put_byte(w, cbor ? 0xF6 : 0xC0);
+        return;
+    }
+
+    if (value >= -FLT_MAX && value <= FLT_MAX && (double) (float) value == value)
+    {
+        float single = (float) value;
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        put_byte(w, cbor ? 0xFA : 0xCA);
+        put_be(w, bits, sizeof(bits));
+    }
+    else
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        put_byte(w, cbor ? 0xFB : 0xCB);
+        put_be(w, bits, sizeof(bits));
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write UTF-8 text string
+
+  \return void
+
+******************************************************************************/
+void put_text(j1939encode_t * w, const char * s, size_t len)
+{
+    if (w->format == J1939DECODE_FORMAT_MSGPACK && len >= 32 && len <= 0xFF)
+    {
+        /* MessagePack has an 8 bit length type for strings only */
+        put_byte(w, 0xD9);
+        put_be(w, len, 1);
+    }
+    else
+    {
+        put_head(w, 3, len, 0xA0, 32, 0xDA);
+    }
+    put(w, s, len);
+}
+
+/**************************************************************************//**
+
+  \brief Write map key, the field number if integer keys are used
+
+  \param w      binary writer
+  \param field  field number in j1939decode.proto
+  \param key    key of the same field in JSON output
+  \param len    length of key in bytes
+
+  \return void
+
+******************************************************************************/
+void put_key(j1939encode_t * w, uint32_t field, const char * key, size_t len)
+{
+    if (w->int_keys)
+    {
+        put_uint(w, field);
+    }
+    else
+    {
+        put_text(w, key, len);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write a decoded suspect parameter number as a map, or its raw value for the raw profile
+
+  \return void
+
+******************************************************************************/
+void write_spn(j1939encode_t * w, const j1939db_t * db, const j1939_spn_value_t * value, uint32_t profile)
+{
+    const j1939db_spn_t * spn_data = value->record;
+
+    if (profile == J1939DECODE_PROFILE_RAW)
+    {
+        put_uint(w, value->value_raw);
+        return;
+    }
+
+    put_map(w, (profile == J1939DECODE_PROFILE_FULL ? 13 : 3) + (value->state != NULL ? 1 : 0));
+
+    if (profile == J1939DECODE_PROFILE_FULL)
+    {
+        put_key(w, FIELD_NAME, LITERAL("Name"));
+        put_string(w, j1939db_string(db, spn_data->name));
+
+        put_key(w, FIELD_DATA_RANGE, LITERAL("DataRange"));
+        put_string(w, j1939db_string(db, spn_data->data_range));
+
+        put_key(w, FIELD_OPERATIONAL_RANGE, LITERAL("OperationalRange"));
+        put_string(w, j1939db_string(db, spn_data->operational_range));
+
+        put_key(w, FIELD_OPERATIONAL_HIGH, LITERAL("OperationalHigh"));
+        put_double(w, spn_data->operational_high);
+
+        put_key(w, FIELD_OPERATIONAL_LOW, LITERAL("OperationalLow"));
+        put_double(w, spn_data->operational_low);
+
+        put_key(w, FIELD_START_BIT, LITERAL("StartBit"));
+        put_uint(w, value->start_bit);
+
+        put_key(w, FIELD_SPN_LENGTH, LITERAL("SPNLength"));
+        if (spn_data->flags & J1939DB_SPN_VARIABLE_LENGTH)
+        {
+            put_text(w, LITERAL("Variable"));
+        }
+        else
+        {
+            put_uint(w, value->length);
+        }
+
+        put_key(w, FIELD_RESOLUTION, LITERAL("Resolution"));
+        if (spn_data->flags & J1939DB_SPN_RESOLUTION_ASCII)
+        {
+            put_text(w, LITERAL("ASCII"));
+        }
+        else
+        {
+            put_double(w, spn_data->resolution);
+        }
+
+        put_key(w, FIELD_OFFSET, LITERAL("Offset"));
+        put_double(w, spn_data->offset);
+
+        put_key(w, FIELD_VALUE_RAW, LITERAL("ValueRaw"));
+        put_uint(w, value->value_raw);
+    }
+
+    /* ASCII SPNs decode to their text, as in JSON output */
+    put_key(w, FIELD_VALUE_DECODED, LITERAL("ValueDecoded"));
+    if (value->text != NULL)
+    {
+        put_text(w, value->text, value->text_len);
+    }
+    else if (value->valid)
+    {
+        put_double(w, value->value);
+    }
+    else
+    {
+        put_text(w, LITERAL("Not available"));
+    }
+
+    if (value->state != NULL)
+    {
+        put_key(w, FIELD_STATE, LITERAL("State"));
+        put_string(w, value->state);
+    }
+
+    put_key(w, FIELD_UNITS, LITERAL("Units"));
+    put_string(w, j1939db_string(db, spn_data->units));
+
+    put_key(w, FIELD_VALID, LITERAL("Valid"));
+    put_bool(w, value->valid);
+}
+
+/**************************************************************************//**
+
+  \brief Write a decoded message as a CBOR or MessagePack map
+
+  \return void
+
+******************************************************************************/
+void write_map_message(j1939encode_t * w, const j1939db_t * db, const j1939_decoded_t * decoded,
+                       const uint64_t * data, uint32_t profile)
+{
+    bool full = profile == J1939DECODE_PROFILE_FULL;
+    bool has_spns = decoded->pgn_name != NULL;
+
+    put_map(w, (full ? 8 : 4) + (has_spns ? (full ? 2 : 1) : 0));
+
+    put_key(w, FIELD_ID, LITERAL("ID"));
+    put_uint(w, decoded->id);
+
+    if (full)
+    {
+        put_key(w, FIELD_PRIORITY, LITERAL("Priority"));
+        put_uint(w, decoded->priority);
+    }
+
+    put_key(w, FIELD_PGN, LITERAL("PGN"));
+    put_uint(w, decoded->pgn);
+
+    put_key(w, FIELD_SA, LITERAL("SA"));
+    put_uint(w, decoded->sa);
+
+    if (full)
+    {
+        put_key(w, FIELD_SA_NAME, LITERAL("SAName"));
+        put_string(w, decoded->sa_name);
+
+        put_key(w, FIELD_DLC, LITERAL("DLC"));
+        put_uint(w, decoded->dlc);
+
+        put_key(w, FIELD_DATA_RAW, LITERAL("DataRaw"));
+        put_array(w, sizeof(*data));
+        for (uint32_t i = 0; i < sizeof(*data); i++)
+        {
+            put_uint(w, ((const uint8_t *) data)[i]);
+        }
+    }
+
+    if (has_spns)
+    {
+        if (full)
+        {
+            put_key(w, FIELD_PGN_NAME, LITERAL("PGNName"));
+            put_string(w, decoded->pgn_name);
+        }
+
+        /* SPN numbers as keys, decimal strings like JSON unless integer keys are used */
+        put_key(w, FIELD_SPNS, LITERAL("SPNs"));
+        put_map(w, decoded->num_spns);
+        for (size_t i = 0; i < decoded->num_spns; i++)
+        {
+            const j1939_spn_value_t * value = &decoded->spns[i];
+            if (w->int_keys)
+            {
+                put_uint(w, value->spn);
+            }
+            else
+            {
+                put_string(w, j1939db_string(db, value->record->key));
+            }
+            write_spn(w, db, value, profile);
+        }
+    }
+
+    put_key(w, FIELD_DECODED, LITERAL("Decoded"));
+    put_bool(w, decoded->decoded);
+}
+
+/**************************************************************************//**
+
+  \brief Write protobuf base 128 varint
+
+  \return void
+
+******************************************************************************/
+void pb_varint(j1939encode_t * w, uint64_t value)
+{
+    uint8_t bytes[10];
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        bytes[n++] = (uint8_t) (value | 0x80);
+        value >>= 7U;
+    }
+    bytes[n++] = (uint8_t) value;
+    put(w, bytes, n);
+}
+
+/**************************************************************************//**
+
+  \brief Write protobuf string field, left out if empty
+
+  \return void
+
+******************************************************************************/
+void pb_string(j1939encode_t * w, uint32_t field, const char * s)
+{
+    pb_text(w, field, s, s != NULL ? strlen(s) : 0);
+}
+
+/**************************************************************************//**
+
+  \brief Write protobuf string field of a given length, left out if empty
+
+  \return void
+
+******************************************************************************/
+void pb_text(j1939encode_t * w, uint32_t field, const char * s, size_t len)
+{
+    if (len > 0)
+    {
+        pb_tag(w, field, WIRE_LEN);
+        pb_varint(w, len);
+        put(w, s, len);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write protobuf double field, least significant byte first, left out if +0.0
+
+  \return void
+
+******************************************************************************/
+void pb_double(j1939encode_t * w, uint32_t field, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits != 0)
+    {
+        uint8_t bytes[8];
+        for (size_t i = 0; i < sizeof(bytes); i++)
+        {
+            bytes[i] = (uint8_t) (bits >> (8U * i));
+        }
+        pb_tag(w, field, WIRE_FIXED64);
+        put(w, bytes, sizeof(bytes));
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write fields of a protobuf Spn message
+
+  \return void
+
+******************************************************************************/
+void pb_write_spn(j1939encode_t * w, const j1939db_t * db, const j1939_spn_value_t * value, uint32_t profile)
+{
+    const j1939db_spn_t * spn_data = value->record;
+
+    pb_uint(w, FIELD_SPN, value->spn);
+
+    if (profile == J1939DECODE_PROFILE_FULL)
+    {
+        pb_string(w, FIELD_NAME, j1939db_string(db, spn_data->name));
+        pb_string(w, FIELD_DATA_RANGE, j1939db_string(db, spn_data->data_range));
+        pb_string(w, FIELD_OPERATIONAL_RANGE, j1939db_string(db, spn_data->operational_range));
+        pb_double(w, FIELD_OPERATIONAL_HIGH, spn_data->operational_high);
+        pb_double(w, FIELD_OPERATIONAL_LOW, spn_data->operational_low);
+        pb_uint(w, FIELD_START_BIT, value->start_bit);
+        /* Variable length and ASCII SPNs are marked by their flags below, as JSON writes text instead */
+        pb_uint(w, FIELD_SPN_LENGTH, (spn_data->flags & J1939DB_SPN_VARIABLE_LENGTH) ? 0 : value->length);
+        pb_double(w, FIELD_RESOLUTION, (spn_data->flags & J1939DB_SPN_RESOLUTION_ASCII) ? 0 : spn_data->resolution);
+        pb_double(w, FIELD_OFFSET, spn_data->offset);
+    }
+
+    if (profile != J1939DECODE_PROFILE_COMPACT)
+    {
+        pb_uint(w, FIELD_VALUE_RAW, value->value_raw);
+    }
+
+    if (profile != J1939DECODE_PROFILE_RAW)
+    {
+        /* Decoded value is left out if outside of operational range, and for ASCII SPNs, which have value_text */
+        if (value->valid && value->text == NULL)
+        {
+            pb_double(w, FIELD_VALUE_DECODED, value->value);
+        }
+        pb_string(w, FIELD_UNITS, j1939db_string(db, spn_data->units));
+        pb_bool(w, FIELD_VALID, value->valid);
+        pb_string(w, FIELD_STATE, value->state);
+        pb_text(w, FIELD_VALUE_TEXT, value->text, value->text_len);
+    }
+
+    if (profile == J1939DECODE_PROFILE_FULL)
+    {
+        pb_bool(w, FIELD_VARIABLE_LENGTH, (spn_data->flags & J1939DB_SPN_VARIABLE_LENGTH) != 0);
+        pb_bool(w, FIELD_RESOLUTION_ASCII, (spn_data->flags & J1939DB_SPN_RESOLUTION_ASCII) != 0);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write a decoded message as a protobuf Message
+
+  \return void
+
+******************************************************************************/
+void pb_write_message(j1939encode_t * w, const j1939db_t * db, const j1939_decoded_t * decoded,
+                      const uint64_t * data, uint32_t profile)
+{
+    bool full = profile == J1939DECODE_PROFILE_FULL;
+
+    pb_uint(w, FIELD_ID, decoded->id);
+    if (full)
+    {
+        pb_uint(w, FIELD_PRIORITY, decoded->priority);
+    }
+    pb_uint(w, FIELD_PGN, decoded->pgn);
+    pb_uint(w, FIELD_SA, decoded->sa);
+
+    if (full)
+    {
+        pb_string(w, FIELD_SA_NAME, decoded->sa_name);
+        pb_uint(w, FIELD_DLC, decoded->dlc);
+
+        pb_tag(w, FIELD_DATA_RAW, WIRE_LEN);
+        pb_varint(w, sizeof(*data));
+        put(w, data, sizeof(*data));
+    }
+
+    if (decoded->pgn_name != NULL)
+    {
+        if (full)
+        {
+            pb_string(w, FIELD_PGN_NAME, decoded->pgn_name);
+        }
+
+        for (size_t i = 0; i < decoded->num_spns; i++)
+        {
+            /* Embedded messages are preceded by their length, measured by writing them without a buffer first */
+            j1939encode_t measure;
+            j1939encode_init(&measure, NULL, 0, w->format, 0);
+            pb_write_spn(&measure, db, &decoded->spns[i], profile);
+
+            pb_tag(w, FIELD_SPNS, WIRE_LEN);
+            pb_varint(w, measure.pos);
+            pb_write_spn(w, db, &decoded->spns[i], profile);
+        }
+    }
+
+    pb_bool(w, FIELD_DECODED, decoded->decoded);
+}
+
+/**************************************************************************//**
+
+  \brief Write a decoded message in the writer's format
+
+  \param w          binary writer
+  \param db         database the decoded strings point into
+  \param decoded    decoded message, with all SPNs written
+  \param data       pointer to data (8 bytes total)
+  \param profile    J1939DECODE_PROFILE_ output profile
+
+  \return void
+
+******************************************************************************/
+void j1939encode_write_message(j1939encode_t * w, const j1939db_t * db, const j1939_decoded_t * decoded,
+                               const uint64_t * data, uint32_t profile)
+{
+    if (w->format == J1939DECODE_FORMAT_PROTOBUF)
+    {
+        pb_write_message(w, db, decoded, data, profile);
+    }
+    else
+    {
+        write_map_message(w, db, decoded, data, profile);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef J1939ENCODE_H
+#define J1939ENCODE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939decode.h"
+#include "j1939db.h"
+
+/* Binary writer into a caller supplied buffer, for the CBOR, MessagePack and protobuf output formats
+ * Messages have the same fields as JSON output, integer keys are the field numbers of j1939decode.proto */
+typedef struct
+{
+    uint8_t * buf;
+    size_t cap;         /* buffer size */
+    size_t pos;         /* length of complete output, may be more than cap */
+    size_t written;     /* length of output actually in the buffer */
+    uint32_t format;    /* J1939DECODE_FORMAT_ value other than JSON */
+    bool int_keys;      /* map keys are field and SPN numbers instead of strings */
+} j1939encode_t;
+
+/* Start writing into buffer, buf may be NULL if len is 0 */
+void j1939encode_init(j1939encode_t * w, uint8_t * buf, size_t len, uint32_t format, uint32_t flags);
+
+/* Returns length of complete output, output was truncated if this is more than the buffer length */
+size_t j1939encode_finish(const j1939encode_t * w);
+
+/* Write a decoded message, with all of its SPNs, with the fields of a J1939DECODE_PROFILE_ */
+void j1939encode_write_message(j1939encode_t * w, const j1939db_t * db, const j1939_decoded_t * decoded,
+                               const uint64_t * data, uint32_t profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939ENCODE_H
@@ -0,0 +1,739 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#if !defined(J1939DECODE_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#define J1939DECODE_HAVE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "j1939file.h"
+#include "j1939ctx.h"
+
+/* Frames parsed before each call of the batch decoder */
+#define FILE_BATCH          256U
+
+/* Chunks decoded or waiting to be written per thread, bounding the memory held for in order output */
+#define FILE_SLOTS_PER_THREAD   4U
+
+/* Largest output buffer of one chunk */
+#define FILE_MAX_OUTPUT     (1U << 30U)
+
+/* Longest "Timestamp" member written in front of a decoded object */
+#define FILE_TIMESTAMP_LEN  48U
+
+/* Output of one chunk */
+typedef struct
+{
+    char * buf;
+    size_t len;
+    size_t cap;
+    size_t num_frames;
+    bool done;                          /* decoded and not yet written */
+    bool failed;
+} chunk_t;
+
+/* Decoding state shared by the pool, chunk i is decoded into slot i % num_slots */
+typedef struct
+{
+    const char * text;
+    size_t len;
+    size_t chunk_size;
+    size_t num_chunks;
+    bool timestamps;
+    const j1939decode_allocator_t * allocator;
+
+    chunk_t * slots;
+    size_t num_slots;
+
+    /* Chunks are claimed in order, so the chunk the writer waits for is always being decoded */
+    size_t next_chunk;
+    size_t num_written;
+    bool stop;
+
+#ifdef J1939DECODE_HAVE_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t decoded;             /* a chunk was decoded */
+    pthread_cond_t written;             /* a chunk was written, freeing its slot */
+#endif
+} pool_t;
+
+/* Decoder thread of the pool */
+typedef struct
+{
+    pool_t * pool;
+    j1939decode_ctx_t * ctx;
+#ifdef J1939DECODE_HAVE_THREADS
+    pthread_t thread;
+#endif
+} worker_t;
+
+/* Static helper functions */
+static void log_msg(uint32_t level, const char * fmt, ...);
+static const char * skip_space(const char * p, const char * end);
+static const char * parse_hex(const char * p, const char * end, uint32_t * value, size_t * digits);
+static const char * parse_timestamp(const char * p, const char * end, uint64_t * timestamp_us);
+static size_t chunk_start(const pool_t * pool, size_t chunk);
+static bool reserve_output(const pool_t * pool, chunk_t * out, size_t len);
+static bool write_batch(const pool_t * pool, j1939decode_ctx_t * ctx, const j1939_frame_t * frames,
+                        const uint64_t * timestamps, size_t count, chunk_t * out);
+static bool decode_chunk(const pool_t * pool, j1939decode_ctx_t * ctx, size_t chunk, chunk_t * out);
+#ifdef J1939DECODE_HAVE_THREADS
+static void * run_worker(void * arg);
+#endif
+
+static inline int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/**************************************************************************//**
+
+  \brief Log formatted message to the process-wide handler
+
+  \return void
+
+******************************************************************************/
+void log_msg(uint32_t level, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    j1939ctx_vlog(NULL, level, fmt, args);
+    va_end(args);
+}
+
+/**************************************************************************//**
+
+  \brief Skip spaces and tabs
+
+  \return char *    pointer to next other character, or end
+
+******************************************************************************/
+const char * skip_space(const char * p, const char * end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    return p;
+}
+
+/**************************************************************************//**
+
+  \brief Parse hexadecimal number of up to 8 digits
+
+  \param p          text
+  \param end        end of text
+  \param value      set to the number
+  \param digits     set to the number of digits parsed
+
+  \return char *    pointer to character after the number
+
+******************************************************************************/
+const char * parse_hex(const char * p, const char * end, uint32_t * value, size_t * digits)
+{
+    uint32_t v = 0;
+    size_t n = 0;
+    int d;
+    while (p + n < end && n < 8 && (d = hex_digit(p[n])) >= 0)
+    {
+        v = (v << 4U) | (uint32_t) d;
+        n++;
+    }
+    *value = v;
+    *digits = n;
+    return p + n;
+}
+
+/**************************************************************************//**
+
+  \brief Parse timestamp in seconds with a fraction
+
+  \param p              text
+  \param end            end of text
+  \param timestamp_us   set to the timestamp in microseconds
+
+  \return char *        pointer to character after the timestamp, NULL if there is no timestamp
+
+******************************************************************************/
+const char * parse_timestamp(const char * p, const char * end, uint64_t * timestamp_us)
+{
+    const char * start = p;
+    uint64_t seconds = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        seconds = seconds * 10U + (uint64_t) (*p++ - '0');
+    }
+    if (p == start)
+    {
+        return NULL;
+    }
+
+    /* Digits beyond microseconds are ignored */
+    uint64_t us = 0;
+    uint64_t scale = 100000U;
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            us += (uint64_t) (*p++ - '0') * scale;
+            scale /= 10U;
+        }
+    }
+
+    *timestamp_us = seconds * 1000000U + us;
+    return p;
+}
+
+/**************************************************************************//**
+
+  \brief Parse one line of a candump log
+
+  \param line           line of text
+  \param len            length of line, not counting any null terminator
+  \param frame          frame to be filled in
+  \param timestamp_us   set to the timestamp of the line, 0 if it has none
+
+  \return bool          true if a frame was parsed
+
+******************************************************************************/
+bool j1939decode_parse_candump(const char * line, size_t len, j1939_frame_t * frame, uint64_t * timestamp_us)
+{
+    const char * end = line + len;
+    const char * p = skip_space(line, end);
+
+    *timestamp_us = 0;
+    if (p < end && *p == '(')
+    {
+        p = parse_timestamp(p + 1, end, timestamp_us);
+        if (p == NULL || p == end || *p != ')')
+        {
+            return false;
+        }
+        p = skip_space(p + 1, end);
+    }
+
+    /* Interface name */
+    while (p < end && *p != ' ' && *p != '\t')
+    {
+        p++;
+    }
+    p = skip_space(p, end);
+
+    /* 29-bit identifiers are always printed with 8 digits, error frames have the error flag set */
+    uint32_t id;
+    size_t digits;
+    p = parse_hex(p, end, &id, &digits);
+    if (digits != 8 || id > J1939DECODE_ID_MASK || p == end)
+    {
+        return false;
+    }
+
+    memset(frame, 0, sizeof(*frame));
+    frame->id = id;
+
+    if (*p == '#')
+    {
+        /* Log format, "##" starts a CAN FD frame and "R" a remote frame */
+        p++;
+        uint8_t dlc = 0;
+        int hi;
+        int lo;
+        while (end - p >= 2 && (hi = hex_digit(p[0])) >= 0 && (lo = hex_digit(p[1])) >= 0)
+        {
+            if (dlc == sizeof(frame->data))
+            {
+                return false;
+            }
+            frame->data[dlc++] = (uint8_t) ((hi << 4U) | lo);
+            p += 2;
+        }
+        if (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '\0')
+        {
+            return false;
+        }
+        frame->dlc = dlc;
+        return true;
+    }
+
+    p = skip_space(p, end);
+    if (end - p < 3 || p[0] != '[' || p[1] < '0' || p[1] > '8' || p[2] != ']')
+    {
+        return false;
+    }
+    frame->dlc = (uint8_t) (p[1] - '0');
+    p += 3;
+
+    for (uint8_t i = 0; i < frame->dlc; i++)
+    {
+        /* Remote frames print "remote request" instead of data */
+        p = skip_space(p, end);
+        int hi = end - p >= 2 ? hex_digit(p[0]) : -1;
+        int lo = hi >= 0 ? hex_digit(p[1]) : -1;
+        if (lo < 0)
+        {
+            return false;
+        }
+        frame->data[i] = (uint8_t) ((hi << 4U) | lo);
+        p += 2;
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Find the start of a chunk, the first line starting at or after chunk * chunk_size
+
+  Every thread finds the same boundaries, so chunks need no setup pass over the text.
+
+  \return size_t    offset of the chunk in the text, the text length for the chunk after the last
+
+******************************************************************************/
+size_t chunk_start(const pool_t * pool, size_t chunk)
+{
+    if (chunk >= pool->num_chunks)
+    {
+        return pool->len;
+    }
+
+    size_t pos = chunk * pool->chunk_size;
+    if (pos == 0 || pool->text[pos - 1] == '\n')
+    {
+        return pos;
+    }
+
+    const char * newline = memchr(pool->text + pos, '\n', pool->len - pos);
+    return newline != NULL ? (size_t) (newline - pool->text) + 1 : pool->len;
+}
+
+/**************************************************************************//**
+
+  \brief Make room for more output of a chunk
+
+  \param pool       decoding state holding the allocator
+  \param out        chunk output
+  \param len        number of bytes needed after the output so far
+
+  \return bool      true on success
+
+******************************************************************************/
+bool reserve_output(const pool_t * pool, chunk_t * out, size_t len)
+{
+    if (out->cap - out->len >= len)
+    {
+        return true;
+    }
+
+    size_t cap = out->cap > 0 ? out->cap : 4096;
+    while (cap - out->len < len)
+    {
+        cap *= 2;
+    }
+    if (cap > FILE_MAX_OUTPUT)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Decoded output of a log chunk is too long");
+        return false;
+    }
+
+    char * buf = pool->allocator->malloc_fn(pool->allocator->user, cap);
+    if (buf == NULL)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return false;
+    }
+    if (out->buf != NULL)
+    {
+        memcpy(buf, out->buf, out->len);
+        pool->allocator->free_fn(pool->allocator->user, out->buf);
+    }
+    out->buf = buf;
+    out->cap = cap;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Decode a batch of frames into the output of a chunk
+
+  \param pool           decoding state
+  \param ctx            decoder context of the thread
+  \param frames         frames parsed from the chunk
+  \param timestamps     timestamp of each frame
+  \param count          number of frames
+  \param out            chunk output
+
+  \return bool          true on success
+
+******************************************************************************/
+bool write_batch(const pool_t * pool, j1939decode_ctx_t * ctx, const j1939_frame_t * frames,
+                 const uint64_t * timestamps, size_t count, chunk_t * out)
+{
+    if (!pool->timestamps)
+    {
+        /* The batch decoder stops when the buffer is full, it is then grown and the rest decoded */
+        size_t done = 0;
+        while (done < count)
+        {
+            size_t written;
+            size_t n = j1939decode_ctx_to_ndjson_batch(ctx, frames + done, count - done, out->buf + out->len,
+                                                       out->cap - out->len, &written);
+            out->len += written;
+            done += n;
+            if (done < count && !reserve_output(pool, out, 2 * (out->cap - out->len) + 4096))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        /* The decoded object is written after the timestamp member, its opening brace is then replaced */
+        char prefix[FILE_TIMESTAMP_LEN];
+        size_t prefix_len = (size_t) snprintf(prefix, sizeof(prefix), "{\"Timestamp\":%llu.%06u,",
+                                              (unsigned long long) (timestamps[i] / 1000000U),
+                                              (unsigned int) (timestamps[i] % 1000000U));
+
+        if (!reserve_output(pool, out, prefix_len + 1024))
+        {
+            return false;
+        }
+
+        uint64_t data;
+        memcpy(&data, frames[i].data, sizeof(data));
+        for (;;)
+        {
+            size_t room = out->cap - out->len - (prefix_len - 1);
+            size_t json_len = j1939decode_ctx_to_json_buf(ctx, frames[i].id, frames[i].dlc, &data,
+                                                          out->buf + out->len + prefix_len - 1, room, 0);
+            if (json_len == 0)
+            {
+                /* Filtered out */
+                break;
+            }
+            if (json_len < room)
+            {
+                memcpy(out->buf + out->len, prefix, prefix_len);
+                out->len += prefix_len - 1 + json_len;
+                out->buf[out->len++] = '\n';
+                break;
+            }
+            if (!reserve_output(pool, out, prefix_len + json_len + 1))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Decode the lines of a chunk
+
+  \param pool       decoding state
+  \param ctx        decoder context of the thread
+  \param chunk      chunk number
+  \param out        chunk output, replaced
+
+  \return bool      true on success
+
+******************************************************************************/
+bool decode_chunk(const pool_t * pool, j1939decode_ctx_t * ctx, size_t chunk, chunk_t * out)
+{
+    j1939_frame_t frames[FILE_BATCH];
+    uint64_t timestamps[FILE_BATCH];
+    size_t count = 0;
+
+    const char * p = pool->text + chunk_start(pool, chunk);
+    const char * end = pool->text + chunk_start(pool, chunk + 1);
+
+    out->len = 0;
+    out->num_frames = 0;
+
+    while (p < end)
+    {
+        const char * newline = memchr(p, '\n', (size_t) (end - p));
+        const char * line_end = newline != NULL ? newline : end;
+        if (j1939decode_parse_candump(p, (size_t) (line_end - p), &frames[count], &timestamps[count]))
+        {
+            count++;
+        }
+        p = newline != NULL ? newline + 1 : end;
+
+        if (count == FILE_BATCH || (p == end && count > 0))
+        {
+            if (!write_batch(pool, ctx, frames, timestamps, count, out))
+            {
+                return false;
+            }
+            out->num_frames += count;
+            count = 0;
+        }
+    }
+    return true;
+}
+
+#ifdef J1939DECODE_HAVE_THREADS
+/**************************************************************************//**
+
+  \brief Decoder thread, claims chunks in order and decodes each once its slot has been written
+
+  \return void *    NULL
+
+******************************************************************************/
+void * run_worker(void * arg)
+{
+    worker_t * worker = arg;
+    pool_t * pool = worker->pool;
+
+    for (;;)
+    {
+        size_t chunk = __atomic_fetch_add(&pool->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= pool->num_chunks)
+        {
+            break;
+        }
+
+        /* Wait until the chunk that last used the slot has been written */
+        pthread_mutex_lock(&pool->lock);
+        while (chunk >= pool->num_written + pool->num_slots && !pool->stop)
+        {
+            pthread_cond_wait(&pool->written, &pool->lock);
+        }
+        bool stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+        {
+            break;
+        }
+
+        chunk_t * out = &pool->slots[chunk % pool->num_slots];
+        bool decoded = decode_chunk(pool, worker->ctx, chunk, out);
+
+        pthread_mutex_lock(&pool->lock);
+        out->done = true;
+        out->failed = !decoded;
+        pthread_cond_signal(&pool->decoded);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+#endif
+
+/**************************************************************************//**
+
+  \brief Decode candump log text into newline delimited JSON with a pool of threads
+
+  \param db             database shared by the decoder contexts
+  \param text           log text
+  \param len            length of log text
+  \param options        decoding options, NULL for the defaults
+  \param write_fn       output callback
+  \param user           passed to write_fn
+  \param num_frames     set to the number of frames parsed, may be NULL
+
+  \return bool          true if all of the text was decoded and written
+
+******************************************************************************/
+bool j1939decode_text_to_ndjson(j1939decode_db_t * db, const char * text, size_t len,
+                                const j1939decode_file_options_t * options, j1939decode_write_fn write_fn, void * user,
+                                size_t * num_frames)
+{
+    static const j1939decode_file_options_t default_options;
+    if (options == NULL)
+    {
+        options = &default_options;
+    }
+    if (num_frames != NULL)
+    {
+        *num_frames = 0;
+    }
+    if (db == NULL)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "J1939 database not loaded");
+        return false;
+    }
+
+    pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.text = text;
+    pool.len = len;
+    pool.chunk_size = options->chunk_size > 0 ? options->chunk_size : J1939DECODE_FILE_CHUNK_SIZE;
+    pool.num_chunks = (len + pool.chunk_size - 1) / pool.chunk_size;
+    pool.timestamps = options->timestamps;
+    pool.allocator = j1939ctx_allocator(options->allocator);
+
+    size_t num_threads = 1;
+#ifdef J1939DECODE_HAVE_THREADS
+    num_threads = options->num_threads;
+    if (num_threads == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = online > 0 ? (size_t) online : 1;
+    }
+#endif
+    num_threads = num_threads < pool.num_chunks ? num_threads : pool.num_chunks;
+    num_threads = num_threads > 0 ? num_threads : 1;
+    pool.num_slots = num_threads > 1 ? num_threads * FILE_SLOTS_PER_THREAD : 1;
+
+    /* Workers, their contexts and the chunk slots in one allocation, slots are 8 byte aligned */
+    size_t slots_offset = (num_threads * sizeof(worker_t) + 7) & ~(size_t) 7;
+    size_t size = slots_offset + pool.num_slots * sizeof(chunk_t);
+    worker_t * workers = pool.allocator->malloc_fn(pool.allocator->user, size);
+    if (workers == NULL)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return false;
+    }
+    memset(workers, 0, size);
+    pool.slots = (chunk_t *) ((uint8_t *) workers + slots_offset);
+
+    bool ok = true;
+    for (size_t i = 0; i < num_threads && ok; i++)
+    {
+        workers[i].pool = &pool;
+        workers[i].ctx = j1939decode_ctx_create_with_allocator(db, pool.allocator);
+        ok = workers[i].ctx != NULL && j1939decode_ctx_set_profile(workers[i].ctx, options->profile) &&
+             (options->pgns == NULL ||
+              j1939decode_ctx_set_pgn_filter(workers[i].ctx, options->pgns, options->num_pgns, true));
+    }
+
+    if (ok && num_threads == 1)
+    {
+        /* Decoded and written in turn without any threads */
+        for (size_t chunk = 0; chunk < pool.num_chunks && ok; chunk++)
+        {
+            ok = decode_chunk(&pool, workers[0].ctx, chunk, &pool.slots[0]);
+            if (ok && num_frames != NULL)
+            {
+                *num_frames += pool.slots[0].num_frames;
+            }
+            ok = ok && (pool.slots[0].len == 0 || write_fn(user, pool.slots[0].buf, pool.slots[0].len));
+        }
+    }
+#ifdef J1939DECODE_HAVE_THREADS
+    else if (ok)
+    {
+        size_t num_started = 0;
+
+        pthread_mutex_init(&pool.lock, NULL);
+        pthread_cond_init(&pool.decoded, NULL);
+        pthread_cond_init(&pool.written, NULL);
+
+        for (; num_started < num_threads; num_started++)
+        {
+            if (pthread_create(&workers[num_started].thread, NULL, run_worker, &workers[num_started]) != 0)
+            {
+                log_msg(J1939DECODE_LOG_ERROR, "Could not start log decoding thread");
+                ok = false;
+                break;
+            }
+        }
+
+        /* Write chunks in order as they are decoded, freeing each slot for the chunk num_slots ahead */
+        for (size_t chunk = 0; chunk < pool.num_chunks && ok && num_started > 0; chunk++)
+        {
+            chunk_t * out = &pool.slots[chunk % pool.num_slots];
+
+            pthread_mutex_lock(&pool.lock);
+            while (!out->done)
+            {
+                pthread_cond_wait(&pool.decoded, &pool.lock);
+            }
+            pthread_mutex_unlock(&pool.lock);
+
+            ok = !out->failed && (out->len == 0 || write_fn(user, out->buf, out->len));
+            if (ok && num_frames != NULL)
+            {
+                *num_frames += out->num_frames;
+            }
+
+            pthread_mutex_lock(&pool.lock);
+            out->done = false;
+            pool.num_written++;
+            pthread_cond_broadcast(&pool.written);
+            pthread_mutex_unlock(&pool.lock);
+        }
+
+        /* Threads still waiting for a slot give up */
+        pthread_mutex_lock(&pool.lock);
+        pool.stop = true;
+        pthread_cond_broadcast(&pool.written);
+        pthread_mutex_unlock(&pool.lock);
+
+        for (size_t i = 0; i < num_started; i++)
+        {
+            pthread_join(workers[i].thread, NULL);
+        }
+
+        pthread_cond_destroy(&pool.written);
+        pthread_cond_destroy(&pool.decoded);
+        pthread_mutex_destroy(&pool.lock);
+    }
+#endif
+
+    for (size_t i = 0; i < pool.num_slots; i++)
+    {
+        if (pool.slots[i].buf != NULL)
+        {
+            pool.allocator->free_fn(pool.allocator->user, pool.slots[i].buf);
+        }
+    }
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        j1939decode_ctx_destroy(workers[i].ctx);
+    }
+    pool.allocator->free_fn(pool.allocator->user, workers);
+
+    return ok;
+}
+
+/**************************************************************************//**
+
+  \brief Decode a candump log file into newline delimited JSON with a pool of threads
+
+  \return bool  true if all of the file was decoded and written
+
+******************************************************************************/
+bool j1939decode_file_to_ndjson(j1939decode_db_t * db, const char * filename,
+                                const j1939decode_file_options_t * options, j1939decode_write_fn write_fn, void * user,
+                                size_t * num_frames)
+{
+    const j1939decode_allocator_t * allocator = j1939ctx_allocator(options != NULL ? options->allocator : NULL);
+
+    size_t len;
+    bool mapped;
+    const char * text = j1939ctx_file_open(filename, allocator, &len, &mapped);
+    if (text == NULL)
+    {
+        if (num_frames != NULL)
+        {
+            *num_frames = 0;
+        }
+        return false;
+    }
+
+    bool ok = j1939decode_text_to_ndjson(db, text, len, options, write_fn, user, num_frames);
+
+    j1939ctx_file_close(text, len, mapped, allocator);
+    return ok;
+}
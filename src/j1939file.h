@@ -0,0 +1,58 @@
+#ifndef J1939FILE_H
+#define J1939FILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939decode.h"
+
+/* Default bytes of log text per work item of parallel decoding */
+#define J1939DECODE_FILE_CHUNK_SIZE (64U * 1024U)
+
+/* Output callback of log decoding, called with whole lines of output, returns false to stop decoding */
+typedef bool (*j1939decode_write_fn)(void * user, const char * buf, size_t len);
+
+/* Log decoding options, zero initialize for the defaults */
+typedef struct
+{
+    size_t num_threads;                 /* decoder threads, 0 for one per online processor */
+    size_t chunk_size;                  /* bytes of log text per work item, 0 for J1939DECODE_FILE_CHUNK_SIZE */
+    uint32_t profile;                   /* J1939DECODE_PROFILE_ of the output */
+    bool timestamps;                    /* start each object with a "Timestamp" member, in seconds */
+    const uint32_t * pgns;              /* only decode these PGNs, NULL to decode all */
+    size_t num_pgns;
+    const j1939decode_allocator_t * allocator;  /* for contexts and output buffers, NULL to use malloc() and free() */
+} j1939decode_file_options_t;
+
+/* Parse one line of a candump log, the line does not need to be null terminated
+ * Accepts the candump -l log format "(1600000000.000000) can0 18FEF100#0011223344556677" and the default format
+ * "can0  18FEF100   [8]  00 11 22 33 44 55 66 77", with an optional "(1600000000.000000)" timestamp in front as
+ * printed by candump -ta. timestamp_us is set to 0 if the line has no timestamp
+ * Returns false for lines without a frame, and for standard, remote, error and CAN FD frames */
+bool j1939decode_parse_candump(const char * line, size_t len, j1939_frame_t * frame, uint64_t * timestamp_us);
+
+/* Decode candump log text into newline delimited JSON, in the order of the lines
+ * The text is split into chunks at line boundaries, which are decoded by a pool of threads that each have their own
+ * context on db. write_fn is only called from the calling thread, with the output of each chunk in order
+ * Log messages may come from any of the threads. Only a few chunks per thread are held in memory at once
+ * num_frames is set to the number of frames parsed if not NULL
+ * Returns true if all of the text was decoded and written */
+bool j1939decode_text_to_ndjson(j1939decode_db_t * db, const char * text, size_t len,
+                                const j1939decode_file_options_t * options, j1939decode_write_fn write_fn, void * user,
+                                size_t * num_frames);
+
+/* Decode a candump log file like j1939decode_text_to_ndjson(), the file is memory-mapped where possible */
+bool j1939decode_file_to_ndjson(j1939decode_db_t * db, const char * filename,
+                                const j1939decode_file_options_t * options, j1939decode_write_fn write_fn, void * user,
+                                size_t * num_frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939FILE_H
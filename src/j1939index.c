@@ -0,0 +1,998 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "j1939index.h"
+#include "j1939ctx.h"
+#ifndef J1939DECODE_NO_CJSON
+#include "cJSON.h"
+#endif
+
+/* Location of one PGN or SPN object in the database text */
+typedef struct
+{
+    uint32_t number;        /* PGN or SPN number parsed from the key */
+    uint32_t key;           /* offset of key, without quotes */
+    uint32_t key_len;
+    uint32_t value;         /* offset of object value */
+    uint32_t value_len;
+} index_entry_t;
+
+/* Object member found by the scanner */
+typedef struct
+{
+    size_t key;
+    size_t key_len;
+    size_t value;
+    size_t value_len;
+} member_t;
+
+struct j1939index
+{
+    j1939decode_allocator_t allocator;
+
+    /* Source address names, and for binary images all tables */
+    const j1939db_t * tables;
+
+    /* Tables built from the source address table of JSON text, NULL for binary images */
+    j1939db_t * sa_tables;
+
+    /* JSON text and the location of every PGN, SPN, SPN bit decoding and source address specific PGN in it,
+     * sorted by number */
+    const char * text;
+    size_t text_size;
+    index_entry_t * pgns;
+    uint32_t num_pgns;
+    index_entry_t * spns;
+    uint32_t num_spns;
+    index_entry_t * decodings;
+    uint32_t num_decodings;
+    index_entry_t * sa_pgns;
+    uint32_t num_sa_pgns;
+
+    /* Tables of each PGN, by position in pgns or in the binary image PGN table
+     * NULL until first looked up, then published once with an atomic compare and swap */
+    const j1939db_t ** slots;
+    size_t num_loaded;
+
+    /* Tables of each SPN looked up on its own, by position in spns or in the binary image SPN table */
+    const j1939db_t ** spn_slots;
+};
+
+/* Published for PGNs that could not be loaded, so that loading is only tried once */
+static const j1939db_t invalid_tables;
+
+/* Static helper functions */
+static void log_msg(uint32_t level, const char * fmt, ...);
+#ifndef J1939DECODE_NO_CJSON
+static size_t skip_space(const char * text, size_t pos, size_t end);
+static bool skip_string(const char * text, size_t * pos, size_t end);
+static bool skip_value(const char * text, size_t * pos, size_t end);
+static bool next_member(const char * text, size_t * pos, size_t end, bool * first, member_t * member);
+static bool parse_number(const char * text, size_t len, uint32_t * number);
+static size_t count_members(const char * text, size_t value, size_t len, bool * valid);
+static uint32_t fill_entries(const char * text, size_t value, size_t len, index_entry_t * entries);
+static int compare_entries(const void * a, const void * b);
+static const index_entry_t * find_entry(const index_entry_t * entries, uint32_t count, uint32_t number);
+static cJSON * parse_value(const j1939index_t * index, size_t value, size_t len);
+static bool add_entry(const j1939index_t * index, cJSON * object, const index_entry_t * entry);
+static bool add_spns(const j1939index_t * index, cJSON * spns, cJSON * decodings, const cJSON * pgn);
+static j1939db_t * build_tables(const j1939index_t * index, const index_entry_t * pgn_entry,
+                                const index_entry_t * spn_entry, const member_t * sa_member);
+#endif
+static const j1939db_t * publish(j1939index_t * index, const j1939db_t ** slots, size_t slot, const j1939db_t * tables);
+
+/**************************************************************************//**
+
+  \brief Log formatted message to the process-wide handler
+
+  \return void
+
+******************************************************************************/
+void log_msg(uint32_t level, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    j1939ctx_vlog(NULL, level, fmt, args);
+    va_end(args);
+}
+
+#ifndef J1939DECODE_NO_CJSON
+/**************************************************************************//**
+
+  \brief Skip JSON whitespace
+
+  \return size_t    position of next non-whitespace character
+
+******************************************************************************/
+size_t skip_space(const char * text, size_t pos, size_t end)
+{
+    while (pos < end && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+    {
+        pos++;
+    }
+    return pos;
+}
+
+/**************************************************************************//**
+
+  \brief Skip JSON string, pos must point at the opening quote
+
+  \return bool  true if the closing quote was found
+
+******************************************************************************/
+bool skip_string(const char * text, size_t * pos, size_t end)
+{
+    for (size_t i = *pos + 1; i < end; i++)
+    {
+        if (text[i] == '\\')
+        {
+            i++;
+        }
+        else if (text[i] == '"')
+        {
+            *pos = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**************************************************************************//**
+
+  \brief Skip any JSON value without parsing it
+
+  Only strings and nesting are tracked, values are checked by cJSON when
+  they are parsed.
+
+  \return bool  true if a complete value was skipped
+
+******************************************************************************/
+bool skip_value(const char * text, size_t * pos, size_t end)
+{
+    size_t i = *pos;
+    uint32_t depth = 0;
+    while (i < end)
+    {
+        char c = text[i];
+        if (c == '"')
+        {
+            if (!skip_string(text, &i, end))
+            {
+                return false;
+            }
+        }
+        else if (c == '{' || c == '[')
+        {
+            depth++;
+            i++;
+        }
+        else if (c == '}' || c == ']')
+        {
+            if (depth == 0)
+            {
+                /* End of the enclosing object or array */
+                break;
+            }
+            depth--;
+            i++;
+        }
+        else if (depth == 0 && (c == ',' || c == ' ' || c == '\t' || c == '\n' || c == '\r'))
+        {
+            break;
+        }
+        else
+        {
+            i++;
+        }
+
+        if (depth == 0 && (c == '"' || c == '}' || c == ']'))
+        {
+            break;
+        }
+    }
+
+    if (depth != 0 || i == *pos)
+    {
+        return false;
+    }
+    *pos = i;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Find next member of a JSON object
+
+  \param text       JSON text
+  \param pos        position after the opening brace or the previous member
+  \param end        end of JSON text
+  \param first      true before the first member, cleared by this function
+  \param member     member to be filled in
+
+  \return bool      true if a member was found, false at the end of the object or on a syntax error
+
+******************************************************************************/
+bool next_member(const char * text, size_t * pos, size_t end, bool * first, member_t * member)
+{
+    size_t i = skip_space(text, *pos, end);
+    if (i < end && text[i] == '}')
+    {
+        return false;
+    }
+    if (!*first)
+    {
+        if (i >= end || text[i] != ',')
+        {
+            return false;
+        }
+        i = skip_space(text, i + 1, end);
+    }
+    *first = false;
+
+    if (i >= end || text[i] != '"')
+    {
+        return false;
+    }
+    member->key = i + 1;
+    if (!skip_string(text, &i, end))
+    {
+        return false;
+    }
+    member->key_len = i - 1 - member->key;
+
+    i = skip_space(text, i, end);
+    if (i >= end || text[i] != ':')
+    {
+        return false;
+    }
+    i = skip_space(text, i + 1, end);
+
+    member->value = i;
+    if (!skip_value(text, &i, end))
+    {
+        return false;
+    }
+    member->value_len = i - member->value;
+
+    *pos = i;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Parse a decimal key
+
+  \return bool  true if the key is a number
+
+******************************************************************************/
+bool parse_number(const char * text, size_t len, uint32_t * number)
+{
+    uint64_t value = 0;
+    if (len == 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (uint64_t) (text[i] - '0');
+        if (value > UINT32_MAX)
+        {
+            return false;
+        }
+    }
+    *number = (uint32_t) value;
+    return true;
+}
+
+/* Count members of a JSON object value */
+size_t count_members(const char * text, size_t value, size_t len, bool * valid)
+{
+    size_t count = 0;
+    size_t pos = value + 1;
+    size_t end = value + len;
+    bool first = true;
+    member_t member;
+
+    *valid = len >= 2 && text[value] == '{';
+    while (*valid && next_member(text, &pos, end, &first, &member))
+    {
+        count++;
+    }
+    return count;
+}
+
+/* Fill in index entries for the members of a JSON object value with numeric keys */
+uint32_t fill_entries(const char * text, size_t value, size_t len, index_entry_t * entries)
+{
+    uint32_t count = 0;
+    size_t pos = value + 1;
+    bool first = true;
+    member_t member;
+
+    while (next_member(text, &pos, value + len, &first, &member))
+    {
+        index_entry_t * entry = &entries[count];
+        if (text[member.value] == '{' && parse_number(&text[member.key], member.key_len, &entry->number))
+        {
+            entry->key = (uint32_t) member.key;
+            entry->key_len = (uint32_t) member.key_len;
+            entry->value = (uint32_t) member.value;
+            entry->value_len = (uint32_t) member.value_len;
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Sort by number, then by position so that the first of any duplicate keys is found */
+int compare_entries(const void * a, const void * b)
+{
+    const index_entry_t * x = a;
+    const index_entry_t * y = b;
+    if (x->number != y->number)
+    {
+        return x->number < y->number ? -1 : 1;
+    }
+    return (x->value > y->value) - (x->value < y->value);
+}
+
+/**************************************************************************//**
+
+  \brief Find first index entry of a number using binary search
+
+  \return const index_entry_t *  pointer to entry, NULL if not found
+
+******************************************************************************/
+const index_entry_t * find_entry(const index_entry_t * entries, uint32_t count, uint32_t number)
+{
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (entries[mid].number < number)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return (low < count && entries[low].number == number) ? &entries[low] : NULL;
+}
+
+/**************************************************************************//**
+
+  \brief Parse one value of the database text
+
+  The text is not null terminated, so the value is copied before parsing.
+
+  \return cJSON *   parsed value, NULL on failure
+
+******************************************************************************/
+cJSON * parse_value(const j1939index_t * index, size_t value, size_t len)
+{
+    char * s = malloc(len + 1);
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    memcpy(s, &index->text[value], len);
+    s[len] = '\0';
+
+    cJSON * json = cJSON_Parse(s);
+    free(s);
+    return json;
+}
+
+/**************************************************************************//**
+
+  \brief Parse PGN or SPN object and add it to an object under its original key
+
+  \return bool  true on success
+
+******************************************************************************/
+bool add_entry(const j1939index_t * index, cJSON * object, const index_entry_t * entry)
+{
+    char key[32];
+    if (entry->key_len >= sizeof(key))
+    {
+        return false;
+    }
+    memcpy(key, &index->text[entry->key], entry->key_len);
+    key[entry->key_len] = '\0';
+
+    /* SPNs listed more than once are only added once */
+    if (cJSON_GetObjectItemCaseSensitive(object, key) != NULL)
+    {
+        return true;
+    }
+
+    cJSON * item = parse_value(index, entry->value, entry->value_len);
+    if (item == NULL)
+    {
+        return false;
+    }
+    cJSON_AddItemToObject(object, key, item);
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Add the SPNs listed by a PGN object and their bit decodings
+
+  \return bool  true on success
+
+******************************************************************************/
+bool add_spns(const j1939index_t * index, cJSON * spns, cJSON * decodings, const cJSON * pgn)
+{
+    const cJSON * spn_list = cJSON_GetObjectItemCaseSensitive(pgn, "SPNs");
+    const cJSON * spn_number;
+    cJSON_ArrayForEach(spn_number, spn_list)
+    {
+        const index_entry_t * spn_entry = NULL;
+        const index_entry_t * decoding_entry = NULL;
+        if (cJSON_IsNumber(spn_number) && spn_number->valueint >= 0)
+        {
+            spn_entry = find_entry(index->spns, index->num_spns, (uint32_t) spn_number->valueint);
+            decoding_entry = find_entry(index->decodings, index->num_decodings, (uint32_t) spn_number->valueint);
+        }
+        if ((spn_entry != NULL && !add_entry(index, spns, spn_entry)) ||
+            (decoding_entry != NULL && !add_entry(index, decodings, decoding_entry)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Build tables from part of the database text
+
+  The parse tree holds only the requested PGN, its source address specific
+  variants and the SPNs they list, or only one SPN, or only the source address
+  table, and is compiled the same way as a whole database.
+
+  \param index      database index
+  \param pgn_entry  PGN to build tables for, NULL for none
+  \param spn_entry  SPN to build tables for, NULL for none
+  \param sa_member  source address table to build tables for, NULL for none
+
+  \return j1939db_t *   tables in one allocation from the index allocator, NULL on failure
+
+******************************************************************************/
+j1939db_t * build_tables(const j1939index_t * index, const index_entry_t * pgn_entry,
+                         const index_entry_t * spn_entry, const member_t * sa_member)
+{
+    j1939db_t * tables = NULL;
+    j1939db_t * compiled = NULL;
+    cJSON * root = cJSON_CreateObject();
+    cJSON * pgns = cJSON_CreateObject();
+    cJSON * spns = cJSON_CreateObject();
+    cJSON * decodings = cJSON_CreateObject();
+    cJSON * sa_pgns = cJSON_CreateObject();
+    if (root == NULL || pgns == NULL || spns == NULL || decodings == NULL || sa_pgns == NULL)
+    {
+        cJSON_Delete(pgns);
+        cJSON_Delete(spns);
+        cJSON_Delete(decodings);
+        cJSON_Delete(sa_pgns);
+        goto cleanup;
+    }
+    cJSON_AddItemToObject(root, "J1939PGNdb", pgns);
+    cJSON_AddItemToObject(root, "J1939SPNdb", spns);
+    cJSON_AddItemToObject(root, "J1939BitDecodings", decodings);
+    cJSON_AddItemToObject(root, "J1939PGNSAdb", sa_pgns);
+
+    if (pgn_entry != NULL)
+    {
+        if (!add_entry(index, pgns, pgn_entry) || !add_spns(index, spns, decodings, pgns->child))
+        {
+            goto cleanup;
+        }
+
+        const index_entry_t * sa_pgn_entry = find_entry(index->sa_pgns, index->num_sa_pgns, pgn_entry->number);
+        if (sa_pgn_entry != NULL)
+        {
+            if (!add_entry(index, sa_pgns, sa_pgn_entry))
+            {
+                goto cleanup;
+            }
+
+            const cJSON * variant;
+            cJSON_ArrayForEach(variant, sa_pgns->child)
+            {
+                if (!add_spns(index, spns, decodings, variant))
+                {
+                    goto cleanup;
+                }
+            }
+        }
+    }
+
+    if (spn_entry != NULL)
+    {
+        const index_entry_t * decoding_entry = find_entry(index->decodings, index->num_decodings, spn_entry->number);
+        if (!add_entry(index, spns, spn_entry) ||
+            (decoding_entry != NULL && !add_entry(index, decodings, decoding_entry)))
+        {
+            goto cleanup;
+        }
+    }
+
+    if (sa_member != NULL)
+    {
+        cJSON * sa_json = parse_value(index, sa_member->value, sa_member->value_len);
+        if (sa_json == NULL)
+        {
+            goto cleanup;
+        }
+        cJSON_AddItemToObject(root, "J1939SATabledb", sa_json);
+    }
+
+    compiled = j1939db_compile(root);
+    if (compiled != NULL)
+    {
+        tables = j1939db_copy(compiled, &index->allocator);
+    }
+
+    cleanup:
+    j1939db_free(compiled);
+    cJSON_Delete(root);
+    return tables;
+}
+
+/**************************************************************************//**
+
+  \brief Build index of the database text
+
+  \param text           J1939db.json text, need not be null terminated
+  \param size           size of text in bytes
+  \param allocator      allocator for the index and tables, NULL to use malloc() and free()
+  \param error          set to a description of the problem on failure
+
+  \return j1939index_t *    pointer to index, NULL on failure
+
+******************************************************************************/
+j1939index_t * j1939index_open_json(const char * text, size_t size, const j1939decode_allocator_t * allocator,
+                                    const char ** error)
+{
+    member_t pgns = {0, 0, 0, 0};
+    member_t spns = {0, 0, 0, 0};
+    member_t sa_names = {0, 0, 0, 0};
+    member_t decodings = {0, 0, 0, 0};
+    member_t sa_pgns = {0, 0, 0, 0};
+    member_t member;
+    bool first = true;
+    bool valid_pgns;
+    bool valid_spns;
+    bool valid_decodings;
+    bool valid_sa_pgns;
+
+    *error = "Unable to parse J1939db";
+
+    /* Offsets are stored as 32 bit numbers */
+    size_t pos = skip_space(text, 0, size);
+    if (size >= UINT32_MAX || pos >= size || text[pos] != '{')
+    {
+        return NULL;
+    }
+
+    pos++;
+    while (next_member(text, &pos, size, &first, &member))
+    {
+        if (member.key_len == 10 && memcmp(&text[member.key], "J1939PGNdb", 10) == 0)
+        {
+            pgns = member;
+        }
+        else if (member.key_len == 10 && memcmp(&text[member.key], "J1939SPNdb", 10) == 0)
+        {
+            spns = member;
+        }
+        else if (member.key_len == 14 && memcmp(&text[member.key], "J1939SATabledb", 14) == 0)
+        {
+            sa_names = member;
+        }
+        else if (member.key_len == 17 && memcmp(&text[member.key], "J1939BitDecodings", 17) == 0)
+        {
+            decodings = member;
+        }
+        else if (member.key_len == 12 && memcmp(&text[member.key], "J1939PGNSAdb", 12) == 0)
+        {
+            sa_pgns = member;
+        }
+    }
+
+    /* Databases without bit decodings or source address specific PGNs are still valid */
+    size_t max_pgns = count_members(text, pgns.value, pgns.value_len, &valid_pgns);
+    size_t max_spns = count_members(text, spns.value, spns.value_len, &valid_spns);
+    size_t max_decodings = count_members(text, decodings.value, decodings.value_len, &valid_decodings);
+    size_t max_sa_pgns = count_members(text, sa_pgns.value, sa_pgns.value_len, &valid_sa_pgns);
+    if (!valid_pgns || !valid_spns)
+    {
+        return NULL;
+    }
+
+    /* Index, entries and slots in one allocation */
+    size_t pgns_offset = (sizeof(j1939index_t) + 7) & ~(size_t) 7;
+    size_t spns_offset = pgns_offset + max_pgns * sizeof(index_entry_t);
+    size_t decodings_offset = spns_offset + max_spns * sizeof(index_entry_t);
+    size_t sa_pgns_offset = decodings_offset + max_decodings * sizeof(index_entry_t);
+    size_t slots_offset = (sa_pgns_offset + max_sa_pgns * sizeof(index_entry_t) + 7) & ~(size_t) 7;
+    size_t spn_slots_offset = slots_offset + max_pgns * sizeof(j1939db_t *);
+    size_t total = spn_slots_offset + max_spns * sizeof(j1939db_t *);
+
+    allocator = j1939ctx_allocator(allocator);
+    j1939index_t * index = allocator->malloc_fn(allocator->user, total);
+    if (index == NULL)
+    {
+        *error = "Memory allocation failure";
+        return NULL;
+    }
+
+    memset(index, 0, sizeof(*index));
+    index->allocator = *allocator;
+    index->text = text;
+    index->text_size = size;
+    index->pgns = (index_entry_t *) ((uint8_t *) index + pgns_offset);
+    index->spns = (index_entry_t *) ((uint8_t *) index + spns_offset);
+    index->decodings = (index_entry_t *) ((uint8_t *) index + decodings_offset);
+    index->sa_pgns = (index_entry_t *) ((uint8_t *) index + sa_pgns_offset);
+    index->slots = (const j1939db_t **) ((uint8_t *) index + slots_offset);
+    index->spn_slots = (const j1939db_t **) ((uint8_t *) index + spn_slots_offset);
+    memset(index->slots, 0, (max_pgns + max_spns) * sizeof(j1939db_t *));
+
+    index->num_pgns = fill_entries(text, pgns.value, pgns.value_len, index->pgns);
+    index->num_spns = fill_entries(text, spns.value, spns.value_len, index->spns);
+    index->num_decodings = fill_entries(text, decodings.value, decodings.value_len, index->decodings);
+    index->num_sa_pgns = fill_entries(text, sa_pgns.value, sa_pgns.value_len, index->sa_pgns);
+    qsort(index->pgns, index->num_pgns, sizeof(index_entry_t), compare_entries);
+    qsort(index->spns, index->num_spns, sizeof(index_entry_t), compare_entries);
+    qsort(index->decodings, index->num_decodings, sizeof(index_entry_t), compare_entries);
+    qsort(index->sa_pgns, index->num_sa_pgns, sizeof(index_entry_t), compare_entries);
+
+    /* Source address names are needed by every message, so they are loaded now */
+    index->sa_tables = build_tables(index, NULL, NULL, sa_names.value_len > 0 ? &sa_names : NULL);
+    if (index->sa_tables == NULL)
+    {
+        allocator->free_fn(allocator->user, index);
+        return NULL;
+    }
+    index->tables = index->sa_tables;
+
+    *error = NULL;
+    return index;
+}
+
+#else
+/**************************************************************************//**
+
+  \brief Index J1939db JSON text, which needs cJSON
+
+  \return j1939index_t *    always NULL
+
+******************************************************************************/
+j1939index_t * j1939index_open_json(const char * text, size_t size, const j1939decode_allocator_t * allocator,
+                                    const char ** error)
+{
+    (void) text;
+    (void) size;
+    (void) allocator;
+    *error = "JSON databases are not supported by this build";
+    return NULL;
+}
+#endif
+
+/**************************************************************************//**
+
+  \brief Index a binary image opened with j1939db_init_image_lazy()
+
+  \param tables             tables of the binary image
+  \param allocator          allocator for the index, NULL to use malloc() and free()
+
+  \return j1939index_t *    pointer to index, NULL on failure
+
+******************************************************************************/
+j1939index_t * j1939index_open_image(const j1939db_t * tables, const j1939decode_allocator_t * allocator)
+{
+    size_t slots_offset = (sizeof(j1939index_t) + 7) & ~(size_t) 7;
+    size_t spn_slots_offset = slots_offset + tables->num_pgns * sizeof(j1939db_t *);
+    size_t total = spn_slots_offset + tables->num_spns * sizeof(j1939db_t *);
+
+    allocator = j1939ctx_allocator(allocator);
+    j1939index_t * index = allocator->malloc_fn(allocator->user, total);
+    if (index == NULL)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return NULL;
+    }
+
+    memset(index, 0, sizeof(*index));
+    index->allocator = *allocator;
+    index->tables = tables;
+    index->slots = (const j1939db_t **) ((uint8_t *) index + slots_offset);
+    index->spn_slots = (const j1939db_t **) ((uint8_t *) index + spn_slots_offset);
+    memset(index->slots, 0, ((size_t) tables->num_pgns + tables->num_spns) * sizeof(j1939db_t *));
+
+    return index;
+}
+
+/**************************************************************************//**
+
+  \brief Free index and all tables built by it
+
+  \return void
+
+******************************************************************************/
+void j1939index_free(j1939index_t * index)
+{
+    if (index == NULL)
+    {
+        return;
+    }
+
+    /* Binary images have their tables validated in place, nothing was built */
+    for (uint32_t i = 0; index->text != NULL && i < index->num_pgns + index->num_spns; i++)
+    {
+        const j1939db_t * tables = i < index->num_pgns ? index->slots[i] : index->spn_slots[i - index->num_pgns];
+        if (tables != NULL && tables != &invalid_tables)
+        {
+            index->allocator.free_fn(index->allocator.user, (void *) tables);
+        }
+    }
+
+    if (index->sa_tables != NULL)
+    {
+        index->allocator.free_fn(index->allocator.user, index->sa_tables);
+    }
+    index->allocator.free_fn(index->allocator.user, index);
+}
+
+/**************************************************************************//**
+
+  \brief Get tables holding the source address names
+
+  \return const j1939db_t *     tables
+
+******************************************************************************/
+const j1939db_t * j1939index_tables(const j1939index_t * index)
+{
+    return index->tables;
+}
+
+/**************************************************************************//**
+
+  \brief Publish the tables of a PGN or SPN unless another thread got there first
+
+  \param index      database index
+  \param slots      PGN or SPN slots
+  \param slot       slot of the PGN or SPN
+  \param tables     tables built by this thread
+
+  \return const j1939db_t *     tables in the slot
+
+******************************************************************************/
+const j1939db_t * publish(j1939index_t * index, const j1939db_t ** slots, size_t slot, const j1939db_t * tables)
+{
+    const j1939db_t * expected = NULL;
+    if (__atomic_compare_exchange_n(&slots[slot], &expected, tables, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        if (tables != &invalid_tables && slots == index->slots)
+        {
+            __atomic_add_fetch(&index->num_loaded, 1, __ATOMIC_RELAXED);
+        }
+        return tables;
+    }
+
+    /* Lost the race, use the other thread's tables */
+    if (tables != &invalid_tables && tables != index->tables)
+    {
+        index->allocator.free_fn(index->allocator.user, (void *) tables);
+    }
+    return expected;
+}
+
+/**************************************************************************//**
+
+  \brief Lookup PGN record, building or validating its tables on first use
+
+  \param index      database index
+  \param pgn        parameter group number
+  \param tables     set to the tables the PGN record belongs to
+
+  \return const j1939db_pgn_t *  pointer to PGN record, NULL if not found or not loadable
+
+******************************************************************************/
+const j1939db_pgn_t * j1939index_find_pgn(j1939index_t * index, uint32_t pgn, const j1939db_t ** tables)
+{
+    const j1939db_t * slot;
+
+    if (index->text == NULL)
+    {
+        /* Binary image, the PGN table itself was bounds checked when the image was opened */
+        const j1939db_pgn_t * pgn_data = j1939db_find_pgn(index->tables, pgn);
+        if (pgn_data == NULL)
+        {
+            return NULL;
+        }
+
+        size_t i = (size_t) (pgn_data - index->tables->pgns);
+        slot = __atomic_load_n(&index->slots[i], __ATOMIC_ACQUIRE);
+        if (slot == NULL)
+        {
+            bool valid = j1939db_validate_pgn(index->tables, pgn_data);
+            if (!valid)
+            {
+                log_msg(J1939DECODE_LOG_ERROR, "Invalid J1939db image entry for PGN %u", pgn);
+            }
+            slot = publish(index, index->slots, i, valid ? index->tables : &invalid_tables);
+        }
+
+        if (slot == &invalid_tables)
+        {
+            return NULL;
+        }
+        *tables = slot;
+        return pgn_data;
+    }
+
+#ifdef J1939DECODE_NO_CJSON
+    /* Only binary images are indexed */
+    return NULL;
+#else
+    const index_entry_t * entry = find_entry(index->pgns, index->num_pgns, pgn);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    size_t i = (size_t) (entry - index->pgns);
+    slot = __atomic_load_n(&index->slots[i], __ATOMIC_ACQUIRE);
+    if (slot == NULL)
+    {
+        const j1939db_t * built = build_tables(index, entry, NULL, NULL);
+        if (built == NULL)
+        {
+            log_msg(J1939DECODE_LOG_ERROR, "Unable to load PGN %u from J1939db", pgn);
+            built = &invalid_tables;
+        }
+        slot = publish(index, index->slots, i, built);
+    }
+
+    if (slot == &invalid_tables)
+    {
+        return NULL;
+    }
+    *tables = slot;
+    return j1939db_find_pgn(slot, pgn);
+#endif
+}
+
+/**************************************************************************//**
+
+  \brief Lookup SPN record on its own, building or validating its tables on first use
+
+  \param index      database index
+  \param spn        suspect parameter number
+  \param tables     set to the tables the SPN record belongs to
+
+  \return const j1939db_spn_t *  pointer to SPN record, NULL if not found or not loadable
+
+******************************************************************************/
+const j1939db_spn_t * j1939index_find_spn(j1939index_t * index, uint32_t spn, const j1939db_t ** tables)
+{
+    const j1939db_t * slot;
+
+    if (index->text == NULL)
+    {
+        const j1939db_spn_t * spn_data = j1939db_find_spn(index->tables, spn);
+        if (spn_data == NULL)
+        {
+            return NULL;
+        }
+
+        size_t i = (size_t) (spn_data - index->tables->spns);
+        slot = __atomic_load_n(&index->spn_slots[i], __ATOMIC_ACQUIRE);
+        if (slot == NULL)
+        {
+            bool valid = j1939db_validate_spn(index->tables, spn_data);
+            if (!valid)
+            {
+                log_msg(J1939DECODE_LOG_ERROR, "Invalid J1939db image entry for SPN %u", spn);
+            }
+            slot = publish(index, index->spn_slots, i, valid ? index->tables : &invalid_tables);
+        }
+
+        if (slot == &invalid_tables)
+        {
+            return NULL;
+        }
+        *tables = slot;
+        return spn_data;
+    }
+
+#ifdef J1939DECODE_NO_CJSON
+    /* Only binary images are indexed */
+    return NULL;
+#else
+    const index_entry_t * entry = find_entry(index->spns, index->num_spns, spn);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    size_t i = (size_t) (entry - index->spns);
+    slot = __atomic_load_n(&index->spn_slots[i], __ATOMIC_ACQUIRE);
+    if (slot == NULL)
+    {
+        const j1939db_t * built = build_tables(index, NULL, entry, NULL);
+        if (built == NULL)
+        {
+            log_msg(J1939DECODE_LOG_ERROR, "Unable to load SPN %u from J1939db", spn);
+            built = &invalid_tables;
+        }
+        slot = publish(index, index->spn_slots, i, built);
+    }
+
+    if (slot == &invalid_tables)
+    {
+        return NULL;
+    }
+    *tables = slot;
+    return j1939db_find_spn(slot, spn);
+#endif
+}
+
+/**************************************************************************//**
+
+  \brief Get number of the PGN at a position of the index
+
+  \param index      database index
+  \param i          position, from 0
+  \param pgn        set to parameter group number
+
+  \return bool      true if position is within the index
+
+******************************************************************************/
+bool j1939index_pgn_number(const j1939index_t * index, size_t i, uint32_t * pgn)
+{
+    if (index->text == NULL)
+    {
+        if (i >= index->tables->num_pgns)
+        {
+            return false;
+        }
+        *pgn = index->tables->pgns[i].pgn;
+        return true;
+    }
+
+    if (i >= index->num_pgns)
+    {
+        return false;
+    }
+    *pgn = index->pgns[i].number;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Get number of PGNs whose tables have been built or validated
+
+  \return size_t    number of PGNs loaded
+
+******************************************************************************/
+size_t j1939index_num_loaded(const j1939index_t * index)
+{
+    return __atomic_load_n(&index->num_loaded, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,56 @@
+#ifndef J1939INDEX_H
+#define J1939INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939decode.h"
+#include "j1939db.h"
+
+/* Lazily loaded database
+ * Opening only builds an index of the database, the tables of a PGN are built or validated the first time it is looked up
+ * Lookups may run concurrently from any number of threads, each PGN's tables are published atomically */
+typedef struct j1939index j1939index_t;
+
+/* Build index of the PGNs and SPNs in J1939db.json text, the text must stay valid until j1939index_free()
+ * Only the source address table is parsed up front */
+j1939index_t * j1939index_open_json(const char * text, size_t size, const j1939decode_allocator_t * allocator,
+                                    const char ** error);
+
+/* Index a binary image opened with j1939db_init_image_lazy(), the tables must stay valid until j1939index_free()
+ * Each PGN is validated the first time it is looked up */
+j1939index_t * j1939index_open_image(const j1939db_t * tables, const j1939decode_allocator_t * allocator);
+
+/* Free index and all tables built by it */
+void j1939index_free(j1939index_t * index);
+
+/* Tables holding the source address names, and for binary images all PGNs */
+const j1939db_t * j1939index_tables(const j1939index_t * index);
+
+/* Lookup PGN record, building its tables on first use
+ * tables is set to the tables the PGN record and its SPN records belong to
+ * Returns NULL if the PGN is not in the database or could not be loaded */
+const j1939db_pgn_t * j1939index_find_pgn(j1939index_t * index, uint32_t pgn, const j1939db_t ** tables);
+
+/* Lookup SPN record on its own, building or validating its tables on first use, independently of the PGNs
+ * tables is set to the tables the SPN record belongs to
+ * Returns NULL if the SPN is not in the database or could not be loaded */
+const j1939db_spn_t * j1939index_find_spn(j1939index_t * index, uint32_t spn, const j1939db_t ** tables);
+
+/* Get number of the PGN at a position of the index, in ascending order and possibly repeated
+ * Returns false past the last PGN */
+bool j1939index_pgn_number(const j1939index_t * index, size_t i, uint32_t * pgn);
+
+/* Number of PGNs whose tables have been built or validated */
+size_t j1939index_num_loaded(const j1939index_t * index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939INDEX_H
@@ -0,0 +1,673 @@
+#include <string.h>
+
+#include "j1939json.h"
+#include "j1939dtoa.h"
+
+/* String literal and its length, for writing constant JSON fragments */
+#define LITERAL(s) s, sizeof(s) - 1
+
+/* Static helper functions */
+static void put_escaped(j1939json_t * w, const char * s);
+static void put_text(j1939json_t * w, const char * s, size_t len);
+static void put_string(j1939json_t * w, const j1939db_t * db, const char * s);
+static void put_db_string(j1939json_t * w, const j1939db_t * db, uint32_t offset);
+static void put_uint(j1939json_t * w, uint64_t value);
+static void put_double(j1939json_t * w, double value);
+static void put_key(j1939json_t * w, const char * key, size_t len);
+static void put_number_key(j1939json_t * w, uint32_t number);
+static void put_spn_key(j1939json_t * w, const j1939db_t * db, const j1939_spn_value_t * value);
+static void begin_object(j1939json_t * w);
+static void end_object(j1939json_t * w);
+static void write_spn_metadata(j1939json_t * w, const j1939db_t * db, const j1939_spn_value_t * value);
+static void write_value_decoded(j1939json_t * w, const j1939db_t * db, const j1939_spn_value_t * value);
+static void write_spn(j1939json_t * w, const j1939db_t * db, const j1939_spn_value_t * value, uint32_t profile);
+static void write_spns(j1939json_t * w, const j1939db_t * db, const j1939_decoded_t * decoded, uint32_t profile);
+
+/* Append bytes to output, once something does not fit only the length is counted */
+static inline void put(j1939json_t * w, const char * s, size_t len)
+{
+    if (w->written == w->pos && len <= w->cap - w->pos)
+    {
+        memcpy(w->buf + w->pos, s, len);
+        w->written += len;
+    }
+    w->pos += len;
+}
+
+static inline void put_char(j1939json_t * w, char c)
+{
+    put(w, &c, 1);
+}
+
+static inline void put_indent(j1939json_t * w)
+{
+    static const char tabs[] = "\t\t\t\t\t\t\t\t";
+    if (w->depth > 0)
+    {
+        put(w, tabs, w->depth < sizeof(tabs) - 1 ? w->depth : sizeof(tabs) - 1);
+    }
+}
+
+static inline void put_bool(j1939json_t * w, bool value)
+{
+    if (value)
+    {
+        put(w, LITERAL("true"));
+    }
+    else
+    {
+        put(w, LITERAL("false"));
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Start writing JSON into buffer
+
+  \param w          JSON writer
+  \param buf        output buffer, may be NULL if len is 0
+  \param len        size of output buffer in bytes
+  \param pretty     pretty print output
+
+  \return void
+
+******************************************************************************/
+void j1939json_init(j1939json_t * w, char * buf, size_t len, bool pretty)
+{
+    w->buf = len > 0 ? buf : NULL;
+    w->cap = len > 0 ? len - 1 : 0;
+    w->pos = 0;
+    w->written = 0;
+    w->depth = 0;
+    w->pretty = pretty;
+    w->first = true;
+}
+
+/**************************************************************************//**
+
+  \brief Null terminate output
+
+  \return size_t    length of complete output, not counting the null terminator
+
+******************************************************************************/
+size_t j1939json_finish(j1939json_t * w)
+{
+    if (w->buf != NULL)
+    {
+        w->buf[w->written] = '\0';
+    }
+    return w->pos;
+}
+
+/**************************************************************************//**
+
+  \brief Write string that is not in the database string pool
+
+  \return void
+
+******************************************************************************/
+void put_escaped(j1939json_t * w, const char * s)
+{
+    size_t len = j1939db_json_escaped_length(s);
+    if (w->written == w->pos && len <= w->cap - w->pos)
+    {
+        j1939db_json_escape(s, w->buf + w->pos);
+        w->written += len;
+    }
+    w->pos += len;
+}
+
+/**************************************************************************//**
+
+  \brief Write string of printable ASCII characters that is not null terminated
+
+  Only quotes and backslashes need escaping within printable ASCII.
+
+  \return void
+
+******************************************************************************/
+void put_text(j1939json_t * w, const char * s, size_t len)
+{
+    put_char(w, '"');
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s[i] == '"' || s[i] == '\\')
+        {
+            put(w, &s[run], i - run);
+            put_char(w, '\\');
+            run = i;
+        }
+    }
+    put(w, &s[run], len - run);
+    put_char(w, '"');
+}
+
+/**************************************************************************//**
+
+  \brief Write string, using the precomputed JSON fragment for database strings
+
+  \return void
+
+******************************************************************************/
+void put_string(j1939json_t * w, const j1939db_t * db, const char * s)
+{
+    uintptr_t p = (uintptr_t) s;
+    uintptr_t strings = (uintptr_t) db->strings;
+    if (p > strings && p < strings + db->strings_size)
+    {
+        put_db_string(w, db, (uint32_t) (p - strings));
+    }
+    else
+    {
+        put_escaped(w, s);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write database string pool entry, missing strings are written as ""
+
+  \return void
+
+******************************************************************************/
+void put_db_string(j1939json_t * w, const j1939db_t * db, uint32_t offset)
+{
+    size_t len;
+    const char * fragment = j1939db_json_string(db, offset, &len);
+    if (fragment != NULL)
+    {
+        put(w, fragment, len);
+    }
+    else
+    {
+        put(w, LITERAL("\"\""));
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write unsigned integer
+
+  \return void
+
+******************************************************************************/
+void put_uint(j1939json_t * w, uint64_t value)
+{
+    /* Integers with more than 15 digits are written as doubles, the same as cJSON */
+    if (value >= 1000000000000000ULL)
+    {
+        put_double(w, (double) value);
+        return;
+    }
+
+    char digits[20];
+    size_t i = sizeof(digits);
+    do
+    {
+        digits[--i] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    put(w, &digits[i], sizeof(digits) - i);
+}
+
+/**************************************************************************//**
+
+  \brief Write floating point number
+
+  \return void
+
+******************************************************************************/
+void put_double(j1939json_t * w, double value)
+{
+    /* NaN and infinity are not valid JSON */
+    if ((value * 0) != 0)
+    {
+        put(w, LITERAL("null"));
+        return;
+    }
+
+    char number[J1939DTOA_MAX_LEN];
+    put(w, number, j1939dtoa_format(value, number));
+}
+
+/**************************************************************************//**
+
+  \brief Write object member key, preceded by separator and indentation
+
+  \param w      JSON writer
+  \param key    quoted JSON string
+  \param len    length of key in bytes
+
+  \return void
+
+******************************************************************************/
+void put_key(j1939json_t * w, const char * key, size_t len)
+{
+    if (!w->first)
+    {
+        put_char(w, ',');
+        if (w->pretty)
+        {
+            put_char(w, '\n');
+        }
+    }
+    w->first = false;
+
+    if (w->pretty)
+    {
+        put_indent(w);
+    }
+
+    put(w, key, len);
+
+    if (w->pretty)
+    {
+        put(w, LITERAL(":\t"));
+    }
+    else
+    {
+        put_char(w, ':');
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write object member key for a number, such as a PGN or source address
+
+  \return void
+
+******************************************************************************/
+void put_number_key(j1939json_t * w, uint32_t number)
+{
+    char key[16];
+    size_t i = sizeof(key);
+    key[--i] = '"';
+    do
+    {
+        key[--i] = (char) ('0' + number % 10);
+        number /= 10;
+    } while (number != 0);
+    key[--i] = '"';
+
+    put_key(w, &key[i], sizeof(key) - i);
+}
+
+/**************************************************************************//**
+
+  \brief Write object member key of a decoded SPN, the SPN number if the record has no key
+
+  \return void
+
+******************************************************************************/
+void put_spn_key(j1939json_t * w, const j1939db_t * db, const j1939_spn_value_t * value)
+{
+    size_t len = 0;
+    const char * key = j1939db_json_string(db, value->record->key, &len);
+    if (key != NULL)
+    {
+        put_key(w, key, len);
+    }
+    else
+    {
+        put_number_key(w, value->spn);
+    }
+}
+
+/* Object nesting */
+void begin_object(j1939json_t * w)
+{
+    put_char(w, '{');
+    if (w->pretty)
+    {
+        put_char(w, '\n');
+    }
+    w->depth++;
+    w->first = true;
+}
+
+void end_object(j1939json_t * w)
+{
+    w->depth--;
+    if (w->pretty)
+    {
+        if (!w->first)
+        {
+            put_char(w, '\n');
+        }
+        put_indent(w);
+    }
+    put_char(w, '}');
+    w->first = false;
+}
+
+/**************************************************************************//**
+
+  \brief Write database metadata of a decoded suspect parameter number
+
+  \return void
+
+******************************************************************************/
+void write_spn_metadata(j1939json_t * w, const j1939db_t * db, const j1939_spn_value_t * value)
+{
+    const j1939db_spn_t * spn_data = value->record;
+
+    put_key(w, LITERAL("\"Name\""));
+    put_db_string(w, db, spn_data->name);
+
+    put_key(w, LITERAL("\"DataRange\""));
+    put_db_string(w, db, spn_data->data_range);
+
+    put_key(w, LITERAL("\"OperationalRange\""));
+    put_db_string(w, db, spn_data->operational_range);
+
+    put_key(w, LITERAL("\"OperationalHigh\""));
+    put_double(w, spn_data->operational_high);
+
+    put_key(w, LITERAL("\"OperationalLow\""));
+    put_double(w, spn_data->operational_low);
+
+    put_key(w, LITERAL("\"StartBit\""));
+    put_uint(w, value->start_bit);
+
+    /* Keep the database string representation for variable length and ASCII SPNs */
+    put_key(w, LITERAL("\"SPNLength\""));
+    if (spn_data->flags & J1939DB_SPN_VARIABLE_LENGTH)
+    {
+        put(w, LITERAL("\"Variable\""));
+    }
+    else
+    {
+        put_uint(w, value->length);
+    }
+
+    put_key(w, LITERAL("\"Resolution\""));
+    if (spn_data->flags & J1939DB_SPN_RESOLUTION_ASCII)
+    {
+        put(w, LITERAL("\"ASCII\""));
+    }
+    else
+    {
+        put_double(w, spn_data->resolution);
+    }
+
+    put_key(w, LITERAL("\"Offset\""));
+    put_double(w, spn_data->offset);
+}
+
+/**************************************************************************//**
+
+  \brief Write decoded value of a suspect parameter number, and the state name of discrete SPNs
+
+  \return void
+
+******************************************************************************/
+void write_value_decoded(j1939json_t * w, const j1939db_t * db, const j1939_spn_value_t * value)
+{
+    /* Decoded value is not available if outside of operational range
+     * Use the "Valid" boolean key when checking if decoded data is valid or not */
+    put_key(w, LITERAL("\"ValueDecoded\""));
+    if (value->text != NULL)
+    {
+        /* ASCII SPNs decode to their text */
+        put_text(w, value->text, value->text_len);
+    }
+    else if (value->valid)
+    {
+        put_double(w, value->value);
+    }
+    else
+    {
+        put(w, LITERAL("\"Not available\""));
+    }
+
+    if (value->state != NULL)
+    {
+        put_key(w, LITERAL("\"State\""));
+        put_string(w, db, value->state);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Write a decoded suspect parameter number
+
+  Only the fields of the output profile are looked up and formatted. The raw
+  profile writes the raw value alone instead of an object.
+
+  \return void
+
+******************************************************************************/
+void write_spn(j1939json_t * w, const j1939db_t * db, const j1939_spn_value_t * value, uint32_t profile)
+{
+    if (profile == J1939DECODE_PROFILE_RAW)
+    {
+        put_uint(w, value->value_raw);
+        return;
+    }
+
+    begin_object(w);
+
+    if (profile == J1939DECODE_PROFILE_FULL)
+    {
+        write_spn_metadata(w, db, value);
+
+        put_key(w, LITERAL("\"ValueRaw\""));
+        put_uint(w, value->value_raw);
+    }
+
+    write_value_decoded(w, db, value);
+
+    put_key(w, LITERAL("\"Units\""));
+    put_db_string(w, db, value->record->units);
+
+    put_key(w, LITERAL("\"Valid\""));
+    put_bool(w, value->valid);
+
+    end_object(w);
+}
+
+/**************************************************************************//**
+
+  \brief Write list of decoded SPNs using SPN number as a key
+
+  \return void
+
+******************************************************************************/
+void write_spns(j1939json_t * w, const j1939db_t * db, const j1939_decoded_t * decoded, uint32_t profile)
+{
+    put_key(w, LITERAL("\"SPNs\""));
+    begin_object(w);
+    for (size_t i = 0; i < decoded->num_spns; i++)
+    {
+        const j1939_spn_value_t * value = &decoded->spns[i];
+        put_spn_key(w, db, value);
+        write_spn(w, db, value, profile);
+    }
+    end_object(w);
+}
+
+/**************************************************************************//**
+
+  \brief Write a decoded message as a JSON object
+
+  \param w          JSON writer
+  \param db         database the decoded strings point into
+  \param decoded    decoded message, with all SPNs written
+  \param data       pointer to data (8 bytes total)
+  \param profile    J1939DECODE_PROFILE_ output profile
+
+  \return void
+
+******************************************************************************/
+void j1939json_write_message(j1939json_t * w, const j1939db_t * db, const j1939_decoded_t * decoded,
+                             const uint64_t * data, uint32_t profile)
+{
+    begin_object(w);
+
+    put_key(w, LITERAL("\"ID\""));
+    put_uint(w, decoded->id);
+
+    if (profile != J1939DECODE_PROFILE_FULL)
+    {
+        /* Only the identifier fields and the decoded SPNs */
+        put_key(w, LITERAL("\"PGN\""));
+        put_uint(w, decoded->pgn);
+
+        put_key(w, LITERAL("\"SA\""));
+        put_uint(w, decoded->sa);
+
+        if (decoded->pgn_name != NULL)
+        {
+            write_spns(w, db, decoded, profile);
+        }
+
+        put_key(w, LITERAL("\"Decoded\""));
+        put_bool(w, decoded->decoded);
+
+        end_object(w);
+        return;
+    }
+
+    put_key(w, LITERAL("\"Priority\""));
+    put_uint(w, decoded->priority);
+
+    put_key(w, LITERAL("\"PGN\""));
+    put_uint(w, decoded->pgn);
+
+    put_key(w, LITERAL("\"SA\""));
+    put_uint(w, decoded->sa);
+
+    put_key(w, LITERAL("\"SAName\""));
+    put_string(w, db, decoded->sa_name);
+
+    put_key(w, LITERAL("\"DLC\""));
+    put_uint(w, decoded->dlc);
+
+    /* Raw data bytes */
+    put_key(w, LITERAL("\"DataRaw\""));
+    put_char(w, '[');
+    for (uint32_t i = 0; i < sizeof(*data); i++)
+    {
+        if (i > 0)
+        {
+            put(w, ", ", w->pretty ? 2 : 1);
+        }
+        put_uint(w, ((const uint8_t *) data)[i]);
+    }
+    put_char(w, ']');
+
+    if (decoded->pgn_name != NULL)
+    {
+        /* PGN number found in lookup table */
+        put_key(w, LITERAL("\"PGNName\""));
+        put_string(w, db, decoded->pgn_name);
+
+        write_spns(w, db, decoded, profile);
+    }
+
+    put_key(w, LITERAL("\"Decoded\""));
+    put_bool(w, decoded->decoded);
+
+    end_object(w);
+}
+
+/**************************************************************************//**
+
+  \brief Start writing the database schema, with the source address names
+
+  \param w          JSON writer
+  \param db         database holding the source address names
+
+  \return void
+
+******************************************************************************/
+void j1939json_begin_schema(j1939json_t * w, const j1939db_t * db)
+{
+    begin_object(w);
+
+    put_key(w, LITERAL("\"SANames\""));
+    begin_object(w);
+    for (uint32_t sa = 0; sa < sizeof(db->sa_names) / sizeof(db->sa_names[0]); sa++)
+    {
+        if (db->sa_names[sa] != J1939DB_NONE)
+        {
+            put_number_key(w, sa);
+            put_db_string(w, db, db->sa_names[sa]);
+        }
+    }
+    end_object(w);
+
+    put_key(w, LITERAL("\"PGNs\""));
+    begin_object(w);
+}
+
+/**************************************************************************//**
+
+  \brief Write the schema of one PGN
+
+  SPN objects have the same metadata fields as in the full output profile, so
+  they can be joined with compact or raw output by PGN and SPN number.
+
+  \param w          JSON writer
+  \param db         database the decoded strings point into
+  \param decoded    message decoded with the PGN, with all SPNs written
+
+  \return void
+
+******************************************************************************/
+void j1939json_write_schema_pgn(j1939json_t * w, const j1939db_t * db, const j1939_decoded_t * decoded)
+{
+    put_number_key(w, decoded->pgn);
+    begin_object(w);
+
+    put_key(w, LITERAL("\"PGNName\""));
+    put_string(w, db, decoded->pgn_name);
+
+    put_key(w, LITERAL("\"SPNs\""));
+    begin_object(w);
+    for (size_t i = 0; i < decoded->num_spns; i++)
+    {
+        const j1939_spn_value_t * value = &decoded->spns[i];
+        put_spn_key(w, db, value);
+
+        begin_object(w);
+        write_spn_metadata(w, db, value);
+        put_key(w, LITERAL("\"Units\""));
+        put_db_string(w, db, value->record->units);
+        if (value->record->num_states > 0)
+        {
+            /* State names by raw value, for compact and raw output */
+            put_key(w, LITERAL("\"States\""));
+            begin_object(w);
+            for (uint32_t raw = 0; raw < value->record->num_states; raw++)
+            {
+                uint32_t state = j1939db_spn_state(db, value->record, raw);
+                if (state != J1939DB_NONE)
+                {
+                    put_number_key(w, raw);
+                    put_db_string(w, db, state);
+                }
+            }
+            end_object(w);
+        }
+        end_object(w);
+    }
+    end_object(w);
+
+    end_object(w);
+}
+
+/**************************************************************************//**
+
+  \brief Finish writing the database schema
+
+  \return void
+
+******************************************************************************/
+void j1939json_end_schema(j1939json_t * w)
+{
+    end_object(w);
+    end_object(w);
+}
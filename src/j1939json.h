@@ -0,0 +1,48 @@
+#ifndef J1939JSON_H
+#define J1939JSON_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939decode.h"
+#include "j1939db.h"
+
+/* JSON writer into a caller supplied buffer
+ * Output matches cJSON_Print() and cJSON_PrintUnformatted() byte for byte */
+typedef struct
+{
+    char * buf;
+    size_t cap;         /* usable buffer size, one byte is kept for the null terminator */
+    size_t pos;         /* length of complete output, may be more than cap */
+    size_t written;     /* length of output actually in the buffer */
+    uint32_t depth;     /* object nesting depth */
+    bool pretty;
+    bool first;         /* no members written to the current object or array yet */
+} j1939json_t;
+
+/* Start writing JSON into buffer, buf may be NULL if len is 0 */
+void j1939json_init(j1939json_t * w, char * buf, size_t len, bool pretty);
+
+/* Null terminate output
+ * Returns length of complete output, output was truncated if this is not less than the buffer length */
+size_t j1939json_finish(j1939json_t * w);
+
+/* Write a decoded message, with all of its SPNs, as a JSON object with the fields of a J1939DECODE_PROFILE_ */
+void j1939json_write_message(j1939json_t * w, const j1939db_t * db, const j1939_decoded_t * decoded,
+                             const uint64_t * data, uint32_t profile);
+
+/* Write the database schema, begin with the source address names, then one PGN at a time in any order */
+void j1939json_begin_schema(j1939json_t * w, const j1939db_t * db);
+void j1939json_write_schema_pgn(j1939json_t * w, const j1939db_t * db, const j1939_decoded_t * decoded);
+void j1939json_end_schema(j1939json_t * w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939JSON_H
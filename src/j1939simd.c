@@ -0,0 +1,241 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939simd.h"
+
+/* Vector kernels are selected at compile time by architecture, and AVX2 is also checked at run time */
+#if !defined(J1939DECODE_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define J1939SIMD_HAVE_AVX2
+#include <immintrin.h>
+#elif !defined(J1939DECODE_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define J1939SIMD_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+/* Static helper functions */
+static void extract_tail(const j1939db_step_t * step, const uint64_t * data, size_t start, size_t count,
+                         uint64_t * raw, double * value, uint8_t * valid);
+#if defined(J1939SIMD_HAVE_AVX2)
+static bool have_avx2(void);
+static void extract_avx2(const j1939db_step_t * step, const uint64_t * data, size_t count,
+                         uint64_t * raw, double * value, uint8_t * valid);
+#elif defined(J1939SIMD_HAVE_NEON)
+static void extract_neon(const j1939db_step_t * step, const uint64_t * data, size_t count,
+                         uint64_t * raw, double * value, uint8_t * valid);
+#endif
+
+/**************************************************************************//**
+
+  \brief Decode frames from start to count with scalar code
+
+  \param step       decode plan step of the SPN
+  \param data       array of 64 bit data fields
+  \param start      first frame to decode, must be a multiple of 8
+  \param count      number of frames
+  \param raw        array of raw values to be filled in
+  \param value      array of decoded values to be filled in
+  \param valid      validity bitmap to be filled in
+
+  \return void
+
+******************************************************************************/
+void extract_tail(const j1939db_step_t * step, const uint64_t * data, size_t start, size_t count,
+                  uint64_t * raw, double * value, uint8_t * valid)
+{
+    uint8_t bits = 0;
+    size_t i;
+    for (i = start; i < count; i++)
+    {
+        uint64_t value_raw = (data[i] >> step->shift) & step->mask;
+        double decoded = value_raw * step->scale + step->offset;
+
+        raw[i] = value_raw;
+        value[i] = decoded;
+        bits |= (uint8_t) ((decoded >= step->low && decoded <= step->high) << (i % 8));
+
+        if (i % 8 == 7)
+        {
+            valid[i / 8] = bits;
+            bits = 0;
+        }
+    }
+
+    /* Partially filled last byte */
+    if (i % 8 != 0)
+    {
+        valid[i / 8] = bits;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Decode one SPN across many frames with scalar code
+
+  \return void
+
+******************************************************************************/
+void j1939simd_extract_scalar(const j1939db_step_t * step, const uint64_t * data, size_t count,
+                              uint64_t * raw, double * value, uint8_t * valid)
+{
+    extract_tail(step, data, 0, count, raw, value, valid);
+}
+
+#if defined(J1939SIMD_HAVE_AVX2)
+
+/**************************************************************************//**
+
+  \brief Check for AVX2 support at run time
+
+  \return bool  true if CPU supports AVX2
+
+******************************************************************************/
+bool have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+/**************************************************************************//**
+
+  \brief Decode one SPN across many frames with AVX2, four frames per vector
+
+  The mask must be below 2^52 so that raw values convert to double exactly by
+  placing them in the mantissa of 2^52.
+
+  \return void
+
+******************************************************************************/
+__attribute__((target("avx2")))
+void extract_avx2(const j1939db_step_t * step, const uint64_t * data, size_t count,
+                  uint64_t * raw, double * value, uint8_t * valid)
+{
+    const __m128i shift = _mm_cvtsi32_si128((int) step->shift);
+    const __m256i mask = _mm256_set1_epi64x((long long) step->mask);
+    const __m256i exponent = _mm256_set1_epi64x(0x4330000000000000LL);
+    const __m256d two_52 = _mm256_set1_pd(4503599627370496.0);
+    const __m256d scale = _mm256_set1_pd(step->scale);
+    const __m256d offset = _mm256_set1_pd(step->offset);
+    const __m256d low = _mm256_set1_pd(step->low);
+    const __m256d high = _mm256_set1_pd(step->high);
+
+    /* Eight frames at a time fill one byte of the validity bitmap */
+    size_t i;
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        int bits = 0;
+        for (size_t j = 0; j < 8; j += 4)
+        {
+            __m256i r = _mm256_loadu_si256((const __m256i *) &data[i + j]);
+            r = _mm256_and_si256(_mm256_srl_epi64(r, shift), mask);
+            _mm256_storeu_si256((__m256i *) &raw[i + j], r);
+
+            /* Multiply and add separately so results match the scalar code */
+            __m256d v = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(r, exponent)), two_52);
+            v = _mm256_add_pd(_mm256_mul_pd(v, scale), offset);
+            _mm256_storeu_pd(&value[i + j], v);
+
+            __m256d ok = _mm256_and_pd(_mm256_cmp_pd(v, low, _CMP_GE_OQ), _mm256_cmp_pd(v, high, _CMP_LE_OQ));
+            bits |= _mm256_movemask_pd(ok) << j;
+        }
+        valid[i / 8] = (uint8_t) bits;
+    }
+
+    extract_tail(step, data, i, count, raw, value, valid);
+}
+
+#elif defined(J1939SIMD_HAVE_NEON)
+
+/**************************************************************************//**
+
+  \brief Decode one SPN across many frames with NEON, two frames per vector
+
+  \return void
+
+******************************************************************************/
+void extract_neon(const j1939db_step_t * step, const uint64_t * data, size_t count,
+                  uint64_t * raw, double * value, uint8_t * valid)
+{
+    /* Negative shift count shifts right */
+    const int64x2_t shift = vdupq_n_s64(-(int64_t) step->shift);
+    const uint64x2_t mask = vdupq_n_u64(step->mask);
+    const float64x2_t scale = vdupq_n_f64(step->scale);
+    const float64x2_t offset = vdupq_n_f64(step->offset);
+    const float64x2_t low = vdupq_n_f64(step->low);
+    const float64x2_t high = vdupq_n_f64(step->high);
+
+    /* Eight frames at a time fill one byte of the validity bitmap */
+    size_t i;
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        unsigned int bits = 0;
+        for (size_t j = 0; j < 8; j += 2)
+        {
+            uint64x2_t r = vandq_u64(vshlq_u64(vld1q_u64(&data[i + j]), shift), mask);
+            vst1q_u64(&raw[i + j], r);
+
+            float64x2_t v = vaddq_f64(vmulq_f64(vcvtq_f64_u64(r), scale), offset);
+            vst1q_f64(&value[i + j], v);
+
+            uint64x2_t ok = vandq_u64(vcgeq_f64(v, low), vcleq_f64(v, high));
+            bits |= (unsigned int) (vgetq_lane_u64(ok, 0) & 1U) << j;
+            bits |= (unsigned int) (vgetq_lane_u64(ok, 1) & 1U) << (j + 1);
+        }
+        valid[i / 8] = (uint8_t) bits;
+    }
+
+    extract_tail(step, data, i, count, raw, value, valid);
+}
+
+#endif
+
+/**************************************************************************//**
+
+  \brief Decode one SPN across many frames of the same PGN into columns
+
+  \param step       decode plan step of the SPN
+  \param data       array of 64 bit data fields
+  \param count      number of frames
+  \param raw        array of count raw values to be filled in
+  \param value      array of count decoded values to be filled in
+  \param valid      validity bitmap of (count + 7) / 8 bytes to be filled in
+
+  \return void
+
+******************************************************************************/
+void j1939simd_extract(const j1939db_step_t * step, const uint64_t * data, size_t count,
+                       uint64_t * raw, double * value, uint8_t * valid)
+{
+#if defined(J1939SIMD_HAVE_AVX2)
+    if (step->mask < (1ULL << 52U) && have_avx2())
+    {
+        extract_avx2(step, data, count, raw, value, valid);
+        return;
+    }
+#elif defined(J1939SIMD_HAVE_NEON)
+    extract_neon(step, data, count, raw, value, valid);
+    return;
+#endif
+
+    j1939simd_extract_scalar(step, data, count, raw, value, valid);
+}
+
+/**************************************************************************//**
+
+  \brief Get name of kernel used by j1939simd_extract()
+
+  \return const char *  kernel name
+
+******************************************************************************/
+const char * j1939simd_kernel(void)
+{
+#if defined(J1939SIMD_HAVE_AVX2)
+    if (have_avx2())
+    {
+        return "avx2";
+    }
+#elif defined(J1939SIMD_HAVE_NEON)
+    return "neon";
+#endif
+
+    return "scalar";
+}
@@ -0,0 +1,30 @@
+#ifndef J1939SIMD_H
+#define J1939SIMD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "j1939db.h"
+
+/* Decode one SPN across many frames of the same PGN into columns
+ * valid is a bitmap with bit i % 8 of byte i / 8 set if frame i is within the operational range
+ * Uses AVX2 or NEON kernels when the CPU supports them */
+void j1939simd_extract(const j1939db_step_t * step, const uint64_t * data, size_t count,
+                       uint64_t * raw, double * value, uint8_t * valid);
+
+/* Portable scalar kernel, gives the same results as the vector kernels */
+void j1939simd_extract_scalar(const j1939db_step_t * step, const uint64_t * data, size_t count,
+                              uint64_t * raw, double * value, uint8_t * valid);
+
+/* Name of kernel used by j1939simd_extract(), "scalar" if no vector kernel is available */
+const char * j1939simd_kernel(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939SIMD_H
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "j1939stats.h"
+#include "j1939ctx.h"
+
+/* Largest number of slots, keys are hashed to 32 bits */
+#define STATS_MAX_SLOTS     (1U << 30U)
+
+/* Frame count and cycle times of one source address and PGN pair */
+typedef struct
+{
+    uint32_t key;               /* source address and PGN plus one, 0 for an empty slot, published last */
+    uint64_t frames;
+    uint64_t last_us;           /* timestamp of the last frame, 0 if it had none */
+    uint64_t cycle_sum_us;
+    uint64_t cycles[J1939DECODE_CYCLE_BUCKETS];
+} pgn_entry_t;
+
+/* Per-PGN statistics, entries are allocated once in the same block */
+struct j1939stats_pgns
+{
+    j1939decode_allocator_t allocator;
+    size_t capacity;            /* maximum number of entries in use */
+    size_t count;
+    uint32_t num_slots;         /* power of two, at least twice the capacity */
+    uint32_t shift;             /* hash shift, 32 minus log2 of num_slots */
+    pgn_entry_t * entries;
+};
+
+/* Text being written, like snprintf() the length is counted past the end of the buffer */
+typedef struct
+{
+    char * buf;
+    size_t len;
+    size_t pos;
+} text_t;
+
+/* Names and descriptions of the counters in the order of j1939decode_stats_t */
+static const struct
+{
+    const char * name;
+    const char * help;
+} counter_names[] = {
+    {"frames", "Frames decoded or written"},
+    {"unknown_pgns", "Frames with a PGN that is not in the database"},
+    {"incomplete_pgns", "Frames of PGNs without a name or without SPNs in the database"},
+    {"unknown_spns", "SPNs without a start bit or SPN record in the database"},
+    {"unknown_sas", "Frames from a source address without a name in the database"},
+    {"spns", "SPNs decoded"},
+    {"spns_out_of_range", "SPNs decoded outside their operational range"},
+    {"allocations", "Memory allocations"},
+    {"output_bytes", "Bytes of JSON and binary output written"},
+};
+
+/* Static helper functions */
+static void log_msg(uint32_t level, const char * fmt, ...);
+static void append(text_t * text, const char * fmt, ...);
+
+static inline uint32_t entry_key(uint8_t sa, uint32_t pgn)
+{
+    /* 18-bit PGN and 8-bit source address, never 0 */
+    return (((uint32_t) sa << 18U) | pgn) + 1U;
+}
+
+static inline uint32_t entry_slot(const j1939stats_pgns_t * pgns, uint32_t key)
+{
+    /* Fibonacci hashing, taking the well mixed high bits of the product */
+    return (uint32_t) (key * 2654435769U) >> pgns->shift;
+}
+
+static inline uint32_t cycle_bucket(uint64_t cycle_us)
+{
+    /* Bucket i holds cycle times of more than 2^(i-1) and up to 2^i whole milliseconds */
+    if (cycle_us <= 1000U)
+    {
+        return 0;
+    }
+    uint32_t bucket = 64U - (uint32_t) __builtin_clzll((cycle_us - 1U) / 1000U);
+    return bucket < J1939DECODE_CYCLE_BUCKETS ? bucket : J1939DECODE_CYCLE_BUCKETS - 1U;
+}
+
+/**************************************************************************//**
+
+  \brief Log formatted message to the process-wide handler
+
+  \return void
+
+******************************************************************************/
+void log_msg(uint32_t level, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    j1939ctx_vlog(NULL, level, fmt, args);
+    va_end(args);
+}
+
+/**************************************************************************//**
+
+  \brief Add counters that may be written by another thread
+
+  \param total  counters to add to
+  \param stats  counters of a context
+
+  \return void
+
+******************************************************************************/
+void j1939stats_add(j1939decode_stats_t * total, const j1939decode_stats_t * stats)
+{
+    /* Both structures are arrays of counters */
+    uint64_t * sum = (uint64_t *) total;
+    const uint64_t * counters = (const uint64_t *) stats;
+    for (size_t i = 0; i < sizeof(j1939decode_stats_t) / sizeof(uint64_t); i++)
+    {
+        sum[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Add the increase of counters that may be written by another thread
+
+  \param total  counters to add to
+  \param stats  counters of a context
+  \param base   earlier values of the counters, not counted again
+
+  \return void
+
+******************************************************************************/
+void j1939stats_add_since(j1939decode_stats_t * total, const j1939decode_stats_t * stats,
+                          const j1939decode_stats_t * base)
+{
+    uint64_t * sum = (uint64_t *) total;
+    const uint64_t * counters = (const uint64_t *) stats;
+    const uint64_t * start = (const uint64_t *) base;
+    for (size_t i = 0; i < sizeof(j1939decode_stats_t) / sizeof(uint64_t); i++)
+    {
+        sum[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED) - start[i];
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Create per-PGN statistics
+
+  \param capacity               maximum number of source address and PGN pairs
+  \param allocator              allocator for the statistics, NULL to use malloc() and free()
+
+  \return j1939stats_pgns_t *   pointer to per-PGN statistics, NULL on failure
+
+******************************************************************************/
+j1939stats_pgns_t * j1939stats_pgns_create(size_t capacity, const j1939decode_allocator_t * allocator)
+{
+    if (capacity == 0 || capacity > STATS_MAX_SLOTS / 2)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Invalid PGN statistics capacity");
+        return NULL;
+    }
+
+    /* Keep the table at most half full so that probe sequences stay short */
+    uint32_t num_slots = 2;
+    uint32_t shift = 31;
+    while (num_slots < capacity * 2)
+    {
+        num_slots *= 2;
+        shift--;
+    }
+
+    /* State and entries in one allocation, entries are 8 byte aligned */
+    size_t entries_offset = (sizeof(j1939stats_pgns_t) + 7) & ~(size_t) 7;
+    size_t size = entries_offset + num_slots * sizeof(pgn_entry_t);
+
+    allocator = j1939ctx_allocator(allocator);
+    j1939stats_pgns_t * pgns = allocator->malloc_fn(allocator->user, size);
+    if (pgns == NULL)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return NULL;
+    }
+
+    pgns->allocator = *allocator;
+    pgns->capacity = capacity;
+    pgns->count = 0;
+    pgns->num_slots = num_slots;
+    pgns->shift = shift;
+    pgns->entries = (pgn_entry_t *) ((uint8_t *) pgns + entries_offset);
+    memset(pgns->entries, 0, num_slots * sizeof(pgn_entry_t));
+
+    return pgns;
+}
+
+/**************************************************************************//**
+
+  \brief Free per-PGN statistics
+
+  \return void
+
+******************************************************************************/
+void j1939stats_pgns_free(j1939stats_pgns_t * pgns)
+{
+    if (pgns == NULL)
+    {
+        return;
+    }
+
+    pgns->allocator.free_fn(pgns->allocator.user, pgns);
+}
+
+/**************************************************************************//**
+
+  \brief Count a frame of a source address and PGN pair
+
+  \param pgns           per-PGN statistics
+  \param sa             source address
+  \param pgn            parameter group number
+  \param timestamp_us   receive time of the frame, 0 if unknown
+
+  \return void
+
+******************************************************************************/
+void j1939stats_pgns_count(j1939stats_pgns_t * pgns, uint8_t sa, uint32_t pgn, uint64_t timestamp_us)
+{
+    uint32_t key = entry_key(sa, pgn);
+    uint32_t mask = pgns->num_slots - 1;
+    uint32_t slot = entry_slot(pgns, key);
+    pgn_entry_t * entry;
+    for (;;)
+    {
+        entry = &pgns->entries[slot];
+        if (entry->key == key)
+        {
+            break;
+        }
+        if (entry->key == 0)
+        {
+            if (pgns->count == pgns->capacity)
+            {
+                return;
+            }
+
+            /* Readers only look at the counters of the entry once its key is published */
+            pgns->count++;
+            __atomic_store_n(&entry->key, key, __ATOMIC_RELEASE);
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    j1939stats_count(&entry->frames, 1);
+    if (timestamp_us != 0)
+    {
+        if (entry->last_us != 0 && timestamp_us >= entry->last_us)
+        {
+            uint64_t cycle_us = timestamp_us - entry->last_us;
+            j1939stats_count(&entry->cycles[cycle_bucket(cycle_us)], 1);
+            j1939stats_count(&entry->cycle_sum_us, cycle_us);
+        }
+        entry->last_us = timestamp_us;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Read per-PGN statistics that may be written by another thread
+
+  \param pgns       per-PGN statistics
+  \param stats      array for the statistics of each pair
+  \param cap        number of elements in the array
+
+  \return size_t    number of pairs counted, which may be more than were written
+
+******************************************************************************/
+size_t j1939stats_pgns_read(const j1939stats_pgns_t * pgns, j1939decode_pgn_stats_t * stats, size_t cap)
+{
+    size_t n = 0;
+    for (uint32_t slot = 0; slot < pgns->num_slots; slot++)
+    {
+        const pgn_entry_t * entry = &pgns->entries[slot];
+        uint32_t key = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+        if (key == 0)
+        {
+            continue;
+        }
+
+        if (n < cap)
+        {
+            j1939decode_pgn_stats_t * out = &stats[n];
+            out->pgn = (key - 1U) & ((1U << 18U) - 1);
+            out->sa = (uint8_t) ((key - 1U) >> 18U);
+            out->frames = __atomic_load_n(&entry->frames, __ATOMIC_RELAXED);
+            out->cycle_sum_us = __atomic_load_n(&entry->cycle_sum_us, __ATOMIC_RELAXED);
+            for (uint32_t i = 0; i < J1939DECODE_CYCLE_BUCKETS; i++)
+            {
+                out->cycles[i] = __atomic_load_n(&entry->cycles[i], __ATOMIC_RELAXED);
+            }
+        }
+        n++;
+    }
+    return n;
+}
+
+/**************************************************************************//**
+
+  \brief Append formatted text
+
+  \return void
+
+******************************************************************************/
+void append(text_t * text, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(text->pos < text->len ? text->buf + text->pos : NULL,
+                      text->pos < text->len ? text->len - text->pos : 0, fmt, args);
+    va_end(args);
+    text->pos += n > 0 ? (size_t) n : 0;
+}
+
+/**************************************************************************//**
+
+  \brief Write counters and per-PGN statistics in the Prometheus text exposition format
+
+  \param stats      counters
+  \param pgns       per-PGN statistics, may be NULL
+  \param num_pgns   number of elements in pgns
+  \param buf        output buffer, may be NULL if len is 0
+  \param len        size of output buffer in bytes
+
+  \return size_t    length of text, not counting the null terminator
+
+******************************************************************************/
+size_t j1939decode_stats_to_prometheus(const j1939decode_stats_t * stats, const j1939decode_pgn_stats_t * pgns,
+                                       size_t num_pgns, char * buf, size_t len)
+{
+    text_t text = {buf, len, 0};
+    if (len > 0)
+    {
+        buf[0] = '\0';
+    }
+
+    const uint64_t * counters = (const uint64_t *) stats;
+    for (size_t i = 0; i < sizeof(counter_names) / sizeof(counter_names[0]); i++)
+    {
+        append(&text, "# HELP j1939decode_%s_total %s\n# TYPE j1939decode_%s_total counter\nj1939decode_%s_total %llu\n",
+               counter_names[i].name, counter_names[i].help, counter_names[i].name, counter_names[i].name,
+               (unsigned long long) counters[i]);
+    }
+
+    if (pgns == NULL || num_pgns == 0)
+    {
+        return text.pos;
+    }
+
+    append(&text, "# HELP j1939decode_pgn_frames_total Frames of each PGN and source address\n"
+           "# TYPE j1939decode_pgn_frames_total counter\n");
+    for (size_t i = 0; i < num_pgns; i++)
+    {
+        append(&text, "j1939decode_pgn_frames_total{pgn=\"%u\",sa=\"%u\"} %llu\n", pgns[i].pgn,
+               (unsigned int) pgns[i].sa, (unsigned long long) pgns[i].frames);
+    }
+
+    /* Histogram buckets are cumulative, the last bucket is the +Inf bucket */
+    append(&text, "# HELP j1939decode_pgn_cycle_seconds Time between frames of each PGN and source address\n"
+           "# TYPE j1939decode_pgn_cycle_seconds histogram\n");
+    for (size_t i = 0; i < num_pgns; i++)
+    {
+        uint64_t cumulative = 0;
+        for (uint32_t bucket = 0; bucket < J1939DECODE_CYCLE_BUCKETS; bucket++)
+        {
+            cumulative += pgns[i].cycles[bucket];
+            if (bucket + 1U < J1939DECODE_CYCLE_BUCKETS)
+            {
+                append(&text, "j1939decode_pgn_cycle_seconds_bucket{pgn=\"%u\",sa=\"%u\",le=\"%g\"} %llu\n",
+                       pgns[i].pgn, (unsigned int) pgns[i].sa, (double) (1U << bucket) / 1000.0,
+                       (unsigned long long) cumulative);
+            }
+            else
+            {
+                append(&text, "j1939decode_pgn_cycle_seconds_bucket{pgn=\"%u\",sa=\"%u\",le=\"+Inf\"} %llu\n",
+                       pgns[i].pgn, (unsigned int) pgns[i].sa, (unsigned long long) cumulative);
+            }
+        }
+        append(&text, "j1939decode_pgn_cycle_seconds_sum{pgn=\"%u\",sa=\"%u\"} %.6f\n"
+               "j1939decode_pgn_cycle_seconds_count{pgn=\"%u\",sa=\"%u\"} %llu\n",
+               pgns[i].pgn, (unsigned int) pgns[i].sa, (double) pgns[i].cycle_sum_us / 1e6,
+               pgns[i].pgn, (unsigned int) pgns[i].sa, (unsigned long long) cumulative);
+    }
+
+    return text.pos;
+}
@@ -0,0 +1,51 @@
+#ifndef J1939STATS_H
+#define J1939STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939decode.h"
+
+/* Per-PGN statistics
+ * Frame counts and cycle time histograms of each source address and PGN pair are kept in a fixed size open
+ * addressed table, with no allocation after j1939stats_pgns_create(). The table is only written by the thread
+ * decoding with its context, and may be read by any other thread at the same time */
+typedef struct j1939stats_pgns j1939stats_pgns_t;
+
+/* Count a number of events with a counter only written by one thread, while other threads may read it */
+static inline void j1939stats_count(uint64_t * counter, uint64_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/* Add counters read while they may be written by another thread */
+void j1939stats_add(j1939decode_stats_t * total, const j1939decode_stats_t * stats);
+
+/* Add the increase of counters since base, read while they may be written by another thread */
+void j1939stats_add_since(j1939decode_stats_t * total, const j1939decode_stats_t * stats,
+                          const j1939decode_stats_t * base);
+
+/* Create per-PGN statistics of up to capacity source address and PGN pairs
+ * Returns NULL on failure */
+j1939stats_pgns_t * j1939stats_pgns_create(size_t capacity, const j1939decode_allocator_t * allocator);
+
+/* Free per-PGN statistics */
+void j1939stats_pgns_free(j1939stats_pgns_t * pgns);
+
+/* Count a frame, and its cycle time if timestamp_us is not 0 and an earlier frame of the pair had a timestamp */
+void j1939stats_pgns_count(j1939stats_pgns_t * pgns, uint8_t sa, uint32_t pgn, uint64_t timestamp_us);
+
+/* Read up to cap pairs into stats
+ * Returns number of pairs counted */
+size_t j1939stats_pgns_read(const j1939stats_pgns_t * pgns, j1939decode_pgn_stats_t * stats, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939STATS_H
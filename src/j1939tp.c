@@ -0,0 +1,451 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "j1939tp.h"
+#include "j1939ctx.h"
+
+/* Transport protocol PGNs, destination address is in the low byte */
+#define TP_CM_PGN           0xEC00U
+#define TP_DT_PGN           0xEB00U
+
+/* TP.CM control bytes */
+#define TP_CM_RTS           16U
+#define TP_CM_CTS           17U
+#define TP_CM_BAM           32U
+#define TP_CM_ABORT         255U
+
+/* Timeouts of J1939-21, T1 between BAM packets and T2 while a connection waits for data */
+#define TP_BAM_TIMEOUT_US   750000U
+#define TP_CMDT_TIMEOUT_US  1250000U
+
+#define TP_PACKET_LEN       7U
+#define TP_MAX_PACKETS      255U
+#define TP_GLOBAL_ADDRESS   255U
+
+/* Session keys hold the address pair, with a flag bit for sessions in use */
+#define TP_KEY_ACTIVE       (1U << 16U)
+
+/* Reassembly state of one transfer */
+typedef struct
+{
+    uint32_t pgn;
+    uint8_t priority;
+    uint8_t sa;
+    uint8_t da;
+    bool broadcast;
+    uint8_t num_packets;
+    uint8_t num_received;
+    uint16_t len;
+    uint64_t deadline_us;                       /* session is dropped if no frame arrives before this time */
+    uint8_t received[(TP_MAX_PACKETS + 8) / 8]; /* bitmap of packets received, by sequence number */
+    uint8_t data[J1939DECODE_TP_MAX_LEN];
+} tp_session_t;
+
+/* Reassembler, sessions are allocated once in the same block as the reassembler */
+struct j1939decode_tp
+{
+    j1939decode_allocator_t allocator;
+    size_t num_sessions;
+    size_t num_active;
+
+    /* Keys are kept apart from the session state so that finding a session only touches this array */
+    uint32_t * keys;
+    tp_session_t * sessions;
+};
+
+/* Static helper functions */
+static void log_msg(uint32_t level, const char * fmt, ...);
+static tp_session_t * find_session(j1939decode_tp_t * tp, uint8_t sa, uint8_t da, uint64_t timestamp_us);
+static tp_session_t * open_session(j1939decode_tp_t * tp, uint8_t sa, uint8_t da, uint64_t timestamp_us);
+static void close_session(j1939decode_tp_t * tp, tp_session_t * session);
+static void receive_cm(j1939decode_tp_t * tp, uint8_t priority, uint8_t sa, uint8_t da, const uint8_t * data,
+                       uint64_t timestamp_us);
+static bool receive_dt(j1939decode_tp_t * tp, uint8_t sa, uint8_t da, const uint8_t * data, uint64_t timestamp_us,
+                       j1939_tp_message_t * msg);
+
+static inline uint32_t session_key(uint8_t sa, uint8_t da)
+{
+    return TP_KEY_ACTIVE | ((uint32_t) sa << 8U) | da;
+}
+
+static inline uint32_t get_pgn24(const uint8_t * p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8U) | ((uint32_t) p[2] << 16U);
+}
+
+/**************************************************************************//**
+
+  \brief Log formatted message to the process-wide handler
+
+  \return void
+
+******************************************************************************/
+void log_msg(uint32_t level, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    j1939ctx_vlog(NULL, level, fmt, args);
+    va_end(args);
+}
+
+/**************************************************************************//**
+
+  \brief Create transport protocol reassembler
+
+  \param num_sessions           maximum number of concurrent transfers
+  \param allocator              allocator for the reassembler, NULL to use malloc() and free()
+
+  \return j1939decode_tp_t *    pointer to reassembler, NULL on failure
+
+******************************************************************************/
+j1939decode_tp_t * j1939decode_tp_create(size_t num_sessions, const j1939decode_allocator_t * allocator)
+{
+    if (num_sessions == 0 || num_sessions > SIZE_MAX / (sizeof(tp_session_t) + sizeof(uint32_t)) - 1)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Invalid number of transport protocol sessions");
+        return NULL;
+    }
+
+    /* Reassembler, keys and sessions in one allocation, sessions are 8 byte aligned */
+    size_t keys_offset = sizeof(j1939decode_tp_t);
+    size_t sessions_offset = (keys_offset + num_sessions * sizeof(uint32_t) + 7) & ~(size_t) 7;
+    size_t size = sessions_offset + num_sessions * sizeof(tp_session_t);
+
+    allocator = j1939ctx_allocator(allocator);
+    j1939decode_tp_t * tp = allocator->malloc_fn(allocator->user, size);
+    if (tp == NULL)
+    {
+        log_msg(J1939DECODE_LOG_ERROR, "Memory allocation failure");
+        return NULL;
+    }
+
+    tp->allocator = *allocator;
+    tp->num_sessions = num_sessions;
+    tp->num_active = 0;
+    tp->keys = (uint32_t *) ((uint8_t *) tp + keys_offset);
+    tp->sessions = (tp_session_t *) ((uint8_t *) tp + sessions_offset);
+    memset(tp->keys, 0, num_sessions * sizeof(uint32_t));
+
+    return tp;
+}
+
+/**************************************************************************//**
+
+  \brief Free transport protocol reassembler
+
+  \return void
+
+******************************************************************************/
+void j1939decode_tp_destroy(j1939decode_tp_t * tp)
+{
+    if (tp == NULL)
+    {
+        return;
+    }
+
+    tp->allocator.free_fn(tp->allocator.user, tp);
+}
+
+/**************************************************************************//**
+
+  \brief Find session of an address pair, dropping it if it has timed out
+
+  \return tp_session_t *    pointer to session, NULL if not found
+
+******************************************************************************/
+tp_session_t * find_session(j1939decode_tp_t * tp, uint8_t sa, uint8_t da, uint64_t timestamp_us)
+{
+    uint32_t key = session_key(sa, da);
+    for (size_t i = 0; i < tp->num_sessions; i++)
+    {
+        if (tp->keys[i] == key)
+        {
+            tp_session_t * session = &tp->sessions[i];
+            if (timestamp_us > session->deadline_us)
+            {
+                close_session(tp, session);
+                return NULL;
+            }
+            return session;
+        }
+    }
+
+    return NULL;
+}
+
+/**************************************************************************//**
+
+  \brief Start a session for an address pair
+
+  A new transfer replaces one in progress between the same addresses. If all
+  sessions are in use, a timed out session is reused.
+
+  \return tp_session_t *    pointer to session, NULL if all sessions are in use
+
+******************************************************************************/
+tp_session_t * open_session(j1939decode_tp_t * tp, uint8_t sa, uint8_t da, uint64_t timestamp_us)
+{
+    uint32_t key = session_key(sa, da);
+    size_t free_index = tp->num_sessions;
+    for (size_t i = 0; i < tp->num_sessions; i++)
+    {
+        if (tp->keys[i] == key)
+        {
+            return &tp->sessions[i];
+        }
+
+        if (free_index == tp->num_sessions &&
+            ((tp->keys[i] & TP_KEY_ACTIVE) == 0 || timestamp_us > tp->sessions[i].deadline_us))
+        {
+            free_index = i;
+        }
+    }
+
+    if (free_index == tp->num_sessions)
+    {
+        return NULL;
+    }
+
+    if ((tp->keys[free_index] & TP_KEY_ACTIVE) == 0)
+    {
+        tp->num_active++;
+    }
+    tp->keys[free_index] = key;
+    return &tp->sessions[free_index];
+}
+
+/**************************************************************************//**
+
+  \brief End a session, its data stays in place until the session is reused
+
+  \return void
+
+******************************************************************************/
+void close_session(j1939decode_tp_t * tp, tp_session_t * session)
+{
+    tp->keys[session - tp->sessions] = 0;
+    tp->num_active--;
+}
+
+/**************************************************************************//**
+
+  \brief Handle a TP.CM connection management frame
+
+  Only the originator's RTS or BAM starts a session. CTS frames from the
+  responder keep the connection alive, and an abort from either side ends it.
+
+  \return void
+
+******************************************************************************/
+void receive_cm(j1939decode_tp_t * tp, uint8_t priority, uint8_t sa, uint8_t da, const uint8_t * data,
+                uint64_t timestamp_us)
+{
+    tp_session_t * session;
+    uint32_t pgn = get_pgn24(&data[5]);
+
+    switch (data[0])
+    {
+        case TP_CM_RTS:
+        case TP_CM_BAM:
+        {
+            bool broadcast = data[0] == TP_CM_BAM;
+            uint16_t len = (uint16_t) (data[1] | (data[2] << 8U));
+            uint8_t num_packets = data[3];
+
+            /* Announced size must need more than one frame and match the number of packets */
+            if (len <= 8 || len > J1939DECODE_TP_MAX_LEN || num_packets != (len + TP_PACKET_LEN - 1) / TP_PACKET_LEN)
+            {
+                return;
+            }
+            if (broadcast != (da == TP_GLOBAL_ADDRESS))
+            {
+                return;
+            }
+
+            session = open_session(tp, sa, da, timestamp_us);
+            if (session == NULL)
+            {
+                /* All sessions busy, the transfer is not reassembled */
+                return;
+            }
+
+            session->pgn = pgn;
+            session->priority = priority;
+            session->sa = sa;
+            session->da = da;
+            session->broadcast = broadcast;
+            session->num_packets = num_packets;
+            session->num_received = 0;
+            session->len = len;
+            session->deadline_us = timestamp_us + (broadcast ? TP_BAM_TIMEOUT_US : TP_CMDT_TIMEOUT_US);
+            memset(session->received, 0, sizeof(session->received));
+            break;
+        }
+
+        case TP_CM_CTS:
+            /* Sent by the responder to the originator */
+            session = find_session(tp, da, sa, timestamp_us);
+            if (session != NULL && session->pgn == pgn)
+            {
+                session->deadline_us = timestamp_us + TP_CMDT_TIMEOUT_US;
+            }
+            break;
+
+        case TP_CM_ABORT:
+            session = find_session(tp, sa, da, timestamp_us);
+            if (session == NULL)
+            {
+                session = find_session(tp, da, sa, timestamp_us);
+            }
+            if (session != NULL && session->pgn == pgn && !session->broadcast)
+            {
+                close_session(tp, session);
+            }
+            break;
+
+        default:
+            /* End of message acknowledgment arrives after the message was already complete */
+            break;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Handle a TP.DT data transfer frame
+
+  Packets are placed by sequence number, so packets resent after a CTS are
+  handled and duplicates are ignored.
+
+  \return bool  true if the frame completes a message
+
+******************************************************************************/
+bool receive_dt(j1939decode_tp_t * tp, uint8_t sa, uint8_t da, const uint8_t * data, uint64_t timestamp_us,
+                j1939_tp_message_t * msg)
+{
+    tp_session_t * session = find_session(tp, sa, da, timestamp_us);
+    if (session == NULL)
+    {
+        return false;
+    }
+
+    uint8_t seq = data[0];
+    if (seq == 0 || seq > session->num_packets)
+    {
+        return false;
+    }
+
+    session->deadline_us = timestamp_us + (session->broadcast ? TP_BAM_TIMEOUT_US : TP_CMDT_TIMEOUT_US);
+
+    uint8_t bit = (uint8_t) (1U << (seq % 8U));
+    if (session->received[seq / 8U] & bit)
+    {
+        return false;
+    }
+    session->received[seq / 8U] |= bit;
+
+    /* Last packet may be partly filled */
+    size_t offset = (size_t) (seq - 1U) * TP_PACKET_LEN;
+    size_t len = session->len - offset < TP_PACKET_LEN ? session->len - offset : TP_PACKET_LEN;
+    memcpy(&session->data[offset], &data[1], len);
+
+    if (++session->num_received < session->num_packets)
+    {
+        return false;
+    }
+
+    /* CAN identifier of the message, PDU1 PGNs carry the destination address */
+    uint32_t pgn_field = session->pgn;
+    if (((session->pgn >> 8U) & 0xFFU) < 240U)
+    {
+        pgn_field = (session->pgn & 0x3FF00U) | session->da;
+    }
+
+    msg->id = ((uint32_t) session->priority << 26U) | (pgn_field << 8U) | session->sa;
+    msg->pgn = session->pgn;
+    msg->priority = session->priority;
+    msg->sa = session->sa;
+    msg->da = session->da;
+    msg->broadcast = session->broadcast;
+    msg->len = session->len;
+    msg->data = session->data;
+
+    close_session(tp, session);
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Feed one CAN frame to the reassembler
+
+  \param tp             reassembler
+  \param frame          received CAN frame
+  \param timestamp_us   receive time in microseconds
+  \param msg            completed message to be filled in
+
+  \return bool          true if the frame completes a message
+
+******************************************************************************/
+bool j1939decode_tp_receive(j1939decode_tp_t * tp, const j1939_frame_t * frame, uint64_t timestamp_us,
+                            j1939_tp_message_t * msg)
+{
+    /* Transport protocol frames always have 8 data bytes */
+    if (tp == NULL || frame->dlc != 8)
+    {
+        return false;
+    }
+
+    uint32_t id = frame->id & J1939DECODE_ID_MASK;
+    uint32_t pgn = (id >> 8U) & 0x3FF00U;
+    uint8_t priority = (uint8_t) ((id >> 26U) & 0x7U);
+    uint8_t da = (uint8_t) (id >> 8U);
+    uint8_t sa = (uint8_t) id;
+
+    if (pgn == TP_CM_PGN)
+    {
+        receive_cm(tp, priority, sa, da, frame->data, timestamp_us);
+        return false;
+    }
+
+    if (pgn == TP_DT_PGN)
+    {
+        return receive_dt(tp, sa, da, frame->data, timestamp_us, msg);
+    }
+
+    return false;
+}
+
+/**************************************************************************//**
+
+  \brief Drop sessions that have timed out
+
+  \return size_t    number of sessions dropped
+
+******************************************************************************/
+size_t j1939decode_tp_expire(j1939decode_tp_t * tp, uint64_t timestamp_us)
+{
+    size_t expired = 0;
+    for (size_t i = 0; tp != NULL && i < tp->num_sessions; i++)
+    {
+        if ((tp->keys[i] & TP_KEY_ACTIVE) && timestamp_us > tp->sessions[i].deadline_us)
+        {
+            close_session(tp, &tp->sessions[i]);
+            expired++;
+        }
+    }
+
+    return expired;
+}
+
+/**************************************************************************//**
+
+  \brief Get number of transfers in progress
+
+  \return size_t    number of sessions in use
+
+******************************************************************************/
+size_t j1939decode_tp_active(const j1939decode_tp_t * tp)
+{
+    return tp != NULL ? tp->num_active : 0;
+}
@@ -0,0 +1,62 @@
+#ifndef J1939TP_H
+#define J1939TP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "j1939decode.h"
+
+/* Maximum payload of a J1939-21 transport protocol message */
+#define J1939DECODE_TP_MAX_LEN J1939DECODE_MAX_PAYLOAD
+
+/* Opaque transport protocol reassembler with a fixed pool of sessions */
+typedef struct j1939decode_tp j1939decode_tp_t;
+
+/* Multi-packet message reassembled from TP.CM and TP.DT frames */
+typedef struct
+{
+    uint32_t id;                        /* CAN identifier the message would have as a single frame */
+    uint32_t pgn;                       /* parameter group number of the message */
+    uint8_t priority;                   /* priority of the connection management frame */
+    uint8_t sa;                         /* source address */
+    uint8_t da;                         /* destination address, 255 for broadcast (BAM) */
+    bool broadcast;                     /* sent with BAM instead of RTS/CTS */
+    size_t len;                         /* payload length in bytes */
+    const uint8_t * data;               /* payload, valid until the next call with the same reassembler
+                                         * decode with j1939decode_decode_payload(id, data, len, ...) */
+} j1939_tp_message_t;
+
+/* Transport protocol reassembly
+ * TP.CM/TP.DT frames of BAM and RTS/CTS transfers are collected into a fixed pool of sessions,
+ * one per source and destination address pair, with no allocation after j1939decode_tp_create()
+ * Timestamps are supplied by the caller in microseconds and only need to be monotonic */
+
+/* Create reassembler with room for num_sessions concurrent transfers, allocator may be NULL to use malloc() and free()
+ * Returns NULL on failure */
+j1939decode_tp_t * j1939decode_tp_create(size_t num_sessions, const j1939decode_allocator_t * allocator);
+
+/* Free reassembler and all of its sessions */
+void j1939decode_tp_destroy(j1939decode_tp_t * tp);
+
+/* Feed one CAN frame to the reassembler, frames other than TP.CM and TP.DT are ignored
+ * Returns true and fills in msg when the frame completes a message */
+bool j1939decode_tp_receive(j1939decode_tp_t * tp, const j1939_frame_t * frame, uint64_t timestamp_us,
+                            j1939_tp_message_t * msg);
+
+/* Drop sessions that have timed out, this also happens for each session as frames are received
+ * Returns number of sessions dropped */
+size_t j1939decode_tp_expire(j1939decode_tp_t * tp, uint64_t timestamp_us);
+
+/* Number of transfers in progress */
+size_t j1939decode_tp_active(const j1939decode_tp_t * tp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //J1939TP_H
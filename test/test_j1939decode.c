@@ -1,10 +1,23 @@
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "unity.h"
 
 #include "j1939decode.h"
+#include "j1939db.h"
+#include "j1939ctx.h"
+#include "j1939index.h"
+#include "j1939delta.h"
+#include "j1939json.h"
+#include "j1939dtoa.h"
+#include "j1939simd.h"
+#include "j1939tp.h"
+#include "j1939dm.h"
+#include "j1939file.h"
 #include "cJSON.h"
 
 
@@ -24,6 +37,29 @@ static inline uint32_t get_id(uint8_t pri, uint32_t pgn, uint8_t sa)
     );
 }
 
+/* Write a JSON database fixture file */
+static void write_json_fixture(const char * filename, const char * json)
+{
+    FILE * fp = fopen(filename, "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fputs(json, fp);
+    fclose(fp);
+}
+
+/* Create a context on a JSON database fixture, the file is removed once the database is loaded */
+static j1939decode_ctx_t * open_json_fixture(const char * json, const j1939decode_allocator_t * allocator)
+{
+    const char * filename = "J1939db_fixture_test.json";
+    write_json_fixture(filename, json);
+
+    j1939decode_db_t * db = j1939decode_db_open(filename, 0, allocator);
+    remove(filename);
+    TEST_ASSERT_NOT_NULL(db);
+    j1939decode_ctx_t * ctx = j1939decode_ctx_create_with_allocator(db, allocator);
+    j1939decode_db_release(db);
+    TEST_ASSERT_NOT_NULL(ctx);
+    return ctx;
+}
 
 void setUp(void)
 {
@@ -186,3 +222,1522 @@ void test_j1939decode_message_sa_industry_group_specific(void)
     cJSON_Delete(json);
     free(json_string);
 }
+
+void test_j1939decode_message_spn_decoded_value(void)
+{
+    /* Electronic Engine Controller 1 */
+    pgn = 61444;
+
+    /* Engine speed of 752.375 rpm in bytes 4 and 5 */
+    data[3] = 0x83;
+    data[4] = 0x17;
+
+    char * json_string = j1939decode_to_json(get_id(pri, pgn, sa), dlc, (uint64_t *) data, false);
+    cJSON * json = cJSON_Parse(json_string);
+
+    /* SPN 190 is Engine Speed */
+    cJSON * spn = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(json, "SPNs"), "190");
+
+    TEST_ASSERT_EQUAL_STRING("Engine Speed", cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(spn, "Name")));
+    TEST_ASSERT_EQUAL_DOUBLE(6019, cJSON_GetObjectItemCaseSensitive(spn, "ValueRaw")->valuedouble);
+    TEST_ASSERT_EQUAL_DOUBLE(752.375, cJSON_GetObjectItemCaseSensitive(spn, "ValueDecoded")->valuedouble);
+    TEST_ASSERT_TRUE(cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(spn, "Valid")));
+
+    cJSON_Delete(json);
+    free(json_string);
+}
+
+void test_j1939decode_message_spn_offset_and_length(void)
+{
+    /* Fractional offset, and a 32 bit SPN whose mask needs all 32 bits */
+    j1939decode_ctx_t * ctx = open_json_fixture(
+        "{\"J1939PGNdb\": {\"65280\": {\"Name\": \"OEM Data\", \"SPNs\": [520192, 520193],"
+        " \"SPNStartBits\": [0, 16]}},"
+        " \"J1939SPNdb\": {"
+        "\"520192\": {\"Name\": \"OEM Temperature\", \"SPNLength\": 16, \"Resolution\": 0.0625,"
+        " \"Offset\": -7.8125, \"OperationalLow\": -7.8125, \"OperationalHigh\": 4087, \"Units\": \"deg C\"},"
+        " \"520193\": {\"Name\": \"OEM Counter\", \"SPNLength\": 32, \"Resolution\": 1, \"Offset\": 0,"
+        " \"OperationalLow\": 0, \"OperationalHigh\": 4211081215, \"Units\": \"\"}}}", NULL);
+
+    const uint8_t frame[8] = {0x00, 0x01, 0xEF, 0xCD, 0xAB, 0x89, 0xFF, 0xFF};
+    memcpy(data, frame, sizeof(data));
+    char * json_string = j1939decode_ctx_to_json(ctx, get_id(pri, 65280, 128), dlc, (uint64_t *) data, false);
+    cJSON * json = cJSON_Parse(json_string);
+    TEST_ASSERT_NOT_NULL(json);
+    cJSON * spns = cJSON_GetObjectItemCaseSensitive(json, "SPNs");
+
+    /* The offset is not truncated to an integer */
+    cJSON * spn = cJSON_GetObjectItemCaseSensitive(spns, "520192");
+    TEST_ASSERT_EQUAL_DOUBLE(-7.8125, cJSON_GetObjectItemCaseSensitive(spn, "Offset")->valuedouble);
+    TEST_ASSERT_EQUAL_DOUBLE(256, cJSON_GetObjectItemCaseSensitive(spn, "ValueRaw")->valuedouble);
+    TEST_ASSERT_EQUAL_DOUBLE(8.1875, cJSON_GetObjectItemCaseSensitive(spn, "ValueDecoded")->valuedouble);
+
+    /* All 32 bits of the raw value are kept */
+    spn = cJSON_GetObjectItemCaseSensitive(spns, "520193");
+    TEST_ASSERT_EQUAL_DOUBLE(2309737967.0, cJSON_GetObjectItemCaseSensitive(spn, "ValueRaw")->valuedouble);
+    TEST_ASSERT_EQUAL_DOUBLE(2309737967.0, cJSON_GetObjectItemCaseSensitive(spn, "ValueDecoded")->valuedouble);
+    TEST_ASSERT_TRUE(cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(spn, "Valid")));
+
+    cJSON_Delete(json);
+    j1939decode_ctx_destroy(ctx);
+    free(json_string);
+}
+
+void test_j1939decode_decode_struct(void)
+{
+    /* Electronic Engine Controller 1 */
+    pri = 3;
+    pgn = 61444;
+
+    /* Engine speed of 752.375 rpm in bytes 4 and 5 */
+    data[3] = 0x83;
+    data[4] = 0x17;
+
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[32];
+    int count = j1939decode_decode(get_id(pri, pgn, sa), dlc, (uint64_t *) data, &decoded, spns, 32);
+
+    TEST_ASSERT_GREATER_THAN(0, count);
+    TEST_ASSERT_EQUAL_UINT(count, decoded.num_spns);
+    TEST_ASSERT_TRUE(decoded.decoded);
+    TEST_ASSERT_EQUAL_UINT8(3, decoded.priority);
+    TEST_ASSERT_EQUAL_UINT32(61444, decoded.pgn);
+    TEST_ASSERT_EQUAL_UINT8(0, decoded.sa);
+    TEST_ASSERT_EQUAL_STRING("Electronic Engine Controller 1", decoded.pgn_name);
+
+    bool found = false;
+    for (int i = 0; i < count; i++)
+    {
+        if (spns[i].spn == 190)
+        {
+            TEST_ASSERT_EQUAL_UINT64(6019, spns[i].value_raw);
+            TEST_ASSERT_EQUAL_DOUBLE(752.375, spns[i].value);
+            TEST_ASSERT_TRUE(spns[i].valid);
+            found = true;
+        }
+    }
+    TEST_ASSERT_TRUE(found);
+}
+
+void test_j1939decode_decode_struct_capacity(void)
+{
+    pgn = 61444;
+
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[1];
+
+    /* Only one SPN fits, but the total number of decoded SPNs is still reported */
+    TEST_ASSERT_EQUAL_INT(1, j1939decode_decode(get_id(pri, pgn, sa), dlc, (uint64_t *) data, &decoded, spns, 1));
+    TEST_ASSERT_GREATER_THAN(1, decoded.num_spns);
+
+    /* Invalid DLC is an error */
+    TEST_ASSERT_EQUAL_INT(-1, j1939decode_decode(get_id(pri, pgn, sa), 9, (uint64_t *) data, &decoded, spns, 1));
+}
+
+void test_j1939decode_binary_database(void)
+{
+    const char * filename = "J1939db_test.bin";
+    pgn = 61444;
+
+    char * json_string = j1939decode_to_json(get_id(pri, pgn, sa), dlc, (uint64_t *) data, false);
+    TEST_ASSERT_TRUE(j1939decode_save_db(filename));
+
+    /* Decoding with the memory-mapped binary database gives the same result as the JSON database */
+    j1939decode_init_file(filename);
+    char * image_json_string = j1939decode_to_json(get_id(pri, pgn, sa), dlc, (uint64_t *) data, false);
+    TEST_ASSERT_EQUAL_STRING(json_string, image_json_string);
+
+    free(image_json_string);
+    free(json_string);
+    remove(filename);
+}
+
+void test_j1939decode_to_json_buf(void)
+{
+    pgn = 61444;
+
+    char buf[4096];
+    char * json_string = j1939decode_to_json(get_id(pri, pgn, sa), dlc, (uint64_t *) data, true);
+    size_t len = j1939decode_to_json_buf(get_id(pri, pgn, sa), dlc, (uint64_t *) data, buf, sizeof(buf), J1939DECODE_JSON_PRETTY);
+
+    /* Same output as j1939decode_to_json() */
+    TEST_ASSERT_EQUAL_UINT(strlen(json_string), len);
+    TEST_ASSERT_EQUAL_STRING(json_string, buf);
+
+    /* Required length is returned when the buffer is too small, with the output truncated */
+    char small[16];
+    TEST_ASSERT_EQUAL_UINT(len, j1939decode_to_json_buf(get_id(pri, pgn, sa), dlc, (uint64_t *) data, small, sizeof(small), J1939DECODE_JSON_PRETTY));
+    TEST_ASSERT_LESS_THAN(sizeof(small), strlen(small));
+    TEST_ASSERT_EQUAL_UINT(len, j1939decode_to_json_buf(get_id(pri, pgn, sa), dlc, (uint64_t *) data, NULL, 0, J1939DECODE_JSON_PRETTY));
+
+    /* Invalid DLC is an error */
+    TEST_ASSERT_EQUAL_UINT(0, j1939decode_to_json_buf(get_id(pri, pgn, sa), 9, (uint64_t *) data, buf, sizeof(buf), 0));
+
+    free(json_string);
+}
+
+void test_j1939decode_frame_layout(void)
+{
+    /* Same layout as SocketCAN struct can_frame */
+    TEST_ASSERT_EQUAL_UINT(16, sizeof(j1939_frame_t));
+    TEST_ASSERT_EQUAL_UINT(8, offsetof(j1939_frame_t, data));
+}
+
+void test_j1939decode_decode_batch(void)
+{
+    j1939_frame_t frames[3];
+    memset(frames, 0xFF, sizeof(frames));
+
+    /* Two frames of the same PGN followed by PGN 1, which does not exist in J1939 database */
+    frames[0].id = get_id(pri, 61444, sa);
+    frames[1].id = get_id(pri, 61444, sa + 1) | 0x80000000U;
+    frames[2].id = get_id(pri, 1, sa);
+    for (size_t i = 0; i < 3; i++)
+    {
+        frames[i].dlc = 8;
+    }
+
+    j1939_decoded_t out[3];
+    j1939_spn_value_t spns[64];
+    TEST_ASSERT_EQUAL_UINT(3, j1939decode_decode_batch(frames, 3, out, spns, 64));
+
+    TEST_ASSERT_TRUE(out[0].decoded);
+    TEST_ASSERT_TRUE(out[1].decoded);
+    TEST_ASSERT_FALSE(out[2].decoded);
+
+    /* SocketCAN flag bits are not part of the identifier */
+    TEST_ASSERT_EQUAL_UINT8(sa + 1, out[1].sa);
+    TEST_ASSERT_EQUAL_HEX32(get_id(pri, 61444, sa + 1), out[1].id);
+
+    /* Each message points at its own SPNs */
+    TEST_ASSERT_TRUE(out[1].spns == out[0].spns + out[0].num_spns);
+
+    /* Batch stops when the SPNs of the next frame may not fit */
+    size_t num_spns = out[0].num_spns;
+    TEST_ASSERT_EQUAL_UINT(1, j1939decode_decode_batch(frames, 3, out, spns, num_spns + 1));
+
+    /* A first frame with more SPNs than the array is decoded truncated, so the batch still moves forward */
+    TEST_ASSERT_EQUAL_UINT(1, j1939decode_decode_batch(frames, 3, out, spns, num_spns - 1));
+    TEST_ASSERT_TRUE(out[0].decoded);
+    TEST_ASSERT_EQUAL_size_t(num_spns, out[0].num_spns);
+
+    /* Frames with an invalid DLC are reported undecoded, and not counted as unknown PGNs */
+    j1939decode_stats_t stats;
+    frames[0].dlc = 9;
+    TEST_ASSERT_EQUAL_UINT(3, j1939decode_decode_batch(frames, 3, out, spns, 64));
+    j1939decode_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT64(2, stats.unknown_pgns);
+    TEST_ASSERT_FALSE(out[0].decoded);
+    TEST_ASSERT_FALSE(out[0].filtered);
+    TEST_ASSERT_EQUAL_UINT32(61444, out[0].pgn);
+    TEST_ASSERT_TRUE(out[1].decoded);
+}
+
+void test_j1939decode_to_ndjson_batch(void)
+{
+    j1939_frame_t frames[2];
+    memset(frames, 0xFF, sizeof(frames));
+    frames[0].id = get_id(pri, 61444, sa);
+    frames[0].dlc = 8;
+    frames[1].id = get_id(pri, 1, sa);
+    frames[1].dlc = 8;
+
+    char buf[4096];
+    size_t written;
+    TEST_ASSERT_EQUAL_UINT(2, j1939decode_to_ndjson_batch(frames, 2, buf, sizeof(buf), &written));
+    TEST_ASSERT_EQUAL_UINT(strlen(buf), written);
+
+    /* Each line is the compact JSON of one frame */
+    char * json_string = j1939decode_to_json(frames[0].id, 8, (uint64_t *) frames[0].data, false);
+    TEST_ASSERT_EQUAL_STRING_LEN(json_string, buf, strlen(json_string));
+    TEST_ASSERT_EQUAL_HEX8('\n', buf[strlen(json_string)]);
+    TEST_ASSERT_EQUAL_HEX8('\n', buf[written - 1]);
+
+    /* Output stops at the first frame that does not fit */
+    TEST_ASSERT_EQUAL_UINT(1, j1939decode_to_ndjson_batch(frames, 2, buf, strlen(json_string) + 10, &written));
+    TEST_ASSERT_EQUAL_UINT(strlen(json_string) + 1, written);
+
+    /* Frames with an invalid DLC are skipped without a line */
+    frames[0].dlc = 9;
+    TEST_ASSERT_EQUAL_UINT(2, j1939decode_to_ndjson_batch(frames, 2, buf, sizeof(buf), &written));
+    TEST_ASSERT_EQUAL_HEX8('\n', buf[written - 1]);
+    TEST_ASSERT_NULL(memchr(buf, '\n', written - 1));
+
+    free(json_string);
+}
+
+static size_t ctx_log_count;
+
+static void ctx_log_fn(const char * msg)
+{
+    (void) msg;
+    ctx_log_count++;
+}
+
+void test_j1939decode_ctx_shared_db(void)
+{
+    pgn = 61444;
+
+    j1939decode_db_t * db = j1939decode_db_load(J1939DECODE_DB);
+    TEST_ASSERT_NOT_NULL(db);
+
+    /* Contexts keep their own reference, so the database outlives the loading reference */
+    j1939decode_ctx_t * ctx1 = j1939decode_ctx_create(db);
+    j1939decode_ctx_t * ctx2 = j1939decode_ctx_create(db);
+    j1939decode_db_release(db);
+    TEST_ASSERT_NOT_NULL(ctx1);
+    TEST_ASSERT_NOT_NULL(ctx2);
+    TEST_ASSERT_TRUE(j1939decode_ctx_db(ctx1) == j1939decode_ctx_db(ctx2));
+
+    /* Contexts give the same result as the default context */
+    char * json_string = j1939decode_to_json(get_id(pri, pgn, sa), dlc, (uint64_t *) data, false);
+    char * ctx1_json_string = j1939decode_ctx_to_json(ctx1, get_id(pri, pgn, sa), dlc, (uint64_t *) data, false);
+    j1939decode_ctx_destroy(ctx1);
+    char * ctx2_json_string = j1939decode_ctx_to_json(ctx2, get_id(pri, pgn, sa), dlc, (uint64_t *) data, false);
+    TEST_ASSERT_EQUAL_STRING(json_string, ctx1_json_string);
+    TEST_ASSERT_EQUAL_STRING(json_string, ctx2_json_string);
+
+    /* Errors are logged to the context's own handler */
+    ctx_log_count = 0;
+    j1939decode_ctx_set_log_fn(ctx2, ctx_log_fn);
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[1];
+    TEST_ASSERT_EQUAL_INT(-1, j1939decode_ctx_decode(ctx2, get_id(pri, pgn, sa), 9, (uint64_t *) data, &decoded, spns, 1));
+    TEST_ASSERT_EQUAL_UINT(1, ctx_log_count);
+
+    /* Source addresses missing from the database are only logged the first time */
+    for (int i = 0; i < 3; i++)
+    {
+        j1939decode_ctx_decode(ctx2, get_id(pri, pgn, 2), dlc, (uint64_t *) data, &decoded, spns, 1);
+        TEST_ASSERT_EQUAL_STRING("Unknown", decoded.sa_name);
+    }
+    TEST_ASSERT_EQUAL_UINT(2, ctx_log_count);
+
+    j1939decode_ctx_destroy(ctx2);
+    free(ctx2_json_string);
+    free(ctx1_json_string);
+    free(json_string);
+}
+
+typedef struct
+{
+    size_t count;
+    uint32_t level;
+} log_record_t;
+
+static void log_handler(void * user, uint32_t level, const char * msg)
+{
+    (void) msg;
+    log_record_t * record = user;
+    record->count++;
+    record->level = level;
+}
+
+void test_j1939decode_ctx_log_levels(void)
+{
+    j1939decode_db_t * db = j1939decode_db_load(J1939DECODE_DB);
+    j1939decode_ctx_t * ctx = j1939decode_ctx_create(db);
+    j1939decode_db_release(db);
+    TEST_ASSERT_NOT_NULL(ctx);
+
+    log_record_t record = {0, 0};
+    j1939decode_ctx_set_log_handler(ctx, log_handler, &record);
+
+    /* Frames with a PGN not in the database are only logged at debug level */
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[1];
+    j1939decode_ctx_decode(ctx, get_id(pri, 1, sa), dlc, (uint64_t *) data, &decoded, spns, 1);
+    TEST_ASSERT_EQUAL_UINT(0, record.count);
+
+    /* and then only once for each PGN */
+    j1939decode_ctx_set_log_level(ctx, J1939DECODE_LOG_DEBUG);
+    for (int i = 0; i < 3; i++)
+    {
+        j1939decode_ctx_decode(ctx, get_id(pri, 1, sa), dlc, (uint64_t *) data, &decoded, spns, 1);
+    }
+    TEST_ASSERT_EQUAL_UINT(1, record.count);
+    TEST_ASSERT_EQUAL_UINT(J1939DECODE_LOG_DEBUG, record.level);
+
+    /* Errors are passed with their level, unless logging is disabled */
+    TEST_ASSERT_EQUAL_INT(-1, j1939decode_ctx_decode(ctx, get_id(pri, pgn, sa), 9, (uint64_t *) data, &decoded, spns, 1));
+    TEST_ASSERT_EQUAL_UINT(2, record.count);
+    TEST_ASSERT_EQUAL_UINT(J1939DECODE_LOG_ERROR, record.level);
+
+    j1939decode_ctx_set_log_level(ctx, J1939DECODE_LOG_NONE);
+    TEST_ASSERT_EQUAL_INT(-1, j1939decode_ctx_decode(ctx, get_id(pri, pgn, sa), 9, (uint64_t *) data, &decoded, spns, 1));
+    TEST_ASSERT_EQUAL_UINT(2, record.count);
+
+    j1939decode_ctx_destroy(ctx);
+}
+
+static size_t alloc_count;
+static size_t free_count;
+
+static void * counting_malloc(void * user, size_t size)
+{
+    (void) user;
+    alloc_count++;
+    return malloc(size);
+}
+
+static void counting_free(void * user, void * ptr)
+{
+    (void) user;
+    free_count++;
+    free(ptr);
+}
+
+void test_j1939decode_allocator(void)
+{
+    pgn = 61444;
+    const j1939decode_allocator_t allocator = {counting_malloc, counting_free, NULL};
+    alloc_count = 0;
+    free_count = 0;
+
+    /* Loaded database keeps a single allocation, the file contents are freed while loading */
+    j1939decode_db_t * db = j1939decode_db_load_with_allocator(J1939DECODE_DB, &allocator);
+    TEST_ASSERT_NOT_NULL(db);
+    TEST_ASSERT_EQUAL_UINT(1, alloc_count - free_count);
+
+    j1939decode_ctx_t * ctx = j1939decode_ctx_create_with_allocator(db, &allocator);
+    j1939decode_db_release(db);
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL_UINT(2, alloc_count - free_count);
+
+    /* Returned string comes from the context's allocator, with one allocation whether or not it is pretty printed */
+    char buf[4096];
+    size_t allocs;
+    for (uint32_t flags = 0; flags <= J1939DECODE_JSON_PRETTY; flags += J1939DECODE_JSON_PRETTY)
+    {
+        allocs = alloc_count;
+        char * json_string = j1939decode_ctx_to_json(ctx, get_id(pri, pgn, sa), dlc, (uint64_t *) data,
+                                                     flags != 0);
+        TEST_ASSERT_NOT_NULL(json_string);
+        TEST_ASSERT_EQUAL_UINT(allocs + 1, alloc_count);
+        j1939decode_ctx_to_json_buf(ctx, get_id(pri, pgn, sa), dlc, (uint64_t *) data, buf, sizeof(buf), flags);
+        TEST_ASSERT_EQUAL_STRING(buf, json_string);
+        counting_free(NULL, json_string);
+    }
+
+    /* Buffer and struct decoding do not allocate */
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[16];
+    allocs = alloc_count;
+    TEST_ASSERT_GREATER_THAN(0, j1939decode_ctx_to_json_buf(ctx, get_id(pri, pgn, sa), dlc, (uint64_t *) data,
+                                                            buf, sizeof(buf), 0));
+    TEST_ASSERT_GREATER_THAN(0, j1939decode_ctx_decode(ctx, get_id(pri, pgn, sa), dlc, (uint64_t *) data,
+                                                       &decoded, spns, 16));
+    TEST_ASSERT_EQUAL_UINT(allocs, alloc_count);
+
+    j1939decode_ctx_destroy(ctx);
+    TEST_ASSERT_EQUAL_UINT(alloc_count, free_count);
+}
+
+void test_j1939decode_allocator_long_message(void)
+{
+    const j1939decode_allocator_t allocator = {counting_malloc, counting_free, NULL};
+
+    /* 32 two bit SPNs give JSON longer than the stack buffer of to_json */
+    static char json[8192];
+    size_t pos = (size_t) snprintf(json, sizeof(json),
+                                   "{\"J1939PGNdb\": {\"65280\": {\"Name\": \"OEM Switches\", \"SPNs\": [");
+    for (int i = 0; i < 32; i++)
+    {
+        pos += (size_t) snprintf(json + pos, sizeof(json) - pos, "%s%d", i > 0 ? ", " : "", 520192 + i);
+    }
+    pos += (size_t) snprintf(json + pos, sizeof(json) - pos, "], \"SPNStartBits\": [");
+    for (int i = 0; i < 32; i++)
+    {
+        pos += (size_t) snprintf(json + pos, sizeof(json) - pos, "%s%d", i > 0 ? ", " : "", 2 * i);
+    }
+    pos += (size_t) snprintf(json + pos, sizeof(json) - pos, "]}}, \"J1939SPNdb\": {");
+    for (int i = 0; i < 32; i++)
+    {
+        pos += (size_t) snprintf(json + pos, sizeof(json) - pos, "%s\"%d\": {\"Name\": \"OEM Switch %d\", "
+                                 "\"SPNLength\": 2, \"Resolution\": 1, \"Offset\": 0, \"Units\": \"bit\"}",
+                                 i > 0 ? ", " : "", 520192 + i, i);
+    }
+    snprintf(json + pos, sizeof(json) - pos, "}}");
+    TEST_ASSERT_LESS_THAN(sizeof(json) - 2, pos);
+    j1939decode_ctx_t * ctx = open_json_fixture(json, &allocator);
+
+    /* Still one allocation of the exact length, industry group addresses log no missing source address name */
+    const uint32_t id = get_id(pri, 65280, 128);
+    static char buf[16384];
+    for (uint32_t flags = 0; flags <= J1939DECODE_JSON_PRETTY; flags += J1939DECODE_JSON_PRETTY)
+    {
+        size_t allocs = alloc_count;
+        char * json_string = j1939decode_ctx_to_json(ctx, id, dlc, (uint64_t *) data,
+                                                     flags != 0);
+        TEST_ASSERT_NOT_NULL(json_string);
+        TEST_ASSERT_EQUAL_UINT(allocs + 1, alloc_count);
+        TEST_ASSERT_GREATER_OR_EQUAL(4096, strlen(json_string));
+        size_t len = j1939decode_ctx_to_json_buf(ctx, id, dlc, (uint64_t *) data,
+                                                 buf, sizeof(buf), flags);
+        TEST_ASSERT_EQUAL_size_t(len, strlen(json_string));
+        TEST_ASSERT_EQUAL_STRING(buf, json_string);
+        counting_free(NULL, json_string);
+    }
+
+    /* Each frame is decoded and counted once, and only the complete output bytes */
+    j1939decode_stats_t before;
+    j1939decode_stats_t after;
+    j1939decode_ctx_stats(ctx, &before);
+    data[0] = 0x00;
+    char * json_string = j1939decode_ctx_to_json(ctx, id, dlc, (uint64_t *) data, true);
+    TEST_ASSERT_NOT_NULL(json_string);
+    j1939decode_ctx_stats(ctx, &after);
+    TEST_ASSERT_EQUAL_UINT64(1, after.frames - before.frames);
+    TEST_ASSERT_EQUAL_UINT64(32, after.spns - before.spns);
+    TEST_ASSERT_EQUAL_UINT64(strlen(json_string), after.output_bytes - before.output_bytes);
+    counting_free(NULL, json_string);
+
+    j1939decode_ctx_destroy(ctx);
+}
+
+void test_j1939decode_lazy_db(void)
+{
+    const char * filename = "J1939db_lazy_test.bin";
+    const uint32_t pgns[] = {61444, 65262, 65265, 61443, 65262};
+    const size_t num_pgns = sizeof(pgns) / sizeof(pgns[0]);
+    TEST_ASSERT_TRUE(j1939decode_save_db(filename));
+
+    j1939decode_db_t * db = j1939decode_db_open(J1939DECODE_DB, J1939DECODE_DB_LAZY, NULL);
+    j1939decode_db_t * image_db = j1939decode_db_open(filename, J1939DECODE_DB_LAZY, NULL);
+    TEST_ASSERT_NOT_NULL(db);
+    TEST_ASSERT_NOT_NULL(image_db);
+    j1939decode_ctx_t * ctx = j1939decode_ctx_create(db);
+    j1939decode_ctx_t * image_ctx = j1939decode_ctx_create(image_db);
+    j1939decode_db_release(image_db);
+    j1939decode_db_release(db);
+
+    /* Nothing is loaded until a PGN is first looked up */
+    TEST_ASSERT_EQUAL_UINT(0, j1939index_num_loaded(db->index));
+    TEST_ASSERT_EQUAL_UINT(0, j1939index_num_loaded(image_db->index));
+    TEST_ASSERT_FALSE(j1939decode_db_save(db, filename));
+
+    /* Lazily loaded databases give the same result as the fully loaded database */
+    for (size_t i = 0; i < num_pgns; i++)
+    {
+        uint32_t id = get_id(pri, pgns[i], sa);
+        char * json_string = j1939decode_to_json(id, dlc, (uint64_t *) data, false);
+        char * lazy_json_string = j1939decode_ctx_to_json(ctx, id, dlc, (uint64_t *) data, false);
+        char * image_json_string = j1939decode_ctx_to_json(image_ctx, id, dlc, (uint64_t *) data, false);
+        TEST_ASSERT_EQUAL_STRING(json_string, lazy_json_string);
+        TEST_ASSERT_EQUAL_STRING(json_string, image_json_string);
+        free(image_json_string);
+        free(lazy_json_string);
+        free(json_string);
+    }
+
+    /* Each PGN is loaded once, PGNs not in the database are not loaded */
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[1];
+    TEST_ASSERT_EQUAL_INT(0, j1939decode_ctx_decode(ctx, get_id(pri, 1, sa), dlc, (uint64_t *) data, &decoded, spns, 1));
+    TEST_ASSERT_NULL(decoded.pgn_name);
+    TEST_ASSERT_EQUAL_UINT(num_pgns - 1, j1939index_num_loaded(db->index));
+    TEST_ASSERT_EQUAL_UINT(num_pgns - 1, j1939index_num_loaded(image_db->index));
+
+    j1939decode_ctx_destroy(image_ctx);
+    j1939decode_ctx_destroy(ctx);
+    remove(filename);
+}
+
+void test_j1939decode_filters(void)
+{
+    const uint32_t allowed_pgns[] = {61444};
+    const uint32_t allowed_spns[] = {190};
+    const uint32_t out_of_range[] = {1U << 18U};
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[16];
+
+    /* Allowlisted PGNs are decoded, all others are skipped */
+    TEST_ASSERT_TRUE(j1939decode_set_pgn_filter(allowed_pgns, 1, true));
+    TEST_ASSERT_GREATER_THAN_INT(1, j1939decode_decode(get_id(pri, 61444, sa), dlc, (uint64_t *) data, &decoded, spns, 16));
+    TEST_ASSERT_FALSE(decoded.filtered);
+    TEST_ASSERT_EQUAL_INT(0, j1939decode_decode(get_id(pri, 65262, sa), dlc, (uint64_t *) data, &decoded, spns, 16));
+    TEST_ASSERT_TRUE(decoded.filtered);
+    TEST_ASSERT_EQUAL_UINT32(65262, decoded.pgn);
+    TEST_ASSERT_NULL(j1939decode_to_json(get_id(pri, 65262, sa), dlc, (uint64_t *) data, false));
+
+    /* Denylisted PGNs are skipped, all others are decoded */
+    TEST_ASSERT_TRUE(j1939decode_set_pgn_filter(allowed_pgns, 1, false));
+    TEST_ASSERT_EQUAL_INT(0, j1939decode_decode(get_id(pri, 61444, sa), dlc, (uint64_t *) data, &decoded, spns, 16));
+    TEST_ASSERT_TRUE(decoded.filtered);
+    TEST_ASSERT_GREATER_THAN_INT(0, j1939decode_decode(get_id(pri, 65262, sa), dlc, (uint64_t *) data, &decoded, spns, 16));
+
+    /* Out of range numbers are rejected and the previous filter is kept */
+    TEST_ASSERT_FALSE(j1939decode_set_pgn_filter(out_of_range, 1, true));
+    TEST_ASSERT_EQUAL_INT(0, j1939decode_decode(get_id(pri, 61444, sa), dlc, (uint64_t *) data, &decoded, spns, 16));
+    TEST_ASSERT_TRUE(j1939decode_set_pgn_filter(NULL, 0, true));
+
+    /* Only allowlisted SPNs are extracted, in JSON output too */
+    TEST_ASSERT_TRUE(j1939decode_set_spn_filter(allowed_spns, 1));
+    TEST_ASSERT_EQUAL_INT(1, j1939decode_decode(get_id(pri, 61444, sa), dlc, (uint64_t *) data, &decoded, spns, 16));
+    TEST_ASSERT_EQUAL_UINT32(190, spns[0].spn);
+
+    char * json_string = j1939decode_to_json(get_id(pri, 61444, sa), dlc, (uint64_t *) data, false);
+    cJSON * json = cJSON_Parse(json_string);
+    const cJSON * spn_json = cJSON_GetObjectItemCaseSensitive(json, "SPNs");
+    TEST_ASSERT_EQUAL_INT(1, cJSON_GetArraySize(spn_json));
+    TEST_ASSERT_NOT_NULL(cJSON_GetObjectItemCaseSensitive(spn_json, "190"));
+    cJSON_Delete(json);
+    free(json_string);
+}
+
+void test_j1939decode_format_double(void)
+{
+    const double values[] = {0.0, -0.0, 900.0, -125.0, 0.125, 0.1, 0.30000000000000004, 6884.5, -40.03125, 1e-5,
+                             0.0001, 1e15, 123456789012345.6, 1e21, 1.7976931348623157e308, 5e-324, 1.0 / 3.0};
+    char expected[64];
+    char number[J1939DTOA_MAX_LEN + 1];
+
+    /* Output matches cJSON: 15 digits if they read back as the same value, 17 otherwise */
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        snprintf(expected, sizeof(expected), "%1.15g", values[i]);
+        if (strtod(expected, NULL) != values[i])
+        {
+            snprintf(expected, sizeof(expected), "%1.17g", values[i]);
+        }
+
+        size_t len = j1939dtoa_format(values[i], number);
+        number[len] = '\0';
+        TEST_ASSERT_EQUAL_STRING(expected, number);
+    }
+}
+
+void test_j1939decode_encode(void)
+{
+    uint8_t buf[1024];
+    uint8_t small[8];
+    uint32_t id = get_id(pri, 61444, sa);
+
+    pgn = 61444;
+    data[3] = 0x20;
+    data[4] = 0x1C;
+
+    /* MessagePack map with the ten fields of full JSON output, starting with "ID" */
+    size_t len = j1939decode_encode(id, dlc, (uint64_t *) data, J1939DECODE_FORMAT_MSGPACK, buf, sizeof(buf), 0);
+    TEST_ASSERT_GREATER_THAN(4, len);
+    TEST_ASSERT_EQUAL_HEX8(0x8A, buf[0]);
+    TEST_ASSERT_EQUAL_MEMORY("\xA2" "ID", &buf[1], 3);
+
+    /* Truncated output still returns the complete length */
+    TEST_ASSERT_EQUAL_size_t(len, j1939decode_encode(id, dlc, (uint64_t *) data, J1939DECODE_FORMAT_MSGPACK,
+                                                     small, sizeof(small), 0));
+
+    /* CBOR with integer keys, the compact profile only has ID, PGN, SA, SPNs and Decoded */
+    TEST_ASSERT_TRUE(j1939decode_set_profile(J1939DECODE_PROFILE_COMPACT));
+    len = j1939decode_encode(id, dlc, (uint64_t *) data, J1939DECODE_FORMAT_CBOR, buf, sizeof(buf),
+                             J1939DECODE_ENCODE_INT_KEYS);
+    const uint8_t cbor_head[] = {0xA5, 0x01, 0x1A, 0x00, 0xF0, 0x04, 0x00, 0x03, 0x19, 0xF0, 0x04, 0x04, 0x00};
+    TEST_ASSERT_GREATER_THAN(sizeof(cbor_head), len);
+    TEST_ASSERT_EQUAL_MEMORY(cbor_head, buf, sizeof(cbor_head));
+    TEST_ASSERT_EQUAL_HEX8(0xF5, buf[len - 1]);
+
+    /* Protobuf Message, SPNs of the raw profile only have their number and raw value */
+    TEST_ASSERT_TRUE(j1939decode_set_profile(J1939DECODE_PROFILE_RAW));
+    len = j1939decode_encode(id, dlc, (uint64_t *) data, J1939DECODE_FORMAT_PROTOBUF, buf, sizeof(buf), 0);
+    const uint8_t pb_head[] = {0x08, 0x80, 0x88, 0xC0, 0x07, 0x18, 0x84, 0xE0, 0x03};
+    TEST_ASSERT_GREATER_THAN(sizeof(pb_head), len);
+    TEST_ASSERT_EQUAL_MEMORY(pb_head, buf, sizeof(pb_head));
+    TEST_ASSERT_EQUAL_MEMORY("\x50\x01", &buf[len - 2], 2);
+
+    TEST_ASSERT_EQUAL_size_t(0, j1939decode_encode(id, dlc, (uint64_t *) data, 4, buf, sizeof(buf), 0));
+}
+
+void test_j1939decode_delta(void)
+{
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[16];
+    char buf[1024];
+
+    pgn = 61444;
+    data[3] = 0x20;
+    data[4] = 0x1C;
+
+    TEST_ASSERT_NULL(j1939decode_delta_create(0, NULL));
+    j1939decode_delta_t * delta = j1939decode_delta_create(1, NULL);
+    TEST_ASSERT_NOT_NULL(delta);
+
+    /* First frame of a pair reports all SPNs, an identical frame is skipped */
+    TEST_ASSERT_GREATER_THAN_INT(1, j1939decode_decode_delta(delta, get_id(pri, pgn, sa), dlc, (uint64_t *) data, 0,
+                                                             &decoded, spns, 16));
+    TEST_ASSERT_FALSE(decoded.filtered);
+    TEST_ASSERT_EQUAL_INT(0, j1939decode_decode_delta(delta, get_id(pri, pgn, sa), dlc, (uint64_t *) data, 10,
+                                                      &decoded, spns, 16));
+    TEST_ASSERT_TRUE(decoded.filtered);
+    TEST_ASSERT_EQUAL_size_t(0, j1939decode_delta_to_json_buf(delta, get_id(pri, pgn, sa), dlc, (uint64_t *) data, 20,
+                                                              buf, sizeof(buf), 0));
+    TEST_ASSERT_EQUAL_STRING("", buf);
+
+    /* Only the SPN whose raw value changed is reported */
+    data[4] = 0x1D;
+    TEST_ASSERT_EQUAL_INT(1, j1939decode_decode_delta(delta, get_id(pri, pgn, sa), dlc, (uint64_t *) data, 30,
+                                                      &decoded, spns, 16));
+    TEST_ASSERT_EQUAL_UINT32(190, spns[0].spn);
+    TEST_ASSERT_EQUAL_DOUBLE(932.0, spns[0].value);
+
+    /* Changes within the deadband of the value last reported are suppressed until they add up */
+    j1939decode_delta_set_deadband(delta, 50.0);
+    data[4] = 0x1E;
+    TEST_ASSERT_EQUAL_INT(0, j1939decode_decode_delta(delta, get_id(pri, pgn, sa), dlc, (uint64_t *) data, 40,
+                                                      &decoded, spns, 16));
+    TEST_ASSERT_TRUE(decoded.filtered);
+    data[4] = 0x1F;
+    TEST_ASSERT_GREATER_THAN_INT(0, j1939decode_delta_to_json_buf(delta, get_id(pri, pgn, sa), dlc, (uint64_t *) data,
+                                                                  50, buf, sizeof(buf), 0));
+    cJSON * json = cJSON_Parse(buf);
+    const cJSON * spn_json = cJSON_GetObjectItemCaseSensitive(json, "SPNs");
+    TEST_ASSERT_EQUAL_INT(1, cJSON_GetArraySize(spn_json));
+    TEST_ASSERT_NOT_NULL(cJSON_GetObjectItemCaseSensitive(spn_json, "190"));
+    cJSON_Delete(json);
+
+    /* All SPNs are reported again once the heartbeat is due */
+    j1939decode_delta_set_heartbeat(delta, 1000);
+    TEST_ASSERT_EQUAL_INT(0, j1939decode_decode_delta(delta, get_id(pri, pgn, sa), dlc, (uint64_t *) data, 999,
+                                                      &decoded, spns, 16));
+    TEST_ASSERT_GREATER_THAN_INT(1, j1939decode_decode_delta(delta, get_id(pri, pgn, sa), dlc, (uint64_t *) data, 1000,
+                                                             &decoded, spns, 16));
+
+    /* Pairs beyond capacity are decoded in full */
+    TEST_ASSERT_EQUAL_size_t(1, j1939decode_delta_count(delta));
+    for (int i = 0; i < 2; i++)
+    {
+        TEST_ASSERT_GREATER_THAN_INT(1, j1939decode_decode_delta(delta, get_id(pri, pgn, sa + 1), dlc,
+                                                                 (uint64_t *) data, 1010, &decoded, spns, 16));
+    }
+    TEST_ASSERT_EQUAL_size_t(1, j1939decode_delta_count(delta));
+
+    /* Reset forgets all payloads */
+    j1939decode_delta_reset(delta);
+    TEST_ASSERT_EQUAL_size_t(0, j1939decode_delta_count(delta));
+    TEST_ASSERT_GREATER_THAN_INT(1, j1939decode_decode_delta(delta, get_id(pri, pgn, sa), dlc, (uint64_t *) data, 1020,
+                                                             &decoded, spns, 16));
+
+    j1939decode_delta_destroy(delta);
+}
+
+void test_j1939decode_profiles(void)
+{
+    pgn = 61444;
+    data[3] = 0x20;
+    data[4] = 0x1C;
+
+    /* Compact profile keeps the decoded value, units and validity of each SPN */
+    TEST_ASSERT_FALSE(j1939decode_set_profile(3));
+    TEST_ASSERT_TRUE(j1939decode_set_profile(J1939DECODE_PROFILE_COMPACT));
+    char * json_string = j1939decode_to_json(get_id(pri, pgn, sa), dlc, (uint64_t *) data, false);
+    cJSON * json = cJSON_Parse(json_string);
+    TEST_ASSERT_NULL(cJSON_GetObjectItemCaseSensitive(json, "SAName"));
+    TEST_ASSERT_NULL(cJSON_GetObjectItemCaseSensitive(json, "DataRaw"));
+    const cJSON * spn_json = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(json, "SPNs"), "190");
+    TEST_ASSERT_EQUAL_INT(3, cJSON_GetArraySize(spn_json));
+    TEST_ASSERT_EQUAL_DOUBLE(900.0, cJSON_GetObjectItemCaseSensitive(spn_json, "ValueDecoded")->valuedouble);
+    TEST_ASSERT_EQUAL_STRING("rpm", cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(spn_json, "Units")));
+    cJSON_Delete(json);
+    free(json_string);
+
+    /* Raw profile maps each SPN to its raw value */
+    TEST_ASSERT_TRUE(j1939decode_set_profile(J1939DECODE_PROFILE_RAW));
+    json_string = j1939decode_to_json(get_id(pri, pgn, sa), dlc, (uint64_t *) data, false);
+    json = cJSON_Parse(json_string);
+    spn_json = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(json, "SPNs"), "190");
+    TEST_ASSERT_EQUAL_DOUBLE(7200.0, spn_json->valuedouble);
+    cJSON_Delete(json);
+    free(json_string);
+
+    /* Schema holds the metadata left out, the same as in the full profile */
+    json_string = j1939decode_schema_to_json(false);
+    json = cJSON_Parse(json_string);
+    TEST_ASSERT_EQUAL_STRING("Engine #1", cJSON_GetStringValue(
+        cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(json, "SANames"), "0")));
+    const cJSON * pgn_json = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(json, "PGNs"), "61444");
+    spn_json = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(pgn_json, "SPNs"), "190");
+    TEST_ASSERT_EQUAL_STRING("Engine Speed", cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(spn_json, "Name")));
+    TEST_ASSERT_EQUAL_DOUBLE(24.0, cJSON_GetObjectItemCaseSensitive(spn_json, "StartBit")->valuedouble);
+    TEST_ASSERT_NULL(cJSON_GetObjectItemCaseSensitive(spn_json, "ValueRaw"));
+    cJSON_Delete(json);
+    free(json_string);
+}
+
+void test_j1939decode_decode_plan(void)
+{
+    cJSON * json = cJSON_Parse(
+        "{\"J1939PGNdb\": {\"100\": {\"Name\": \"Test\", \"SPNs\": [1, 2550, 2], \"SPNStartBits\": [4, 0, 70]}},"
+        " \"J1939SPNdb\": {\"1\": {\"SPNLength\": 12, \"Resolution\": 0.5, \"Offset\": -10},"
+        "                  \"2\": {\"SPNLength\": 8}, \"2550\": {\"SPNLength\": 64}},"
+        " \"J1939SATabledb\": {}}");
+    j1939db_t * db = j1939db_compile(json);
+    cJSON_Delete(json);
+    TEST_ASSERT_NOT_NULL(db);
+
+    /* Proprietary SPN is left out of the plan but still counted as listed */
+    const j1939db_pgn_t * pgn_data = j1939db_find_pgn(db, 100);
+    TEST_ASSERT_NOT_NULL(pgn_data);
+    TEST_ASSERT_EQUAL_UINT32(3, pgn_data->num_spns);
+    TEST_ASSERT_EQUAL_UINT32(2, pgn_data->num_steps);
+
+    const j1939db_step_t * plan = &db->steps[pgn_data->first_step];
+    TEST_ASSERT_EQUAL_UINT32(1, plan[0].spn);
+    TEST_ASSERT_EQUAL_UINT32(4, plan[0].shift);
+    TEST_ASSERT_EQUAL_HEX64(0xFFF, plan[0].mask);
+    TEST_ASSERT_EQUAL_DOUBLE(0.5, plan[0].scale);
+    TEST_ASSERT_EQUAL_DOUBLE(-10, plan[0].offset);
+
+    /* Start bit outside of the data field always decodes as zero */
+    TEST_ASSERT_EQUAL_UINT32(2, plan[1].spn);
+    TEST_ASSERT_EQUAL_INT32(70, plan[1].start_bit);
+    TEST_ASSERT_EQUAL_HEX64(0, plan[1].mask);
+
+    j1939db_free(db);
+}
+
+void test_j1939decode_decode_columns(void)
+{
+    /* Wheel Speed Information, with a partial last byte in the validity bitmaps */
+    pgn = 65215;
+    enum { count = 37, max_columns = 16 };
+
+    uint64_t frames[count];
+    uint64_t seed = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        frames[i] = seed;
+    }
+
+    uint64_t raw[max_columns][count];
+    double value[max_columns][count];
+    uint8_t valid[max_columns][(count + 7) / 8];
+    j1939_spn_column_t columns[max_columns];
+    for (size_t c = 0; c < max_columns; c++)
+    {
+        columns[c].value_raw = raw[c];
+        columns[c].value = value[c];
+        columns[c].valid = valid[c];
+    }
+
+    int num_columns = j1939decode_decode_columns(pgn, frames, count, columns, max_columns);
+    TEST_ASSERT_GREATER_THAN(0, num_columns);
+    TEST_ASSERT_LESS_OR_EQUAL(max_columns, num_columns);
+
+    /* Columns hold the same values as decoding each frame */
+    for (size_t i = 0; i < count; i++)
+    {
+        j1939_decoded_t decoded;
+        j1939_spn_value_t spns[max_columns];
+        TEST_ASSERT_EQUAL_INT(num_columns, j1939decode_decode(get_id(pri, pgn, sa), dlc, &frames[i], &decoded, spns, max_columns));
+
+        for (int c = 0; c < num_columns; c++)
+        {
+            TEST_ASSERT_EQUAL_UINT32(spns[c].spn, columns[c].spn);
+            TEST_ASSERT_EQUAL_UINT64(spns[c].value_raw, raw[c][i]);
+            TEST_ASSERT_EQUAL_DOUBLE(spns[c].value, value[c][i]);
+            TEST_ASSERT_EQUAL(spns[c].valid, (valid[c][i / 8] >> (i % 8)) & 1U);
+        }
+    }
+
+    /* Scalar kernel gives the same results as the vector kernels */
+    j1939decode_db_t * db = j1939decode_db_load(J1939DECODE_DB);
+    TEST_ASSERT_NOT_NULL(db);
+    const j1939db_pgn_t * pgn_data = j1939db_find_pgn(db->tables, pgn);
+    for (uint32_t i = 0; i < pgn_data->num_steps; i++)
+    {
+        const j1939db_step_t * step = &db->tables->steps[pgn_data->first_step + i];
+        j1939simd_extract(step, frames, count, raw[0], value[0], valid[0]);
+        j1939simd_extract_scalar(step, frames, count, raw[1], value[1], valid[1]);
+        TEST_ASSERT_EQUAL_MEMORY(raw[0], raw[1], sizeof(raw[0]));
+        TEST_ASSERT_EQUAL_MEMORY(value[0], value[1], sizeof(value[0]));
+        TEST_ASSERT_EQUAL_MEMORY(valid[0], valid[1], sizeof(valid[0]));
+    }
+    j1939decode_db_release(db);
+}
+
+void test_j1939decode_decode_payload(void)
+{
+    const uint32_t pgns[] = {0, 61443, 61444, 65262, 65265};
+    const uint8_t payload[8] = {0x12, 0x7D, 0x80, 0x3E, 0x1F, 0xFF, 0xA5, 0x40};
+    j1939_decoded_t decoded;
+    j1939_decoded_t payload_decoded;
+    j1939_spn_value_t spns[16];
+    j1939_spn_value_t payload_spns[16];
+
+    /* Word loads give the same results as the 64 bit path for classic frames */
+    for (size_t i = 0; i < sizeof(pgns) / sizeof(pgns[0]); i++)
+    {
+        uint32_t id = get_id(pri, pgns[i], sa);
+        uint64_t frame_data;
+        memcpy(&frame_data, payload, sizeof(frame_data));
+        int n = j1939decode_decode(id, 8, &frame_data, &decoded, spns, 16);
+        TEST_ASSERT_GREATER_THAN(0, n);
+        TEST_ASSERT_EQUAL_INT(n, j1939decode_decode_payload(id, payload, sizeof(payload), &payload_decoded, payload_spns, 16));
+        TEST_ASSERT_EQUAL_size_t(8, payload_decoded.len);
+        for (int j = 0; j < n; j++)
+        {
+            TEST_ASSERT_EQUAL_UINT32(spns[j].spn, payload_spns[j].spn);
+            TEST_ASSERT_EQUAL_UINT64(spns[j].value_raw, payload_spns[j].value_raw);
+            TEST_ASSERT_EQUAL_DOUBLE(spns[j].value, payload_spns[j].value);
+        }
+    }
+
+    /* SPNs past the end of a short payload are skipped */
+    int n = j1939decode_decode_payload(get_id(pri, 61444, sa), payload, 4, &payload_decoded, payload_spns, 16);
+    TEST_ASSERT_GREATER_THAN(0, n);
+    TEST_ASSERT_EQUAL_size_t(4, payload_decoded.len);
+    for (int j = 0; j < n; j++)
+    {
+        TEST_ASSERT_LESS_OR_EQUAL(32, payload_spns[j].start_bit + payload_spns[j].length);
+    }
+
+    /* Payloads longer than 8 bytes, such as a DM1 with two DTCs */
+    const uint8_t dm1[10] = {0x04, 0xFF, 0x64, 0x00, 0x03, 0x01, 0x6E, 0x00, 0x05, 0x01};
+    TEST_ASSERT_GREATER_THAN(0, j1939decode_decode_payload(get_id(6, 65226, 0), dm1, sizeof(dm1),
+                                                           &payload_decoded, payload_spns, 16));
+    TEST_ASSERT_TRUE(payload_decoded.decoded);
+    TEST_ASSERT_EQUAL_size_t(10, payload_decoded.len);
+    TEST_ASSERT_EQUAL_INT(-1, j1939decode_decode_payload(get_id(6, 65226, 0), dm1, J1939DECODE_MAX_PAYLOAD + 1,
+                                                         &payload_decoded, payload_spns, 16));
+}
+
+void test_j1939decode_decode_payload_long_spn(void)
+{
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[16];
+
+    /* SPNs longer than 64 bits, byte aligned and not */
+    j1939decode_ctx_t * ctx = open_json_fixture(
+        "{\"J1939PGNdb\": {\"65280\": {\"Name\": \"OEM Data\", \"SPNs\": [520192, 520193],"
+        " \"SPNStartBits\": [0, 132]}},"
+        " \"J1939SPNdb\": {"
+        "\"520192\": {\"Name\": \"OEM Block\", \"SPNLength\": 128, \"Resolution\": 1, \"Offset\": 0, \"Units\": \"\"},"
+        " \"520193\": {\"Name\": \"OEM Record\", \"SPNLength\": 72, \"Resolution\": 1, \"Offset\": 0,"
+        " \"Units\": \"\"}}}", NULL);
+
+    uint8_t payload[32];
+    for (size_t i = 0; i < 16; i++)
+    {
+        payload[i] = (uint8_t) (i + 1);
+        payload[i + 16] = (uint8_t) (0xA0 + i);
+    }
+
+    /* The raw value is the low 64 bits */
+    TEST_ASSERT_EQUAL_INT(2, j1939decode_ctx_decode_payload(ctx, get_id(pri, 65280, sa), payload, sizeof(payload),
+                                                            &decoded, spns, 16));
+    TEST_ASSERT_EQUAL_UINT32(520192, spns[0].spn);
+    TEST_ASSERT_EQUAL_UINT32(128, spns[0].length);
+    TEST_ASSERT_EQUAL_UINT64(0x0807060504030201ULL, spns[0].value_raw);
+    TEST_ASSERT_EQUAL_UINT32(520193, spns[1].spn);
+    TEST_ASSERT_EQUAL_UINT64(0x8A7A6A5A4A3A2A1AULL, spns[1].value_raw);
+
+    /* Only the first fits in a 16 byte payload */
+    TEST_ASSERT_EQUAL_INT(1, j1939decode_ctx_decode_payload(ctx, get_id(pri, 65280, sa), payload, 16,
+                                                            &decoded, spns, 16));
+    TEST_ASSERT_EQUAL_UINT64(0x0807060504030201ULL, spns[0].value_raw);
+    j1939decode_ctx_destroy(ctx);
+}
+
+static j1939_frame_t tp_frame(uint32_t id, const uint8_t * bytes)
+{
+    j1939_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.dlc = 8;
+    memcpy(frame.data, bytes, 8);
+    return frame;
+}
+
+void test_j1939decode_tp_bam(void)
+{
+    j1939decode_tp_t * tp = j1939decode_tp_create(2, NULL);
+    TEST_ASSERT_NOT_NULL(tp);
+
+    /* DM1 with two DTCs sent by SA 0 with BAM, 10 bytes in 2 packets */
+    const uint8_t bam[8] = {32, 10, 0, 2, 0xFF, 0xCA, 0xFE, 0x00};
+    const uint8_t dt1[8] = {1, 0x04, 0xFF, 0x64, 0x00, 0x03, 0x01, 0x6E};
+    const uint8_t dt2[8] = {2, 0x00, 0x05, 0x01, 0xFF, 0xFF, 0xFF, 0xFF};
+    j1939_frame_t frame;
+    j1939_tp_message_t msg;
+
+    frame = tp_frame(get_id(7, 0xECFF, 0), bam);
+    TEST_ASSERT_FALSE(j1939decode_tp_receive(tp, &frame, 0, &msg));
+    TEST_ASSERT_EQUAL_UINT(1, j1939decode_tp_active(tp));
+
+    /* Duplicate and other frames do not complete the message */
+    frame = tp_frame(get_id(7, 0xEBFF, 0), dt1);
+    TEST_ASSERT_FALSE(j1939decode_tp_receive(tp, &frame, 50000, &msg));
+    TEST_ASSERT_FALSE(j1939decode_tp_receive(tp, &frame, 100000, &msg));
+    frame = tp_frame(get_id(3, 61444, 0), dt2);
+    TEST_ASSERT_FALSE(j1939decode_tp_receive(tp, &frame, 100000, &msg));
+
+    frame = tp_frame(get_id(7, 0xEBFF, 0), dt2);
+    TEST_ASSERT_TRUE(j1939decode_tp_receive(tp, &frame, 150000, &msg));
+    TEST_ASSERT_EQUAL_UINT32(65226, msg.pgn);
+    TEST_ASSERT_EQUAL_UINT32(get_id(7, 65226, 0), msg.id);
+    TEST_ASSERT_EQUAL_UINT8(0, msg.sa);
+    TEST_ASSERT_EQUAL_UINT8(255, msg.da);
+    TEST_ASSERT_TRUE(msg.broadcast);
+    TEST_ASSERT_EQUAL_size_t(10, msg.len);
+    const uint8_t payload[10] = {0x04, 0xFF, 0x64, 0x00, 0x03, 0x01, 0x6E, 0x00, 0x05, 0x01};
+    TEST_ASSERT_EQUAL_MEMORY(payload, msg.data, sizeof(payload));
+    TEST_ASSERT_EQUAL_UINT(0, j1939decode_tp_active(tp));
+
+    /* Sessions beyond the pool size are not reassembled, and timed out sessions are dropped */
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        frame = tp_frame(get_id(7, 0xECFF, i), bam);
+        j1939decode_tp_receive(tp, &frame, 200000, &msg);
+    }
+    TEST_ASSERT_EQUAL_UINT(2, j1939decode_tp_active(tp));
+    frame = tp_frame(get_id(7, 0xEBFF, 2), dt1);
+    TEST_ASSERT_FALSE(j1939decode_tp_receive(tp, &frame, 250000, &msg));
+    TEST_ASSERT_EQUAL_size_t(2, j1939decode_tp_expire(tp, 2000000));
+    TEST_ASSERT_EQUAL_UINT(0, j1939decode_tp_active(tp));
+
+    j1939decode_tp_destroy(tp);
+}
+
+void test_j1939decode_tp_rts_cts(void)
+{
+    j1939decode_tp_t * tp = j1939decode_tp_create(4, NULL);
+    TEST_ASSERT_NOT_NULL(tp);
+
+    /* Vehicle identification from SA 0 to SA 249, 17 bytes in 3 packets */
+    const uint8_t rts[8] = {16, 17, 0, 3, 3, 0xEC, 0xFE, 0x00};
+    const uint8_t cts[8] = {17, 3, 1, 0xFF, 0xFF, 0xEC, 0xFE, 0x00};
+    const uint8_t dt[3][8] =
+    {
+        {1, '1', 'H', 'G', 'C', 'M', '8', '2'},
+        {2, '6', '3', '3', 'A', '0', '0', '4'},
+        {3, '3', '5', '2', 0xFF, 0xFF, 0xFF, 0xFF},
+    };
+    j1939_frame_t frame;
+    j1939_tp_message_t msg;
+
+    frame = tp_frame(get_id(7, 0xECF9, 0), rts);
+    j1939decode_tp_receive(tp, &frame, 1000, &msg);
+    frame = tp_frame(get_id(7, 0xEC00, 249), cts);
+    j1939decode_tp_receive(tp, &frame, 2000, &msg);
+
+    /* Packets are placed by sequence number */
+    frame = tp_frame(get_id(7, 0xEBF9, 0), dt[1]);
+    TEST_ASSERT_FALSE(j1939decode_tp_receive(tp, &frame, 3000, &msg));
+    frame = tp_frame(get_id(7, 0xEBF9, 0), dt[0]);
+    TEST_ASSERT_FALSE(j1939decode_tp_receive(tp, &frame, 4000, &msg));
+    frame = tp_frame(get_id(7, 0xEBF9, 0), dt[2]);
+    TEST_ASSERT_TRUE(j1939decode_tp_receive(tp, &frame, 5000, &msg));
+    TEST_ASSERT_EQUAL_UINT32(65260, msg.pgn);
+    TEST_ASSERT_EQUAL_UINT8(249, msg.da);
+    TEST_ASSERT_FALSE(msg.broadcast);
+    TEST_ASSERT_EQUAL_size_t(17, msg.len);
+    TEST_ASSERT_EQUAL_MEMORY("1HGCM82633A004352", msg.data, 17);
+
+    /* Abort from the responder ends the connection */
+    const uint8_t abort_msg[8] = {255, 1, 0xFF, 0xFF, 0xFF, 0xEC, 0xFE, 0x00};
+    frame = tp_frame(get_id(7, 0xECF9, 0), rts);
+    j1939decode_tp_receive(tp, &frame, 6000, &msg);
+    TEST_ASSERT_EQUAL_UINT(1, j1939decode_tp_active(tp));
+    frame = tp_frame(get_id(7, 0xEC00, 249), abort_msg);
+    j1939decode_tp_receive(tp, &frame, 7000, &msg);
+    TEST_ASSERT_EQUAL_UINT(0, j1939decode_tp_active(tp));
+
+    j1939decode_tp_destroy(tp);
+}
+
+/* Output of log decoding is appended to a string */
+typedef struct
+{
+    char buf[65536];
+    size_t len;
+} ndjson_out_t;
+
+static bool append_ndjson(void * user, const char * buf, size_t len)
+{
+    ndjson_out_t * out = user;
+    if (out->len + len >= sizeof(out->buf))
+    {
+        return false;
+    }
+    memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+    out->buf[out->len] = '\0';
+    return true;
+}
+
+void test_j1939decode_file_to_ndjson(void)
+{
+    j1939_frame_t frame;
+    uint64_t timestamp_us;
+
+    /* Log format and default format, lines do not need to be null terminated */
+    const char * line = "(1600000000.250000) can0 18FEF100#0011223344556677\nnext";
+    TEST_ASSERT_TRUE(j1939decode_parse_candump(line, strlen(line) - 5, &frame, &timestamp_us));
+    TEST_ASSERT_EQUAL_UINT32(0x18FEF100, frame.id);
+    TEST_ASSERT_EQUAL_UINT8(8, frame.dlc);
+    TEST_ASSERT_EQUAL_UINT8(0x77, frame.data[7]);
+    TEST_ASSERT_EQUAL_UINT64(1600000000250000ULL, timestamp_us);
+    line = "  can0  0CF00400   [3]  01 02 03";
+    TEST_ASSERT_TRUE(j1939decode_parse_candump(line, strlen(line), &frame, &timestamp_us));
+    TEST_ASSERT_EQUAL_UINT32(0x0CF00400, frame.id);
+    TEST_ASSERT_EQUAL_UINT8(3, frame.dlc);
+    TEST_ASSERT_EQUAL_UINT64(0, timestamp_us);
+
+    /* Standard identifiers, remote frames and truncated lines are skipped */
+    line = "(1600000000.250000) can0 123#0011";
+    TEST_ASSERT_FALSE(j1939decode_parse_candump(line, strlen(line), &frame, &timestamp_us));
+    line = "(1600000000.250000) can0 18FEF100#R";
+    TEST_ASSERT_FALSE(j1939decode_parse_candump(line, strlen(line), &frame, &timestamp_us));
+    line = "can0  0CF00400   [3]  01 02 03";
+    TEST_ASSERT_FALSE(j1939decode_parse_candump(line, strlen(line) - 1, &frame, &timestamp_us));
+
+    char text[4096];
+    size_t len = 0;
+    for (unsigned int i = 0; i < 40; i++)
+    {
+        len += (size_t) snprintf(text + len, sizeof(text) - len, "(%u.000100) can0 %08X#%016X\n", 1600000000U + i,
+                                 get_id(3, i % 2 == 0 ? 61444 : 65265, (uint8_t) i), i);
+        if (i % 7 == 0)
+        {
+            len += (size_t) snprintf(text + len, sizeof(text) - len, "(%u.000200) can0 123#00\n", 1600000000U + i);
+        }
+    }
+
+    j1939decode_db_t * db = j1939decode_db_load(J1939DECODE_DB);
+    TEST_ASSERT_NOT_NULL(db);
+
+    /* Output of small chunks decoded on several threads is in the order of the lines */
+    static ndjson_out_t expected;
+    static ndjson_out_t out;
+    j1939decode_file_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.num_threads = 1;
+    options.profile = J1939DECODE_PROFILE_COMPACT;
+    options.timestamps = true;
+    size_t num_frames;
+    expected.len = 0;
+    TEST_ASSERT_TRUE(j1939decode_text_to_ndjson(db, text, len, &options, append_ndjson, &expected, &num_frames));
+    TEST_ASSERT_EQUAL_size_t(40, num_frames);
+    TEST_ASSERT_EQUAL_MEMORY("{\"Timestamp\":1600000000.000100,", expected.buf, 31);
+
+    options.num_threads = 4;
+    options.chunk_size = 100;
+    out.len = 0;
+    TEST_ASSERT_TRUE(j1939decode_text_to_ndjson(db, text, len, &options, append_ndjson, &out, &num_frames));
+    TEST_ASSERT_EQUAL_size_t(40, num_frames);
+    TEST_ASSERT_EQUAL_STRING(expected.buf, out.buf);
+
+    /* PGN filter applies to every thread */
+    const uint32_t pgns[] = {61444};
+    options.pgns = pgns;
+    options.num_pgns = 1;
+    out.len = 0;
+    TEST_ASSERT_TRUE(j1939decode_text_to_ndjson(db, text, len, &options, append_ndjson, &out, &num_frames));
+    size_t lines = 0;
+    for (char * p = strchr(out.buf, '\n'); p != NULL; p = strchr(p + 1, '\n'))
+    {
+        lines++;
+    }
+    TEST_ASSERT_EQUAL_size_t(20, lines);
+
+    /* A failing write stops decoding */
+    options.pgns = NULL;
+    out.len = sizeof(out.buf);
+    TEST_ASSERT_FALSE(j1939decode_text_to_ndjson(db, text, len, &options, append_ndjson, &out, &num_frames));
+
+    j1939decode_db_release(db);
+}
+
+void test_j1939decode_cache(void)
+{
+    char expected[4096];
+    char buf[4096];
+    j1939decode_cache_stats_t stats;
+
+    pgn = 61444;
+    data[3] = 0x20;
+    data[4] = 0x1C;
+    size_t len = j1939decode_to_json_buf(get_id(pri, pgn, sa), dlc, (uint64_t *) data, expected, sizeof(expected), 0);
+    TEST_ASSERT_GREATER_THAN(0, len);
+
+    /* Invalid sizes keep the context without a cache */
+    TEST_ASSERT_FALSE(j1939decode_set_cache(1, 1U << 20U));
+    j1939decode_cache_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT64(0, stats.misses);
+
+    /* A repeated frame is copied from the cache */
+    TEST_ASSERT_TRUE(j1939decode_set_cache(2, 0));
+    for (int i = 0; i < 2; i++)
+    {
+        TEST_ASSERT_EQUAL_size_t(len, j1939decode_to_json_buf(get_id(pri, pgn, sa), dlc, (uint64_t *) data,
+                                                              buf, sizeof(buf), 0));
+        TEST_ASSERT_EQUAL_STRING(expected, buf);
+    }
+    j1939decode_cache_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.misses);
+
+    /* Hits are truncated like decoded output */
+    TEST_ASSERT_EQUAL_size_t(len, j1939decode_to_json_buf(get_id(pri, pgn, sa), dlc, (uint64_t *) data, buf, 8, 0));
+    TEST_ASSERT_EQUAL_STRING_LEN(expected, buf, 7);
+    TEST_ASSERT_EQUAL_UINT8('\0', buf[7]);
+
+    /* Other data, source addresses and formats are different entries */
+    data[4] = 0x1D;
+    TEST_ASSERT_GREATER_THAN(0, j1939decode_to_json_buf(get_id(pri, pgn, sa), dlc, (uint64_t *) data,
+                                                        buf, sizeof(buf), 0));
+    TEST_ASSERT_TRUE(strcmp(expected, buf) != 0);
+    uint8_t cbor[4096];
+    TEST_ASSERT_GREATER_THAN(0, j1939decode_encode(get_id(pri, pgn, sa + 1), dlc, (uint64_t *) data,
+                                                   J1939DECODE_FORMAT_CBOR, cbor, sizeof(cbor), 0));
+    TEST_ASSERT_EQUAL_UINT8(0xA0, cbor[0] & 0xE0);
+    j1939decode_cache_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT64(3, stats.misses);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.evictions);
+    TEST_ASSERT_EQUAL_size_t(2, stats.count);
+
+    /* Changing the profile clears the cache */
+    TEST_ASSERT_TRUE(j1939decode_set_profile(J1939DECODE_PROFILE_RAW));
+    j1939decode_cache_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.count);
+    char * json = j1939decode_to_json(get_id(pri, pgn, sa), dlc, (uint64_t *) data, false);
+    TEST_ASSERT_NOT_NULL(json);
+    TEST_ASSERT_NULL(strstr(json, "PGNName"));
+    free(json);
+
+    TEST_ASSERT_TRUE(j1939decode_set_cache(0, 0));
+    j1939decode_cache_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT64(0, stats.hits);
+}
+
+void test_j1939decode_stats(void)
+{
+    j1939decode_stats_t stats;
+    j1939decode_pgn_stats_t pgn_stats[4];
+    char buf[8192];
+
+    j1939decode_db_t * db = j1939decode_db_load(J1939DECODE_DB);
+    j1939decode_ctx_t * ctx = j1939decode_ctx_create(db);
+    TEST_ASSERT_NOT_NULL(ctx);
+
+    /* Frames of PGNs missing from the database are counted */
+    TEST_ASSERT_GREATER_THAN(0, j1939decode_ctx_to_json_buf(ctx, get_id(pri, 1, sa), dlc, (uint64_t *) data,
+                                                            buf, sizeof(buf), 0));
+    j1939decode_ctx_stats(ctx, &stats);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.frames);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.unknown_pgns);
+    TEST_ASSERT_EQUAL_UINT64(0, stats.spns);
+
+    /* Cycle times of each PGN and source address pair are counted from the set receive times */
+    pgn = 61444;
+    TEST_ASSERT_TRUE(j1939decode_ctx_set_pgn_stats(ctx, 4));
+    for (uint64_t i = 0; i < 3; i++)
+    {
+        j1939decode_ctx_set_time(ctx, 1000000U + i * 100000U);
+        TEST_ASSERT_GREATER_THAN(0, j1939decode_ctx_to_json_buf(ctx, get_id(pri, pgn, sa), dlc, (uint64_t *) data,
+                                                                buf, sizeof(buf), 0));
+    }
+    j1939decode_ctx_stats(ctx, &stats);
+    TEST_ASSERT_EQUAL_UINT64(4, stats.frames);
+    TEST_ASSERT_GREATER_THAN(0, stats.spns);
+    TEST_ASSERT_GREATER_THAN(0, stats.output_bytes);
+    TEST_ASSERT_EQUAL_size_t(1, j1939decode_ctx_pgn_stats(ctx, pgn_stats, 4));
+    TEST_ASSERT_EQUAL_UINT32(pgn, pgn_stats[0].pgn);
+    TEST_ASSERT_EQUAL_UINT8(sa, pgn_stats[0].sa);
+    TEST_ASSERT_EQUAL_UINT64(3, pgn_stats[0].frames);
+    TEST_ASSERT_EQUAL_UINT64(2, pgn_stats[0].cycles[7]);
+    TEST_ASSERT_EQUAL_UINT64(200000, pgn_stats[0].cycle_sum_us);
+
+    /* Prometheus text holds the counters and a histogram ending in +Inf */
+    size_t len = j1939decode_stats_to_prometheus(&stats, pgn_stats, 1, buf, sizeof(buf));
+    TEST_ASSERT_LESS_THAN(sizeof(buf), len);
+    TEST_ASSERT_EQUAL_size_t(len, strlen(buf));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "j1939decode_frames_total 4\n"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "le=\"+Inf\"} 2\n"));
+    TEST_ASSERT_EQUAL_size_t(len, j1939decode_stats_to_prometheus(&stats, pgn_stats, 1, buf, 16));
+    TEST_ASSERT_EQUAL_UINT8('\0', buf[15]);
+
+    /* Counters of destroyed contexts stay in the database total */
+    j1939decode_ctx_t * other = j1939decode_ctx_create(db);
+    TEST_ASSERT_GREATER_THAN(0, j1939decode_ctx_to_json_buf(other, get_id(pri, pgn, sa), dlc, (uint64_t *) data,
+                                                            buf, sizeof(buf), 0));
+    j1939decode_ctx_destroy(other);
+    j1939decode_db_stats(db, &stats);
+    TEST_ASSERT_EQUAL_UINT64(5, stats.frames);
+
+    j1939decode_ctx_destroy(ctx);
+    j1939decode_db_stats(db, &stats);
+    TEST_ASSERT_EQUAL_UINT64(5, stats.frames);
+    j1939decode_db_release(db);
+}
+
+void test_j1939decode_states_and_text(void)
+{
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[16];
+
+    /* Discrete SPNs get the state name of their raw value, Engine Torque Mode 2 is cruise control */
+    pgn = 61444;
+    data[0] = 0xF2;
+    int n = j1939decode_decode(get_id(pri, pgn, sa), dlc, (uint64_t *) data, &decoded, spns, 16);
+    TEST_ASSERT_GREATER_THAN(0, n);
+    TEST_ASSERT_EQUAL_UINT32(899, spns[0].spn);
+    TEST_ASSERT_EQUAL_STRING("Cruise control", spns[0].state);
+    TEST_ASSERT_NULL(spns[0].text);
+
+    /* Raw values without a name and SPNs without bit decodings have no state */
+    data[0] = 0xF5;
+    j1939decode_decode(get_id(pri, pgn, sa), dlc, (uint64_t *) data, &decoded, spns, 16);
+    TEST_ASSERT_NULL(spns[0].state);
+    TEST_ASSERT_NULL(spns[1].state);
+
+    char buf[4096];
+    data[0] = 0xF3;
+    TEST_ASSERT_GREATER_THAN(0, j1939decode_to_json_buf(get_id(pri, pgn, sa), dlc, (uint64_t *) data,
+                                                        buf, sizeof(buf), 0));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"State\":\"PTO governor\""));
+
+    /* ASCII SPNs point into the payload, up to the delimiter of variable length SPNs */
+    const uint8_t vin[20] = "1FUJA6CK\"4LM12345*";
+    TEST_ASSERT_EQUAL_INT(1, j1939decode_decode_payload(get_id(6, 65260, 0), vin, sizeof(vin), &decoded, spns, 16));
+    TEST_ASSERT_TRUE(spns[0].text == (const char *) vin);
+    TEST_ASSERT_EQUAL_size_t(17, spns[0].text_len);
+
+    /* Text is written as the decoded value and escaped, padding is left out */
+    const uint8_t frame[8] = {'A', '"', 'C', 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    memcpy(data, frame, sizeof(data));
+    TEST_ASSERT_GREATER_THAN(0, j1939decode_to_json_buf(get_id(6, 65260, 0), dlc, (uint64_t *) data,
+                                                        buf, sizeof(buf), 0));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\"ValueDecoded\":\"A\\\"C\""));
+    cJSON * json = cJSON_Parse(buf);
+    TEST_ASSERT_NOT_NULL(json);
+    cJSON_Delete(json);
+}
+
+void test_j1939decode_dm(void)
+{
+    j1939_dm_t dm;
+    j1939_dtc_t dtcs[4];
+
+    /* Single frame DM1 with the MIL and amber warning lamp on, Engine Speed FMI 2 occurred 3 times */
+    const uint8_t frame[8] = {0x44, 0xFF, 0xBE, 0x00, 0x02, 0x03, 0xFF, 0xFF};
+    TEST_ASSERT_EQUAL_INT(1, j1939decode_decode_dm(get_id(6, J1939DECODE_DM1_PGN, sa), frame, sizeof(frame),
+                                                   &dm, dtcs, 4));
+    TEST_ASSERT_EQUAL_UINT32(J1939DECODE_DM1_PGN, dm.pgn);
+    TEST_ASSERT_EQUAL_UINT8(sa, dm.sa);
+    TEST_ASSERT_EQUAL_UINT8(J1939DECODE_LAMP_ON, dm.lamps.mil);
+    TEST_ASSERT_EQUAL_UINT8(J1939DECODE_LAMP_OFF, dm.lamps.red_stop);
+    TEST_ASSERT_EQUAL_UINT8(J1939DECODE_LAMP_ON, dm.lamps.amber_warning);
+    TEST_ASSERT_EQUAL_UINT8(J1939DECODE_FLASH_OFF, dm.lamps.mil_flash);
+    TEST_ASSERT_EQUAL_size_t(1, dm.num_dtcs);
+    TEST_ASSERT_EQUAL_UINT32(190, dtcs[0].spn);
+    TEST_ASSERT_EQUAL_UINT8(2, dtcs[0].fmi);
+    TEST_ASSERT_EQUAL_UINT8(3, dtcs[0].oc);
+    TEST_ASSERT_FALSE(dtcs[0].cm);
+    TEST_ASSERT_EQUAL_STRING("Engine Speed", dtcs[0].spn_name);
+
+    /* Reassembled DM2 with a DTC of the largest SPN, which is not in the database */
+    const uint8_t payload[14] = {0x00, 0xFF, 0xBE, 0x00, 0x02, 0x03, 0x6E, 0x00, 0x00, 0x01, 0xFF, 0xFF, 0xE5, 0xFF};
+    TEST_ASSERT_EQUAL_INT(3, j1939decode_decode_dm(get_id(6, J1939DECODE_DM2_PGN, sa), payload, sizeof(payload),
+                                                   &dm, dtcs, 4));
+    TEST_ASSERT_EQUAL_STRING("Engine Coolant Temperature", dtcs[1].spn_name);
+    TEST_ASSERT_EQUAL_UINT32(524287, dtcs[2].spn);
+    TEST_ASSERT_EQUAL_UINT8(5, dtcs[2].fmi);
+    TEST_ASSERT_EQUAL_UINT8(J1939DECODE_OC_NOT_AVAILABLE, dtcs[2].oc);
+    TEST_ASSERT_TRUE(dtcs[2].cm);
+    TEST_ASSERT_NULL(dtcs[2].spn_name);
+
+    /* DTCs beyond the capacity are counted but not written */
+    TEST_ASSERT_EQUAL_INT(2, j1939decode_decode_dm(get_id(6, J1939DECODE_DM2_PGN, sa), payload, sizeof(payload),
+                                                   &dm, dtcs, 2));
+    TEST_ASSERT_EQUAL_size_t(3, dm.num_dtcs);
+
+    /* Other PGNs and truncated payloads are rejected */
+    TEST_ASSERT_EQUAL_INT(-1, j1939decode_decode_dm(get_id(6, 61444, sa), frame, sizeof(frame), &dm, dtcs, 4));
+    TEST_ASSERT_EQUAL_INT(-1, j1939decode_decode_dm(get_id(6, J1939DECODE_DM1_PGN, sa), frame, 1, &dm, dtcs, 4));
+
+    /* SPN names of lazily loaded databases are looked up on demand */
+    j1939decode_db_t * db = j1939decode_db_open(J1939DECODE_DB, J1939DECODE_DB_LAZY, NULL);
+    TEST_ASSERT_NOT_NULL(db);
+    j1939decode_ctx_t * ctx = j1939decode_ctx_create(db);
+    j1939decode_db_release(db);
+    TEST_ASSERT_EQUAL_INT(3, j1939decode_ctx_decode_dm(ctx, get_id(6, J1939DECODE_DM2_PGN, sa), payload,
+                                                       sizeof(payload), &dm, dtcs, 4));
+    TEST_ASSERT_EQUAL_STRING("Engine Speed", dtcs[0].spn_name);
+    TEST_ASSERT_NULL(dtcs[2].spn_name);
+    j1939decode_ctx_destroy(ctx);
+}
+
+void test_j1939decode_db_open_image(void)
+{
+    const char * filename = "J1939db_memory_test.bin";
+    TEST_ASSERT_TRUE(j1939decode_save_db(filename));
+
+    FILE * fp = fopen(filename, "rb");
+    TEST_ASSERT_NOT_NULL(fp);
+    fseek(fp, 0, SEEK_END);
+    size_t size = (size_t) ftell(fp);
+    rewind(fp);
+    uint64_t * image = malloc(size + 8);
+    TEST_ASSERT_EQUAL_size_t(size, fread(image, 1, size, fp));
+    fclose(fp);
+    remove(filename);
+
+    /* Images in memory decode the same as the file, whether validated up front or on first use */
+    for (uint32_t flags = 0; flags <= J1939DECODE_DB_LAZY; flags += J1939DECODE_DB_LAZY)
+    {
+        j1939decode_db_t * db = j1939decode_db_open_image(image, size, flags, NULL);
+        TEST_ASSERT_NOT_NULL(db);
+        j1939decode_ctx_t * ctx = j1939decode_ctx_create(db);
+        j1939decode_db_release(db);
+
+        uint32_t id = get_id(pri, 65262, sa);
+        char * json_string = j1939decode_to_json(id, dlc, (uint64_t *) data, false);
+        char * image_json_string = j1939decode_ctx_to_json(ctx, id, dlc, (uint64_t *) data, false);
+        TEST_ASSERT_EQUAL_STRING(json_string, image_json_string);
+        free(image_json_string);
+        free(json_string);
+        j1939decode_ctx_destroy(ctx);
+    }
+
+    /* Tables are read in place, so the image must be aligned */
+    memmove((uint8_t *) image + 1, image, size);
+    TEST_ASSERT_NULL(j1939decode_db_open_image((uint8_t *) image + 1, size, 0, NULL));
+    free(image);
+}
+
+void test_j1939decode_db_replace(void)
+{
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[16];
+    uint32_t id = get_id(pri, 61444, sa);
+
+    j1939decode_db_t * db = j1939decode_db_open(J1939DECODE_DB, 0, NULL);
+    j1939decode_db_t * new_db = j1939decode_db_open(J1939DECODE_DB, J1939DECODE_DB_LAZY, NULL);
+    TEST_ASSERT_NOT_NULL(db);
+    TEST_ASSERT_NOT_NULL(new_db);
+    j1939decode_ctx_t * ctx = j1939decode_ctx_create(db);
+    int n = j1939decode_ctx_decode(ctx, id, dlc, (uint64_t *) data, &decoded, spns, 16);
+    TEST_ASSERT_GREATER_THAN(0, n);
+
+    /* Each database takes part in one replacement, so replacements cannot form a loop */
+    TEST_ASSERT_TRUE(j1939decode_db_replace(db, new_db));
+    TEST_ASSERT_FALSE(j1939decode_db_replace(db, new_db));
+    TEST_ASSERT_FALSE(j1939decode_db_replace(new_db, db));
+    j1939decode_db_release(new_db);
+
+    /* The context moves at the start of its next call, and the old database is freed once nothing uses it */
+    TEST_ASSERT_TRUE(j1939decode_ctx_db(ctx) == db);
+    TEST_ASSERT_EQUAL_INT(n, j1939decode_ctx_decode(ctx, id, dlc, (uint64_t *) data, &decoded, spns, 16));
+    TEST_ASSERT_TRUE(j1939decode_ctx_db(ctx) == new_db);
+
+    /* Each database counts the frames decoded with it */
+    j1939decode_stats_t stats;
+    j1939decode_db_stats(db, &stats);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.frames);
+    j1939decode_db_stats(new_db, &stats);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.frames);
+    j1939decode_ctx_stats(ctx, &stats);
+    TEST_ASSERT_EQUAL_UINT64(2, stats.frames);
+    j1939decode_db_release(db);
+    TEST_ASSERT_EQUAL_UINT(1, j1939index_num_loaded(new_db->index));
+    j1939decode_ctx_destroy(ctx);
+
+    /* A context idle across many replacements frees the whole chain with its database */
+    const j1939decode_allocator_t allocator = {counting_malloc, counting_free, NULL};
+    alloc_count = 0;
+    free_count = 0;
+    db = j1939decode_db_open(J1939DECODE_DB, J1939DECODE_DB_LAZY, &allocator);
+    TEST_ASSERT_NOT_NULL(db);
+    ctx = j1939decode_ctx_create_with_allocator(db, &allocator);
+    for (int i = 0; i < 16; i++)
+    {
+        new_db = j1939decode_db_open(J1939DECODE_DB, J1939DECODE_DB_LAZY, &allocator);
+        TEST_ASSERT_TRUE(j1939decode_db_replace(db, new_db));
+        j1939decode_db_release(db);
+        db = new_db;
+    }
+    j1939decode_db_release(db);
+    j1939decode_ctx_destroy(ctx);
+    TEST_ASSERT_EQUAL_UINT(alloc_count, free_count);
+
+    /* Reloading the default database keeps the loaded table if the file cannot be opened */
+    char * json_string = j1939decode_to_json(id, dlc, (uint64_t *) data, false);
+    TEST_ASSERT_TRUE(j1939decode_reload(J1939DECODE_DB));
+    TEST_ASSERT_FALSE(j1939decode_reload("missing_J1939db.json"));
+    char * reloaded_json_string = j1939decode_to_json(id, dlc, (uint64_t *) data, false);
+    TEST_ASSERT_EQUAL_STRING(json_string, reloaded_json_string);
+    free(reloaded_json_string);
+    free(json_string);
+}
+
+void test_j1939decode_db_overlays(void)
+{
+    j1939_decoded_t decoded;
+    j1939_spn_value_t spns[16];
+    const char * filename = "J1939db_overlay_test.json";
+    const char * image_filename = "J1939db_overlay_test.bin";
+
+    /* OEM PGN with a different layout for source address 33, which takes the PGN name */
+    write_json_fixture(filename,
+        "{\"J1939PGNdb\": {\"65280\": {\"Name\": \"OEM Status\", \"SPNs\": [520192], \"SPNStartBits\": [0]}},"
+        " \"J1939SPNdb\": {"
+        "\"520192\": {\"Name\": \"OEM Mode\", \"SPNLength\": 8, \"Resolution\": 1, \"Offset\": 0, \"Units\": \"\"},"
+        " \"520193\": {\"Name\": \"OEM Pressure\", \"SPNLength\": 16, \"Resolution\": 0.5, \"Offset\": 0,"
+        " \"Units\": \"kPa\"}},"
+        " \"J1939PGNSAdb\": {\"65280\": {\"33\": {\"SPNs\": [520193, 520192], \"SPNStartBits\": [0, 16]}}}}");
+
+    const char * overlays[] = {filename};
+    j1939decode_db_t * db = j1939decode_db_open_overlays(J1939DECODE_DB, overlays, 1, NULL);
+    TEST_ASSERT_NOT_NULL(db);
+    TEST_ASSERT_TRUE(j1939decode_db_save(db, image_filename));
+    j1939decode_db_t * dbs[] = {
+        db,
+        j1939decode_db_open(filename, J1939DECODE_DB_LAZY, NULL),
+        j1939decode_db_open(image_filename, J1939DECODE_DB_LAZY, NULL),
+    };
+
+    data[0] = 0x10;
+    data[1] = 0x20;
+    data[2] = 0x03;
+    for (size_t i = 0; i < sizeof(dbs) / sizeof(dbs[0]); i++)
+    {
+        TEST_ASSERT_NOT_NULL(dbs[i]);
+        j1939decode_ctx_t * ctx = j1939decode_ctx_create(dbs[i]);
+        j1939decode_db_release(dbs[i]);
+
+        /* Other source addresses decode the PGN table entry */
+        TEST_ASSERT_EQUAL_INT(1, j1939decode_ctx_decode(ctx, get_id(pri, 65280, 0), dlc, (uint64_t *) data,
+                                                        &decoded, spns, 16));
+        TEST_ASSERT_EQUAL_STRING("OEM Status", decoded.pgn_name);
+        TEST_ASSERT_EQUAL_UINT32(520192, spns[0].spn);
+        TEST_ASSERT_EQUAL_UINT64(0x10, spns[0].value_raw);
+
+        TEST_ASSERT_EQUAL_INT(2, j1939decode_ctx_decode(ctx, get_id(pri, 65280, 33), dlc, (uint64_t *) data,
+                                                        &decoded, spns, 16));
+        TEST_ASSERT_EQUAL_STRING("OEM Status", decoded.pgn_name);
+        TEST_ASSERT_EQUAL_UINT32(520193, spns[0].spn);
+        TEST_ASSERT_EQUAL_DOUBLE(4104.0, spns[0].value);
+        TEST_ASSERT_EQUAL_STRING("kPa", spns[0].units);
+        TEST_ASSERT_EQUAL_UINT64(0x03, spns[1].value_raw);
+
+        /* The database the overlay was merged into still decodes as before */
+        if (i != 1)
+        {
+            TEST_ASSERT_GREATER_THAN(0, j1939decode_ctx_decode(ctx, get_id(pri, 61444, sa), dlc, (uint64_t *) data,
+                                                               &decoded, spns, 16));
+        }
+        j1939decode_ctx_destroy(ctx);
+    }
+
+    /* Images cannot be merged into */
+    TEST_ASSERT_NULL(j1939decode_db_open_overlays(image_filename, overlays, 1, NULL));
+    remove(image_filename);
+
+    /* Overlays of the default database are kept for reloading */
+    j1939decode_set_overlays(overlays, 1);
+    TEST_ASSERT_TRUE(j1939decode_reload(J1939DECODE_DB));
+    TEST_ASSERT_EQUAL_INT(2, j1939decode_decode(get_id(pri, 65280, 33), dlc, (uint64_t *) data, &decoded, spns, 16));
+    j1939decode_set_overlays(NULL, 0);
+    remove(filename);
+}
@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "j1939decode.h"
+#include "j1939db.h"
+#include "cJSON.h"
+
+/* Words per line of generated C source */
+#define SOURCE_LINE_WORDS 4
+
+/* Static helper functions */
+static char * read_file(const char * filename);
+static cJSON * parse_file(const char * filename);
+static size_t parse_pgns(const char * list, uint32_t ** pgns);
+static bool keep_pgn(const uint32_t * pgns, size_t num_pgns, const char * key);
+static void keep_spns(cJSON * kept_spns, const cJSON * pgn);
+static void filter_table(cJSON * json, const char * table, const uint32_t * pgns, size_t num_pgns, cJSON * kept_spns,
+                         bool nested);
+static void filter_pgns(cJSON * json, const uint32_t * pgns, size_t num_pgns);
+static bool has_suffix(const char * s, const char * suffix);
+static bool write_source(const j1939db_t * db, const char * input, FILE * fp);
+static void usage(const char * name);
+
+/**************************************************************************//**
+
+  \brief Read file contents into a null terminated buffer
+
+  \return char *    allocated file contents, NULL on failure
+
+******************************************************************************/
+char * read_file(const char * filename)
+{
+    FILE * fp = fopen(filename, "rb");
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    char * buf = size >= 0 ? malloc((size_t) size + 1) : NULL;
+    if (buf == NULL || fread(buf, 1, (size_t) size, fp) != (size_t) size)
+    {
+        free(buf);
+        fclose(fp);
+        return NULL;
+    }
+
+    buf[size] = '\0';
+    fclose(fp);
+    return buf;
+}
+
+/**************************************************************************//**
+
+  \brief Read and parse a JSON database or overlay file
+
+  \return cJSON *   parsed JSON, NULL on failure
+
+******************************************************************************/
+cJSON * parse_file(const char * filename)
+{
+    char * text = read_file(filename);
+    cJSON * json = text != NULL ? cJSON_Parse(text) : NULL;
+    free(text);
+    if (json == NULL)
+    {
+        fprintf(stderr, "Unable to parse %s\n", filename);
+    }
+    return json;
+}
+
+/**************************************************************************//**
+
+  \brief Parse a comma separated list of PGNs
+
+  \return size_t    number of PGNs, 0 if the list is empty or invalid
+
+******************************************************************************/
+size_t parse_pgns(const char * list, uint32_t ** pgns)
+{
+    size_t count = 1;
+    for (const char * c = list; *c != '\0'; c++)
+    {
+        count += *c == ',';
+    }
+
+    *pgns = malloc(count * sizeof(uint32_t));
+    if (*pgns == NULL)
+    {
+        return 0;
+    }
+
+    const char * c = list;
+    for (size_t i = 0; i < count; i++)
+    {
+        char * end;
+        unsigned long pgn = strtoul(c, &end, 10);
+        if (end == c || (*end != ',' && *end != '\0') || pgn >= (1UL << 18U))
+        {
+            free(*pgns);
+            *pgns = NULL;
+            return 0;
+        }
+        (*pgns)[i] = (uint32_t) pgn;
+        c = end + 1;
+    }
+
+    return count;
+}
+
+/**************************************************************************//**
+
+  \brief Check if the key of a PGN object is one of the PGNs kept
+
+  \return bool  true if kept
+
+******************************************************************************/
+bool keep_pgn(const uint32_t * pgns, size_t num_pgns, const char * key)
+{
+    char * end;
+    unsigned long pgn = strtoul(key, &end, 10);
+    for (size_t i = 0; *end == '\0' && i < num_pgns; i++)
+    {
+        if (pgns[i] == pgn)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**************************************************************************//**
+
+  \brief Mark the SPNs listed by a PGN object as kept
+
+  \return void
+
+******************************************************************************/
+void keep_spns(cJSON * kept_spns, const cJSON * pgn)
+{
+    const cJSON * spn;
+    cJSON_ArrayForEach(spn, cJSON_GetObjectItemCaseSensitive(pgn, "SPNs"))
+    {
+        char key[16];
+        if (!cJSON_IsNumber(spn) || spn->valueint < 0)
+        {
+            continue;
+        }
+        snprintf(key, sizeof(key), "%d", spn->valueint);
+        if (cJSON_GetObjectItemCaseSensitive(kept_spns, key) == NULL)
+        {
+            cJSON_AddItemToObject(kept_spns, key, cJSON_CreateTrue());
+        }
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Remove the PGNs not kept from a PGN table, and mark the SPNs of the rest as kept
+
+  \param json       root J1939db JSON object
+  \param table      name of the PGN table
+  \param pgns       PGNs kept
+  \param num_pgns   number of PGNs kept
+  \param kept_spns  object of kept SPN numbers
+  \param nested     each PGN holds PGN objects by source address
+
+  \return void
+
+******************************************************************************/
+void filter_table(cJSON * json, const char * table, const uint32_t * pgns, size_t num_pgns, cJSON * kept_spns,
+                  bool nested)
+{
+    cJSON * pgn_db = cJSON_GetObjectItemCaseSensitive(json, table);
+    cJSON * pgn = pgn_db != NULL ? pgn_db->child : NULL;
+    while (pgn != NULL)
+    {
+        cJSON * next = pgn->next;
+        if (!keep_pgn(pgns, num_pgns, pgn->string))
+        {
+            cJSON_Delete(cJSON_DetachItemViaPointer(pgn_db, pgn));
+        }
+        else if (nested)
+        {
+            const cJSON * variant;
+            cJSON_ArrayForEach(variant, pgn)
+            {
+                keep_spns(kept_spns, variant);
+            }
+        }
+        else
+        {
+            keep_spns(kept_spns, pgn);
+        }
+        pgn = next;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Remove the PGNs not kept, and every SPN and bit decoding only they use
+
+  \return void
+
+******************************************************************************/
+void filter_pgns(cJSON * json, const uint32_t * pgns, size_t num_pgns)
+{
+    cJSON * kept_spns = cJSON_CreateObject();
+    filter_table(json, "J1939PGNdb", pgns, num_pgns, kept_spns, false);
+    filter_table(json, "J1939PGNSAdb", pgns, num_pgns, kept_spns, true);
+
+    const char * spn_tables[] = {"J1939SPNdb", "J1939BitDecodings"};
+    for (size_t i = 0; i < sizeof(spn_tables) / sizeof(spn_tables[0]); i++)
+    {
+        cJSON * spn_db = cJSON_GetObjectItemCaseSensitive(json, spn_tables[i]);
+        cJSON * spn = spn_db != NULL ? spn_db->child : NULL;
+        while (spn != NULL)
+        {
+            cJSON * next = spn->next;
+            if (cJSON_GetObjectItemCaseSensitive(kept_spns, spn->string) == NULL)
+            {
+                cJSON_Delete(cJSON_DetachItemViaPointer(spn_db, spn));
+            }
+            spn = next;
+        }
+    }
+
+    cJSON_Delete(kept_spns);
+}
+
+/**************************************************************************//**
+
+  \brief Check if a string ends with a suffix
+
+  \return bool  true if it does
+
+******************************************************************************/
+bool has_suffix(const char * s, const char * suffix)
+{
+    size_t len = strlen(s);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+/**************************************************************************//**
+
+  \brief Write the binary image of a database as C source defining j1939db_static_image
+
+  The image is written as a const array of 64-bit words in this machine's byte
+  order, so that it is 8 byte aligned and placed in flash or read-only data.
+  j1939decode_init() opens it in place in builds with J1939DECODE_STATIC_DB.
+
+  \return bool  false on write failure
+
+******************************************************************************/
+bool write_source(const j1939db_t * db, const char * input, FILE * fp)
+{
+    size_t size = j1939db_image_size(db);
+    size_t num_words = (size + 7) / 8;
+    uint8_t * image = calloc(num_words, 8);
+    if (image == NULL)
+    {
+        return false;
+    }
+    j1939db_build_image(db, image);
+
+    fprintf(fp, "/* Generated by j1939db-convert from %s, do not edit */\n\n", input);
+    fprintf(fp, "#include \"j1939db.h\"\n\n");
+    fprintf(fp, "const uint64_t j1939db_static_image[%zu] = {\n", num_words);
+    for (size_t i = 0; i < num_words; i++)
+    {
+        uint64_t word;
+        memcpy(&word, image + i * 8, sizeof(word));
+        fprintf(fp, "%s0x%016llXULL,%s", i % SOURCE_LINE_WORDS == 0 ? "    " : "", (unsigned long long) word,
+                i % SOURCE_LINE_WORDS == SOURCE_LINE_WORDS - 1 || i == num_words - 1 ? "\n" : " ");
+    }
+    fprintf(fp, "};\n\n");
+    fprintf(fp, "const size_t j1939db_static_image_size = %zu;\n", size);
+
+    free(image);
+    return !ferror(fp);
+}
+
+/**************************************************************************//**
+
+  \brief Print usage
+
+  \return void
+
+******************************************************************************/
+void usage(const char * name)
+{
+    fprintf(stderr, "Usage: %s [-o <overlay.json>]... [-p <PGN,...>] <input J1939db.json> "
+            "<output J1939db.bin | j1939db_static.c>\n", name);
+    fprintf(stderr, "  -o <overlay.json>   merge an overlay database into the input, may be repeated\n");
+    fprintf(stderr, "  -p <PGN,...>        keep only these PGNs and their SPNs\n");
+    fprintf(stderr, "Outputs ending in .c are written as C source for J1939DECODE_STATIC_DB builds\n");
+}
+
+/**************************************************************************//**
+
+  \brief Convert a J1939db.json database into a binary database image or C source
+
+  Usage: j1939db-convert [-o <overlay.json>]... [-p <PGN,...>] <input J1939db.json>
+                         <output J1939db.bin | j1939db_static.c>
+
+  \return int   exit status
+
+******************************************************************************/
+int main(int argc, char * argv[])
+{
+    uint32_t * pgns = NULL;
+    size_t num_pgns = 0;
+    int arg = 1;
+
+    /* Options come in pairs in front of the input and output */
+    while (arg + 2 < argc && argv[arg][0] == '-')
+    {
+        if (strcmp(argv[arg], "-p") == 0 && pgns == NULL)
+        {
+            num_pgns = parse_pgns(argv[arg + 1], &pgns);
+            if (num_pgns == 0)
+            {
+                fprintf(stderr, "Invalid PGN list %s\n", argv[arg + 1]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[arg], "-o") != 0)
+        {
+            break;
+        }
+        arg += 2;
+    }
+    if (argc - arg != 2)
+    {
+        usage(argv[0]);
+        free(pgns);
+        return EXIT_FAILURE;
+    }
+    const char * input = argv[arg];
+    const char * output = argv[arg + 1];
+
+    cJSON * json = parse_file(input);
+    if (json == NULL)
+    {
+        free(pgns);
+        return EXIT_FAILURE;
+    }
+
+    /* Overlays are merged in the order given, before filtering so that their PGNs can be kept */
+    for (int i = 1; i < arg; i += 2)
+    {
+        if (strcmp(argv[i], "-o") != 0)
+        {
+            continue;
+        }
+
+        cJSON * overlay = parse_file(argv[i + 1]);
+        bool merged = overlay != NULL && j1939db_merge(json, overlay);
+        cJSON_Delete(overlay);
+        if (!merged)
+        {
+            if (overlay != NULL)
+            {
+                fprintf(stderr, "Invalid overlay %s\n", argv[i + 1]);
+            }
+            cJSON_Delete(json);
+            free(pgns);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (num_pgns > 0)
+    {
+        filter_pgns(json, pgns, num_pgns);
+    }
+    free(pgns);
+
+    j1939db_t * db = j1939db_compile(json);
+    cJSON_Delete(json);
+    if (db == NULL)
+    {
+        fprintf(stderr, "Unable to compile %s\n", input);
+        return EXIT_FAILURE;
+    }
+
+    bool source = has_suffix(output, ".c");
+    FILE * fp = fopen(output, source ? "w" : "wb");
+    bool written = fp != NULL && (source ? write_source(db, input, fp) : j1939db_write_image(db, fp));
+    if (fp == NULL || fclose(fp) != 0 || !written)
+    {
+        fprintf(stderr, "Could not write file %s\n", output);
+        written = false;
+    }
+
+    j1939db_free(db);
+
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
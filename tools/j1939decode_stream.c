@@ -0,0 +1,1914 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef __linux__
+#define STREAM_HAVE_SOCKETCAN
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#endif
+
+#ifdef J1939DECODE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "j1939decode.h"
+#include "j1939file.h"
+
+/* Defaults */
+#define STREAM_RING_FRAMES      65536U      /* frames buffered between the reader and the decode worker */
+#define STREAM_RECV_BATCH       64U         /* frames received with one recvmmsg() call */
+#define STREAM_OUT_LEN          (256U * 1024U)  /* output buffer */
+#define STREAM_FLUSH_LEN        (64U * 1024U)   /* output is written once this much is buffered, or the ring is empty */
+#define STREAM_MAX_PENDING      16384U      /* frames in the output buffer whose latency is measured after writing */
+#define STREAM_LINE_LEN         4096U
+#define STREAM_MAX_PGNS         256U        /* PGNs of the -P allow list */
+#define STREAM_LATENCY_BUCKETS  512U
+
+/* Input kinds */
+enum
+{
+    INPUT_SOCKETCAN,
+    INPUT_CANDUMP,
+    INPUT_ASC,
+    INPUT_BLF,
+};
+
+/* Single producer single consumer ring of frames, head and tail count frames and are masked to index the slots
+ * The reader fills slots at head and publishes them with a release store, the worker consumes them at tail
+ * Each side caches the other's counter, so the shared cache lines are only read when the cached value runs out */
+typedef struct
+{
+    /* Written by the reader */
+    size_t head;
+    size_t tail_cache;
+    uint8_t reader_pad[64 - 2 * sizeof(size_t)];
+
+    /* Written by the worker */
+    size_t tail;
+    size_t head_cache;
+    uint8_t worker_pad[64 - 2 * sizeof(size_t)];
+
+    size_t mask;                    /* number of slots minus one, slots are a power of two */
+    bool done;                      /* the reader has stopped, set with a release store */
+    j1939_frame_t * frames;
+    uint64_t * timestamp_us;        /* receive or log timestamp of each frame */
+    uint64_t * received_ns;         /* monotonic time each frame was read */
+} ring_t;
+
+/* Latency histogram, buckets have 3 bits of precision */
+typedef struct
+{
+    uint64_t count;
+    uint64_t max_ns;
+    uint64_t buckets[STREAM_LATENCY_BUCKETS];
+} latency_t;
+
+/* Input state of the reader */
+typedef struct
+{
+    int kind;
+    const char * name;
+    bool software_ts;               /* SocketCAN timestamps are CLOCK_REALTIME software timestamps */
+    bool streaming;                 /* a pipe or terminal rather than a regular file, every frame is published at once */
+    FILE * fp;
+    int fd;
+
+    /* ASC header settings */
+    bool asc_decimal;
+    bool asc_relative;
+    uint64_t asc_last_us;
+
+    /* BLF container data not yet parsed */
+    uint8_t * blf_data;
+    size_t blf_len;
+    size_t blf_pos;
+    size_t blf_cap;
+
+    uint64_t frames_read;
+    uint64_t frames_dropped;
+} input_t;
+
+/* Output state of the decode worker */
+typedef struct
+{
+    j1939decode_ctx_t * ctx;
+    ring_t * ring;
+    int fd;
+    uint32_t format;
+    bool timestamps;
+    bool live;
+
+    uint8_t * buf;
+    size_t len;
+    uint64_t * pending_ns;          /* read time of the frames in the output buffer */
+    uint64_t * pending_us;          /* receive timestamp of the frames in the output buffer */
+    size_t num_pending;
+    bool failed;
+
+    uint64_t frames_written;
+    uint64_t frames_skipped;
+    uint64_t bytes_written;
+    uint64_t writes;
+    latency_t read_latency;         /* read by this tool to output written */
+    latency_t receive_latency;      /* kernel receive timestamp to output written, software timestamps only */
+} output_t;
+
+/* Set by SIGINT and SIGTERM */
+static volatile sig_atomic_t stop = 0;
+
+/* Static helper functions */
+static void on_signal(int signum);
+static uint64_t now_ns(void);
+static uint64_t now_realtime_us(void);
+static void backoff(unsigned int * spins);
+static bool ring_init(ring_t * ring, size_t num_frames);
+static void ring_free(ring_t * ring);
+static size_t ring_reserve(ring_t * ring, size_t max);
+static void ring_commit(ring_t * ring, size_t count);
+static size_t ring_peek(ring_t * ring, size_t max);
+static void ring_consume(ring_t * ring, size_t count);
+static void latency_add(latency_t * latency, uint64_t ns);
+static uint64_t latency_percentile(const latency_t * latency, double percentile);
+static void latency_print(const char * name, const latency_t * latency);
+static const char * skip_space(const char * p);
+static const char * parse_hex(const char * p, uint32_t * value, size_t * digits);
+static const char * parse_dec(const char * p, uint32_t * value, size_t * digits);
+static const char * parse_timestamp(const char * p, uint64_t * timestamp_us);
+static bool parse_asc_line(input_t * in, const char * line, j1939_frame_t * frame, uint64_t * timestamp_us);
+static bool blf_open(input_t * in);
+static bool blf_fill(input_t * in);
+static int blf_next(input_t * in, j1939_frame_t * frame, uint64_t * timestamp_us);
+static size_t read_file(input_t * in, ring_t * ring, bool * eof);
+#ifdef STREAM_HAVE_SOCKETCAN
+static int socketcan_open(input_t * in);
+static size_t read_socketcan(input_t * in, ring_t * ring);
+#endif
+static void run_reader(input_t * in, ring_t * ring);
+static int open_output(const char * target);
+static bool write_all(int fd, const uint8_t * buf, size_t len);
+static void flush_output(output_t * out);
+static size_t encode_frame(output_t * out, const j1939_frame_t * frame, uint64_t timestamp_us,
+                           uint8_t * buf, size_t room);
+static void * run_worker(void * arg);
+static bool parse_pgn_list(const char * list, uint32_t * pgns, size_t * count);
+static bool write_chunk(void * user, const char * buf, size_t len);
+static bool decode_parallel(output_t * out, j1939decode_db_t * db, const char * filename,
+                            const j1939decode_file_options_t * options, bool stats);
+static bool parse_format(const char * name, uint32_t * format);
+static bool parse_profile(const char * name, uint32_t * profile);
+static void usage(const char * argv0);
+
+static inline uint16_t get_u16(const uint8_t * p)
+{
+    return (uint16_t) (p[0] | (p[1] << 8U));
+}
+
+static inline uint32_t get_u32(const uint8_t * p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8U) | ((uint32_t) p[2] << 16U) | ((uint32_t) p[3] << 24U);
+}
+
+static inline uint64_t get_u64(const uint8_t * p)
+{
+    return (uint64_t) get_u32(p) | ((uint64_t) get_u32(p + 4) << 32U);
+}
+
+static inline int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/**************************************************************************//**
+
+  \brief Request the reader to stop, the worker then drains the ring
+
+  \return void
+
+******************************************************************************/
+void on_signal(int signum)
+{
+    (void) signum;
+    stop = 1;
+}
+
+/**************************************************************************//**
+
+  \brief Get monotonic time
+
+  \return uint64_t  time in nanoseconds
+
+******************************************************************************/
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+/**************************************************************************//**
+
+  \brief Get wall clock time, in the clock domain of SocketCAN software timestamps
+
+  \return uint64_t  time in microseconds since the epoch
+
+******************************************************************************/
+uint64_t now_realtime_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000U + (uint64_t) ts.tv_nsec / 1000U;
+}
+
+/**************************************************************************//**
+
+  \brief Wait for the other side of the ring, spinning first and then sleeping
+
+  \param spins      number of waits since the ring last made progress, reset it to 0 on progress
+
+  \return void
+
+******************************************************************************/
+void backoff(unsigned int * spins)
+{
+    if (*spins < 64)
+    {
+        /* Busy wait, the other side usually catches up within a few microseconds */
+    }
+    else if (*spins < 128)
+    {
+        sched_yield();
+    }
+    else
+    {
+        struct timespec ts = {0, 50000};
+        nanosleep(&ts, NULL);
+    }
+    (*spins)++;
+}
+
+/**************************************************************************//**
+
+  \brief Allocate ring
+
+  \param ring           ring to initialize
+  \param num_frames     number of slots, a power of two
+
+  \return bool          true on success
+
+******************************************************************************/
+bool ring_init(ring_t * ring, size_t num_frames)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->mask = num_frames - 1;
+    ring->frames = malloc(num_frames * sizeof(j1939_frame_t));
+    ring->timestamp_us = malloc(num_frames * sizeof(uint64_t));
+    ring->received_ns = malloc(num_frames * sizeof(uint64_t));
+    if (ring->frames == NULL || ring->timestamp_us == NULL || ring->received_ns == NULL)
+    {
+        ring_free(ring);
+        return false;
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Free ring slots
+
+  \return void
+
+******************************************************************************/
+void ring_free(ring_t * ring)
+{
+    free(ring->received_ns);
+    free(ring->timestamp_us);
+    free(ring->frames);
+}
+
+/**************************************************************************//**
+
+  \brief Get free slots to fill, called by the reader
+
+  \param ring       ring
+  \param max        maximum number of slots wanted
+
+  \return size_t    number of contiguous free slots starting at head & mask, 0 if the ring is full
+
+******************************************************************************/
+size_t ring_reserve(ring_t * ring, size_t max)
+{
+    size_t size = ring->mask + 1;
+    if (ring->head - ring->tail_cache == size)
+    {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    }
+
+    size_t free_slots = size - (ring->head - ring->tail_cache);
+    size_t contiguous = size - (ring->head & ring->mask);
+    free_slots = free_slots < contiguous ? free_slots : contiguous;
+    return free_slots < max ? free_slots : max;
+}
+
+/**************************************************************************//**
+
+  \brief Publish filled slots to the worker
+
+  \return void
+
+******************************************************************************/
+void ring_commit(ring_t * ring, size_t count)
+{
+    __atomic_store_n(&ring->head, ring->head + count, __ATOMIC_RELEASE);
+}
+
+/**************************************************************************//**
+
+  \brief Get filled slots to consume, called by the worker
+
+  \param ring       ring
+  \param max        maximum number of slots wanted
+
+  \return size_t    number of contiguous filled slots starting at tail & mask, 0 if the ring is empty
+
+******************************************************************************/
+size_t ring_peek(ring_t * ring, size_t max)
+{
+    if (ring->head_cache == ring->tail)
+    {
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+
+    size_t used = ring->head_cache - ring->tail;
+    size_t contiguous = ring->mask + 1 - (ring->tail & ring->mask);
+    used = used < contiguous ? used : contiguous;
+    return used < max ? used : max;
+}
+
+/**************************************************************************//**
+
+  \brief Return consumed slots to the reader
+
+  \return void
+
+******************************************************************************/
+void ring_consume(ring_t * ring, size_t count)
+{
+    __atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+}
+
+/**************************************************************************//**
+
+  \brief Add a latency sample
+
+  \return void
+
+******************************************************************************/
+void latency_add(latency_t * latency, uint64_t ns)
+{
+    size_t bucket;
+    if (ns < 8)
+    {
+        bucket = (size_t) ns;
+    }
+    else
+    {
+        /* Exponent and the next 3 bits below the leading bit */
+        unsigned int msb = 63U - (unsigned int) __builtin_clzll(ns);
+        bucket = (msb - 2U) * 8U + ((ns >> (msb - 3U)) & 7U);
+    }
+
+    latency->buckets[bucket]++;
+    latency->count++;
+    latency->max_ns = ns > latency->max_ns ? ns : latency->max_ns;
+}
+
+/**************************************************************************//**
+
+  \brief Get latency percentile
+
+  \return uint64_t  lower bound of the bucket holding the percentile, in nanoseconds
+
+******************************************************************************/
+uint64_t latency_percentile(const latency_t * latency, double percentile)
+{
+    uint64_t rank = (uint64_t) ((double) latency->count * percentile);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < STREAM_LATENCY_BUCKETS; bucket++)
+    {
+        seen += latency->buckets[bucket];
+        if (seen > rank)
+        {
+            if (bucket < 8)
+            {
+                return bucket;
+            }
+            return (uint64_t) (8U + bucket % 8U) << (bucket / 8U - 1U);
+        }
+    }
+    return latency->max_ns;
+}
+
+/**************************************************************************//**
+
+  \brief Print latency percentiles to stderr
+
+  \return void
+
+******************************************************************************/
+void latency_print(const char * name, const latency_t * latency)
+{
+    if (latency->count == 0)
+    {
+        return;
+    }
+
+    fprintf(stderr, "Latency %s: p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", name,
+            (double) latency_percentile(latency, 0.5) / 1e3, (double) latency_percentile(latency, 0.9) / 1e3,
+            (double) latency_percentile(latency, 0.99) / 1e3, (double) latency_percentile(latency, 0.999) / 1e3,
+            (double) latency->max_ns / 1e3);
+}
+
+/**************************************************************************//**
+
+  \brief Skip spaces and tabs
+
+  \return char *    pointer to next other character
+
+******************************************************************************/
+const char * skip_space(const char * p)
+{
+    while (*p == ' ' || *p == '\t')
+    {
+        p++;
+    }
+    return p;
+}
+
+/**************************************************************************//**
+
+  \brief Parse hexadecimal number
+
+  \param p          text
+  \param value      set to the number
+  \param digits     set to the number of digits parsed
+
+  \return char *    pointer to character after the number
+
+******************************************************************************/
+const char * parse_hex(const char * p, uint32_t * value, size_t * digits)
+{
+    uint32_t v = 0;
+    size_t n = 0;
+    int d;
+    while ((d = hex_digit(p[n])) >= 0 && n < 8)
+    {
+        v = (v << 4U) | (uint32_t) d;
+        n++;
+    }
+    *value = v;
+    *digits = n;
+    return p + n;
+}
+
+/**************************************************************************//**
+
+  \brief Parse decimal number
+
+  \param p          text
+  \param value      set to the number
+  \param digits     set to the number of digits parsed
+
+  \return char *    pointer to character after the number
+
+******************************************************************************/
+const char * parse_dec(const char * p, uint32_t * value, size_t * digits)
+{
+    uint32_t v = 0;
+    size_t n = 0;
+    while (p[n] >= '0' && p[n] <= '9' && n < 10)
+    {
+        v = v * 10U + (uint32_t) (p[n] - '0');
+        n++;
+    }
+    *value = v;
+    *digits = n;
+    return p + n;
+}
+
+/**************************************************************************//**
+
+  \brief Parse timestamp in seconds with a fraction
+
+  \param p              text
+  \param timestamp_us   set to the timestamp in microseconds
+
+  \return char *        pointer to character after the timestamp, NULL if there is no timestamp
+
+******************************************************************************/
+const char * parse_timestamp(const char * p, uint64_t * timestamp_us)
+{
+    uint64_t seconds = 0;
+    const char * start = p;
+    while (*p >= '0' && *p <= '9')
+    {
+        seconds = seconds * 10U + (uint64_t) (*p++ - '0');
+    }
+    if (p == start)
+    {
+        return NULL;
+    }
+
+    uint64_t us = 0;
+    uint64_t scale = 100000U;
+    if (*p == '.')
+    {
+        p++;
+        while (*p >= '0' && *p <= '9')
+        {
+            us += (uint64_t) (*p++ - '0') * scale;
+            scale /= 10U;
+        }
+    }
+
+    *timestamp_us = seconds * 1000000U + us;
+    return p;
+}
+
+/**************************************************************************//**
+
+  \brief Parse one line of a Vector ASC log
+
+  Accepts "0.012345 1  18FEF100x       Rx   d 8 00 11 22 33 44 55 66 77", and the "base hex|dec" and
+  "timestamps absolute|relative" header settings.
+  Standard, remote, error and CAN FD frames are skipped.
+
+  \param in             input state holding the header settings
+  \param line           line of text
+  \param frame          frame to be filled in
+  \param timestamp_us   set to the timestamp of the line, relative to the start of the measurement
+
+  \return bool          true if a frame was parsed
+
+******************************************************************************/
+bool parse_asc_line(input_t * in, const char * line, j1939_frame_t * frame, uint64_t * timestamp_us)
+{
+    const char * p = skip_space(line);
+    uint32_t value;
+    size_t digits;
+
+    if (strncmp(p, "base ", 5) == 0)
+    {
+        in->asc_decimal = strncmp(skip_space(p + 5), "dec", 3) == 0;
+        in->asc_relative = strstr(p, "timestamps relative") != NULL;
+        return false;
+    }
+
+    p = parse_timestamp(p, timestamp_us);
+    if (p == NULL || (*p != ' ' && *p != '\t'))
+    {
+        return false;
+    }
+    if (in->asc_relative)
+    {
+        *timestamp_us += in->asc_last_us;
+        in->asc_last_us = *timestamp_us;
+    }
+
+    /* Channel number, CAN FD lines start with "CANFD" instead */
+    p = parse_dec(skip_space(p), &value, &digits);
+    if (digits == 0)
+    {
+        return false;
+    }
+
+    /* 29-bit identifiers have an x suffix */
+    p = skip_space(p);
+    p = in->asc_decimal ? parse_dec(p, &value, &digits) : parse_hex(p, &value, &digits);
+    if (digits == 0 || *p != 'x' || value > J1939DECODE_ID_MASK)
+    {
+        return false;
+    }
+
+    memset(frame, 0, sizeof(*frame));
+    frame->id = value;
+
+    /* Direction, then d for a data frame or r for a remote frame */
+    p = skip_space(p + 1);
+    if (strncmp(p, "Rx", 2) != 0 && strncmp(p, "Tx", 2) != 0)
+    {
+        return false;
+    }
+    p = skip_space(p + 2);
+    if (p[0] != 'd' || (p[1] != ' ' && p[1] != '\t'))
+    {
+        return false;
+    }
+
+    p = parse_hex(skip_space(p + 1), &value, &digits);
+    if (digits != 1 || value > sizeof(frame->data))
+    {
+        return false;
+    }
+    frame->dlc = (uint8_t) value;
+
+    for (uint8_t i = 0; i < frame->dlc; i++)
+    {
+        p = skip_space(p);
+        p = in->asc_decimal ? parse_dec(p, &value, &digits) : parse_hex(p, &value, &digits);
+        if (digits == 0 || value > 0xFF)
+        {
+            return false;
+        }
+        frame->data[i] = (uint8_t) value;
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Check and skip the BLF file header
+
+  \return bool  true if the file is a BLF log
+
+******************************************************************************/
+bool blf_open(input_t * in)
+{
+    /* Signature, header size, then fields that are not needed */
+    uint8_t header[8];
+    if (fread(header, 1, sizeof(header), in->fp) != sizeof(header) || memcmp(header, "LOGG", 4) != 0)
+    {
+        fprintf(stderr, "%s is not a BLF file\n", in->name);
+        return false;
+    }
+
+    uint32_t header_size = get_u32(&header[4]);
+    if (header_size < sizeof(header) || fseek(in->fp, (long) header_size, SEEK_SET) != 0)
+    {
+        fprintf(stderr, "Invalid BLF file header in %s\n", in->name);
+        return false;
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Append the data of the next log container of a BLF file to the unparsed data
+
+  \return bool  true if data was appended, false at the end of the file or on error
+
+******************************************************************************/
+bool blf_fill(input_t * in)
+{
+    for (;;)
+    {
+        /* Object header: "LOBJ", header size, header version, object size and object type */
+        uint8_t header[16];
+        if (fread(header, 1, sizeof(header), in->fp) != sizeof(header))
+        {
+            return false;
+        }
+        if (memcmp(header, "LOBJ", 4) != 0)
+        {
+            fprintf(stderr, "Invalid BLF object in %s\n", in->name);
+            return false;
+        }
+
+        uint32_t obj_size = get_u32(&header[8]);
+        uint32_t obj_type = get_u32(&header[12]);
+        if (obj_size < sizeof(header) + 16)
+        {
+            fprintf(stderr, "Invalid BLF object in %s\n", in->name);
+            return false;
+        }
+
+        /* Objects are padded to 4 bytes */
+        long data_size = (long) (obj_size - sizeof(header));
+        long padding = (long) (obj_size % 4U);
+
+        /* Log containers hold the objects, everything else at the top level is skipped */
+        if (obj_type != 10)
+        {
+            if (fseek(in->fp, data_size + padding, SEEK_CUR) != 0)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        /* Container header: compression method, reserved, uncompressed size, reserved */
+        uint8_t container[16];
+        if (fread(container, 1, sizeof(container), in->fp) != sizeof(container))
+        {
+            return false;
+        }
+        uint16_t method = get_u16(&container[0]);
+        size_t uncompressed_size = get_u32(&container[8]);
+        size_t size = (size_t) data_size - sizeof(container);
+
+        /* Keep the unparsed tail of the previous container, objects may span containers */
+        memmove(in->blf_data, in->blf_data + in->blf_pos, in->blf_len - in->blf_pos);
+        in->blf_len -= in->blf_pos;
+        in->blf_pos = 0;
+
+        size_t needed = in->blf_len + (method == 0 ? size : uncompressed_size);
+        if (needed > in->blf_cap)
+        {
+            uint8_t * grown = realloc(in->blf_data, needed);
+            if (grown == NULL)
+            {
+                fprintf(stderr, "Memory allocation failure\n");
+                return false;
+            }
+            in->blf_data = grown;
+            in->blf_cap = needed;
+        }
+
+        if (method == 0)
+        {
+            if (fread(in->blf_data + in->blf_len, 1, size, in->fp) != size)
+            {
+                return false;
+            }
+            in->blf_len += size;
+        }
+        else if (method == 2)
+        {
+#ifdef J1939DECODE_HAVE_ZLIB
+            uint8_t * compressed = malloc(size);
+            if (compressed == NULL || fread(compressed, 1, size, in->fp) != size)
+            {
+                free(compressed);
+                return false;
+            }
+            uLongf dest_len = (uLongf) uncompressed_size;
+            int status = uncompress(in->blf_data + in->blf_len, &dest_len, compressed, (uLong) size);
+            free(compressed);
+            if (status != Z_OK)
+            {
+                fprintf(stderr, "Invalid compressed BLF container in %s\n", in->name);
+                return false;
+            }
+            in->blf_len += dest_len;
+#else
+            fprintf(stderr, "%s has compressed BLF containers, which need a build with zlib\n", in->name);
+            return false;
+#endif
+        }
+        else
+        {
+            fprintf(stderr, "Unknown BLF compression method %u in %s\n", method, in->name);
+            return false;
+        }
+
+        if (padding != 0 && fseek(in->fp, padding, SEEK_CUR) != 0)
+        {
+            return false;
+        }
+        return true;
+    }
+}
+
+/**************************************************************************//**
+
+  \brief Get the next CAN frame of a BLF file
+
+  \param in             input state
+  \param frame          frame to be filled in
+  \param timestamp_us   set to the timestamp of the frame, relative to the start of the measurement
+
+  \return int           1 if a frame was read, 0 if the object was skipped, -1 at the end of the file
+
+******************************************************************************/
+int blf_next(input_t * in, j1939_frame_t * frame, uint64_t * timestamp_us)
+{
+    /* Objects start with "LOBJ" after up to 4 bytes of padding */
+    const uint8_t * obj = NULL;
+    size_t obj_size = 0;
+    while (obj == NULL)
+    {
+        bool found = false;
+        for (size_t pos = in->blf_pos; pos + 16 <= in->blf_len && pos < in->blf_pos + 8; pos++)
+        {
+            if (memcmp(&in->blf_data[pos], "LOBJ", 4) == 0)
+            {
+                found = true;
+                obj_size = get_u32(&in->blf_data[pos + 8]);
+                if (obj_size < 16)
+                {
+                    fprintf(stderr, "Invalid BLF object in %s\n", in->name);
+                    return -1;
+                }
+                if (pos + obj_size <= in->blf_len)
+                {
+                    in->blf_pos = pos;
+                    obj = &in->blf_data[pos];
+                }
+                break;
+            }
+        }
+
+        if (!found && in->blf_len - in->blf_pos >= 8 + 16)
+        {
+            fprintf(stderr, "Invalid BLF object in %s\n", in->name);
+            return -1;
+        }
+        if (obj == NULL && !blf_fill(in))
+        {
+            return -1;
+        }
+    }
+    in->blf_pos += obj_size;
+
+    /* Object header version 1 and 2 have the timestamp flags first and the timestamp at offset 8 */
+    uint16_t header_version = get_u16(&obj[6]);
+    uint32_t obj_type = get_u32(&obj[12]);
+    size_t header_size = header_version == 1 ? 32 : 40;
+    if ((header_version != 1 && header_version != 2) || obj_size < header_size + 16)
+    {
+        return 0;
+    }
+
+    /* CAN_MESSAGE and CAN_MESSAGE2: channel, flags, DLC, identifier, data */
+    if (obj_type != 1 && obj_type != 86)
+    {
+        return 0;
+    }
+
+    uint32_t flags = get_u32(&obj[16]);
+    uint64_t timestamp = get_u64(&obj[24]);
+    *timestamp_us = flags == 1 ? timestamp * 10U : timestamp / 1000U;
+
+    const uint8_t * msg = &obj[header_size];
+    uint8_t msg_flags = msg[2];
+    uint8_t dlc = msg[3];
+    uint32_t id = get_u32(&msg[4]);
+    if ((id & 0x80000000U) == 0 || (msg_flags & 0x80U) != 0 || dlc > sizeof(frame->data))
+    {
+        /* Standard or remote frame */
+        return 0;
+    }
+
+    memset(frame, 0, sizeof(*frame));
+    frame->id = id & J1939DECODE_ID_MASK;
+    frame->dlc = dlc;
+    memcpy(frame->data, &msg[8], dlc);
+    return 1;
+}
+
+/**************************************************************************//**
+
+  \brief Read frames of a log file into the ring
+
+  \param in     input state
+  \param ring   ring
+  \param eof    set to true at the end of the file
+
+  \return size_t    number of frames added
+
+******************************************************************************/
+size_t read_file(input_t * in, ring_t * ring, bool * eof)
+{
+    size_t count = ring_reserve(ring, STREAM_RECV_BATCH);
+    size_t n = 0;
+    char line[STREAM_LINE_LEN];
+
+    while (n < count)
+    {
+        size_t slot = (ring->head + n) & ring->mask;
+        j1939_frame_t * frame = &ring->frames[slot];
+        uint64_t * timestamp_us = &ring->timestamp_us[slot];
+        bool parsed;
+
+        if (in->kind == INPUT_BLF)
+        {
+            int status = blf_next(in, frame, timestamp_us);
+            if (status < 0)
+            {
+                *eof = true;
+                break;
+            }
+            parsed = status > 0;
+        }
+        else
+        {
+            if (fgets(line, sizeof(line), in->fp) == NULL)
+            {
+                *eof = true;
+                break;
+            }
+            parsed = in->kind == INPUT_ASC ? parse_asc_line(in, line, frame, timestamp_us) :
+                     j1939decode_parse_candump(line, strlen(line), frame, timestamp_us);
+        }
+
+        if (parsed)
+        {
+            ring->received_ns[slot] = now_ns();
+            n++;
+            if (in->streaming)
+            {
+                /* The next line may take a while to arrive */
+                break;
+            }
+        }
+    }
+
+    ring_commit(ring, n);
+    in->frames_read += n;
+    return n;
+}
+
+#ifdef STREAM_HAVE_SOCKETCAN
+/**************************************************************************//**
+
+  \brief Open a raw SocketCAN socket with receive timestamps
+
+  \return int   socket, -1 on failure
+
+******************************************************************************/
+int socketcan_open(input_t * in)
+{
+    int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not open CAN socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, in->name, sizeof(ifr.ifr_name) - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        fprintf(stderr, "Unknown CAN interface %s\n", in->name);
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "Could not bind to CAN interface %s: %s\n", in->name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    /* A larger receive buffer rides out bursts while the reader waits for ring slots */
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    /* Hardware timestamps where the controller has them, software timestamps otherwise */
+    int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+    {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    }
+
+    return fd;
+}
+
+/**************************************************************************//**
+
+  \brief Receive a batch of frames from SocketCAN into the ring
+
+  Frames are received in place, struct can_frame has the memory layout of j1939_frame_t.
+  Frames arriving while the ring is full are dropped and counted.
+
+  \param in     input state
+  \param ring   ring
+
+  \return size_t    number of frames added
+
+******************************************************************************/
+size_t read_socketcan(input_t * in, ring_t * ring)
+{
+    static j1939_frame_t discard[STREAM_RECV_BATCH];
+    struct mmsghdr msgs[STREAM_RECV_BATCH];
+    struct iovec iovs[STREAM_RECV_BATCH];
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct timespec))];
+        struct cmsghdr align;
+    } control[STREAM_RECV_BATCH];
+
+    size_t count = ring_reserve(ring, STREAM_RECV_BATCH);
+    bool full = count == 0;
+    if (full)
+    {
+        count = STREAM_RECV_BATCH;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < count; i++)
+    {
+        iovs[i].iov_base = full ? &discard[i] : &ring->frames[(ring->head + i) & ring->mask];
+        iovs[i].iov_len = sizeof(struct can_frame);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i].buf;
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+    }
+
+    int received = recvmmsg(in->fd, msgs, (unsigned int) count, MSG_WAITFORONE, NULL);
+    if (received <= 0)
+    {
+        if (received < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "Could not receive from CAN interface %s: %s\n", in->name, strerror(errno));
+            stop = 1;
+        }
+        return 0;
+    }
+
+    uint64_t received_ns = now_ns();
+    if (full)
+    {
+        in->frames_dropped += (uint64_t) received;
+        return 0;
+    }
+
+    /* Keep extended data frames, moving them down over skipped frames */
+    size_t n = 0;
+    for (size_t i = 0; i < (size_t) received; i++)
+    {
+        const struct can_frame * cf = iovs[i].iov_base;
+        if (msgs[i].msg_len != sizeof(struct can_frame) || (cf->can_id & CAN_EFF_FLAG) == 0 ||
+            (cf->can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) != 0 || cf->can_dlc > CAN_MAX_DLEN)
+        {
+            continue;
+        }
+
+        uint64_t timestamp_us = 0;
+        for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+        {
+            const struct timespec * ts = NULL;
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+            {
+                /* Software timestamp first, raw hardware timestamp last */
+                const struct scm_timestamping * tss = (const struct scm_timestamping *) CMSG_DATA(cmsg);
+                bool hardware = tss->ts[2].tv_sec != 0 || tss->ts[2].tv_nsec != 0;
+                ts = hardware ? &tss->ts[2] : &tss->ts[0];
+                in->software_ts = !hardware;
+            }
+            else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+            {
+                ts = (const struct timespec *) CMSG_DATA(cmsg);
+                in->software_ts = true;
+            }
+            if (ts != NULL)
+            {
+                timestamp_us = (uint64_t) ts->tv_sec * 1000000U + (uint64_t) ts->tv_nsec / 1000U;
+            }
+        }
+
+        size_t slot = (ring->head + n) & ring->mask;
+        if (i != n)
+        {
+            ring->frames[slot] = *(const j1939_frame_t *) cf;
+        }
+        ring->frames[slot].id &= CAN_EFF_MASK;
+        ring->timestamp_us[slot] = timestamp_us;
+        ring->received_ns[slot] = received_ns;
+        n++;
+    }
+
+    ring_commit(ring, n);
+    in->frames_read += n;
+    return n;
+}
+#endif
+
+/**************************************************************************//**
+
+  \brief Read frames into the ring until the input ends or a signal is received
+
+  \return void
+
+******************************************************************************/
+void run_reader(input_t * in, ring_t * ring)
+{
+    unsigned int spins = 0;
+    bool eof = false;
+
+    while (!stop && !eof)
+    {
+#ifdef STREAM_HAVE_SOCKETCAN
+        if (in->kind == INPUT_SOCKETCAN)
+        {
+            read_socketcan(in, ring);
+            continue;
+        }
+#endif
+
+        /* Log files are read as fast as the worker decodes, waiting while the ring is full */
+        if (read_file(in, ring, &eof) > 0 || ring_reserve(ring, 1) > 0)
+        {
+            spins = 0;
+        }
+        else
+        {
+            backoff(&spins);
+        }
+    }
+
+    __atomic_store_n(&ring->done, true, __ATOMIC_RELEASE);
+}
+
+/**************************************************************************//**
+
+  \brief Open output, stdout, a TCP connection or a Unix domain socket
+
+  \param target     NULL or "-" for stdout, "tcp:host:port" or "unix:path"
+
+  \return int       file descriptor, -1 on failure
+
+******************************************************************************/
+int open_output(const char * target)
+{
+    if (target == NULL || strcmp(target, "-") == 0)
+    {
+        return STDOUT_FILENO;
+    }
+
+    if (strncmp(target, "unix:", 5) == 0)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(target + 5) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Socket path %s is too long\n", target + 5);
+            return -1;
+        }
+        strcpy(addr.sun_path, target + 5);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+        {
+            fprintf(stderr, "Could not connect to %s: %s\n", target, strerror(errno));
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    if (strncmp(target, "tcp:", 4) == 0)
+    {
+        char host[256];
+        const char * port = strrchr(target + 4, ':');
+        if (port == NULL || (size_t) (port - (target + 4)) >= sizeof(host))
+        {
+            fprintf(stderr, "Output %s must be tcp:host:port\n", target);
+            return -1;
+        }
+        memcpy(host, target + 4, (size_t) (port - (target + 4)));
+        host[port - (target + 4)] = '\0';
+
+        struct addrinfo hints;
+        struct addrinfo * results;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, port + 1, &hints, &results) != 0)
+        {
+            fprintf(stderr, "Unknown host %s\n", host);
+            return -1;
+        }
+
+        int fd = -1;
+        for (struct addrinfo * ai = results; ai != NULL && fd < 0; ai = ai->ai_next)
+        {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(results);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Could not connect to %s\n", target);
+            return -1;
+        }
+
+        /* Writes are already batched, so do not delay them further */
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        return fd;
+    }
+
+    fprintf(stderr, "Unknown output %s\n", target);
+    return -1;
+}
+
+/**************************************************************************//**
+
+  \brief Write all of a buffer, retrying partial writes
+
+  \return bool  true on success
+
+******************************************************************************/
+bool write_all(int fd, const uint8_t * buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Write the output buffer and measure the latency of the frames in it
+
+  \return void
+
+******************************************************************************/
+void flush_output(output_t * out)
+{
+    if (out->len == 0)
+    {
+        return;
+    }
+
+    if (out->failed)
+    {
+        out->len = 0;
+        out->num_pending = 0;
+        return;
+    }
+    if (!write_all(out->fd, out->buf, out->len))
+    {
+        fprintf(stderr, "Could not write output: %s\n", strerror(errno));
+        out->failed = true;
+        stop = 1;
+    }
+    out->bytes_written += out->len;
+    out->writes++;
+    out->len = 0;
+
+    uint64_t written_ns = now_ns();
+    uint64_t written_us = out->live ? now_realtime_us() : 0;
+    for (size_t i = 0; i < out->num_pending; i++)
+    {
+        latency_add(&out->read_latency, written_ns - out->pending_ns[i]);
+        if (out->live && out->pending_us[i] != 0 && written_us >= out->pending_us[i])
+        {
+            latency_add(&out->receive_latency, (written_us - out->pending_us[i]) * 1000U);
+        }
+    }
+    out->num_pending = 0;
+}
+
+/**************************************************************************//**
+
+  \brief Encode one frame into the output buffer
+
+  JSON is written as one line per frame, with a "Timestamp" member first if timestamps are enabled.
+  CBOR and MessagePack items are written back to back, protobuf messages are preceded by their varint length.
+
+  \param out            output state
+  \param frame          CAN frame
+  \param timestamp_us   timestamp of the frame
+  \param buf            output position
+  \param room           bytes left in the buffer
+
+  \return size_t        length of the encoded frame, more than room if it did not fit, 0 if it was skipped
+
+******************************************************************************/
+size_t encode_frame(output_t * out, const j1939_frame_t * frame, uint64_t timestamp_us, uint8_t * buf, size_t room)
+{
+    uint64_t data;
+    memcpy(&data, frame->data, sizeof(data));
+
+    if (out->format == J1939DECODE_FORMAT_JSON)
+    {
+        /* The decoded object is written after the timestamp member, its opening brace is then replaced */
+        char prefix[48];
+        size_t prefix_len = 0;
+        if (out->timestamps)
+        {
+            prefix_len = (size_t) snprintf(prefix, sizeof(prefix), "{\"Timestamp\":%llu.%06u,",
+                                           (unsigned long long) (timestamp_us / 1000000U),
+                                           (unsigned int) (timestamp_us % 1000000U));
+        }
+        size_t skip = prefix_len > 0 ? prefix_len - 1 : 0;
+        if (room < skip + 2)
+        {
+            return room + 1;
+        }
+
+        size_t len = j1939decode_ctx_encode(out->ctx, frame->id, frame->dlc, &data, J1939DECODE_FORMAT_JSON,
+                                            buf + skip, room - skip, 0);
+        if (len == 0)
+        {
+            return 0;
+        }
+        if (len >= room - skip)
+        {
+            return skip + len + 1;
+        }
+
+        memcpy(buf, prefix, prefix_len);
+        buf[skip + len] = '\n';
+        return skip + len + 1;
+    }
+
+    if (out->format == J1939DECODE_FORMAT_PROTOBUF)
+    {
+        /* Encoded after room for the longest length prefix, then moved down behind the actual prefix */
+        const size_t max_prefix = 5;
+        size_t avail = room > max_prefix ? room - max_prefix : 0;
+        size_t len = j1939decode_ctx_encode(out->ctx, frame->id, frame->dlc, &data, out->format,
+                                            buf + (avail > 0 ? max_prefix : 0), avail, 0);
+        if (len == 0 || len > UINT32_MAX)
+        {
+            return 0;
+        }
+
+        /* A 32 bit length takes at most 5 varint bytes */
+        uint8_t prefix[5];
+        size_t prefix_len = 0;
+        for (uint32_t v = (uint32_t) len; ; v >>= 7U)
+        {
+            prefix[prefix_len++] = (uint8_t) ((v & 0x7FU) | (v > 0x7FU ? 0x80U : 0U));
+            if (v <= 0x7FU)
+            {
+                break;
+            }
+        }
+        if (len > avail)
+        {
+            return prefix_len + len > room ? prefix_len + len : room + 1;
+        }
+
+        memmove(buf + prefix_len, buf + max_prefix, len);
+        memcpy(buf, prefix, prefix_len);
+        return prefix_len + len;
+    }
+
+    return j1939decode_ctx_encode(out->ctx, frame->id, frame->dlc, &data, out->format, buf, room, 0);
+}
+
+/**************************************************************************//**
+
+  \brief Decode worker, decodes frames from the ring into the output until the reader is done and the ring is empty
+
+  \return void *    NULL
+
+******************************************************************************/
+void * run_worker(void * arg)
+{
+    output_t * out = arg;
+    ring_t * ring = out->ring;
+    unsigned int spins = 0;
+
+    for (;;)
+    {
+        size_t count = ring_peek(ring, STREAM_RECV_BATCH);
+        if (count == 0)
+        {
+            /* Write whatever is buffered while waiting, so that latency stays low when the bus is quiet */
+            flush_output(out);
+            if (__atomic_load_n(&ring->done, __ATOMIC_ACQUIRE) && ring_peek(ring, 1) == 0)
+            {
+                break;
+            }
+            backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t slot = (ring->tail + i) & ring->mask;
+            size_t len = encode_frame(out, &ring->frames[slot], ring->timestamp_us[slot], out->buf + out->len,
+                                      STREAM_OUT_LEN - out->len);
+            if (len > STREAM_OUT_LEN - out->len && out->len > 0)
+            {
+                flush_output(out);
+                len = encode_frame(out, &ring->frames[slot], ring->timestamp_us[slot], out->buf, STREAM_OUT_LEN);
+            }
+
+            if (len == 0 || len > STREAM_OUT_LEN - out->len)
+            {
+                /* Filtered, failed, or larger than the whole output buffer */
+                out->frames_skipped++;
+                continue;
+            }
+
+            out->len += len;
+            out->pending_ns[out->num_pending] = ring->received_ns[slot];
+            out->pending_us[out->num_pending] = ring->timestamp_us[slot];
+            out->num_pending++;
+            out->frames_written++;
+
+            if (out->len >= STREAM_FLUSH_LEN || out->num_pending == STREAM_MAX_PENDING)
+            {
+                flush_output(out);
+            }
+        }
+        ring_consume(ring, count);
+    }
+
+    return NULL;
+}
+
+/**************************************************************************//**
+
+  \brief Parse output format name
+
+  \return bool  true if the name is known
+
+******************************************************************************/
+bool parse_format(const char * name, uint32_t * format)
+{
+    static const char * const names[] = {"json", "cbor", "msgpack", "protobuf"};
+    for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *format = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**************************************************************************//**
+
+  \brief Parse output profile name
+
+  \return bool  true if the name is known
+
+******************************************************************************/
+bool parse_profile(const char * name, uint32_t * profile)
+{
+    static const char * const names[] = {"full", "compact", "raw"};
+    for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *profile = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**************************************************************************//**
+
+  \brief Parse PGN allow list of comma separated numbers
+
+  \param list   comma separated numbers
+  \param pgns   array of STREAM_MAX_PGNS PGNs to be filled in
+  \param count  set to the number of PGNs
+
+  \return bool  true on success
+
+******************************************************************************/
+bool parse_pgn_list(const char * list, uint32_t * pgns, size_t * count)
+{
+    const char * p = list;
+    *count = 0;
+    while (*p != '\0' && *count < STREAM_MAX_PGNS)
+    {
+        char * end;
+        pgns[(*count)++] = (uint32_t) strtoul(p, &end, 0);
+        if (end == p || (*end != ',' && *end != '\0'))
+        {
+            return false;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return *p == '\0';
+}
+
+/**************************************************************************//**
+
+  \brief Output callback of parallel log decoding
+
+  \return bool  true on success
+
+******************************************************************************/
+bool write_chunk(void * user, const char * buf, size_t len)
+{
+    output_t * out = user;
+    if (!write_all(out->fd, (const uint8_t *) buf, len))
+    {
+        out->failed = true;
+        return false;
+    }
+    out->bytes_written += len;
+    out->writes++;
+    return true;
+}
+
+/**************************************************************************//**
+
+  \brief Decode a candump log file to JSON on a pool of threads, without the reader and the ring
+
+  \param out        output, only fd and the counters are used
+  \param db         database
+  \param filename   candump log file
+  \param options    log decoding options
+  \param stats      print statistics to stderr
+
+  \return bool      true on success
+
+******************************************************************************/
+bool decode_parallel(output_t * out, j1939decode_db_t * db, const char * filename,
+                     const j1939decode_file_options_t * options, bool stats)
+{
+    uint64_t start = now_ns();
+    size_t num_frames;
+    bool ok = j1939decode_file_to_ndjson(db, filename, options, write_chunk, out, &num_frames);
+    uint64_t elapsed_ns = now_ns() - start;
+
+    if (!ok && !out->failed)
+    {
+        fprintf(stderr, "Could not decode file %s\n", filename);
+    }
+    if (stats)
+    {
+        double seconds = (double) elapsed_ns / 1e9;
+        fprintf(stderr, "Frames read %llu, output %llu bytes in %llu writes, %.3f s, %.0f frames/s\n",
+                (unsigned long long) num_frames, (unsigned long long) out->bytes_written,
+                (unsigned long long) out->writes, seconds, seconds > 0 ? (double) num_frames / seconds : 0.0);
+    }
+    return ok;
+}
+
+/**************************************************************************//**
+
+  \brief Print usage
+
+  \return void
+
+******************************************************************************/
+void usage(const char * argv0)
+{
+    fprintf(stderr, "Usage: %s [-d J1939db.json] [-l] [-f json|cbor|msgpack|protobuf] [-p full|compact|raw] [-t]\n"
+            "       [-P pgn,...] [-o -|tcp:host:port|unix:path] [-r ring frames] [-j threads] [-s]\n"
+            "       (-i can interface | candump.log | log.asc | log.blf | -)\n", argv0);
+}
+
+/**************************************************************************//**
+
+  \brief Decode a live SocketCAN interface or a CAN log file into a stream of decoded messages
+
+  Usage: j1939decode-stream [-d J1939db.json] [-l] [-f json|cbor|msgpack|protobuf] [-p full|compact|raw] [-t]
+                            [-P pgn,...] [-o -|tcp:host:port|unix:path] [-r ring frames] [-j threads] [-s]
+                            (-i can interface | candump.log | log.asc | log.blf | -)
+
+  The reader thread receives frames with recvmmsg() or parses the log file, and passes them through a lock-free
+  single producer single consumer ring to a decode worker thread, which writes the output in large batches.
+  With -j a candump log file is instead decoded to JSON by j1939decode_file_to_ndjson() on a pool of threads,
+  0 for one per processor.
+
+  \return int   exit status
+
+******************************************************************************/
+int main(int argc, char * argv[])
+{
+    const char * db_file = J1939DECODE_DB;
+    const char * interface = NULL;
+    const char * filename = NULL;
+    const char * target = NULL;
+    const char * pgn_list = NULL;
+    uint32_t db_flags = 0;
+    uint32_t format = J1939DECODE_FORMAT_JSON;
+    uint32_t profile = J1939DECODE_PROFILE_FULL;
+    size_t ring_frames = STREAM_RING_FRAMES;
+    const char * threads = NULL;
+    bool timestamps = false;
+    bool stats = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "-l") == 0)
+        {
+            db_flags |= J1939DECODE_DB_LAZY;
+            continue;
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            timestamps = true;
+            continue;
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            stats = true;
+            continue;
+        }
+        else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)
+        {
+            filename = argv[i];
+            continue;
+        }
+        else if (value != NULL && strcmp(argv[i], "-d") == 0)
+        {
+            db_file = value;
+        }
+        else if (value != NULL && strcmp(argv[i], "-i") == 0)
+        {
+            interface = value;
+        }
+        else if (value != NULL && strcmp(argv[i], "-o") == 0)
+        {
+            target = value;
+        }
+        else if (value != NULL && strcmp(argv[i], "-P") == 0)
+        {
+            pgn_list = value;
+        }
+        else if (value != NULL && strcmp(argv[i], "-r") == 0)
+        {
+            ring_frames = strtoul(value, NULL, 0);
+        }
+        else if (value != NULL && strcmp(argv[i], "-j") == 0)
+        {
+            threads = value;
+        }
+        else if (value != NULL && strcmp(argv[i], "-f") == 0)
+        {
+            if (!parse_format(value, &format))
+            {
+                fprintf(stderr, "Unknown output format %s\n", value);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (value != NULL && strcmp(argv[i], "-p") == 0)
+        {
+            if (!parse_profile(value, &profile))
+            {
+                fprintf(stderr, "Unknown output profile %s\n", value);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+
+    if ((interface == NULL) == (filename == NULL))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (ring_frames < STREAM_RECV_BATCH || (ring_frames & (ring_frames - 1)) != 0)
+    {
+        fprintf(stderr, "Ring frames must be a power of two of at least %u\n", STREAM_RECV_BATCH);
+        return EXIT_FAILURE;
+    }
+    if (timestamps && format != J1939DECODE_FORMAT_JSON)
+    {
+        fprintf(stderr, "Timestamps are only written with JSON output\n");
+        return EXIT_FAILURE;
+    }
+
+    uint32_t pgns[STREAM_MAX_PGNS];
+    size_t num_pgns = 0;
+    if (pgn_list != NULL && !parse_pgn_list(pgn_list, pgns, &num_pgns))
+    {
+        fprintf(stderr, "Invalid PGN list %s\n", pgn_list);
+        return EXIT_FAILURE;
+    }
+
+    if (threads != NULL)
+    {
+        /* Chunks of a candump file are decoded in parallel straight from the mapped file */
+        size_t len = filename != NULL ? strlen(filename) : 0;
+        if (len == 0 || strcmp(filename, "-") == 0 || (len > 4 && strcmp(filename + len - 4, ".asc") == 0) ||
+            (len > 4 && strcmp(filename + len - 4, ".blf") == 0) || format != J1939DECODE_FORMAT_JSON)
+        {
+            fprintf(stderr, "Threads are only used to decode candump log files to JSON\n");
+            return EXIT_FAILURE;
+        }
+
+        j1939decode_file_options_t options;
+        memset(&options, 0, sizeof(options));
+        options.num_threads = strtoul(threads, NULL, 0);
+        options.profile = profile;
+        options.timestamps = timestamps;
+        options.pgns = pgn_list != NULL ? pgns : NULL;
+        options.num_pgns = num_pgns;
+
+        output_t out;
+        memset(&out, 0, sizeof(out));
+        out.fd = open_output(target);
+        signal(SIGPIPE, SIG_IGN);
+
+        j1939decode_db_t * db = j1939decode_db_open(db_file, db_flags, NULL);
+        bool ok = out.fd >= 0 && db != NULL && decode_parallel(&out, db, filename, &options, stats);
+        j1939decode_db_release(db);
+        if (out.fd > STDERR_FILENO)
+        {
+            close(out.fd);
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    input_t in;
+    memset(&in, 0, sizeof(in));
+    in.fd = -1;
+    if (interface != NULL)
+    {
+#ifdef STREAM_HAVE_SOCKETCAN
+        in.kind = INPUT_SOCKETCAN;
+        in.name = interface;
+        in.fd = socketcan_open(&in);
+        if (in.fd < 0)
+        {
+            return EXIT_FAILURE;
+        }
+#else
+        fprintf(stderr, "SocketCAN is only available on Linux\n");
+        return EXIT_FAILURE;
+#endif
+    }
+    else
+    {
+        size_t len = strlen(filename);
+        in.name = filename;
+        in.kind = INPUT_CANDUMP;
+        if (len > 4 && strcmp(filename + len - 4, ".asc") == 0)
+        {
+            in.kind = INPUT_ASC;
+        }
+        else if (len > 4 && strcmp(filename + len - 4, ".blf") == 0)
+        {
+            in.kind = INPUT_BLF;
+        }
+
+        in.fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+        if (in.fp == NULL)
+        {
+            fprintf(stderr, "Could not open file %s\n", filename);
+            return EXIT_FAILURE;
+        }
+        struct stat st;
+        in.streaming = fstat(fileno(in.fp), &st) != 0 || !S_ISREG(st.st_mode);
+        if (in.kind == INPUT_BLF && !blf_open(&in))
+        {
+            fclose(in.fp);
+            return EXIT_FAILURE;
+        }
+    }
+
+    output_t out;
+    memset(&out, 0, sizeof(out));
+    out.format = format;
+    out.timestamps = timestamps;
+    out.live = in.kind == INPUT_SOCKETCAN;
+    out.fd = open_output(target);
+
+    ring_t ring;
+    bool ok = out.fd >= 0 && ring_init(&ring, ring_frames);
+    if (ok)
+    {
+        out.ring = &ring;
+        out.buf = malloc(STREAM_OUT_LEN);
+        out.pending_ns = malloc(STREAM_MAX_PENDING * sizeof(uint64_t));
+        out.pending_us = malloc(STREAM_MAX_PENDING * sizeof(uint64_t));
+
+        /* The worker gets its own context, the reader never decodes */
+        j1939decode_db_t * db = j1939decode_db_open(db_file, db_flags, NULL);
+        out.ctx = j1939decode_ctx_create(db);
+        j1939decode_db_release(db);
+
+        ok = out.buf != NULL && out.pending_ns != NULL && out.pending_us != NULL && out.ctx != NULL &&
+             j1939decode_ctx_set_profile(out.ctx, profile) &&
+             (pgn_list == NULL || j1939decode_ctx_set_pgn_filter(out.ctx, pgns, num_pgns, true));
+    }
+
+    /* Signals must interrupt recvmmsg() in the reader, so they are installed without SA_RESTART
+     * and blocked in the worker, which inherits the signal mask it is created with */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    pthread_t worker;
+    if (ok && pthread_create(&worker, NULL, run_worker, &out) != 0)
+    {
+        fprintf(stderr, "Could not start decode worker\n");
+        ok = false;
+    }
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+    if (ok)
+    {
+        uint64_t start = now_ns();
+        run_reader(&in, &ring);
+        pthread_join(worker, NULL);
+        uint64_t elapsed_ns = now_ns() - start;
+
+        if (stats)
+        {
+            double seconds = (double) elapsed_ns / 1e9;
+            fprintf(stderr, "Frames read %llu, written %llu, skipped %llu, dropped %llu\n",
+                    (unsigned long long) in.frames_read, (unsigned long long) out.frames_written,
+                    (unsigned long long) out.frames_skipped, (unsigned long long) in.frames_dropped);
+            fprintf(stderr, "Output %llu bytes in %llu writes, %.3f s, %.0f frames/s\n",
+                    (unsigned long long) out.bytes_written, (unsigned long long) out.writes, seconds,
+                    seconds > 0 ? (double) out.frames_written / seconds : 0.0);
+            latency_print("read to write", &out.read_latency);
+            if (in.software_ts)
+            {
+                latency_print("receive to write", &out.receive_latency);
+            }
+        }
+        ok = !out.failed;
+    }
+
+    j1939decode_ctx_destroy(out.ctx);
+    free(out.pending_us);
+    free(out.pending_ns);
+    free(out.buf);
+    if (out.ring != NULL)
+    {
+        ring_free(&ring);
+    }
+    if (out.fd > STDERR_FILENO)
+    {
+        close(out.fd);
+    }
+    if (in.fp != NULL && in.fp != stdin)
+    {
+        fclose(in.fp);
+    }
+    if (in.fd >= 0)
+    {
+        close(in.fd);
+    }
+    free(in.blf_data);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}